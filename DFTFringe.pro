@@ -89,8 +89,15 @@ SOURCES += main.cpp\
     settingsgeneral.cpp \
     squareimage.cpp \
     bathastigdlg.cpp \
-    zernikeeditdlg.cpp
-    punwrap.cpp
+    zernikeeditdlg.cpp \
+    vortex.cpp \
+    zernikebasis.cpp \
+    batchengine.cpp \
+    wavefrontfile.cpp \
+    wavefrontstore.cpp \
+    wavefrontaccumulator.cpp \
+    referencepsf.cpp \
+    foucaultmask.cpp
 
 HEADERS  += mainwindow.h \
     igramarea.h \
@@ -159,7 +166,14 @@ HEADERS  += mainwindow.h \
     settingsgeneral.h \
     squareimage.h \
     bathastigdlg.h \
-    zernikeeditdlg.h
+    zernikeeditdlg.h \
+    zernikebasis.h \
+    batchengine.h \
+    wavefrontfile.h \
+    wavefrontstore.h \
+    wavefrontaccumulator.h \
+    referencepsf.h \
+    foucaultmask.h
 FORMS    += mainwindow.ui \
     dfttools.ui \
     dftarea.ui \
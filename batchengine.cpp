@@ -0,0 +1,418 @@
+/******************************************************************************
+**
+**  Copyright 2016 Dale Eason
+**  This file is part of DFTFringe
+**  is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation version 3 of the License
+
+** DFTFringe is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with DFTFringe.  If not, see <http://www.gnu.org/licenses/>.
+
+****************************************************************************/
+#include "batchengine.h"
+#include <QThreadPool>
+#include <QThread>
+#include <QRunnable>
+#include <QElapsedTimer>
+#include <QFileInfo>
+#include <QDir>
+#include <fstream>
+#include "opencv/highgui.h"
+#include "vortex.h"
+#include "punwrap.h"
+#include "wavefrontfile.h"
+#include "graphicsutilities.h"
+#include "zernikebasis.h"
+#include "zernikedlg.h"
+
+extern cv::Mat_<double> subtractPlane(cv::Mat_<double> phase, cv::Mat_<bool> mask);
+extern void fitZernikes(wavefront &wf, int terms);
+
+batchSettings::batchSettings() :
+    dftSize(640), centerFilter(10.), vortexSmooth(9), flipH(false), ellipse(false),
+    verticalAxis(0.), diameter(0.), roc(0.), lambda(640.), fringeSpacing(1.),
+    fastUnwrap(false), referenceQuality(false), binary(false), float32(false),
+    zernikeTerms(Z_TERMS), threads(0), queueDepth(4)
+{
+}
+
+// Runs one worker of one stage until its input is exhausted.
+class batchStageRunner : public QRunnable
+{
+public:
+    batchStageRunner(batchEngine *engine, int s) : m_engine(engine), m_stage(s) {}
+    void run() { m_engine->stageLoop(m_stage); }
+private:
+    batchEngine *m_engine;
+    int m_stage;
+};
+
+batchEngine::batchEngine(const batchSettings &settings, QObject *parent) :
+    QObject(parent), m_settings(settings), m_next(0), m_done(0), m_cancelled(false), m_wallNs(0)
+{
+    for (int s = 0; s < STAGE_COUNT; ++s){
+        m_queues[s] = 0;
+        m_workers[s] = 0;
+        m_items[s] = 0;
+        m_busyNs[s] = 0;
+    }
+    // made here so the fit workers do not race to read its settings
+    zernikeBasisCache::get_Instance();
+}
+
+const char *batchEngine::stageName(int s){
+    static const char *names[] = {"decode", "roi", "dft/vortex", "unwrap", "zernike fit", "write"};
+    return names[s];
+}
+
+void batchEngine::cancel(){
+    QMutexLocker lock(&m_lock);
+    m_cancelled = true;
+    for (int s = 0; s < STAGE_COUNT; ++s){
+        if (m_queues[s])
+            m_queues[s]->cancel();
+    }
+}
+
+QVector<batchItem> batchEngine::run(const QStringList &files){
+    QElapsedTimer wall;
+    wall.start();
+    m_files = files;
+    m_next = 0;
+    m_done = 0;
+    m_cancelled = false;
+    m_results = QVector<batchItem>(files.size());
+
+    // The transform and unwrap stages do most of the work and get every core.  Decode
+    // and write are mostly file access and one or two workers keep up with them.
+    // The fit is only done for .wfb output.
+    int cores = m_settings.threads > 0 ? m_settings.threads : QThread::idealThreadCount();
+    if (cores < 1)
+        cores = 1;
+    m_workers[DECODE] = qMin(2, cores);
+    m_workers[ROI] = qMax(1, cores/4);
+    m_workers[PHASE] = cores;
+    m_workers[UNWRAP] = cores;
+    m_workers[FIT] = m_settings.binary ? qMax(1, cores/2) : 1;
+    m_workers[WRITE] = 1;
+
+    int total = 0;
+    QMutexLocker lock(&m_lock);
+    for (int s = 0; s < STAGE_COUNT; ++s){
+        m_items[s] = 0;
+        m_busyNs[s] = 0;
+        total += m_workers[s];
+        if (s > DECODE){
+            m_queues[s] = new boundedQueue<batchItem>(m_settings.queueDepth);
+            m_queues[s]->setProducers(m_workers[s-1]);
+        }
+    }
+    lock.unlock();
+
+    // Every worker blocks on its queues so all of them must have a thread.
+    QThreadPool pool;
+    pool.setMaxThreadCount(total);
+    for (int s = 0; s < STAGE_COUNT; ++s){
+        for (int w = 0; w < m_workers[s]; ++w)
+            pool.start(new batchStageRunner(this, s));
+    }
+    pool.waitForDone();
+
+    lock.relock();
+    for (int s = 0; s < STAGE_COUNT; ++s){
+        delete m_queues[s];
+        m_queues[s] = 0;
+    }
+    m_wallNs = wall.nsecsElapsed();
+    return m_results;
+}
+
+bool batchEngine::nextFile(batchItem &item){
+    QMutexLocker lock(&m_lock);
+    if (m_cancelled || m_next >= m_files.size())
+        return false;
+    item = batchItem();
+    item.index = m_next;
+    item.igram = m_files[m_next++];
+    return true;
+}
+
+void batchEngine::stageLoop(int s){
+    vortexEngine vortex;
+    unwrapContext unwrapper;
+    unwrapContext::queueMode mode = m_settings.fastUnwrap ?
+                unwrapContext::BUCKET_QUEUE : unwrapContext::EXACT_HEAP;
+    vortex.unwrapper().setQueueMode(mode);
+    unwrapper.setQueueMode(mode);
+    if (m_settings.referenceQuality)
+        unwrapper.setQualityMode(unwrapContext::QUALITY_REFERENCE);
+
+    batchItem item;
+    while ((s == DECODE) ? nextFile(item) : m_queues[s]->pop(item)){
+        QElapsedTimer timer;
+        timer.start();
+        bool counted = true;
+        if (item.error.isEmpty()){
+            try {
+                switch (s){
+                case DECODE:
+                    decode(item);
+                    break;
+                case ROI:
+                    extractRoi(item);
+                    break;
+                case PHASE:{
+                    double smooth = .01 * m_settings.vortexSmooth * item.input.cols/2.;
+                    item.surface = vortex.compute(item.input, item.mask, item.centerFilter, smooth);
+                    item.input.release();
+                    break;
+                }
+                case UNWRAP:{
+                    cv::Mat phase = item.surface;
+                    cv::Mat result = cv::Mat::zeros(phase.size(), CV_64F);
+                    phase.copyTo(result, item.mask);
+                    phase = result.clone();
+                    normalize(phase, phase, 0, 1., CV_MINMAX, CV_64F, item.mask);
+
+                    cv::Mat mask = (255 - item.mask)/255;
+                    unwrapper.resize(phase.cols, phase.rows);
+                    unwrapper.unwrap((double *)(phase.data), (double *)(result.data), (char *)(mask.data));
+
+                    flip(result, result, 0); // flip around x axis.
+                    item.outside.m_center.ry() = result.rows - item.outside.m_center.y();
+                    item.center.m_center.ry() = result.rows - item.center.m_center.y();
+                    if (m_settings.fringeSpacing != 1.)
+                        result *= m_settings.fringeSpacing;
+
+                    if (m_settings.ellipse){
+                        CircleOutline t = item.outside;
+                        t.enlarge(-2);
+                        cv::Mat m = makeOutlineMask(t, item.center, result.rows, result.cols,
+                                                    m_settings.verticalAxis/m_settings.diameter);
+                        result = subtractPlane(result, m);
+                    }
+                    item.surface = result;
+                    item.mask.release();
+                    break;
+                }
+                case FIT:
+                    counted = fit(item);
+                    break;
+                case WRITE:
+                    write(item);
+                    break;
+                }
+            }
+            catch (cv::Exception &e){
+                item.error = QString::fromStdString(e.what());
+            }
+        }
+        qint64 ns = timer.nsecsElapsed();
+
+        if (s == WRITE){
+            int done;
+            {
+                QMutexLocker lock(&m_lock);
+                m_items[s] += 1;
+                m_busyNs[s] += ns;
+                m_results[item.index] = item;
+                done = ++m_done;
+            }
+            emit fileDone(item.igram, item.wft, item.error);
+            emit progress(done, m_files.size());
+            continue;
+        }
+        if (counted){
+            QMutexLocker lock(&m_lock);
+            m_items[s] += 1;
+            m_busyNs[s] += ns;
+        }
+        if (!m_queues[s+1]->push(item))
+            break;
+    }
+    if (s < WRITE)
+        m_queues[s+1]->producerDone();
+}
+
+// Read the igram and its outline.  The outline file has the same name as the igram
+// with an .oln suffix.  Without one the last outline used is assumed.
+void batchEngine::decode(batchItem &item){
+    item.image = cv::imread(item.igram.toStdString(), CV_LOAD_IMAGE_COLOR);
+    if (item.image.empty()){
+        item.error = "Can not read " + item.igram;
+        return;
+    }
+    if (m_settings.flipH)
+        cv::flip(item.image, item.image, 1);
+
+    item.outside = m_settings.outside;
+    item.center = m_settings.center;
+    item.centerFilter = m_settings.centerFilter;
+
+    QFileInfo info(item.igram);
+    QString oln = info.absolutePath() + "/" + info.completeBaseName() + ".oln";
+    std::ifstream file(oln.toStdString().c_str(), std::ios::binary);
+    if (file.is_open()){
+        file.seekg(0, std::ios::end);
+        std::streamoff fsize = file.tellg();
+        file.seekg(0, std::ios::beg);
+        item.outside = readCircle(file);
+        item.centerFilter = readCircle(file).m_radius;
+        item.center = CircleOutline(QPointF(0,0),0);
+        if ((file.tellg() > 0) && (fsize > file.tellg()))
+            item.center = readCircle(file);
+    }
+
+    double cx = item.outside.m_center.x();
+    double cy = item.outside.m_center.y();
+    double rad = item.outside.m_radius;
+    if (rad <= 0 || cx + rad > item.image.cols || cx - rad < 0 ||
+            cy + rad > item.image.rows || cy - rad < 0)
+        item.error = "No usable outline for " + item.igram;
+}
+
+// Cut a square around the outline, scale it down to the DFT size and pick the color
+// plane.  Same steps as DFTArea::grayComplexMatfromImage.
+void batchEngine::extractRoi(batchItem &item){
+    double centerX = item.outside.m_center.x();
+    double centerY = item.outside.m_center.y();
+    double rad = item.outside.m_radius;
+    double yScale = 1.;
+    if (m_settings.ellipse)
+        yScale = m_settings.verticalAxis/m_settings.diameter;
+    double rady = rad * yScale;
+    double radpix = ceil(rad);
+    double left = std::max(centerX - radpix, 0.);
+    double top = std::max(centerY - rady, 0.);
+    int width = std::min((int)(2. * radpix), item.image.cols - (int)left);
+    int height = std::min((int)(2. * rady), item.image.rows - (int)top);
+
+    // new center because of crop
+    double xCenterShift = centerX - left;
+    double yCenterShift = centerY - top;
+
+    cv::Mat roi = item.image(cv::Rect((int)left,(int)top,width,height)).clone();
+    item.image.release();
+
+    double centerDx = centerX - item.center.m_center.x();
+    double centerDy = centerY - item.center.m_center.y();
+
+    roi.convertTo(roi,CV_32FC3);
+
+    double scaleFactor = (double)m_settings.dftSize/roi.cols;
+    CircleOutline outside(QPointF(xCenterShift,yCenterShift), rad);
+    CircleOutline center(QPointF(xCenterShift - centerDx, yCenterShift - centerDy),
+                         item.center.m_radius);
+    if (scaleFactor < 1.){
+        cv::resize(roi,roi, cv::Size(0,0), scaleFactor, scaleFactor);
+        double roicx = (roi.cols-1)/2.;
+        double roicy = (roi.rows-1)/2.;
+        outside = CircleOutline(QPointF(roicx,roicy),roicx);
+        center = CircleOutline(QPointF((roicx - centerDx * scaleFactor), (roicy - centerDy * scaleFactor)),
+                               center.m_radius * scaleFactor);
+    }
+    if (m_settings.channel == "ALL RGB")
+        cvtColor(roi,roi,CV_BGR2HSV);
+
+    std::vector<cv::Mat> bgr_planes;
+    split(roi, bgr_planes);
+
+    // use the color plane with the largest mean value
+    cv::Scalar mean = cv::mean(roi);
+    double maxMean = 0;
+    int maxndx = 0;
+    for (int i = 0; i < 3; ++i){
+        if (mean[i] > maxMean){
+            maxMean = mean[i];
+            maxndx = i;
+        }
+    }
+    if (m_settings.channel == "Blue") maxndx = 0;
+    else if (m_settings.channel == "Green") maxndx = 1;
+    else if (m_settings.channel == "Red") maxndx = 2;
+
+    cv::Mat plane = bgr_planes[maxndx] - mean[maxndx];
+
+    item.mask = makeOutlineMask(outside, center, plane.rows, plane.cols, yScale);
+    cv::Mat masked;
+    plane.copyTo(masked, item.mask);
+    mean = cv::mean(masked, item.mask);
+    masked -= mean;
+    masked.convertTo(item.input, CV_64F);
+    item.outside = outside;
+    item.center = center;
+}
+
+// Fit the zernikes of a .wfb surface inside the outline less a two pixel margin, the
+// default the surface manager uses.  Elliptical mirrors are only fitted when loaded.
+// False when there was nothing to fit so the item is not counted for this stage.
+bool batchEngine::fit(batchItem &item){
+    if (!m_settings.binary || m_settings.ellipse)
+        return false;
+    wavefront wf;
+    wf.data = item.surface;
+    wf.m_outside = item.outside;
+    wf.m_inside = item.center;
+    CircleOutline outside = item.outside;
+    outside.m_radius -= 2;
+    CircleOutline inside = item.center;
+    if (inside.m_radius > 0)
+        inside.m_radius += 2;
+    wf.workMask = makeOutlineMask(outside, inside, wf.data.rows, wf.data.cols) != 0;
+    fitZernikes(wf, m_settings.zernikeTerms);
+    item.zerns = wf.InputZerns;
+    return true;
+}
+
+void batchEngine::write(batchItem &item){
+    wavefront wf;
+    wf.data = item.surface;
+    wf.m_outside = item.outside;
+    wf.m_inside = item.center;
+    wf.diameter = m_settings.diameter;
+    wf.roc = m_settings.roc;
+    wf.lambda = m_settings.lambda;
+    wf.InputZerns = item.zerns;
+
+    QFileInfo info(item.igram);
+    QString dir = m_settings.outputDir.isEmpty() ? info.absolutePath() : m_settings.outputDir;
+    item.wft = dir + QDir::separator() + info.completeBaseName() + (m_settings.binary ? ".wfb" : ".wft");
+    double verticalAxis = m_settings.ellipse ? m_settings.verticalAxis : 0.;
+    bool ok = m_settings.binary ?
+                writeWavefrontBinary(item.wft, wf, false, verticalAxis, m_settings.float32) :
+                writeWavefrontFile(item.wft, wf, false, verticalAxis);
+    if (!ok){
+        item.error = "Can not write " + item.wft;
+        item.wft.clear();
+    }
+    item.surface.release();
+}
+
+QStringList batchEngine::written() const{
+    QStringList list;
+    for (int i = 0; i < m_results.size(); ++i){
+        if (!m_results[i].wft.isEmpty())
+            list << m_results[i].wft;
+    }
+    return list;
+}
+
+QString batchEngine::report() const{
+    double wall = wallSeconds();
+    QString r = QString().sprintf("%d igrams in %6.2lf s, %6.2lf igrams/s\n",
+                                  m_items[WRITE], wall, (wall > 0) ? m_items[WRITE]/wall : 0.);
+    for (int s = 0; s < STAGE_COUNT; ++s){
+        double busy = busySeconds(s);
+        // a stage with n workers can do n seconds of work per second
+        double rate = (busy > 0) ? m_items[s] * m_workers[s] / busy : 0.;
+        r += QString().sprintf("%-12s %2d workers %5d igrams %8.2lf s busy %8.2lf igrams/s\n",
+                               stageName(s), m_workers[s], m_items[s], busy, rate);
+    }
+    return r;
+}
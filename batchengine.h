@@ -0,0 +1,193 @@
+/******************************************************************************
+**
+**  Copyright 2016 Dale Eason
+**  This file is part of DFTFringe
+**  is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation version 3 of the License
+
+** DFTFringe is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with DFTFringe.  If not, see <http://www.gnu.org/licenses/>.
+
+****************************************************************************/
+#ifndef BATCHENGINE_H
+#define BATCHENGINE_H
+
+#include <QObject>
+#include <QStringList>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QQueue>
+#include <QVector>
+#include "opencv/cv.h"
+#include "circleoutline.h"
+
+// Everything the batch pipeline needs from the application.  Filled in on the GUI
+// thread before the run so the workers never read a widget.
+struct batchSettings
+{
+    batchSettings();
+    int dftSize;
+    QString channel;            // "ALL RGB", "Red", "Green", "Blue" or automatic
+    double centerFilter;        // used when an igram has no outline file
+    int vortexSmooth;           // percent of the radius
+    bool flipH;
+    bool ellipse;
+    double verticalAxis;
+    double diameter;
+    double roc;
+    double lambda;
+    double fringeSpacing;
+    bool fastUnwrap;            // bucket queue unwrap
+    bool referenceQuality;
+    CircleOutline outside;      // used when an igram has no outline file
+    CircleOutline center;
+    QString outputDir;          // empty writes each wavefront next to its igram
+    bool binary;                // write .wfb with the fitted zernikes instead of .wft
+    bool float32;               // .wfb raster in single precision
+    int zernikeTerms;           // zernikes fitted for a .wfb
+    int threads;                // 0 is one per core
+    int queueDepth;             // igrams allowed between two stages
+};
+
+// One igram as it moves down the pipeline.
+struct batchItem
+{
+    batchItem() : index(-1), centerFilter(0.) {}
+    int index;
+    QString igram;
+    QString wft;
+    QString error;
+    cv::Mat image;
+    cv::Mat input;
+    cv::Mat mask;
+    cv::Mat surface;
+    std::vector<double> zerns;
+    CircleOutline outside;
+    CircleOutline center;
+    double centerFilter;
+};
+
+// Fixed size queue between two pipeline stages.  push blocks while the queue is full
+// so a fast stage can not run ahead of a slow one and fill memory with images.  pop
+// blocks until an item arrives or every producer is finished.
+template <typename T>
+class boundedQueue
+{
+public:
+    explicit boundedQueue(int capacity = 4) :
+        m_capacity(capacity < 1 ? 1 : capacity), m_producers(0), m_cancelled(false) {}
+
+    void setProducers(int n) {
+        QMutexLocker lock(&m_lock);
+        m_producers = n;
+    }
+    void producerDone() {
+        QMutexLocker lock(&m_lock);
+        if (--m_producers <= 0)
+            m_notEmpty.wakeAll();
+    }
+    void cancel() {
+        QMutexLocker lock(&m_lock);
+        m_cancelled = true;
+        m_queue.clear();
+        m_notEmpty.wakeAll();
+        m_notFull.wakeAll();
+    }
+    bool push(const T &item) {
+        QMutexLocker lock(&m_lock);
+        while (!m_cancelled && m_queue.size() >= m_capacity)
+            m_notFull.wait(&m_lock);
+        if (m_cancelled)
+            return false;
+        m_queue.enqueue(item);
+        m_notEmpty.wakeOne();
+        return true;
+    }
+    bool pop(T &item) {
+        QMutexLocker lock(&m_lock);
+        while (!m_cancelled && m_queue.isEmpty() && m_producers > 0)
+            m_notEmpty.wait(&m_lock);
+        if (m_cancelled || m_queue.isEmpty())
+            return false;
+        item = m_queue.dequeue();
+        m_notFull.wakeOne();
+        return true;
+    }
+
+private:
+    QMutex m_lock;
+    QWaitCondition m_notEmpty;
+    QWaitCondition m_notFull;
+    QQueue<T> m_queue;
+    int m_capacity;
+    int m_producers;
+    bool m_cancelled;
+};
+
+// Headless interferogram to wavefront pipeline.  Each igram is decoded, cut to the
+// mirror outline, turned into phase with the vortex transform, unwrapped and written
+// as a .wft or .wfb file.  Zernikes are fitted only for .wfb files, which have room
+// for them.  Loading either one fits again with the outline offsets the user has set.
+// Every stage has its own workers and
+// the stages are joined by bounded queues so different igrams are in different
+// stages at the same time.  Does not use any widget and can run on any thread.
+class batchEngine : public QObject
+{
+    Q_OBJECT
+public:
+    enum stage { DECODE, ROI, PHASE, UNWRAP, FIT, WRITE, STAGE_COUNT };
+
+    explicit batchEngine(const batchSettings &settings, QObject *parent = 0);
+
+    // Process the files and block until they are all done or the run is cancelled.
+    // Returns the items in the order of files.
+    QVector<batchItem> run(const QStringList &files);
+
+    // Per stage worker count, busy time and throughput of the last run.
+    QString report() const;
+    QStringList written() const;
+    QVector<batchItem> results() const { return m_results; }
+
+    static const char *stageName(int s);
+    int workers(int s) const { return m_workers[s]; }
+    int items(int s) const { return m_items[s]; }
+    double busySeconds(int s) const { return m_busyNs[s] * 1.e-9; }
+    double wallSeconds() const { return m_wallNs * 1.e-9; }
+
+    void stageLoop(int s);
+
+public slots:
+    void cancel();
+
+signals:
+    void progress(int done, int total);
+    void fileDone(QString igram, QString wft, QString error);
+
+private:
+    batchSettings m_settings;
+    QStringList m_files;
+    int m_next;                 // next file for the decode stage
+    int m_done;
+    bool m_cancelled;
+    QMutex m_lock;              // guards m_next, m_done, m_results and the stats
+    boundedQueue<batchItem> *m_queues[STAGE_COUNT];
+    QVector<batchItem> m_results;
+    int m_workers[STAGE_COUNT];
+    int m_items[STAGE_COUNT];
+    qint64 m_busyNs[STAGE_COUNT];
+    qint64 m_wallNs;
+
+    bool nextFile(batchItem &item);
+    void decode(batchItem &item);
+    void extractRoi(batchItem &item);
+    bool fit(batchItem &item);
+    void write(batchItem &item);
+};
+
+#endif // BATCHENGINE_H
@@ -0,0 +1,324 @@
+/******************************************************************************
+**
+**  Copyright 2016 Dale Eason
+**  This file is part of DFTFringe
+**  is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation version 3 of the License
+
+** DFTFringe is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with DFTFringe.  If not, see <http://www.gnu.org/licenses/>.
+
+****************************************************************************/
+
+// dftfringe_bench: times the compute stages of DFTFringe on synthetic interferograms.
+//
+// For each size an interferogram is made from a fixed set of zernikes with the same
+// generator the simulated igram dialog uses.  It is then taken through the same
+// calls the application makes: outline mask, DFT, vortex transform, unwrap, zernike
+// fit, nulling, gaussian blur, star test and Foucault.  Each stage is timed on its own
+// for a number of repetitions and the median and percentiles are written as JSON.
+//
+//  dftfringe_bench [--sizes 640,1024,2048,4096] [--reps 7] [--warmup 1] [--terms 48]
+//                  [--bucket] [--out file]
+//
+// --terms is the number of zernike terms the fit stage fits, 231 is all terms up to
+// order 20.  --bucket unwraps with the bucket queue instead of the exact heap.
+//
+// The application settings are not read, the bench uses its own settings so runs on
+// different machines are comparable.  On Linux it runs without a display.
+
+#include <QApplication>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QStringList>
+#include <QThread>
+#include <algorithm>
+#include <stdio.h>
+#include "opencv/cv.h"
+#include "wavefront.h"
+#include "graphicsutilities.h"
+#include "vortex.h"
+#include "zernikeprocess.h"
+#include "simigramdlg.h"
+#include "simulationsview.h"
+#include "foucaultview.h"
+#include "mirrordlg.h"
+
+extern void expandBorder(wavefront *wf);
+
+#define BENCH_BORDER 20
+
+enum benchStage { MASK, DFT, VORTEX, UNWRAP, FIT, NULLING, BLUR, STARTEST, FOUCAULT,
+                  BENCH_STAGES };
+static const char *stageNames[BENCH_STAGES] = {
+    "mask", "dft", "vortex", "unwrap", "fit", "null", "blur", "startest", "foucault"
+};
+
+// linear interpolation between the closest ranks, p from 0 to 100
+static double percentile(std::vector<double> v, double p){
+    if (v.empty())
+        return 0.;
+    std::sort(v.begin(), v.end());
+    double pos = p/100. * (v.size() - 1);
+    int lo = (int)pos;
+    int hi = std::min(lo + 1, (int)v.size() - 1);
+    return v[lo] + (pos - lo) * (v[hi] - v[lo]);
+}
+
+static QJsonObject stageSummary(const std::vector<double> &ms){
+    QJsonObject o;
+    o["samples"] = (int)ms.size();
+    o["median_ms"] = percentile(ms, 50.);
+    o["p10_ms"] = percentile(ms, 10.);
+    o["p90_ms"] = percentile(ms, 90.);
+    o["min_ms"] = percentile(ms, 0.);
+    o["max_ms"] = percentile(ms, 100.);
+    return o;
+}
+
+// Known igram: tilt for fringes plus some defocus, astig, coma and spherical.
+static cv::Mat makeIgram(int size){
+    simIgramDlg &dlg = *simIgramDlg::get_instance();
+    dlg.size = size;
+    dlg.star = 0.;
+    dlg.ring = 0.;
+    dlg.doCorrection = false;
+    dlg.zernikes = std::vector<double>(Z_TERMS, 0.);
+    dlg.zernikes[1] = 15.;
+    dlg.zernikes[3] = 2.;
+    dlg.zernikes[4] = .4;
+    dlg.zernikes[6] = .2;
+    dlg.zernikes[8] = .3;
+    cv::Mat igram = makeSurfaceFromZerns(BENCH_BORDER, true);
+    cv::Mat red;
+    cv::extractChannel(igram, red, 2);
+    red.convertTo(red, CV_64F);
+    return red;
+}
+
+class stageTimer
+{
+public:
+    explicit stageTimer(std::vector<double> *samples, bool record) :
+        m_samples(samples), m_record(record) { m_timer.start(); }
+    ~stageTimer() {
+        if (m_record)
+            m_samples->push_back(m_timer.nsecsElapsed() * 1.e-6);
+    }
+private:
+    std::vector<double> *m_samples;
+    bool m_record;
+    QElapsedTimer m_timer;
+};
+
+static QJsonObject benchSize(int size, int reps, int warmup, int terms,
+                             unwrapContext::queueMode mode){
+    fprintf(stderr, "size %d\n", size);
+    cv::Mat image = makeIgram(size);
+    double c = (size - 1)/2.;
+    CircleOutline outside(QPointF(c, c), c - BENCH_BORDER);
+    CircleOutline center(QPointF(c, c), 0.);
+
+    std::vector<double> samples[BENCH_STAGES];
+    vortexEngine vortex;
+    unwrapContext unwrapper;
+    vortex.unwrapper().setQueueMode(mode);
+    unwrapper.setQueueMode(mode);
+    SimulationsView *sv = SimulationsView::getInstance(0);
+    foucaultView *fv = foucaultView::get_Instance(0);
+    zernikeProcess &zp = *zernikeProcess::get_Instance();
+
+    for (int rep = 0; rep < warmup + reps; ++rep){
+        bool record = rep >= warmup;
+        cv::Mat mask;
+        {
+            stageTimer t(&samples[MASK], record);
+            mask = makeOutlineMask(outside, center, image.rows, image.cols);
+        }
+
+        {
+            stageTimer t(&samples[DFT], record);
+            cv::Mat planes[2] = {image.clone(), cv::Mat::zeros(image.size(), CV_64F)};
+            cv::Scalar mean, std;
+            cv::meanStdDev(planes[0], mean, std, mask);
+            planes[0] -= mean[0];
+            cv::Mat complexI;
+            cv::merge(planes, 2, complexI);
+            cv::dft(complexI, complexI);
+        }
+
+        cv::Mat phase;
+        {
+            stageTimer t(&samples[VORTEX], record);
+            cv::Mat input = cv::Mat::zeros(image.size(), CV_64F);
+            image.copyTo(input, mask);
+            phase = vortex.compute(input, mask, 10., .01 * 9. * input.cols/2.);
+        }
+
+        cv::Mat result;
+        CircleOutline wfOutside = outside;
+        {
+            stageTimer t(&samples[UNWRAP], record);
+            result = cv::Mat::zeros(phase.size(), CV_64F);
+            phase.copyTo(result, mask);
+            phase = result.clone();
+            normalize(phase, phase, 0, 1., CV_MINMAX, CV_64F, mask);
+            cv::Mat m = (255 - mask)/255;
+            unwrapper.resize(phase.cols, phase.rows);
+            unwrapper.unwrap((double *)(phase.data), (double *)(result.data), (char *)(m.data));
+            flip(result, result, 0);
+            wfOutside.m_center.ry() = result.rows - wfOutside.m_center.y();
+        }
+
+        wavefront wf;
+        wf.data = result;
+        wf.m_outside = wfOutside;
+        wf.m_inside = center;
+        wf.diameter = mirrorDlg::get_Instance()->diameter;
+        wf.roc = mirrorDlg::get_Instance()->roc;
+        wf.lambda = mirrorDlg::get_Instance()->lambda;
+        CircleOutline fitOutside = wfOutside;
+        fitOutside.m_radius -= 2;
+        wf.mask = makeOutlineMask(fitOutside, center, result.rows, result.cols) != 0;
+        wf.workMask = wf.mask.clone();
+        {
+            stageTimer t(&samples[FIT], record);
+            fitZernikes(wf, terms);
+        }
+
+        {
+            stageTimer t(&samples[NULLING], record);
+            wf.nulledData = zp.null_unwrapped(wf, wf.InputZerns, zernEnables, 0, Z_TERMS);
+        }
+
+        {
+            stageTimer t(&samples[BLUR], record);
+            wf.workData = wf.nulledData.clone();
+            expandBorder(&wf);
+            cv::GaussianBlur(wf.nulledData.clone(), wf.workData, cv::Size(21, 21), 0, 0);
+        }
+        wf.dirtyZerns = false;
+
+        sv->setSurface(&wf);
+        {
+            stageTimer t(&samples[STARTEST], record);
+            sv->computeStarTest(sv->nulledSurface(-5.), 512, 4.);
+            sv->computeStarTest(sv->nulledSurface(5.), 512, 4.);
+        }
+
+        fv->setSurface(&wf);
+        {
+            stageTimer t(&samples[FOUCAULT], record);
+            fv->on_makePb_clicked();
+        }
+    }
+
+    QJsonObject stages;
+    for (int s = 0; s < BENCH_STAGES; ++s)
+        stages[stageNames[s]] = stageSummary(samples[s]);
+    QJsonObject o;
+    o["size"] = size;
+    o["stages"] = stages;
+    return o;
+}
+
+int main(int argc, char *argv[])
+{
+#ifndef Q_OS_WIN
+    if (qgetenv("QT_QPA_PLATFORM").isEmpty())
+        qputenv("QT_QPA_PLATFORM", "offscreen");
+#endif
+    QApplication a(argc, argv);
+    a.setOrganizationName("DFTFringe");
+    a.setApplicationName("DFTFringeBench");
+
+    QList<int> sizes;
+    sizes << 640 << 1024 << 2048 << 4096;
+    int reps = 7;
+    int warmup = 1;
+    int terms = Z_TERMS;
+    unwrapContext::queueMode mode = unwrapContext::EXACT_HEAP;
+    QString outName;
+    QStringList args = a.arguments();
+    for (int i = 1; i < args.size(); ++i){
+        QString arg = args[i];
+        QString val = (i + 1 < args.size()) ? args[i + 1] : QString();
+        if (arg == "--sizes"){
+            sizes.clear();
+            foreach (QString s, val.split(",", QString::SkipEmptyParts))
+                sizes << s.toInt();
+            ++i;
+        }
+        else if (arg == "--reps"){
+            reps = std::max(1, val.toInt());
+            ++i;
+        }
+        else if (arg == "--warmup"){
+            warmup = std::max(0, val.toInt());
+            ++i;
+        }
+        else if (arg == "--terms"){
+            terms = std::max(Z_TERMS, val.toInt());
+            ++i;
+        }
+        else if (arg == "--bucket"){
+            mode = unwrapContext::BUCKET_QUEUE;
+        }
+        else if (arg == "--out"){
+            outName = val;
+            ++i;
+        }
+        else {
+            fprintf(stderr, "usage: dftfringe_bench [--sizes 640,1024,2048,4096] [--reps 7]"
+                            " [--warmup 1] [--terms 48] [--bucket] [--out file.json]\n");
+            return 1;
+        }
+    }
+
+    // same nulls as the application starts with
+    zernEnables = std::vector<bool>(Z_TERMS, true);
+    for (int i = 0; i < 8; ++i){
+        if (i == 4 || i == 5)
+            continue;
+        zernEnables[i] = false;
+    }
+
+    QJsonArray results;
+    foreach (int size, sizes){
+        if (size > 2 * BENCH_BORDER + 10)
+            results.append(benchSize(size, reps, warmup, terms, mode));
+    }
+
+    QJsonObject doc;
+    doc["benchmark"] = QString("dftfringe_bench");
+    doc["version"] = QString(APP_VERSION);
+    doc["threads"] = QThread::idealThreadCount();
+    doc["opencvThreads"] = cv::getNumThreads();
+    doc["repetitions"] = reps;
+    doc["warmup"] = warmup;
+    doc["fitTerms"] = terms;
+    doc["unwrap"] = QString(mode == unwrapContext::BUCKET_QUEUE ? "bucket queue" : "exact heap");
+    doc["results"] = results;
+    QByteArray json = QJsonDocument(doc).toJson();
+
+    if (outName.isEmpty()){
+        fwrite(json.constData(), 1, json.size(), stdout);
+        return 0;
+    }
+    QFile file(outName);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate)){
+        fprintf(stderr, "can not write %s\n", outName.toLocal8Bit().constData());
+        return 1;
+    }
+    file.write(json);
+    return 0;
+}
@@ -23,47 +23,15 @@
 #include "punwrap.h"
 #include "zernikeprocess.h"
 #include "settings2.h"
+#include "graphicsutilities.h"
 using namespace cv;
 
 cv::Mat  makeMask(CircleOutline outside, CircleOutline center, cv::Mat data){
-    int width = data.cols;
-    int height = data.rows;
-
-    double radm = ceil(outside.m_radius) + 1;
-    double rady = radm;
     mirrorDlg &md = *mirrorDlg::get_Instance();
+    double yScale = 1.;
     if (md.isEllipse())
-        rady = radm * md.m_verticalAxis/md.diameter;
-    double rado = center.m_radius;
-    double cx = outside.m_center.x();
-    double cy = outside.m_center.y();
-    cv::Mat mask = cv::Mat::zeros(height,width,CV_8UC1);
-
-    double rx = outside.m_radius-1;
-    double rx2 = rx * rx;
-    double ry = rx * md.m_verticalAxis/md.diameter;
-    double ry2 = ry * ry;
-    for (int y = 0; y < height; ++y){
-        for (int x = 0; x < width; ++x){
-            double dx = (double)(x - cx)/(radm);
-            double dy = (double)(y - cy)/(rady);
-            if (sqrt(dx * dx + dy * dy) <= 1.)
-                mask.at<uchar>(y,x) = 255;
-        }
-    }
-    cx = center.m_center.x();
-    cy = center.m_center.y();
-    if (rado > 0) {
-        for (int y = 0; y < height; ++y){
-            for (int x = 0; x < width; ++x){
-                double dx = (double)(x - (cx))/(rado);
-                double dy = (double)(y - (cy))/(rado);
-                if (sqrt(dx * dx + dy * dy) < 1.)
-                    mask.at<uchar>(y,x) = 0;
-            }
-        }
-    }
-    return mask;
+        yScale = md.m_verticalAxis/md.diameter;
+    return makeOutlineMask(outside, center, data.rows, data.cols, yScale);
 }
 
 DFTArea::DFTArea(QWidget *mparent, IgramArea *ip, DFTTools * tools, vortexDebug *vdbug) :
@@ -265,76 +233,6 @@ Mat DFTArea::grayComplexMatfromImage(QImage &img){
     return complexI;
 }
 
-//swap quadrants
-void shiftDFT(cv::Mat &magI){
-
-    // crop the spectrum, if it has an odd number of rows or columns
-    magI = magI(Rect(0, 0, magI.cols & -2, magI.rows & -2));
-
-    // rearrange the quadrants of Fourier image  so that the origin is at the image center
-    int cx = magI.cols/2;
-    int cy = magI.rows/2;
-
-    Mat  q0(magI, Rect(0, 0, cx, cy));   // Top-Left - Create a ROI per quadrant
-    Mat  q1(magI, Rect(cx, 0, cx, cy));  // Top-Right
-    Mat  q2(magI, Rect(0, cy, cx, cy));  // Bottom-Left
-    Mat  q3(magI, Rect(cx, cy, cx, cy)); // Bottom-Right
-
-    Mat  tmp;                           // swap quadrants (Top-Left with Bottom-Right)
-    q0.copyTo(tmp);
-    q3.copyTo(q0);
-    tmp.copyTo(q3);
-
-    q1.copyTo(tmp);                    // swap quadrant (Top-Right with Bottom-Left)
-    q2.copyTo(q1);
-    tmp.copyTo(q2);
-}
-
-void showData(const string& txt, cv::Mat mat, bool useLog){
-    cv::Mat tmp = mat.clone();
-    if (useLog){
-        tmp = mat+1;
-        log(tmp, tmp);
-    }
-    normalize(tmp, tmp,0,255,CV_MINMAX);
-    tmp.convertTo(tmp,CV_8U);
-    cvtColor(tmp,tmp, CV_GRAY2RGB);
-    cv::imshow(txt, tmp);
-    cv::waitKey(1);
-}
-
-
-QImage  showMag(cv::Mat complexI, bool show, const char* title, bool doLog, double gamma){
-    // compute the magnitude and switch to logarithmic scale
-    // => log(1 + sqrt(Re(DFT(I))^2 + Im(DFT(I))^2))
-    Mat planes[2];
-    split(complexI, planes);                   // planes[0] = Re(DFT(I), planes[1] = Im(DFT(I))
-    magnitude(planes[0], planes[1], planes[0]);// planes[0] = magnitude
-    Mat  magI = planes[0];
-    double mmin;
-    double mmax;
-    minMaxIdx(magI, &mmin,&mmax);
-    magI-= mmin;
-
-    if (doLog)
-        log((magI+0.1), magI);
-
-    if (gamma != 0.){
-        cv::pow(magI,gamma,magI);
-    }
-    normalize(magI, magI,0,255,CV_MINMAX, CV_8U);
-    minMaxIdx(magI, &mmin,&mmax);
-
-    cv::Mat tmp = magI.clone();
-    cv::waitKey(1);
-    cvtColor(magI,magI, CV_GRAY2RGB);
-    if (show){
-        imshow(title, magI);
-        waitKey(1);
-    }
-    return QImage((uchar*)magI.data, magI.cols, magI.rows, magI.step, QImage::Format_RGB888).copy();
-}
-
 void DFTArea::doDFT(){
     QImage img = igramArea->igramImage;
 
@@ -404,387 +302,23 @@ void DFTArea::paintEvent(QPaintEvent *)
 }
 
 
-#define WRAP(x) (((x) > 0.5) ? ((x)-1.0) : (((x) <= -0.5) ? ((x)+1.0) : (x)))
-#define WRAPPI(x) (((x) > M_PI) ? ((x)-2*M_PI) : (((x) <= -M_PI) ? ((x)+2*M_PI) : (x)))
-
-#define BORDER      0x1
-#define UNWRAPPED   0x2
-double *g_qmap;
-class comp_qual {
-public:
-  int operator() (const int &p1, const int &p2) {
-    return (g_qmap[p1] < g_qmap[p2]);
-  }
-};
-#define unwrap_and_insert(ndx, val) \
-  { \
-    unwrapped[ndx] = val;  \
-    flags[ndx] |= UNWRAPPED; \
-    path[ndx] = order++; \
-    todo.push (ndx); \
-  }
-
-// Quality-guided path following phase unwrapper.
-void qg_path_follower_vortex (Size size, double *phase, double *qmap,
-               double *unwrapped, double *path)
-{
-  std::priority_queue<int, std::vector<int>, comp_qual> todo;
-  int total = size.area();
-  int order = 0;
-  g_qmap = qmap;
-
-  // Initialize the flags array to mark the border.
-  char *flags = new char[total];
-  for (int k=0; k < total; ++k)
-    flags[k] = phase[k] == 0.0;
-
-  // Repeat while still elements to unwrap (handles disjoint regions).
-  while (1) {
-
-    // Find the point of highest quality.
-    double m = -HUGE;
-    int mndx;
-    for (int k=0; k < total; ++k)
-      if (qmap[k] > m && ! flags[k])
-    m = qmap[mndx = k];
-    if (m == -HUGE) break;
-
-    // Unwrap the first point.
-    unwrap_and_insert (mndx, phase[mndx]);
-
-    // Unwrap the rest of the points in order of quality.
-    while (!todo.empty()) {
-      int ndx = todo.top();
-      todo.pop();
-      int x = ndx%size.width;
-      int y = ndx/size.width;
-      double val = unwrapped[ndx];
-      if (x > 0 && ! flags[ndx-1])
-    unwrap_and_insert (ndx-1, val+WRAP(phase[ndx-1]-phase[ndx]));
-      if (x < size.width-1 && ! flags[ndx+1])
-    unwrap_and_insert (ndx+1, val+WRAP(phase[ndx+1]-phase[ndx]));
-      if (y > 0 && ! flags[ndx-size.width])
-    unwrap_and_insert (ndx-size.width, val+WRAP(phase[ndx-size.width]-phase[ndx]));
-      if (y < size.height-1 && ! flags[ndx+size.width])
-    unwrap_and_insert (ndx+size.width, val+WRAP(phase[ndx+size.width]-phase[ndx]));
-    }
-  }
-  delete[] flags;
-}
-
 cv::Mat DFTArea::vortex(QImage &img, double low)
-  {
-
+{
     cv::Mat image = grayComplexMatfromImage(img);
-    cv::Mat imagePlanes[2];
-    split(image,imagePlanes);
-
-
-    int xsize = image.cols;
-    int ysize = image.rows;
-    int nx = xsize, ny = ysize;
-    int size = xsize*ysize;
-    double smooth = .01 * m_vortexDebugTool->m_smooth * xsize/2.;
-    double *dir = new double[size];
-    double *path = new double[size];
-    double *qmap = new double[size];
-    double *orient = new double[size];
-
-
-    double *imRe = new double[size];
-
-
-    //double *fdom[2]; fdom[0] = new double[size]; fdom[1] = new double[size];
-    double *d1[2]; d1[0] = new double[size]; d1[1] = new double[size];
-    double *d2[2]; d2[0] = new double [size]; d2[1] = new double [size];
-
-    double *spiralRe = new double [size];
-    double *spiralIm = new double[size];
-
-    // Create rho and theta arrays for later use.
+    cv::Mat input;
+    cv::extractChannel(image, input, 0);
+    input.convertTo(input, CV_64F);
 
-    int *ix = new int[xsize];
-    int *iy = new int[ysize];
-    for (int i=0; i<=xsize/2; ++i) ix[i] = -i;
-    for (int i=1; i<=xsize/2; ++i) ix[xsize-i] = i;
-    for (int i=0; i<=ysize/2; ++i) iy[i] = -i;
-    for (int i=1; i<=ysize/2; ++i) iy[ysize-i] = i;
-
-
-    double *rho = new double[size];
-    double *theta = new double[size];
-
-    for (int j=0; j<ysize; ++j) {
-      int base = j*xsize;
-      for (int i=0; i<xsize; ++i) {
-        rho[base+i] = sqrt (ix[i]*ix[i] + iy[j]*iy[j]);
-        theta[base+i] = atan2 (iy[j], ix[i]);
-      }
-    }
-
-    // Prepare the image and convert it to doubles.
-    float *pIm = imagePlanes[0].ptr<float>(0);
-    for (int i=0; i<size; ++i) {
-      imRe[i] = (double)(pIm[i]);
-
-    }
-/*
-    QwtPlot *pl1 = new QwtPlot();
-    QwtPlotCurve *curve1 = new QwtPlotCurve("DFT image");
-    QPolygonF points1;
-    for (int x = 0; x < xsize; ++x){
-        double v = imRe[size/2 + x];
-        points1 << QPointF(x,v);
-    }
-    curve1->setSamples(points1);
-    curve1->attach(pl1);
-
-
-
-    pl1->resize(1000,400);
-    pl1->show();
-*/
     if (m_vortexDebugTool->m_showInput){
-        cv::Mat tmp = cv::Mat(ysize,xsize,CV_64F, imRe);
         cv::Mat xx;
-        tmp.convertTo(xx,CV_32F);
+        input.convertTo(xx,CV_32F);
         cv::imshow("input", xx);
         cv::waitKey(1);
     }
-
-    // Take the Fourier transform.
-    cv::Mat imPlanes[2] = {cv::Mat(Size(nx,ny), CV_64F, imRe),
-                           cv::Mat::zeros(Size(nx,ny),CV_64F)};
-
-    cv::Mat imMat;
-    cv::Mat fdomMat;
-    cv::Mat fdomPlanes[2];
-    merge(imPlanes,2, imMat);
-
-    dft(imMat,fdomMat);
-    split(fdomMat, fdomPlanes);
-
-    //p = fftw_plan_dft_2d (ysize, xsize, im, fdom, FFTW_FORWARD, FFTW_ESTIMATE);
-    //fftw_execute (p);
-
-
-
-    // High-pass filter the Fourier domain to remove the background.
-    double *planes[2] = {fdomPlanes[0].ptr<double>(0), fdomPlanes[1].ptr<double>(0)};
-    if (low > 0)
-    {
-        for (int i=0; i<size; ++i) {
-          double a = 1.0 - exp (-(rho[i]*rho[i])/(low*low));
-
-            planes[0][i] *= a;
-            planes[1][i] *= a;
-        }
-    }
-    merge(fdomPlanes,2, fdomMat);
-    if (m_vortexDebugTool->m_showFdom){
-        showMag(fdomMat.clone(),true,"fdom");
-    }
-
-    // Take the inverse Fourier transform to get the cleaned igram.
-
-    //p = fftw_plan_dft_2d (ysize, xsize, fdom, im, FFTW_BACKWARD, FFTW_ESTIMATE);
-    //fftw_execute (p);
-    dft(fdomMat, imMat, DFT_INVERSE);
-    split(imMat,imPlanes);
-    qDebug() << "imPlanes" << imPlanes[0].size().width  << imPlanes[0].size().height << m_mask.cols <<
-                m_mask.rows;
-    imPlanes[0]/= size;
-    cv::Mat tmp;
-    imPlanes[0].copyTo(tmp, m_mask);
-    imPlanes[0] = tmp.clone();
-    // Normalize the image by removing the exterior and centering values.
-    cv::Scalar mean,std;
-    cv::meanStdDev(imPlanes[0],mean,std, m_mask);
-    double sum = 0;
-    double *q = imPlanes[0].ptr<double>(0);
-
-    merge(imPlanes,2, imMat);
-
-    dft(imMat,fdomMat);
-    double dc = fdomMat.at<double>(0,0,0);
-    dc/=size;
-    int count = 0;
-    bool *bp = m_mask.ptr<bool>(0);
-    for (int i = 0; i < size; ++i){
-        if (bp[i]){
-            sum += q[i];
-            if (q[i] != 0.0)
-            ++count;
-        }
-
-    }
-    double m2 = sum/count;
-    imPlanes[0] -= m2;
-
-
-    imPlanes[1] *= 0.;
-
-    imRe = (double *)(imPlanes[0].data);
-    if (0) { //(0 == strcmp (what, "im2")) {
-        showData("im border added", imPlanes[0].clone());
-    }
-    merge(imPlanes,2,imMat);
-
-    // Calculate the intermediate values d1 and d2.
-
-    for (int i=0; i<size; ++i) {
-      spiralRe[i] = cos(theta[i]);
-      spiralIm[i] = sin(theta[i]);
-    }
-    split(fdomMat,fdomPlanes);
-    double *fdomRe = (double*)(fdomPlanes[0].data);
-    double *fdomIm = (double *)(fdomPlanes[1].data);
-
-    for (int i=0; i<size; ++i) {
-      double re = fdomRe[i]*spiralRe[i] - fdomIm[i]*spiralIm[i];
-      double im = fdomRe[i]*spiralIm[i] + fdomIm[i]*spiralRe[i];
-      fdomRe[i] = re;
-      fdomIm[i] = im;
-    }
-    merge(fdomPlanes,2,fdomMat);
-    cv::Mat d1Mat;
-    dft(fdomMat,d1Mat, DFT_INVERSE);
-    //p = fftw_plan_dft_2d (ysize, xsize, fdomMat, d1Mat, FFTW_BACKWARD, FFTW_ESTIMATE);
-    //fftw_execute (p);
-    d1Mat/= size;
-
-
-
-    if (0){ //(0 == strcmp (what, "d1")) {
-        showMag(d1Mat.clone(), true, "D1");
-    }
-
-
-    for (int i=0; i<size; ++i) {
-      double re = fdomRe[i]*spiralRe[i] - fdomIm[i]*spiralIm[i];
-      double im = fdomRe[i]*spiralIm[i] + fdomIm[i]*spiralRe[i];
-      fdomRe[i] = re;
-      fdomIm[i] = im;
-    }
-    cv::Mat d2Mat;
-    merge(fdomPlanes,2, fdomMat);
-    dft(fdomMat,d2Mat,DFT_INVERSE);
-    //p = fftw_plan_dft_2d (ysize, xsize, fdom, d2, FFTW_BACKWARD, FFTW_ESTIMATE);
-    //fftw_execute (p);
-    d2Mat/= size;
-
-
-    if (0){//(0 == strcmp (what, "d2")) {
-        showMag(d2Mat.clone(),true, "D2");
-    }
-
-
-    cv::Mat rMat;
-    cv::Mat rPlanes[2] = {cv::Mat::zeros(Size(xsize,ysize),CV_64F), cv::Mat::zeros(Size(xsize,ysize),CV_64F)};
-    cv::Mat d1Planes[2];
-    cv::Mat d2Planes[2];
-    split(d1Mat,d1Planes);
-    split(d2Mat,d2Planes);
-    double *d1Re = (double *)(d1Planes[0].data);
-    double *d1Im = (double *)(d1Planes[1].data);
-    double *d2Re = (double *)(d2Planes[0].data);
-    double *d2Im = (double *)(d2Planes[1].data);
-    double *rRe = (double *)(rPlanes[0].data);
-    double *rIm = (double *)(rPlanes[1].data);
-
-    // Calculate the orientation and the quality map for unwrapping.
-    for (int i=0; i<size; ++i) {
-      rRe[i] = d1Re[i]*d1Re[i] - d1Im[i]*d1Im[i] - imRe[i]*d2Re[i];
-      rIm[i] = d1Re[i]*d1Im[i] + d1Im[i]*d1Re[i] - imRe[i]*d2Im[i];
-    }
-    //smooth = 0;
-    if (smooth > 0) {
-        merge(rPlanes,2, rMat);
-        cv::Mat temp;
-        cv::Mat tempPlanes[2];
-      // Low-pass filter r to smooth it.
-      dft(rMat,temp);
-      //p = fftw_plan_dft_2d (ysize, xsize, r, temp, FFTW_FORWARD, FFTW_ESTIMATE);
-      //fftw_execute (p);
-      split(temp,tempPlanes);
-      double *tempRe = (double *)(tempPlanes[0].data);
-      double *tempIm = (double *)(tempPlanes[1].data);
-
-      for (int i=0; i<size; ++i) {
-        double a = exp (-(rho[i]*rho[i])/(smooth * smooth));
-        tempRe[i] *= a;
-        tempIm[i] *= a;
-      }
-      //showData("smooth", tempPlanes[0].clone());
-      merge(tempPlanes,2,temp);
-      dft(temp,rMat,DFT_INVERSE);
-      //p = fftw_plan_dft_2d (ysize, xsize, temp, r, FFTW_BACKWARD, FFTW_ESTIMATE);
-      //fftw_execute (p);
-      rMat/= size;
-      split(rMat,rPlanes);
-    }
-
-    for (int i=0; i<size; ++i)
-      orient[i] = atan2 (rIm[i], rRe[i]);
-
-    if (m_vortexDebugTool->m_showOrientation){
-        cv::Mat orm(ysize,xsize,CV_64F,orient);
-        showData("orient", orm.clone());
-    }
-
-
-    for (int i=0; i<size; ++i) {
-      qmap[i] = sqrt (rRe[i]*rRe[i] + rIm[i]*rIm[i]);
-      orient[i] /= (2.*M_PI);  // put in range -.5..5 for unwrap
-    }
-
-    // Unwrap the orientation to get the direction.
-    qg_path_follower_vortex (Size(xsize,ysize), orient, qmap, dir, path);
-    for (int i=0; i<size; ++i)
-     dir[i] = WRAPPI(dir[i]*M_PI);
-
-    // Calculate the quadrature.
-    imPlanes[1] = cv::Mat::zeros(Size(xsize,ysize), CV_64F);
-    double *imIm = (double *)(imPlanes[1].data);
-    for (int i=0; i<size; ++i)
-      imIm[i] = d1Re[i]*cos(-dir[i]) - d1Im[i]*sin(-dir[i]);
-
-      // Display the isolated side lobe.
-    cv::Mat sideLobe;
-    merge(imPlanes,2,sideLobe);
-    shiftDFT(sideLobe);
-    dft(sideLobe,fdomMat);
-    shiftDFT(fdomMat);\
-    if (m_vortexDebugTool->m_showFdom3){
-        showMag(fdomMat, true, "fdom3");
-    }
-    cv::Mat phase(Size(xsize,ysize), CV_64F);
-    double *p = (double *)(phase.data);
-    for (int i=0; i<size; ++i) {
-       p[i] = atan2 (imIm[i], imRe[i]);
-     }
-    // mask to only the mirror portion.
-    phase.copyTo(tmp, m_mask);
-    phase = tmp.clone();
-    if (m_vortexDebugTool->m_showWrapped){
-        cv::Mat tt = phase.clone();
-        cv::normalize(tt,tt,0.f,1.f,CV_MINMAX);
-        cv::imshow(" wrapped ", tt);
-        cv::waitKey(1);
-    }
-    delete[] qmap;
-    delete[] orient;
-    delete[] d1[0];
-    delete[] d1[1];
-    delete[] d2[0];
-    delete[] d2[1];
-    delete[] rho;
-    delete[] theta;
-    delete[] spiralRe;
-    delete[] spiralIm;
-    delete[] dir;
-    delete[] path;
-    return phase;
+    double smooth = .01 * m_vortexDebugTool->m_smooth * input.cols/2.;
+    m_vortex.unwrapper().setQueueMode(Settings2::fastUnwrap() ?
+                                unwrapContext::BUCKET_QUEUE : unwrapContext::EXACT_HEAP);
+    return m_vortex.compute(input, m_mask, low, smooth, m_vortexDebugTool);
 }
 cv::Mat_<double> subtractPlane(cv::Mat_<double> phase, cv::Mat_<bool> mask){
     cv::Mat_<double> coeff(3,1);
@@ -823,12 +357,15 @@ qDebug() << "plane coeffs" << coeff(0) << coeff(1) << coeff(2);
 }
 
 // make a surface from the image using DFT and vortex transfroms.
-void DFTArea::makeSurface(){
+// Returns false if no newWavefront was emitted.
+bool DFTArea::makeSurface(){
     if (!tools->wasPressed)
-        return;
+        return false;
     tools->wasPressed = false;
     igramArea->writeOutlines(igramArea->makeOutlineName());  // save outlines including center filter
     cv::Mat phase = vortex(igramArea->igramImage,  m_center_filter);
+    if (phase.empty())
+        return false;
 
     int wx = phase.rows;
     int wy = wx;
@@ -843,8 +380,11 @@ void DFTArea::makeSurface(){
 
     cv::Mat mask = m_mask.clone();
     mask = (255 - m_mask)/255;
-    unwrap((double *)(phase.data), (double *)(result.data), (char *)(mask.data),
-           phase.size().width, phase.size().height);
+    unwrapContext unwrapper(phase.cols, phase.rows, Settings2::fastUnwrap() ?
+                                unwrapContext::BUCKET_QUEUE : unwrapContext::EXACT_HEAP);
+    if (Settings2::referenceQualityMap())
+        unwrapper.setQualityMode(unwrapContext::QUALITY_REFERENCE);
+    unwrapper.unwrap((double *)(phase.data), (double *)(result.data), (char *)(mask.data));
 
     flip(result,result,0); // flip around x axis.
     m_outside.m_center.ry() = result.rows - m_outside.m_center.y();
@@ -869,7 +409,7 @@ void DFTArea::makeSurface(){
     }
 
     emit newWavefront(result, m_outside, m_center, QFileInfo(igramArea->m_filename).baseName());
-
+    return true;
 }
 void DFTArea::newIgram(QImage){
     doDFT();
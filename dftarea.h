@@ -25,11 +25,10 @@
 #include "dfttools.h"
 #include <QImage>
 #include "vortexdebug.h"
+#include "vortex.h"
+#include "graphicsutilities.h"
 #include <string>
 using namespace cv;
-extern void showData(const string& txt, cv::Mat mat, bool useLog = false);
-extern QImage showMag(cv::Mat complexI, bool show = false, const char *title = "FFT", bool doLog = true, double gamma = 0);
-extern void shiftDFT(cv::Mat &magI);
 namespace Ui {
 class DFTArea;
 }
@@ -59,7 +58,7 @@ public slots:
     void dftSizeVal(int);
     void setChannel(const QString&);
     void dftCenterFilter(double v);
-    void makeSurface();
+    bool makeSurface();
     void newIgram(QImage);
     void gamma(int);
 signals:
@@ -85,6 +84,7 @@ private:
     void mouseReleaseEvent(QMouseEvent *event);
     double m_smooth;
     vortexDebug    *m_vortexDebugTool;
+    vortexEngine m_vortex;
     int m;  // x border added to dft
     int n;  //y border added to dft
     double scale;
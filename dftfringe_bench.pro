@@ -0,0 +1,17 @@
+#-------------------------------------------------
+#
+# dftfringe_bench: compute stage benchmark.
+# Built from the same sources as DFTFringe with benchmain.cpp in place of main.cpp.
+# See benchmain.cpp for the command line.
+#
+#-------------------------------------------------
+
+include(DFTFringe.pro)
+
+TARGET = dftfringe_bench
+CONFIG += console
+
+SOURCES -= main.cpp
+SOURCES += benchmain.cpp
+
+RC_FILE =
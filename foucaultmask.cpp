@@ -0,0 +1,173 @@
+/******************************************************************************
+**
+**  Copyright 2016 Dale Eason
+**  This file is part of DFTFringe
+**  is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation version 3 of the License
+
+** DFTFringe is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with DFTFringe.  If not, see <http://www.gnu.org/licenses/>.
+
+****************************************************************************/
+#include "foucaultmask.h"
+#include "graphicsutilities.h"
+#include <cmath>
+
+// Pixel masks as foucaultView has always drawn them.  Each is the real part of a
+// complex plane.
+static void ronchiMasks(int size, int ppl, bool clearCenter, cv::Mat &grid, cv::Mat &slit){
+    int hx = (size -1)/2;
+    int start = ((double)(size)/2.) -(double)ppl/2.;
+    bool even = ((start / ppl) % 2) == 0;
+    if (clearCenter)
+        even = !even;
+    start = ppl - start % (ppl);
+
+    // every row of the grating is the same
+    cv::Mat row = cv::Mat::zeros(1, size, CV_64F);
+    int roffset = start;
+    int line_no = 0;
+    for (int x = 0; x < size; ++x){
+        if ((even && (line_no%2 == 0)) || (!even && (line_no%2 != 0)))
+            row.at<double>(0,x) = 1;
+        if(++roffset >= ppl)
+        {
+            ++line_no;
+            roffset = 0;
+        }
+    }
+    grid = cv::repeat(row, size, 1);
+
+    slit = cv::Mat::zeros(size, size, CV_64F);
+    for (int x = 0; x < size; ++x){
+        if (x> hx - ppl/2. && x < hx + ppl/2.)
+            slit.col(x).setTo(1);
+    }
+}
+
+static void foucaultMasks(int size, double slitWidthHalf, bool knifeOnLeft, cv::Mat &knife,
+                          cv::Mat &slit){
+    int hx = (size -1)/2;
+    double hy = hx;
+    knife = cv::Mat::zeros(size, size, CV_64F);
+    slit = cv::Mat::zeros(size, size, CV_64F);
+    for (int y = 0; y < size; ++y)
+    {
+        double ry = double(y - hy)/(double)hy;
+        for (int x = 0; x < size; ++x)
+        {
+            double rx = double(x - hx)/(double)hx;
+            double r = sqrt(rx * rx + ry *ry);
+            //slit width is in inches convert to 1/1000 s.
+            if (r <= 1. && (x > hx -slitWidthHalf)  && (x < hx + slitWidthHalf))
+                slit.at<double>(y,x) = 255.;
+
+            int knife_side = x;
+            if (knifeOnLeft)
+                knife_side = size - x;
+            if (knife_side > hx )
+                knife.at<double>(y,x) = 255.;
+        }
+    }
+}
+
+// spectrum of a real mask
+static cv::Mat maskSpectrum(const cv::Mat &mask){
+    cv::Mat planes[] = {mask, cv::Mat::zeros(mask.size(), CV_64F)};
+    cv::Mat complexIn, out;
+    cv::merge(planes, 2, complexIn);
+    cv::dft(complexIn, out, cv::DFT_REAL_OUTPUT);
+    return out;
+}
+
+foucaultMask::foucaultMask(int kind, int size, int ppl, bool clearCenter, double slitWidthHalf,
+                           bool knifeOnLeft):
+    kind(kind), size(size), ppl(ppl), clearCenter(clearCenter), slitWidthHalf(slitWidthHalf),
+    knifeOnLeft(knifeOnLeft)
+{
+    cv::Mat edge, slit;
+    if (kind == RONCHI)
+        ronchiMasks(size, ppl, clearCenter, edge, slit);
+    else
+        foucaultMasks(size, slitWidthHalf, knifeOnLeft, edge, slit);
+
+    cv::Mat FFT1 = maskSpectrum(edge);
+    cv::Mat FFT2 = maskSpectrum(slit);
+    if (kind == RONCHI){
+        shiftDFT(FFT1);
+        shiftDFT(FFT2);
+    }
+    cv::mulSpectrums(FFT1, FFT2, kernel, 0, true);
+    cv::idft(kernel, kernel, cv::DFT_SCALE); // gives us the correlation result...
+    if (kind == RONCHI)
+        shiftDFT(kernel);
+}
+
+size_t foucaultMask::bytes() const
+{
+    return kernel.total() * kernel.elemSize();
+}
+
+bool foucaultMask::matches(int k, int s, int p, bool c, double w, bool l) const
+{
+    return k == kind && s == size && p == ppl && c == clearCenter && w == slitWidthHalf &&
+            l == knifeOnLeft;
+}
+
+foucaultMaskCache *foucaultMaskCache::m_instance = 0;
+foucaultMaskCache *foucaultMaskCache::get_Instance(){
+    if (m_instance == 0){
+        m_instance = new foucaultMaskCache;
+    }
+    return m_instance;
+}
+
+foucaultMaskCache::foucaultMaskCache():
+    m_maxEntries(6), m_hits(0), m_misses(0)
+{
+}
+
+foucaultMaskPtr foucaultMaskCache::ronchi(int size, int ppl, bool clearCenter)
+{
+    return get(foucaultMask::RONCHI, size, ppl, clearCenter, 0., false);
+}
+
+foucaultMaskPtr foucaultMaskCache::foucault(int size, double slitWidthHalf, bool knifeOnLeft)
+{
+    return get(foucaultMask::FOUCAULT, size, 0, false, slitWidthHalf, knifeOnLeft);
+}
+
+// Made while holding the lock like zernikeBasisCache, so renders that miss at the
+// same time make the kernel once.
+foucaultMaskPtr foucaultMaskCache::get(int kind, int size, int ppl, bool clearCenter,
+                                       double slitWidthHalf, bool knifeOnLeft)
+{
+    QMutexLocker lock(&m_lock);
+    for (int i = 0; i < m_entries.size(); ++i){
+        if (m_entries[i]->matches(kind, size, ppl, clearCenter, slitWidthHalf, knifeOnLeft)){
+            ++m_hits;
+            if (i > 0)
+                m_entries.move(i, 0);
+            return m_entries[0];
+        }
+    }
+    ++m_misses;
+    foucaultMaskPtr mask(new foucaultMask(kind, size, ppl, clearCenter, slitWidthHalf,
+                                          knifeOnLeft));
+    m_entries.prepend(mask);
+    while (m_entries.size() > m_maxEntries)
+        m_entries.removeLast();
+    return mask;
+}
+
+void foucaultMaskCache::clear()
+{
+    QMutexLocker lock(&m_lock);
+    m_entries.clear();
+}
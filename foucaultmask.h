@@ -0,0 +1,73 @@
+/******************************************************************************
+**
+**  Copyright 2016 Dale Eason
+**  This file is part of DFTFringe
+**  is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation version 3 of the License
+
+** DFTFringe is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with DFTFringe.  If not, see <http://www.gnu.org/licenses/>.
+
+****************************************************************************/
+#ifndef FOUCAULTMASK_H
+#define FOUCAULTMASK_H
+#include <QMutex>
+#include <QSharedPointer>
+#include <QList>
+#include "opencv/cv.h"
+
+// Correlation of a Ronchi grating or Foucault knife with its source slit, the part of
+// a Foucault view render that does not depend on the surface.  A render multiplies it
+// with the star test spectrum, so each one is made once for a set of mask settings
+// instead of on every render.
+class foucaultMask
+{
+public:
+    enum maskKind { RONCHI, FOUCAULT };
+    int kind;
+    int size;               // fft size
+    int ppl;                // Ronchi grating pixels per line
+    bool clearCenter;       // Ronchi line or space on the center
+    double slitWidthHalf;   // Foucault slit half width in pixels
+    bool knifeOnLeft;
+
+    cv::Mat kernel;         // 2 channel
+
+    foucaultMask(int kind, int size, int ppl, bool clearCenter, double slitWidthHalf,
+                 bool knifeOnLeft);
+    size_t bytes() const;
+    bool matches(int kind, int size, int ppl, bool clearCenter, double slitWidthHalf,
+                 bool knifeOnLeft) const;
+};
+typedef QSharedPointer<const foucaultMask> foucaultMaskPtr;
+
+// Process wide cache of foucaultMask kernels keyed on the mask settings.  The least
+// recently used are dropped beyond a fixed count.  Safe to use from several threads.
+class foucaultMaskCache
+{
+public:
+    static foucaultMaskCache *get_Instance();
+    foucaultMaskPtr ronchi(int size, int ppl, bool clearCenter);
+    foucaultMaskPtr foucault(int size, double slitWidthHalf, bool knifeOnLeft);
+    int hits() const { return m_hits; }
+    int misses() const { return m_misses; }
+    void clear();
+private:
+    foucaultMaskCache();
+    static foucaultMaskCache *m_instance;
+    foucaultMaskPtr get(int kind, int size, int ppl, bool clearCenter, double slitWidthHalf,
+                        bool knifeOnLeft);
+    QMutex m_lock;
+    QList<foucaultMaskPtr> m_entries;     // most recently used first
+    int m_maxEntries;
+    int m_hits;
+    int m_misses;
+};
+
+#endif // FOUCAULTMASK_H
@@ -7,11 +7,17 @@
 #include <QVector>
 #include <QMenu>
 #include "zernikeprocess.h"
+#include "foucaultmask.h"
+#include "graphicsutilities.h"
+#include <QRunnable>
+#include <QDir>
+#include <QFileDialog>
 foucaultView *foucaultView::m_instance = 0;
 
 foucaultView::foucaultView(QWidget *parent, SurfaceManager *sm) :
     QWidget(parent),m_sm(sm),
-    ui(new Ui::foucaultView), heightMultiply(1)
+    ui(new Ui::foucaultView), heightMultiply(1), m_scanGeneration(0), m_scanNext(0),
+    m_exportFrames(0), m_exportDone(0)
 {
     m_wf = 0;
     needsDrawing = false;
@@ -20,6 +26,7 @@ foucaultView::foucaultView(QWidget *parent, SurfaceManager *sm) :
     ui->lpiSb->setValue(set.value("ronchiLPI", 100).toDouble());
     connect(&m_guiTimer, SIGNAL(timeout()), this, SLOT(on_makePb_clicked()));
     ui->rocOffsetSb->setSuffix(" inch");
+    m_pool = new QThreadPool(this);
 
 }
 foucaultView *foucaultView::get_Instance(SurfaceManager *sm){
@@ -31,6 +38,11 @@ foucaultView *foucaultView::get_Instance(SurfaceManager *sm){
 
 foucaultView::~foucaultView()
 {
+    if (m_scan)
+        m_scan->cancelled.store(1);
+    if (m_export)
+        m_export->cancelled.store(1);
+    m_pool->waitForDone();
     delete ui;
 }
 void foucaultView::setSurface(wavefront *wf){
@@ -44,16 +56,12 @@ void foucaultView::setSurface(wavefront *wf){
     needsDrawing = true;
 }
 
-void foucaultView::on_makePb_clicked()
+// Request for the current settings and surface.
+foucaultRequestPtr foucaultView::makeRequest()
 {
-    m_guiTimer.stop();
-    if (m_wf == 0 ||( m_wf->data.cols == 0))
-        return;
-    if (mirrorDlg::get_Instance()->isEllipse()){
-        QMessageBox::warning(0,"warning","Foucaualt is not suppported for flat surfaces");
-        return;
-    }
-    QApplication::setOverrideCursor(Qt::WaitCursor);
+    foucaultRequestPtr req(new foucaultRequest);
+    req->generation = 0;
+    req->cancelled.store(0);
 
     double pad = 1.1;
     int size = m_wf->data.cols * pad;
@@ -61,65 +69,32 @@ void foucaultView::on_makePb_clicked()
     size *= 2;
 
     pad = (double)size/m_wf->data.cols;
-    double moving_constant = (ui->movingSourceRb->isChecked()) ? 1. : 2.;
+    req->size = size;
+    req->pad = pad;
+    req->movingConstant = (ui->movingSourceRb->isChecked()) ? 1. : 2.;
+    req->heightMultiply = heightMultiply;
 
-    double gamma =     ui->gammaSb->value();
+    req->gamma =     ui->gammaSb->value();
     mirrorDlg *md = mirrorDlg::get_Instance();
     double Radius = md->diameter/2.;
-    double r2 = Radius * Radius;
-    double fl = md->roc / 2.;
+    req->r2 = Radius * Radius;
+    req->fl = md->roc / 2.;
     double Fnumber =  .5 * md->roc/md->diameter;	//ROC is twice FL
-    double unitMultiplyer = 1.;
+    req->unitMultiplyer = 1.;
     if (!ui->useMM->isChecked()){
-        unitMultiplyer = 25.4;
+        req->unitMultiplyer = 25.4;
     }
 
-
-    double coc_offset_mm = ui->rocOffsetSb->value() * unitMultiplyer;
-
-    double b = (fl * 2) + coc_offset_mm;
-    double pv =   ( sqrt((r2)+(fl * fl * 4.))
-         - (sqrt(r2+ b * b) - coc_offset_mm) )/ (550 * 1.E-6);
-
-    std::vector<double> zerns = m_wf->InputZerns;
-    std::vector<double> newZerns = zerns;
-    double z3 = pv / ( moving_constant);
-
-
-//qDebug() << "Z3" << z3 << "z{3]" << newZerns[3] << "pv" << pv << "coc_Offset_mm" << coc_offset_mm;
-    bool oldDoNull = md->doNull;
-    md->doNull = false;
-
-    cv::Mat surf_fft;
-    SimulationsView *sv = SimulationsView::getInstance(0);
+    // the render does not use the SA null, turning it off on this copy does what
+    // clearing mirrorDlg::doNull around the render did without touching the setting
+    req->wf = *m_wf;
+    req->wf.useSANull = false;
+    std::vector<double> &newZerns = req->wf.InputZerns;
     newZerns[3] = newZerns[3] - 3 * newZerns[8];
-    m_wf->InputZerns = newZerns;
-    sv->setSurface(m_wf);
-//qDebug() << "size "<< size << "pad" << pad;
-
-    surf_fft = sv->computeStarTest(heightMultiply * sv->nulledSurface(z3), size, pad ,true);
-    //showMag(surf_fft, true, "star ", true, gamma);
-    size = surf_fft.cols;
-
-    int hx = (size -1)/2;
-    m_wf->InputZerns = zerns;
-
-    md->doNull = oldDoNull;
-
-    double hy = hx;
-
-    cv::Mat vknife[] = {cv::Mat::zeros(size,size,CV_64F)
-                        ,cv::Mat::zeros(Size(size,size),CV_64F)};
-
-    cv::Mat ronchiGrid[] = {cv::Mat::zeros(size,size,CV_64F)
-                            ,cv::Mat::zeros(Size(size,size),CV_64F)};
-
-    cv::Mat slit[] = {cv::Mat::zeros(size,size,CV_64F)
-                   ,cv::Mat::zeros(Size(size,size),CV_64F)};
-
-
-    cv::Mat ronchiSlit[] = {cv::Mat::zeros(size,size,CV_64F)
-                   ,cv::Mat::zeros(Size(size,size),CV_64F)};
+    req->enables = zernEnables;
+    QSettings settings;
+    req->blur = settings.value("GBlur", true).toBool();
+    req->blurSize = settings.value("GBValue", 21).toInt();
 
     // compute real world pixel width.
     double pixwidth =  550.E-6* Fnumber * 2./(25.4 * pad);
@@ -131,126 +106,88 @@ void foucaultView::on_makePb_clicked()
     if (ppl <= 0)
         ppl = 1;
 
-    int start = ((double)(size)/2.) -(double)ppl/2.;
-    bool even = ((start / ppl) % 2) == 0;
-
-    if (ui->clearCenterCb->isChecked())
-        even = !even;
-
-    start = ppl - start % (ppl);// + ui->lateralKnifeSb->value() * unitMultiplyer;
-
     double pixels_per_thou = .001 / pixwidth;
     double slitWidthHalf = pixels_per_thou * ui->slitWidthSb->value() * 1000 * ((ui->useMM->isChecked()) ? 1./25.4 : 1.);
-    // compute offset so that line is at center
-    for (int y = 0; y < size; ++y)
-    {
-        double ry = double(y - hy)/(double)hy;
-        int roffset = start;
-        int line_no = 0;
-        for (int x = 0; x < size; ++x)
-        {
-            double rx = double(x - hx)/(double)hx;
-            double r = sqrt(rx * rx + ry *ry);
-
-                // foucault setup
-                if (r <= 1.)
-                {
-                    //slit width is in inches convert to 1/1000 s.
-                    if ((x > hx -slitWidthHalf)  && (x < hx + slitWidthHalf))
-                    {
-                        slit[0].at<double>(y,x) = 255.;
-                    }
-                }
-
-                int knife_side = x;
-                if (ui->knifeOnLeftCb->isChecked())
-                    knife_side = size - x;
-
-                if (knife_side > hx )
-                {
-                    vknife[0].at<double>(y,x) = 255.;
-                }
-
-
-                // ronchi setup
-                if ((even && (line_no%2 == 0)) || (!even && (line_no%2 != 0)))
-                {
-                    ronchiGrid[0].at<double>(y,x) = 1;
-                }
-                if(++roffset >= ppl)
-                {
-                    ++line_no;
-                    roffset = 0;
-                }
-
-
-                if (x> hx - ppl/2. && x < hx + ppl/2.)
-                {
-                    ronchiSlit[0].at<double>(y,x) = 1;
-                }
-
-            }
-        }
-
-    Mat FFT1, FFT2;
-    //fftw_plan p;
-    cv::Mat complexIn;
-    cv::Mat complexIn2;
-
-    merge(ronchiGrid, 2, complexIn);
-    merge(ronchiSlit,2,complexIn2);
-
-    //showData("grid", ronchiGrid[0]);
-    //showData("rslit", ronchiSlit[0]);
-
-
-    dft(complexIn, FFT1, DFT_REAL_OUTPUT);
-    shiftDFT(FFT1);
-    dft(complexIn2, FFT2, DFT_REAL_OUTPUT);
-    shiftDFT(FFT2);
-    cv::Mat knifeSlit;
-    mulSpectrums(FFT1, FFT2, knifeSlit, 0, true);
-    idft(knifeSlit, knifeSlit, DFT_SCALE); // gives us the correlation result...
-    shiftDFT(knifeSlit);
-    cv::Mat knifeSurf;
 
-    mulSpectrums(knifeSlit, surf_fft, knifeSurf,0,true);
-    idft(knifeSurf, knifeSurf, DFT_SCALE);
-    shiftDFT(knifeSurf);
-
-    QImage ronchi = showMag(knifeSurf, false,"", false, gamma);
-    int startx = size - m_wf->data.cols;
-    ronchi = ronchi.copy(startx,startx,m_wf->data.cols, m_wf->data.cols);
-
-    ronchi = ronchi.mirrored(true,false);
-    QSize s = ui->ronchiViewLb->size();
-    ui->ronchiViewLb->setPixmap(QPixmap::fromImage(ronchi.scaledToWidth(s.width())));
+    // the grating and knife only change with their settings so their correlations
+    // with the slit come from the cache
+    foucaultMaskCache &masks = *foucaultMaskCache::get_Instance();
+    req->ronchiMask = masks.ronchi(size, ppl, ui->clearCenterCb->isChecked());
+    req->knifeMask = masks.foucault(size, slitWidthHalf, ui->knifeOnLeftCb->isChecked());
+    return req;
+}
 
-    merge(vknife, 2, complexIn);
-    merge(slit,2,complexIn2);
+// showMag without the highgui calls so it can run on the scan workers.
+static QImage magImage(const cv::Mat &complexI, double gamma){
+    Mat planes[2];
+    split(complexI, planes);
+    magnitude(planes[0], planes[1], planes[0]);
+    Mat  magI = planes[0];
+    double mmin;
+    double mmax;
+    minMaxIdx(magI, &mmin,&mmax);
+    magI-= mmin;
+    if (gamma != 0.){
+        cv::pow(magI,gamma,magI);
+    }
+    normalize(magI, magI,0,255,CV_MINMAX, CV_8U);
+    cvtColor(magI,magI, CV_GRAY2RGB);
+    return QImage((uchar*)magI.data, magI.cols, magI.rows, magI.step, QImage::Format_RGB888).copy();
+}
 
+void foucaultView::render(foucaultRequest &req, double rocOffset, QImage &ronchi,
+                          QImage &foucault)
+{
+    double coc_offset_mm = rocOffset * req.unitMultiplyer;
 
-    dft(complexIn, FFT1, DFT_REAL_OUTPUT);
-    dft(complexIn2, FFT2, DFT_REAL_OUTPUT);
+    double b = (req.fl * 2) + coc_offset_mm;
+    double pv =   ( sqrt((req.r2)+(req.fl * req.fl * 4.))
+         - (sqrt(req.r2+ b * b) - coc_offset_mm) )/ (550 * 1.E-6);
 
-    mulSpectrums(FFT1, FFT2, knifeSlit, 0, true);
-    idft(knifeSlit, knifeSlit, DFT_SCALE); // gives us the correlation result...
+    double z3 = pv / ( req.movingConstant);
 
+    cv::Mat surface = req.heightMultiply *
+            SimulationsView::nulledSurface(req.wf, req.enables, z3, req.blur, req.blurSize);
+    cv::Mat surf_fft = SimulationsView::starTest(surface, req.wf.workMask, req.size, req.pad,
+                                                 true);
+    int size = surf_fft.cols;
+    int cols = req.wf.data.cols;
+    int startx = size - cols;
 
-    mulSpectrums(knifeSlit, surf_fft, knifeSurf,0,true);
+    cv::Mat knifeSurf;
+    mulSpectrums(req.ronchiMask->kernel, surf_fft, knifeSurf,0,true);
     idft(knifeSurf, knifeSurf, DFT_SCALE);
+    shiftDFT(knifeSurf);
+    ronchi = magImage(knifeSurf, req.gamma).copy(startx,startx,cols, cols).mirrored(true,false);
 
-    QImage foucault = showMag(knifeSurf, false,"", false, gamma);
-    startx = size - m_wf->data.cols;
-    foucault = foucault.copy(startx,startx,m_wf->data.cols, m_wf->data.cols);
-
-
+    mulSpectrums(req.knifeMask->kernel, surf_fft, knifeSurf,0,true);
+    idft(knifeSurf, knifeSurf, DFT_SCALE);
+    foucault = magImage(knifeSurf, req.gamma).copy(startx,startx,cols, cols).mirrored(true, false);
+}
 
-    foucault = foucault.mirrored(true, false);
+void foucaultView::showImages(const QImage &ronchi, const QImage &foucault)
+{
+    QSize s = ui->ronchiViewLb->size();
+    ui->ronchiViewLb->setPixmap(QPixmap::fromImage(ronchi.scaledToWidth(s.width())));
     s = ui->foucaultViewLb->size();
     ui->foucaultViewLb->setPixmap(QPixmap::fromImage(foucault.scaledToWidth(s.width())));
+}
 
+void foucaultView::on_makePb_clicked()
+{
+    m_guiTimer.stop();
+    if (m_wf == 0 ||( m_wf->data.cols == 0))
+        return;
+    if (mirrorDlg::get_Instance()->isEllipse()){
+        QMessageBox::warning(0,"warning","Foucaualt is not suppported for flat surfaces");
+        return;
+    }
+    QApplication::setOverrideCursor(Qt::WaitCursor);
 
+    foucaultRequestPtr req = makeRequest();
+    QImage ronchi, foucault;
+    render(*req, ui->rocOffsetSb->value(), ronchi, foucault);
+    showImages(ronchi, foucault);
 
     QApplication::restoreOverrideCursor();
 }
@@ -326,15 +263,152 @@ void foucaultView::on_useMM_clicked(bool checked)
     m_guiTimer.start(500);
 }
 
-void foucaultView::on_scanPb_clicked()
+// Renders one frame of a scan on the view's pool.  Frames do not depend on each other
+// so all of them run at once, each is saved if there is a directory and handed to the
+// view, which shows them in order.  Frames of an export are only saved.
+class foucaultScanJob : public QRunnable
 {
+public:
+    foucaultScanJob(foucaultView *view, foucaultRequestPtr req, int index, double offset,
+                    const QString &dir, bool show = true) :
+        m_view(view), m_req(req), m_index(index), m_offset(offset), m_dir(dir), m_show(show)
+    { setAutoDelete(true); }
+    void run();
+private:
+    foucaultView *m_view;
+    foucaultRequestPtr m_req;
+    int m_index;
+    double m_offset;
+    QString m_dir;
+    bool m_show;
+};
+
+void foucaultScanJob::run(){
+    if (m_req->cancelled.load())
+        return;
+    QImage ronchi, foucault;
+    foucaultView::render(*m_req, m_offset, ronchi, foucault);
+    if (m_req->cancelled.load())
+        return;
+    if (!m_dir.isEmpty()){
+        QString num = QString("%1.png").arg(m_index + 1, 3, 10, QChar('0'));
+        ronchi.save(m_dir + "/ronchi_" + num);
+        foucault.save(m_dir + "/foucault_" + num);
+    }
+    if (m_show)
+        QMetaObject::invokeMethod(m_view, "scanFrameDone", Qt::QueuedConnection,
+                                  Q_ARG(int, m_req->generation), Q_ARG(int, m_index),
+                                  Q_ARG(QImage, ronchi), Q_ARG(QImage, foucault));
+    else
+        QMetaObject::invokeMethod(m_view, "exportFrameDone", Qt::QueuedConnection,
+                                  Q_ARG(int, m_req->generation));
+}
 
+QVector<double> foucaultView::scanOffsets()
+{
     double steps = ui->scanSteps->value();
     double start = ui->scanStart->value();
     double end = ui->scanEndOffset->value();
     double step = (end - start)/steps;
-    for (double v = start; v <= end ; v += step){
+    QVector<double> offsets;
+    for (double v = start; v <= end ; v += step)
+        offsets << v;
+    return offsets;
+}
+
+int foucaultView::exportScan(const QString &dir)
+{
+    if (m_wf == 0 ||( m_wf->data.cols == 0) || mirrorDlg::get_Instance()->isEllipse())
+        return 0;
+    if (!QDir().mkpath(dir))
+        return 0;
+    cancelExport();
+    QVector<double> offsets = scanOffsets();
+    if (offsets.isEmpty())
+        return 0;
+    m_export = makeRequest();
+    m_export->generation = ++m_scanGeneration;
+    m_exportDir = dir;
+    m_exportFrames = offsets.size();
+    m_exportDone = 0;
+    for (int i = 0; i < offsets.size(); ++i)
+        m_pool->start(new foucaultScanJob(this, m_export, i, offsets[i], dir, false));
+    return offsets.size();
+}
+
+void foucaultView::cancelExport()
+{
+    if (m_export)
+        m_export->cancelled.store(1);
+    m_export.clear();
+}
+
+void foucaultView::exportFrameDone(int generation)
+{
+    if (!m_export || generation != m_export->generation)
+        return;
+    if (++m_exportDone < m_exportFrames)
+        return;
+    m_export.clear();
+    emit scanExported(QString("Saved %1 Ronchi and Foucault frames to %2").arg(m_exportFrames)
+                      .arg(m_exportDir));
+}
 
+void foucaultView::stopScan()
+{
+    if (m_scan)
+        m_scan->cancelled.store(1);
+    m_scan.clear();
+    m_scanFrames.clear();
+    ui->scanPb->setText("Scan");
+}
+
+void foucaultView::on_scanPb_clicked()
+{
+    // pressed again while scanning it stops the scan
+    if (m_scan){
+        stopScan();
+        return;
+    }
+    if (m_wf == 0 ||( m_wf->data.cols == 0))
+        return;
+    if (mirrorDlg::get_Instance()->isEllipse()){
+        QMessageBox::warning(0,"warning","Foucaualt is not suppported for flat surfaces");
+        return;
+    }
+    QString dir;
+    if (ui->saveScanCb->isChecked()){
+        dir = QFileDialog::getExistingDirectory(0, tr("Save scan frames to"),
+                                                mirrorDlg::getProjectPath());
+        if (dir.isEmpty())
+            return;
+    }
+
+    m_guiTimer.stop();
+    m_scan = makeRequest();
+    m_scan->generation = ++m_scanGeneration;
+    m_scanOffsets = scanOffsets();
+    m_scanFrames.clear();
+    m_scanNext = 0;
+    if (m_scanOffsets.isEmpty()){
+        m_scan.clear();
+        return;
+    }
+    ui->scanPb->setText("Stop");
+    for (int i = 0; i < m_scanOffsets.size(); ++i)
+        m_pool->start(new foucaultScanJob(this, m_scan, i, m_scanOffsets[i], dir));
+}
+
+void foucaultView::scanFrameDone(int generation, int index, QImage ronchi, QImage foucault)
+{
+    if (!m_scan || generation != m_scan->generation)
+        return;
+    m_scanFrames.insert(index, qMakePair(ronchi, foucault));
+
+    // frames finish in any order, show the ones that are next
+    while (m_scanFrames.contains(m_scanNext)){
+        QPair<QImage, QImage> frame = m_scanFrames.take(m_scanNext);
+        double v = m_scanOffsets[m_scanNext];
         ui->rocOffsetSb->setValue(v);
         double st = (ui->useMM->isChecked()) ? 24.5 * m_sag/40 : m_sag/40;
 
@@ -342,11 +416,11 @@ void foucaultView::on_scanPb_clicked()
         ui->rocOffsetSlider->blockSignals(true);
         ui->rocOffsetSlider->setValue(pos);
         ui->rocOffsetSlider->blockSignals(false);
-        on_makePb_clicked();
-
-        qApp->processEvents();
-
+        showImages(frame.first, frame.second);
+        ++m_scanNext;
     }
+    if (m_scanNext == m_scanOffsets.size())
+        stopScan();
 }
 
 void foucaultView::on_h1x_clicked()
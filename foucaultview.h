@@ -4,10 +4,41 @@
 #include <QWidget>
 #include "surfacemanager.h"
 #include <QTimer>
+#include <QThreadPool>
+#include <QSharedPointer>
+#include <QAtomicInt>
+#include <QImage>
+#include <QMap>
+#include <QPair>
+#include <QVector>
+#include "foucaultmask.h"
 namespace Ui {
 class foucaultView;
 }
 
+// Inputs of a Foucault and Ronchi render except the ROC offset.  Made on the GUI thread
+// so the frames of a scan can be rendered on workers.
+struct foucaultRequest
+{
+    int generation;
+    QAtomicInt cancelled;           // set when a newer scan replaces this one
+    wavefront wf;                   // with the zernikes and null a render uses
+    std::vector<bool> enables;
+    bool blur;
+    int blurSize;
+    int size;                       // fft size
+    double pad;
+    double movingConstant;
+    int heightMultiply;
+    double r2;                      // mirror radius squared, mm
+    double fl;                      // focal length, mm
+    double unitMultiplyer;          // mm per ROC offset unit
+    double gamma;
+    foucaultMaskPtr ronchiMask;
+    foucaultMaskPtr knifeMask;
+};
+typedef QSharedPointer<foucaultRequest> foucaultRequestPtr;
+
 class foucaultView : public QWidget
 {
     Q_OBJECT
@@ -19,9 +50,21 @@ public:
     ~foucaultView();
     void setSurface(wavefront * wf);
     bool needsDrawing;
+    // Ronchi and Foucault images of req at one ROC offset, in the units of the offset
+    // spin box, at the full wavefront resolution.  Safe on any thread.
+    static void render(foucaultRequest &req, double rocOffset, QImage &ronchi, QImage &foucault);
+    // Render the scan set in the view to numbered PNG files in dir on the view's pool
+    // without showing them.  A running export is cancelled first.  Returns the number
+    // of frames started, scanExported is emitted when they are all written.
+    int exportScan(const QString &dir);
+    void cancelExport();
+signals:
+    void scanExported(QString message);
 public slots:
     void on_makePb_clicked();
 private slots:
+    void scanFrameDone(int generation, int index, QImage ronchi, QImage foucault);
+    void exportFrameDone(int generation);
 
     void on_gammaSb_valueChanged(double arg1);
 
@@ -66,6 +109,20 @@ private:
     int heightMultiply;
     double m_sag;
     wavefront *m_wf;
+    QThreadPool *m_pool;
+    foucaultRequestPtr m_scan;      // the scan being shown
+    int m_scanGeneration;
+    QVector<double> m_scanOffsets;
+    QMap<int, QPair<QImage, QImage> > m_scanFrames;    // done ahead of their turn
+    int m_scanNext;                 // next frame to show
+    foucaultRequestPtr m_export;    // the scan being exported
+    QString m_exportDir;
+    int m_exportFrames;
+    int m_exportDone;
+    foucaultRequestPtr makeRequest();
+    QVector<double> scanOffsets();
+    void showImages(const QImage &ronchi, const QImage &foucault);
+    void stopScan();
 };
 
 #endif // FOUCAULTVIEW_H
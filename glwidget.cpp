@@ -20,13 +20,28 @@
 //#include <cmath>
 #include "qwt_math.h"
 #include "circleoutline.h"
-#include <gl/glu.h>
+#include <GL/glu.h>
 #include <qsettings.h>
 #include <QOpenGLFunctions>
 #include <QFont>
 #include <QFontMetricsF>
 #define STEPS 200
 #define SHADE_STEPS 200
+#define COLOR_LUT_SIZE 1024
+
+// GL 1.2 names missing from the windows gl.h
+#ifndef GL_CLAMP_TO_EDGE
+#define GL_CLAMP_TO_EDGE 0x812F
+#endif
+#ifndef GL_LIGHT_MODEL_COLOR_CONTROL
+#define GL_LIGHT_MODEL_COLOR_CONTROL 0x81F8
+#endif
+#ifndef GL_SINGLE_COLOR
+#define GL_SINGLE_COLOR 0x81F9
+#endif
+#ifndef GL_SEPARATE_SPECULAR_COLOR
+#define GL_SEPARATE_SPECULAR_COLOR 0x81FA
+#endif
 
 GLWidget::GLWidget(QWidget *parent, ContourTools* tools, surfaceAnalysisTools* surfTools )
     : QGLWidget(parent), m_tools(tools),m_surfTools(surfTools),m_red(100),m_green(100),m_blue(100),
@@ -41,7 +56,13 @@ GLWidget::GLWidget(QWidget *parent, ContourTools* tools, surfaceAnalysisTools* s
       m_BackWall_Scale(.125),
       m_ortho(false),
       m_flip_y_view(false),
-      m_flip_x_view(false)
+      m_flip_x_view(false),
+      m_vertexBuffer(QGLBuffer::VertexBuffer),
+      m_indexBuffer(QGLBuffer::IndexBuffer),
+      m_useBuffers(false),
+      m_mesh_dirty(true),
+      m_colorTexture(0),
+      m_colors_dirty(true)
 {
     QSettings set;
     m_background = QColor(set.value("oglBackground", "black").toString());
@@ -93,6 +114,12 @@ GLWidget::GLWidget(QWidget *parent, ContourTools* tools, surfaceAnalysisTools* s
 GLWidget::~GLWidget()
 {
     makeCurrent();
+    if (m_vertexBuffer.isCreated())
+        m_vertexBuffer.destroy();
+    if (m_indexBuffer.isCreated())
+        m_indexBuffer.destroy();
+    if (m_colorTexture)
+        glDeleteTextures(1, &m_colorTexture);
 }
 
 void GLWidget::setBackground(QColor c){
@@ -240,6 +267,7 @@ void GLWidget::paintGL()
     glRotatef (yRot/16.f, 0.0f, 1.0f, 0.0f );
     glRotatef (zRot/16.f, 0.0f, 0.0f, 1.0f );
     SetLight();
+    drawMesh();
     glCallList(1);
 
     //glRotatef (35.f, 1.0f, .0f, 0.0f );
@@ -411,95 +439,11 @@ void GLWidget::DrawScene()
     //====== Create the new list of OpenGL commands
     if (m_list_good)
         return;
+    //====== The surface itself is drawn by drawMesh, the list has the axes and profiles
     glNewList(1, GL_COMPILE);
-    glShadeModel(GL_SMOOTH);
-    glDepthFunc(GL_LESS);
     glEnable(GL_DEPTH_TEST);
     glEnable(GL_COLOR_MATERIAL);
-    glMatrixMode (GL_PROJECTION);
-    //====== Set the polygon filling mode
-    if (m_FillMode == GL_LINE)
-    {
-
-        glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
-    }
-    else
-    {
-        glPolygonMode(GL_FRONT_AND_BACK, m_FillMode);
-    }
-    glEnable(GL_NORMALIZE);
-    glShadeModel(GL_SMOOTH);
-
-    //====== Turn on the primitive connection mode (not connected)
-    glLineWidth(1.0);
-    glBegin (GL_QUADS);
-    double minr,maxr;
-    minr = m_min_y;
-    maxr = m_max_y;
-    for (UINT n = 0; n < m_quads.size(); ++n)
-    {
-        //====== Turn on the primitive connection mode (connected)
-        //====== The strip of connected quads begins here
-        double
-            xi = m_quads[n].i.x(),
-            zi = m_quads[n].i.y(),
-            yi = m_Vscale * m_quads[n].i.z(),
-
-            xj = m_quads[n].j.x(),
-            zj = m_quads[n].j.y(),
-            yj = m_Vscale * m_quads[n].j.z(),
-
-            xk = m_quads[n].k.x(),
-            zk = m_quads[n].k.y(),
-            yk = m_Vscale * m_quads[n].k.z(),
-
-            xn = m_quads[n].n.x(),
-            zn = m_quads[n].n.y(),
-            yn = m_Vscale * m_quads[n].n.z();
-
-            if (!m_flip_y_view)
-            {
-                zi = -zi;
-                zj = -zj;
-                zk = - zk;
-                zn = -zn;
-            }
-            if (m_flip_x_view)
-            {
-                xi = -xi;
-                xj = - xj;
-                xk = -xk;
-                xn = -xn;
-            }
-            QVector3D norm = normal(QVector3D(xk,yk,zk), QVector3D(xj,yj,zj), QVector3D(xi,yi,zi));
-
-
-                //====== Set the normal vector
-                // y is inverted on windows screens
-            glNormal3f (norm.x(), norm.y(), norm.z());
-
-            //====== Vertices are given in counter clockwise direction order
-            QColor c = m_colorMap->color(QwtInterval(minr,maxr),yi/m_Vscale);
-
-            glColor3f(c.redF(),c.greenF(),c.blueF());
-            glVertex3f (xi, yi, zi);
-
-            //glNormal3f(norm2.x, norm2.y, norm2.z);
-            c = m_colorMap->color(QwtInterval(minr,maxr),yj/m_Vscale);
-            glColor3f(c.redF(),c.greenF(),c.blueF());
-            glVertex3f (xj, yj, zj);
-
-            //glNormal3f(norm3.x, norm3.y, norm3.z);
-            c = m_colorMap->color(QwtInterval(minr,maxr),yk/m_Vscale);
-            glColor3f(c.redF(),c.greenF(),c.blueF());
-            glVertex3f (xk, yk, zk);
-
-            //glNormal3f(norm4.x, norm4.y, norm4.z);
-            c = m_colorMap->color(QwtInterval(minr,maxr),yn/m_Vscale);
-            glColor3f(c.redF(),c.greenF(),c.blueF());
-            glVertex3f (xn, yn, zn);
-        }
-    glEnd();
+    glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
 
     glPushMatrix();
 
@@ -674,38 +618,80 @@ void GLWidget::make_surface_from_doubles()
     if (step < 1)
         step = 1;
 
-    m_quads.clear();
-
     int h = resized.rows;
     int w = resized.cols;
     double xy_scale = 2.d * RADIUS/std::max(h,w);
 
-
-    // make the quads
+    // one vertex per grid point inside the mask, shared by the quads around it
     double dhalfx = ((double)w-1)/2.;
     double dhalfy = (double)(h-1)/2.;
-    for (int x = 0; x < w-step; x+=step)
-    {
-        for (int y = 0; y < h-step; y+=step)
-        {
-
-            int nx = x  - dhalfx;
-            int ny = y - dhalfy;
+    int gw = (w - 1)/step + 1;
+    int gh = (h - 1)/step + 1;
+    std::vector<GLuint> vndx(gw * gh, (GLuint)-1);
+    m_vertices.clear();
+    m_indices.clear();
+    for (int gy = 0; gy < gh; ++gy){
+        int y = gy * step;
+        for (int gx = 0; gx < gw; ++gx){
+            int x = gx * step;
+            if (rMask(y,x) == 0)
+                continue;
+            vndx[gy * gw + gx] = m_vertices.size()/6;
+            m_vertices.push_back((x - dhalfx) * xy_scale);
+            m_vertices.push_back(resized.at<double>(y,x));
+            m_vertices.push_back((y - dhalfy) * xy_scale);
+            m_vertices.push_back(0.f);
+            m_vertices.push_back(1.f);
+            m_vertices.push_back(0.f);
+        }
+    }
 
-            // ignore masked values.
-            int b = (int)rMask(y,x) & (int)rMask(y+step,x) & (int)rMask(y+step,x+step) &
-                    rMask(y,x+step);
+    // quads with all four corners inside the mask, same corner order as before
+    for (int gx = 0; gx < gw - 1; ++gx){
+        for (int gy = 0; gy < gh - 1; ++gy){
+            GLuint p1 = vndx[gy * gw + gx];
+            GLuint p2 = vndx[(gy + 1) * gw + gx];
+            GLuint p3 = vndx[(gy + 1) * gw + gx + 1];
+            GLuint p4 = vndx[gy * gw + gx + 1];
+            if (p1 == (GLuint)-1 || p2 == (GLuint)-1 || p3 == (GLuint)-1 || p4 == (GLuint)-1)
+                continue;
+            m_indices.push_back(p1);
+            m_indices.push_back(p2);
+            m_indices.push_back(p3);
+            m_indices.push_back(p4);
+        }
+    }
 
-            if (b != 0){
-                int yy = y;
-                QVector3D p1(nx * xy_scale, ny * xy_scale,resized.at<double>(yy,x));
-                QVector3D p2(nx * xy_scale, (ny+step) * xy_scale, resized.at<double>(yy+step,x));
-                QVector3D p3((nx+step)*xy_scale, (ny+step)*xy_scale, resized.at<double>(yy+step,x+step));
-                QVector3D p4((nx+step)*xy_scale, ny * xy_scale, resized.at<double>(yy,x+step));
-                m_quads.push_back(CQuad(p1,p2,p3,p4));
-            }
+    // per vertex normals of the unscaled height field from the neighbouring grid points.
+    // The height magnification is applied by the modelview matrix and GL transforms
+    // the normals with it.
+    for (int gy = 0; gy < gh; ++gy){
+        for (int gx = 0; gx < gw; ++gx){
+            GLuint c = vndx[gy * gw + gx];
+            if (c == (GLuint)-1)
+                continue;
+            GLuint l = (gx > 0) ? vndx[gy * gw + gx - 1] : (GLuint)-1;
+            GLuint r = (gx < gw - 1) ? vndx[gy * gw + gx + 1] : (GLuint)-1;
+            GLuint u = (gy > 0) ? vndx[(gy - 1) * gw + gx] : (GLuint)-1;
+            GLuint d = (gy < gh - 1) ? vndx[(gy + 1) * gw + gx] : (GLuint)-1;
+            if (l == (GLuint)-1) l = c;
+            if (r == (GLuint)-1) r = c;
+            if (u == (GLuint)-1) u = c;
+            if (d == (GLuint)-1) d = c;
+            double dhdx = 0., dhdy = 0.;
+            if (r != l)
+                dhdx = (m_vertices[6 * r + 1] - m_vertices[6 * l + 1]) /
+                        (m_vertices[6 * r] - m_vertices[6 * l]);
+            if (d != u)
+                dhdy = (m_vertices[6 * d + 1] - m_vertices[6 * u + 1]) /
+                        (m_vertices[6 * d + 2] - m_vertices[6 * u + 2]);
+            double len = sqrt(dhdx * dhdx + 1. + dhdy * dhdy);
+            m_vertices[6 * c + 3] = -dhdx/len;
+            m_vertices[6 * c + 4] = 1./len;
+            m_vertices[6 * c + 5] = -dhdy/len;
         }
     }
+    m_mesh_dirty = true;
 
 
     if (m_draw_profiles_on_3d)
@@ -755,6 +741,124 @@ void GLWidget::make_surface_from_doubles()
     m_dirty_surface = false;
 }
 
+// Copy the mesh to the GL buffers.  Needs the GL context so it is done from
+// paintGL.  Without buffer object support the mesh is drawn from the vectors.
+void GLWidget::uploadMesh()
+{
+    if (!m_vertexBuffer.isCreated())
+        m_useBuffers = m_vertexBuffer.create() && m_indexBuffer.create();
+
+    if (m_useBuffers){
+        m_vertexBuffer.setUsagePattern(QGLBuffer::StaticDraw);
+        m_vertexBuffer.bind();
+        m_vertexBuffer.allocate(&m_vertices[0], m_vertices.size() * sizeof(GLfloat));
+        m_vertexBuffer.release();
+        m_indexBuffer.setUsagePattern(QGLBuffer::StaticDraw);
+        m_indexBuffer.bind();
+        m_indexBuffer.allocate(&m_indices[0], m_indices.size() * sizeof(GLuint));
+        m_indexBuffer.release();
+    }
+    m_mesh_dirty = false;
+}
+
+// Sample the colour map into a 1D texture.  The texture matrix set in drawMesh
+// maps the colour range onto it.
+void GLWidget::makeColorTexture()
+{
+    if (!m_colorTexture)
+        glGenTextures(1, &m_colorTexture);
+
+    std::vector<GLubyte> lut(3 * COLOR_LUT_SIZE);
+    for (int i = 0; i < COLOR_LUT_SIZE; ++i){
+        QColor c = m_colorMap->color(QwtInterval(0.,1.), (double)i/(COLOR_LUT_SIZE - 1));
+        lut[3 * i] = c.red();
+        lut[3 * i + 1] = c.green();
+        lut[3 * i + 2] = c.blue();
+    }
+    glBindTexture(GL_TEXTURE_1D, m_colorTexture);
+    glTexParameteri(GL_TEXTURE_1D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_1D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_1D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glTexImage1D(GL_TEXTURE_1D, 0, GL_RGB, COLOR_LUT_SIZE, 0, GL_RGB, GL_UNSIGNED_BYTE, &lut[0]);
+    glBindTexture(GL_TEXTURE_1D, 0);
+    m_colors_dirty = false;
+}
+
+void GLWidget::drawMesh()
+{
+    if (m_indices.empty())
+        return;
+    if (m_mesh_dirty)
+        uploadMesh();
+    if (m_colors_dirty)
+        makeColorTexture();
+
+    glShadeModel(GL_SMOOTH);
+    glDepthFunc(GL_LESS);
+    glEnable(GL_DEPTH_TEST);
+    glEnable(GL_LIGHTING);
+    glEnable(GL_NORMALIZE);
+    glEnable(GL_COLOR_MATERIAL);
+    glPolygonMode(GL_FRONT_AND_BACK, m_FillMode);
+
+    //====== Lit white surface modulated by the colour map, specular added after
+    glColor3f(1.f, 1.f, 1.f);
+    glLightModeli(GL_LIGHT_MODEL_COLOR_CONTROL, GL_SEPARATE_SPECULAR_COLOR);
+    glEnable(GL_TEXTURE_1D);
+    glBindTexture(GL_TEXTURE_1D, m_colorTexture);
+    glTexEnvi(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_MODULATE);
+
+    //====== Height to colour map position, texel centers at the ends of the range
+    double range = m_max_y - m_min_y;
+    if (range <= 0.)
+        range = 1.;
+    glMatrixMode(GL_TEXTURE);
+    glLoadIdentity();
+    glTranslated(.5/COLOR_LUT_SIZE, 0., 0.);
+    glScaled((COLOR_LUT_SIZE - 1.)/(COLOR_LUT_SIZE * range), 1., 1.);
+    glTranslated(-m_min_y, 0., 0.);
+
+    //====== Height magnification and view flips
+    glMatrixMode(GL_MODELVIEW);
+    glPushMatrix();
+    glScaled(m_flip_x_view ? -1. : 1., m_Vscale, m_flip_y_view ? 1. : -1.);
+
+    const char *vbase = 0;
+    const char *ibase = 0;
+    if (m_useBuffers){
+        m_vertexBuffer.bind();
+        m_indexBuffer.bind();
+    }
+    else {
+        vbase = (const char *)&m_vertices[0];
+        ibase = (const char *)&m_indices[0];
+    }
+    GLsizei stride = 6 * sizeof(GLfloat);
+    glEnableClientState(GL_VERTEX_ARRAY);
+    glEnableClientState(GL_NORMAL_ARRAY);
+    glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+    glVertexPointer(3, GL_FLOAT, stride, vbase);
+    glNormalPointer(GL_FLOAT, stride, vbase + 3 * sizeof(GLfloat));
+    glTexCoordPointer(1, GL_FLOAT, stride, vbase + sizeof(GLfloat));
+    glDrawElements(GL_QUADS, m_indices.size(), GL_UNSIGNED_INT, ibase);
+    glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+    glDisableClientState(GL_NORMAL_ARRAY);
+    glDisableClientState(GL_VERTEX_ARRAY);
+    if (m_useBuffers){
+        m_indexBuffer.release();
+        m_vertexBuffer.release();
+    }
+
+    glPopMatrix();
+    glMatrixMode(GL_TEXTURE);
+    glLoadIdentity();
+    glMatrixMode(GL_MODELVIEW);
+    glBindTexture(GL_TEXTURE_1D, 0);
+    glDisable(GL_TEXTURE_1D);
+    glLightModeli(GL_LIGHT_MODEL_COLOR_CONTROL, GL_SINGLE_COLOR);
+    glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+}
 
 void GLWidget::setZranges(){
     double maxy = 0,miny = 0;
@@ -792,13 +896,11 @@ void GLWidget::contourZeroOffsetChanged(const QString &){
 void GLWidget::contourColorRangeChanged(const QString &arg1){
     m_zRangeMode = arg1;
     setZranges();
-    m_list_good = false;
     updateGL();
 }
 
 void GLWidget::setMinMaxValues(double min, double max){
     m_profile_scale_setting = max - min;
-    m_list_good = false;
     updateGL();
 }
 
@@ -809,7 +911,6 @@ void GLWidget::contourIntervalChanged(double){
 void GLWidget::contourWaveRangeChanged(double val){
     m_profile_scale_setting = val;
     setZranges();
-    m_list_good = false;
     updateGL();
 }
 
@@ -819,7 +920,7 @@ void GLWidget::colorMapChanged(int ndx){
         delete m_colorMap;
     m_colorMap = new dftColorMap(ndx,m_wf, false, .125, .7);
 
-    m_list_good = false;
+    m_colors_dirty = true;
     updateGL();
 }
 void GLWidget::backWallScale(double v){
@@ -830,7 +931,6 @@ void GLWidget::backWallScale(double v){
 
 void GLWidget::ogheightMagValue(int val){
     m_Vscale = val;
-    m_list_good = false;
     updateGL();
 }
 
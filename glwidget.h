@@ -20,6 +20,7 @@
 #define GLWIDGET_H
 #include <QObject>
 #include <QGLWidget>
+#include <QGLBuffer>
 #include <QVector3D>
 #include <vector>
 #include <QCheckBox>
@@ -30,29 +31,6 @@
 #include "surfaceanalysistools.h"
 #include "surfacepropertiesdlg.h"
 #define RADIUS 400
-class CQuad
-{
-public:
-    QVector3D i;
-    QVector3D j;
-    QVector3D k;
-    QVector3D n;
-    CQuad() { QVector3D p;  i = j = k = n =  p;}
-    CQuad( QVector3D p1, QVector3D p2, QVector3D p3, QVector3D p4): i(p1), j(p2), k(p3), n(p4)
-    {};
-    CQuad(const CQuad& q)
-    {
-        *this = q;
-    }
-    CQuad& operator=(const CQuad& q)
-    {
-        i = q.i;
-        j = q.j;
-        k = q.k;
-        n= q.n;
-        return *this;
-    }
-};
 
 class GLWidget : public QGLWidget
 {
@@ -131,6 +109,9 @@ private:
     void make_surface(void);
     void make_color(double & y, double& r, double& g, double& b);
     void make_surface_from_doubles();
+    void uploadMesh();
+    void makeColorTexture();
+    void drawMesh();
     void DrawScene();
     void SetLight();
     void setZranges();
@@ -157,8 +138,19 @@ private:
     bool m_GB_enabled;
     int m_gbValue;
 
-    std::vector< CQuad> m_quads;
-    std::vector<CQuad> m_grids;
+    // The surface is one grid of shared vertices drawn from vertex and index buffers.
+    // Each vertex is x, height, y and a normal.  Height is in waves and is scaled to
+    // the screen by the modelview matrix, colour comes from a 1D colour map texture
+    // indexed by height through the texture matrix.  So changing the height
+    // magnification, colour map or colour range does not touch the mesh.
+    std::vector<GLfloat> m_vertices;
+    std::vector<GLuint> m_indices;
+    QGLBuffer m_vertexBuffer;
+    QGLBuffer m_indexBuffer;
+    bool m_useBuffers;
+    bool m_mesh_dirty;
+    GLuint m_colorTexture;
+    bool m_colors_dirty;
     std::vector<QVector3D> m_vert_profile;
     std::vector<QVector3D> m_horz_profile;
 
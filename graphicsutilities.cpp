@@ -19,6 +19,7 @@
 #include <iostream>
 #include <fstream>
 #include <cstring>
+#include "opencv/highgui.h"
 
 void writeCircle(std::ofstream& file, CircleOutline& circle){
     double x = circle.m_center.x();
@@ -75,3 +76,105 @@ CircleOutline readCircle(std::ifstream &file){
     c.m_p2.m_p.ry() = c.m_center.y();
     return c;
 }
+
+cv::Mat makeOutlineMask(const CircleOutline &outside, const CircleOutline &center,
+                        int rows, int cols, double yScale){
+    double radm = ceil(outside.m_radius) + 1;
+    double rady = radm * yScale;
+    double rado = center.m_radius;
+    double cx = outside.m_center.x();
+    double cy = outside.m_center.y();
+    cv::Mat mask = cv::Mat::zeros(rows,cols,CV_8UC1);
+
+    for (int y = 0; y < rows; ++y){
+        for (int x = 0; x < cols; ++x){
+            double dx = (double)(x - cx)/(radm);
+            double dy = (double)(y - cy)/(rady);
+            if (sqrt(dx * dx + dy * dy) <= 1.)
+                mask.at<uchar>(y,x) = 255;
+        }
+    }
+    cx = center.m_center.x();
+    cy = center.m_center.y();
+    if (rado > 0) {
+        for (int y = 0; y < rows; ++y){
+            for (int x = 0; x < cols; ++x){
+                double dx = (double)(x - (cx))/(rado);
+                double dy = (double)(y - (cy))/(rado);
+                if (sqrt(dx * dx + dy * dy) < 1.)
+                    mask.at<uchar>(y,x) = 0;
+            }
+        }
+    }
+    return mask;
+}
+
+//swap quadrants
+void shiftDFT(cv::Mat &magI){
+
+    // crop the spectrum, if it has an odd number of rows or columns
+    magI = magI(cv::Rect(0, 0, magI.cols & -2, magI.rows & -2));
+
+    // rearrange the quadrants of Fourier image  so that the origin is at the image center
+    int cx = magI.cols/2;
+    int cy = magI.rows/2;
+
+    cv::Mat  q0(magI, cv::Rect(0, 0, cx, cy));   // Top-Left - Create a ROI per quadrant
+    cv::Mat  q1(magI, cv::Rect(cx, 0, cx, cy));  // Top-Right
+    cv::Mat  q2(magI, cv::Rect(0, cy, cx, cy));  // Bottom-Left
+    cv::Mat  q3(magI, cv::Rect(cx, cy, cx, cy)); // Bottom-Right
+
+    cv::Mat  tmp;                           // swap quadrants (Top-Left with Bottom-Right)
+    q0.copyTo(tmp);
+    q3.copyTo(q0);
+    tmp.copyTo(q3);
+
+    q1.copyTo(tmp);                    // swap quadrant (Top-Right with Bottom-Left)
+    q2.copyTo(q1);
+    tmp.copyTo(q2);
+}
+
+void showData(const std::string& txt, cv::Mat mat, bool useLog){
+    cv::Mat tmp = mat.clone();
+    if (useLog){
+        tmp = mat+1;
+        cv::log(tmp, tmp);
+    }
+    cv::normalize(tmp, tmp,0,255,CV_MINMAX);
+    tmp.convertTo(tmp,CV_8U);
+    cv::cvtColor(tmp,tmp, CV_GRAY2RGB);
+    cv::imshow(txt, tmp);
+    cv::waitKey(1);
+}
+
+
+QImage  showMag(cv::Mat complexI, bool show, const char* title, bool doLog, double gamma){
+    // compute the magnitude and switch to logarithmic scale
+    // => log(1 + sqrt(Re(DFT(I))^2 + Im(DFT(I))^2))
+    cv::Mat planes[2];
+    cv::split(complexI, planes);                   // planes[0] = Re(DFT(I), planes[1] = Im(DFT(I))
+    cv::magnitude(planes[0], planes[1], planes[0]);// planes[0] = magnitude
+    cv::Mat  magI = planes[0];
+    double mmin;
+    double mmax;
+    cv::minMaxIdx(magI, &mmin,&mmax);
+    magI-= mmin;
+
+    if (doLog)
+        cv::log((magI+0.1), magI);
+
+    if (gamma != 0.){
+        cv::pow(magI,gamma,magI);
+    }
+    cv::normalize(magI, magI,0,255,CV_MINMAX, CV_8U);
+    cv::minMaxIdx(magI, &mmin,&mmax);
+
+    cv::Mat tmp = magI.clone();
+    cv::waitKey(1);
+    cv::cvtColor(magI,magI, CV_GRAY2RGB);
+    if (show){
+        cv::imshow(title, magI);
+        cv::waitKey(1);
+    }
+    return QImage((uchar*)magI.data, magI.cols, magI.rows, magI.step, QImage::Format_RGB888).copy();
+}
@@ -20,11 +20,24 @@
 
 #include <QtCore>
 #include "circleoutline.h"
+#include "opencv/cv.h"
+#include <QImage>
 #include <iostream>
 #include <fstream>
+#include <string>
 
 void drawPlus(QPointF p, QPainter& dc);
 
 CircleOutline readCircle(std::ifstream& file);
 void writeCircle(std::ofstream& file, CircleOutline &circle);
+
+// 255 inside outside and not inside center. yScale squeezes the outside
+// vertically for elliptical mirrors.
+cv::Mat makeOutlineMask(const CircleOutline &outside, const CircleOutline &center,
+                        int rows, int cols, double yScale = 1.);
+
+// DFT display helpers shared by the DFT view, the vortex transform and the simulations.
+void shiftDFT(cv::Mat &magI);
+void showData(const std::string& txt, cv::Mat mat, bool useLog = false);
+QImage showMag(cv::Mat complexI, bool show = false, const char *title = "FFT", bool doLog = true, double gamma = 0);
 #endif // GRAPHICSUTILITIES_H
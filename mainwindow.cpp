@@ -37,6 +37,9 @@
 #include "simulationsview.h"
 #include "outlinehelpdocwidget.h"
 #include "bathastigdlg.h"
+#include "batchengine.h"
+#include "wavefrontfile.h"
+#include <QFutureWatcher>
 
 
 using namespace QtConcurrent;
@@ -47,8 +50,8 @@ QScrollArea *gscrollArea;
 
 MainWindow::MainWindow(QWidget *parent) :
     QMainWindow(parent),
-    ui(new Ui::MainWindow),m_showChannels(false), m_showIntensity(false),m_inBatch(false),m_OutlineDoneInBatch(false),
-    m_batchMakeSurfaceReady(false)
+    ui(new Ui::MainWindow),m_showChannels(false), m_showIntensity(false),m_inBatch(false),m_batchStep(BATCH_IDLE),
+    m_batchEngine(0), m_jitterDelta(0)
 {
     ui->setupUi(this);
     const QString toolButtonStyle("QToolButton {"
@@ -141,16 +144,17 @@ MainWindow::MainWindow(QWidget *parent) :
     connect(m_surfaceManager, SIGNAL(showMessage(QString)), this, SLOT(showMessage(QString)));
     connect(m_contourView, SIGNAL(showAllContours()), m_surfaceManager, SLOT(showAllContours()));
     connect(m_dftArea, SIGNAL(newWavefront(cv::Mat,CircleOutline,CircleOutline,QString)),
-            m_surfaceManager, SLOT(createSurfaceFromPhaseMap(cv::Mat,CircleOutline,CircleOutline,QString)));
+            this, SLOT(newWavefront(cv::Mat,CircleOutline,CircleOutline,QString)));
     connect(m_surfaceManager, SIGNAL(diameterChanged(double)),this,SLOT(diameterChanged(double)));
     connect(m_surfaceManager, SIGNAL(showTab(int)), ui->tabWidget, SLOT(setCurrentIndex(int)));
-    connect(m_surfTools, SIGNAL(updateSelected()), m_surfaceManager, SLOT(backGroundUpdate()));
+    connect(m_surfTools, SIGNAL(updateSelected()), m_surfaceManager, SLOT(refitSelected()));
     connect(m_ogl, SIGNAL(showAll3d(GLWidget *)), m_surfaceManager, SLOT(showAll3D(GLWidget *)));
 
     ui->tabWidget->addTab(review, "Results");
 
     ui->tabWidget->addTab(SimulationsView::getInstance(ui->tabWidget), "Star Test, PSF, MTF");
     ui->tabWidget->addTab(foucaultView::get_Instance(m_surfaceManager), "Ronchi & Foucault");
+    connect(foucaultView::get_Instance(), SIGNAL(scanExported(QString)), statusBar(), SLOT(showMessage(QString)));
     scrollArea->setWidgetResizable(true);
     scrollAreaDft->setWidgetResizable(true);
     createActions();
@@ -493,7 +497,7 @@ void MainWindow::on_actionRead_WaveFront_triggered()
     QFileDialog dialog(this);
     dialog.setDirectory(lastPath);
     dialog.setFileMode(QFileDialog::ExistingFiles);
-    dialog.setNameFilter(tr("wft (*.wft)"));
+    dialog.setNameFilter(tr("wavefront (*.wft *.wfb)"));
     QStringList fileNames;
 
     if (dialog.exec()) {
@@ -582,6 +586,32 @@ void MainWindow::on_actionWrite_WaveFront_triggered()
 }
 
 
+// Convert text .wft files to binary .wfb and binary ones back to text.
+void MainWindow::on_actionConvert_wavefront_files_triggered()
+{
+    QSettings settings;
+    QString lastPath = settings.value("lastPath",".").toString();
+    QStringList fileNames = QFileDialog::getOpenFileNames(this,
+                        tr("Wavefront files to convert"), lastPath,
+                        tr("wavefront (*.wft *.wfb)"));
+    if (fileNames.isEmpty())
+        return;
+    bool float32 = settings.value("wfbFloat32", false).toBool();
+    QProgressDialog pd(tr("Converting wavefront files"), tr("Cancel"), 0, fileNames.size(), this);
+    pd.setWindowModality(Qt::WindowModal);
+    QStringList failed;
+    for (int i = 0; i < fileNames.size() && !pd.wasCanceled(); ++i){
+        pd.setLabelText(fileNames[i]);
+        pd.setValue(i);
+        if (convertWavefrontFile(fileNames[i], float32).isEmpty())
+            failed << fileNames[i];
+    }
+    pd.setValue(fileNames.size());
+    if (failed.size() > 0)
+        QMessageBox::warning(this, tr("Convert wavefront files"),
+                             tr("Could not convert:\n") + failed.join("\n"));
+}
+
 void MainWindow::on_actionSave_Wavefront_triggered()
 {
     m_surfaceManager->SaveWavefronts(false);
@@ -619,8 +649,8 @@ void MainWindow::on_pushButton_clicked()
 {
     if (!m_inBatch)
         m_igramArea->nextStep();
-    else {
-        m_OutlineDoneInBatch = true;
+    else if (m_batchStep == BATCH_OUTLINE){
+        batchOutlineDone();
     }
 }
 
@@ -678,6 +708,20 @@ void MainWindow::on_actionIgram_triggered()
     m_igramArea->generateSimIgram();
 }
 
+void MainWindow::on_actionExport_Foucault_scan_triggered()
+{
+    QString dir = QFileDialog::getExistingDirectory(this, tr("Export scan frames to"),
+                                                    mirrorDlg::getProjectPath());
+    if (dir.isEmpty())
+        return;
+    int frames = foucaultView::get_Instance()->exportScan(dir);
+    if (frames == 0){
+        QMessageBox::warning(this, "warning", "There is no round surface to scan or the scan has no frames.");
+        return;
+    }
+    statusBar()->showMessage(QString("Exporting %1 Ronchi and Foucault frames").arg(frames));
+}
+
 void MainWindow::on_actionSave_interferogram_triggered()
 {
     m_igramArea->save();
@@ -834,7 +878,8 @@ void MainWindow::on_actionError_Margins_triggered()
     dlg.exec();
 }
 void MainWindow::batchMakeSurfaceReady(){
-    m_batchMakeSurfaceReady = true;
+    if (m_batchStep == BATCH_DFT)
+        batchMakeSurface();
 }
 void MainWindow::batchFinished(int ){
     batchConnections(false);
@@ -850,55 +895,153 @@ void MainWindow::batchConnections(bool flag){
         m_inBatch = false;
         disconnect(m_dftTools, SIGNAL(makeSurface()), this, SLOT(batchMakeSurfaceReady()));
         connect(m_dftTools, SIGNAL(makeSurface()), m_dftArea, SLOT(makeSurface()));
+        // a surface being made ends the batch when it is done
+        if (m_batchStep == BATCH_OUTLINE || m_batchStep == BATCH_DFT)
+            batchDone();
     }
 }
 
+// Surfaces made by the DFT go through here so the batch and outline iteration can
+// wait on the operation that computes them.
+void MainWindow::newWavefront(cv::Mat phase, CircleOutline outside, CircleOutline center, QString name){
+    m_surfaceOp = m_surfaceManager->createSurfaceFromPhaseMap(phase, outside, center, name);
+}
+
+// Make a surface from the current igram.  slot is called with the operation that
+// computes it once it is done and deletes the operation.  False if the DFT made no
+// surface.
+bool MainWindow::makeSurfaceThen(const char *slot){
+    m_surfaceOp = 0;
+    m_dftTools->wasPressed = true;
+    if (!m_dftArea->makeSurface() || m_surfaceOp.isNull())
+        return false;
+    m_surfaceOp->then(this, slot);
+    m_surfaceOp = 0;
+    return true;
+}
+
+// Process igrams without the GUI using the batch pipeline.  autoBatchDone loads the
+// wavefronts it wrote.  The igram outlines come from their .oln files or the last
+// outline used.  Wavefronts are written in the format last saved, .wfb files with
+// the zernikeFitTerms hidden setting worth of zernikes.
+void MainWindow::autoBatchProcess(QStringList fileList){
+    mirrorDlg &md = *mirrorDlg::get_Instance();
+    QSettings set;
+    batchSettings bs;
+    bs.dftSize = Settings2::dftSize();
+    bs.channel = m_dftArea->channel;
+    bs.centerFilter = m_dftArea->m_center_filter;
+    bs.vortexSmooth = m_vortexDebugTool->m_smooth;
+    bs.flipH = md.shouldFlipH();
+    bs.ellipse = md.isEllipse();
+    bs.verticalAxis = md.m_verticalAxis;
+    bs.diameter = md.diameter;
+    bs.roc = md.roc;
+    bs.lambda = md.lambda;
+    bs.fringeSpacing = md.fringeSpacing;
+    bs.fastUnwrap = Settings2::fastUnwrap();
+    bs.referenceQuality = Settings2::referenceQualityMap();
+    bs.outside = CircleOutline(QPointF(set.value("lastOutsideCx", 0).toDouble(),
+                                       set.value("lastOutsideCy", 0).toDouble()),
+                               set.value("lastOutsideRad", 0).toDouble());
+    bs.center = CircleOutline(QPointF(set.value("lastInsideCx", 0).toDouble(),
+                                      set.value("lastInsideCy", 0).toDouble()),
+                              set.value("lastInsideRad", 0).toDouble());
+    bs.binary = set.value("wavefrontSaveSuffix", "wft").toString() == "wfb";
+    bs.float32 = set.value("wfbFloat32", false).toBool();
+    bs.zernikeTerms = qMax(1, set.value("zernikeFitTerms", Z_TERMS).toInt());
+
+    m_batchEngine = new batchEngine(bs, this);
+    QProgressDialog *pd = new QProgressDialog("Processing interferograms", "Cancel", 0, fileList.size(), this);
+    pd->setWindowModality(Qt::WindowModal);
+    connect(m_batchEngine, SIGNAL(progress(int,int)), pd, SLOT(setValue(int)));
+    connect(pd, SIGNAL(canceled()), m_batchEngine, SLOT(cancel()), Qt::DirectConnection);
+    connect(m_batchEngine, SIGNAL(destroyed()), pd, SLOT(deleteLater()));
+
+    QFutureWatcher<QVector<batchItem> > *watcher = new QFutureWatcher<QVector<batchItem> >(m_batchEngine);
+    connect(watcher, SIGNAL(finished()), this, SLOT(autoBatchDone()));
+    watcher->setFuture(QtConcurrent::run(m_batchEngine, &batchEngine::run, fileList));
+}
+
+void MainWindow::autoBatchDone(){
+    QVector<batchItem> results = m_batchEngine->results();
+    QString errors;
+    for (int i = 0; i < results.size(); ++i){
+        if (!results[i].error.isEmpty())
+            errors += results[i].error + "\n";
+    }
+    QString report = m_batchEngine->report();
+    QStringList written = m_batchEngine->written();
+    m_batchEngine->deleteLater();
+    m_batchEngine = 0;
+    batchDone();
+
+    QMessageBox::information(this, tr("Batch processing"), report + errors);
+    if (written.size() > 0)
+        emit load(written, m_surfaceManager);
+}
+
+// Each igram is a chain of steps.  In manual mode the outline and the DFT steps
+// wait for the user's Done and Make Surface, otherwise each step runs the next.
 void MainWindow::batchProcess(QStringList fileList){
 
         this->setCursor(Qt::WaitCursor);
         batchIgramWizard::goPb->setEnabled(false);
-        QApplication::processEvents();
         QFileInfo info(m_igramsToProcess[0]);
 
         QString lastPath = info.absolutePath();
         QSettings settings;
         settings.setValue("lastPath",lastPath);
-        foreach(QString fn, fileList){
-            m_OutlineDoneInBatch = false;
-            m_igramArea->openImage(fn);
-            if (batchIgramWizard::manualRb->isChecked()){
-                while (m_inBatch && !m_OutlineDoneInBatch) {
-                    QApplication::processEvents();
-                }
-            }
-            if (!m_inBatch)
-                break;
-            m_igramArea->nextStep();
-            m_batchMakeSurfaceReady = false;
-            if (batchIgramWizard::manualRb->isChecked()){
-                while (m_inBatch && !m_batchMakeSurfaceReady) {
-                    QApplication::processEvents();
-                }
-            }
-            if (!m_inBatch)
-                break;
-            m_surfaceManager->m_surface_finished = false;
-            ui->tabWidget->setCurrentIndex(2);
-            m_dftTools->wasPressed = true;
-            m_dftArea->makeSurface();
-            qDebug() << "batch make surface";
-            while(m_inBatch && !m_surfaceManager->m_surface_finished){qApp->processEvents();}
-            if (!m_inBatch)
-                break;
-            Sleep(1000);
+        m_batchFiles = fileList;
+        m_batchStep = BATCH_SURFACE;
+        if (batchIgramWizard::autoRb->isChecked()){
+            autoBatchProcess(fileList);
+            return;
         }
-        batchIgramWizard::goPb->setEnabled(true);
-        batchWiz->close();
-        delete batchWiz;
+        batchNextIgram();
+}
 
-        this->setCursor(Qt::ArrowCursor);
+void MainWindow::batchNextIgram(){
+    if (!m_inBatch || m_batchFiles.isEmpty()){
+        batchDone();
+        return;
+    }
+    m_igramArea->openImage(m_batchFiles.takeFirst());
+    m_batchStep = BATCH_OUTLINE;
+    if (!batchIgramWizard::manualRb->isChecked())
+        batchOutlineDone();
+}
+
+void MainWindow::batchOutlineDone(){
+    m_igramArea->nextStep();
+    m_batchStep = BATCH_DFT;
+    if (!batchIgramWizard::manualRb->isChecked())
+        batchMakeSurface();
+}
+
+void MainWindow::batchMakeSurface(){
+    m_batchStep = BATCH_SURFACE;
+    ui->tabWidget->setCurrentIndex(2);
+    if (!makeSurfaceThen(SLOT(batchSurfaceDone(surfaceOperation*))))
+        batchNextIgram();
+}
 
+void MainWindow::batchSurfaceDone(surfaceOperation *op){
+    op->deleteLater();
+    batchNextIgram();
+}
+
+void MainWindow::batchDone(){
+    if (m_batchStep == BATCH_IDLE)
+        return;
+    m_batchStep = BATCH_IDLE;
+    m_batchFiles.clear();
+    batchIgramWizard::goPb->setEnabled(true);
+    // closing the wizard ends the batch connections, it is deleted once that is done
+    batchWiz->close();
+    batchWiz->deleteLater();
 
+    this->setCursor(Qt::ArrowCursor);
 }
 
 void MainWindow::Batch_Process_Interferograms()
@@ -932,77 +1075,108 @@ void MainWindow::on_actionIterate_outline_triggered()
     dlg->show();
 }
 static bool stopJittering = false;
+static bool jittering = false;
 void MainWindow::stopJitter(){
     stopJittering = true;
 }
 
+// Each outline is shown for a second before its surface is made.  The next outline
+// is started when the surface is done.
 void MainWindow::startJitter(){
     if (m_igramArea->m_outside.m_radius == 0){
         QMessageBox::warning(this, "Error", "You must first load an interferogram and outline the mirror. and press 'Done'");
         return;
     }
+    if (jittering)
+        return;
     jitterOutlineDlg *dlg = jitterOutlineDlg::getInstance(this);
+    jittering = true;
     stopJittering = false;
-    int start = dlg->getStart();
-    int end = dlg->getEnd();
-    int step = dlg->getStep();
-    int x = 0;
-    int y = 0;
-    int rad = 0;
 
     m_igramArea->openImage(m_igramArea->m_filename);
-    CircleOutline  saved = (m_igramArea->m_current_boundry == OutSideOutline) ? m_igramArea->m_outside : m_igramArea->m_center;
-    dlg->getProgressBar()->setMinimum(start);
-    dlg->getProgressBar()->setMaximum(end);
-    for (int delta = start; delta <= end; delta += step){
-        dlg->getProgressBar()->setValue(delta);
-        switch (dlg->getType()){
-        case 1:
-            x = delta;
-            break;
-        case 2:
-            y = delta;
-            break;
-        case 3:
-            rad = delta;
-            break;
-        }
+    m_jitterSaved = (m_igramArea->m_current_boundry == OutSideOutline) ? m_igramArea->m_outside : m_igramArea->m_center;
+    dlg->getProgressBar()->setMinimum(dlg->getStart());
+    dlg->getProgressBar()->setMaximum(dlg->getEnd());
+    m_jitterDelta = dlg->getStart();
+    jitterStep();
+}
+
+// The outline offsets for the current step.
+void MainWindow::jitterOffsets(int *x, int *y, int *rad){
+    *x = *y = *rad = 0;
+    switch (jitterOutlineDlg::getInstance(this)->getType()){
+    case 1:
+        *x = m_jitterDelta;
+        break;
+    case 2:
+        *y = m_jitterDelta;
+        break;
+    case 3:
+        *rad = m_jitterDelta;
+        break;
+    }
+}
 
-        if (stopJittering)
-            break;
-        m_igramArea->openImage(m_igramArea->m_filename);
-        if (m_igramArea->m_current_boundry == OutSideOutline)
-            m_igramArea->m_outside = saved;
-        else
-            m_igramArea->m_center = saved;
+void MainWindow::jitterStep(){
+    jitterOutlineDlg *dlg = jitterOutlineDlg::getInstance(this);
+    if (stopJittering || m_jitterDelta > dlg->getEnd()){
+        jitterDone();
+        return;
+    }
+    dlg->getProgressBar()->setValue(m_jitterDelta);
+    int x, y, rad;
+    jitterOffsets(&x, &y, &rad);
 
-        m_igramArea->increase(rad);
-        m_igramArea->shiftoutline(QPointF(x,y));
-        qApp->processEvents();
-        Sleep(1000);
+    m_igramArea->openImage(m_igramArea->m_filename);
+    if (m_igramArea->m_current_boundry == OutSideOutline)
+        m_igramArea->m_outside = m_jitterSaved;
+    else
+        m_igramArea->m_center = m_jitterSaved;
 
-        m_igramArea->nextStep();
+    m_igramArea->increase(rad);
+    m_igramArea->shiftoutline(QPointF(x,y));
+    QTimer::singleShot(1000, this, SLOT(jitterMakeSurface()));
+}
 
-        m_surfaceManager->m_surface_finished = false;
-        ui->tabWidget->setCurrentIndex(2);
-        m_dftTools->wasPressed = true;
-        m_dftArea->makeSurface();
-        while(m_inBatch && !m_surfaceManager->m_surface_finished){qApp->processEvents();}
-        wavefront *wf = m_surfaceManager->m_wavefronts[m_surfaceManager->m_currentNdx];
-        wf->name = QString().sprintf("x:_%d_Y:_%d_radius:_%d",x,y,rad);
-        dlg->status(wf->name);
-        m_surfTools->nameChanged(m_surfaceManager->m_currentNdx, wf->name);
-        qApp->processEvents();
-        Sleep(500);
+void MainWindow::jitterMakeSurface(){
+    if (stopJittering){
+        jitterDone();
+        return;
+    }
+    m_igramArea->nextStep();
+
+    ui->tabWidget->setCurrentIndex(2);
+    if (!makeSurfaceThen(SLOT(jitterSurfaceDone(surfaceOperation*))))
+        jitterDone();
+}
+
+void MainWindow::jitterSurfaceDone(surfaceOperation *op){
+    int ndx = op->wavefront();
+    op->deleteLater();
+    if (stopJittering || ndx < 0){
+        jitterDone();
+        return;
     }
-    dlg->getProgressBar()->reset();
+    int x, y, rad;
+    jitterOffsets(&x, &y, &rad);
+    wavefront *wf = m_surfaceManager->m_wavefronts[ndx];
+    wf->name = QString().sprintf("x:_%d_Y:_%d_radius:_%d",x,y,rad);
+    jitterOutlineDlg::getInstance(this)->status(wf->name);
+    m_surfTools->nameChanged(m_surfaceManager->m_currentNdx, wf->name);
+    m_jitterDelta += jitterOutlineDlg::getInstance(this)->getStep();
+    QTimer::singleShot(500, this, SLOT(jitterStep()));
+}
+
+void MainWindow::jitterDone(){
+    jitterOutlineDlg::getInstance(this)->getProgressBar()->reset();
     stopJittering = false;
+    jittering = false;
 
     m_igramArea->openImage(m_igramArea->m_filename);
     if (m_igramArea->m_current_boundry == OutSideOutline)
-        m_igramArea->m_outside = saved;
+        m_igramArea->m_outside = m_jitterSaved;
     else
-        m_igramArea->m_center = saved;
+        m_igramArea->m_center = m_jitterSaved;
     m_igramArea->nextStep();
     m_igramArea->openImage(m_igramArea->m_filename);
 }
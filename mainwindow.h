@@ -47,6 +47,7 @@
 #include "batchigramwizard.h"
 #include "outlinehelpdocwidget.h"
 #include "foucaultview.h"
+class batchEngine;
 namespace Ui {
 class MainWindow;
 }
@@ -81,6 +82,12 @@ public slots:
     void batchFinished(int);
     void startJitter();
     void stopJitter();
+    void newWavefront(cv::Mat phase, CircleOutline outside, CircleOutline center, QString name);
+    void batchSurfaceDone(surfaceOperation *op);
+    void autoBatchDone();
+    void jitterStep();
+    void jitterMakeSurface();
+    void jitterSurfaceDone(surfaceOperation *op);
     void restoreOgl();
     void restoreContour();
     void zoomContour(bool flag);
@@ -93,6 +100,7 @@ private slots:
     void updateChannels(QImage);
     void openRecentFile();
     void on_actionLoad_Interferogram_triggered();
+    void on_actionConvert_wavefront_files_triggered();
     void on_pushButton_5_clicked();
     void on_pushButton_8_clicked();
     void on_pushButton_7_clicked();
@@ -139,6 +147,8 @@ private slots:
 
     void on_actionIgram_triggered();
 
+    void on_actionExport_Foucault_scan_triggered();
+
     void on_actionSave_interferogram_triggered();
 
     void on_actionSave_screen_triggered();
@@ -245,8 +255,20 @@ private:
     bool m_showChannels;
     bool m_showIntensity;
     bool m_inBatch;
-    bool m_OutlineDoneInBatch;
-    bool m_batchMakeSurfaceReady;
+    enum { BATCH_IDLE, BATCH_OUTLINE, BATCH_DFT, BATCH_SURFACE };
+    int m_batchStep;            // what the batch is waiting for
+    QStringList m_batchFiles;   // igrams the batch has still to do
+    void batchNextIgram();
+    void batchOutlineDone();
+    void batchMakeSurface();
+    void batchDone();
+    batchEngine *m_batchEngine;     // automatic batch being run
+    QPointer<surfaceOperation> m_surfaceOp;    // made by the last newWavefront
+    bool makeSurfaceThen(const char *slot);
+    int m_jitterDelta;          // outline offset of the surface being made
+    CircleOutline m_jitterSaved;    // outline to put back when the iteration ends
+    void jitterOffsets(int *x, int *y, int *rad);
+    void jitterDone();
 
     enum { MaxRecentFiles = 5 };
     QAction *recentFileActs[MaxRecentFiles];
@@ -261,6 +283,7 @@ private:
     QWidget *oglFv;
     QWidget *contourFv;
     void Batch_Process_Interferograms();
+    void autoBatchProcess(QStringList fileList);
 };
 
 #endif // MAINWINDOW_H
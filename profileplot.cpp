@@ -43,6 +43,7 @@
 #include <qlayout.h>
 #include "settings2.h"
 #include "mirrordlg.h"
+#include "surfacemanager.h"
 
 #define PITORAD  M_PI/180.;
 double g_angle = 270. * PITORAD; //start at 90 deg (pointing east)
@@ -349,11 +350,13 @@ void ProfilePlot::populate()
 
         m_plot->insertLegend( new QwtLegend() , QwtPlot::BottomLegend);
         for (int i = 0; i < wfs->size(); ++i){
+            SurfaceManager::get_instance()->makeResident(wfs->at(i));
             QwtPlotCurve *cprofile = new QwtPlotCurve(wfs->at(i)->name );
             cprofile->setPen(QPen(Settings2::m_profile->getColor(i)));
             cprofile->setRenderHint( QwtPlotItem::RenderAntialiased );
             cprofile->setSamples( createProfile( m_showNm * m_showSurface,wfs->at(i)));
             cprofile->attach( m_plot );
+            SurfaceManager::get_instance()->trimMemory();
 
 
         }
@@ -19,50 +19,143 @@
 #include "punwrap.h"
 #include <math.h>
 #include <algorithm>
-#include <queue>
 #include <cstring>
-using namespace std;
-int xsize,ysize;
-double* qmap = NULL;
-double* phase;
-double* unwrapped;
-
 #include <stdlib.h>
-#include <math.h>
+#include <float.h>
+using namespace std;
 
 #define WRAP(x) (((x) > 0.5) ? ((x)-1.0) : (((x) <= -0.5) ? ((x)+1.0) : (x)))
-//double WRAP(double x){
-//   if (x > .5){
-//       return x - 1.;
-//   }
-//   else if (x <= -.5){
-//       return x+1.0;
-
-//   }
-//   return x;
-//}
-
-char* flags = NULL;
-#define BORDER      0x1
-#define UNWRAPPED   0x2
-
-#define SWAP(a, i, j)                           \
-    {                                           \
-        int t = a[i];                           \
-        a[i] = a[j];                            \
-        a[j] = t;                               \
+
+unwrapContext::unwrapContext(int nx, int ny, queueMode mode):
+    m_nx(0), m_ny(0), m_end(0), m_mode(mode), m_nbuckets(4096), m_top(0),
+    m_qmin(0.), m_qscale(0.), m_seedPos(0), m_qualityMode(QUALITY_INTEGRAL)
+{
+    resize(nx, ny);
+    m_head.assign(m_nbuckets, -1);
+    m_tail.assign(m_nbuckets, -1);
+}
+
+void unwrapContext::setQueueMode(queueMode mode, int buckets)
+{
+    m_mode = mode;
+    if (buckets < 1)
+        buckets = 1;
+    if (buckets != m_nbuckets) {
+        m_nbuckets = buckets;
+        m_head.assign(m_nbuckets, -1);
+        m_tail.assign(m_nbuckets, -1);
+    }
+}
+
+void unwrapContext::resize(int nx, int ny)
+{
+    if (nx == m_nx && ny == m_ny && m_qmap.size() > 0)
+        return;
+    m_nx = nx;
+    m_ny = ny;
+    int size = std::max(nx * ny, 1);
+    m_qmap.assign(size, 0.);
+    m_path.assign(size, 0.);
+    m_flags.assign(size, 0);
+    m_todo.assign(size, 0);
+    m_next.assign(size, -1);
+    m_seeds.reserve(size);
+}
+
+// Function object to order pixel indexes best quality first
+class bestFirst
+{
+public:
+    const double *m_q;
+    bestFirst(const double *q) : m_q(q){}
+    bool operator() (int p1, int p2) const
+    {
+        return m_q[p1] > m_q[p2];
+    }
+};
+
+// Sort the unflagged pixels into the order they would be chosen as the seed of a new
+// region, best quality first and lowest index first among equal qualities.
+void unwrapContext::makeSeedList(const double *qmap)
+{
+    int size = m_nx * m_ny;
+    const char *flags = &m_flags[0];
+
+    double qmin = HUGE;
+    double qmax = -HUGE;
+    m_seeds.clear();
+    for (int k = 0; k < size; ++k){
+        if (flags[k] || !(qmap[k] > -HUGE))
+            continue;
+        m_seeds.push_back(k);
+        qmin = std::min(qmin, qmap[k]);
+        qmax = std::max(qmax, qmap[k]);
+    }
+    m_seedPos = 0;
+    m_qmin = qmin;
+    m_qscale = (qmax > qmin) ? (m_nbuckets - 1)/(qmax - qmin) : 0.;
+
+    if (m_mode == EXACT_HEAP){
+        std::stable_sort(m_seeds.begin(), m_seeds.end(), bestFirst(qmap));
+        return;
+    }
+
+    // counting sort on the bucket index
+    std::vector<int> &count = m_tail;
+    std::fill(count.begin(), count.end(), 0);
+    for (size_t i = 0; i < m_seeds.size(); ++i)
+        ++count[bucketOf(qmap[m_seeds[i]])];
+    int start = 0;
+    for (int b = m_nbuckets - 1; b >= 0; --b){
+        int c = count[b];
+        count[b] = start;
+        start += c;
+    }
+    std::vector<int> &sorted = m_todo;
+    for (size_t i = 0; i < m_seeds.size(); ++i)
+        sorted[count[bucketOf(qmap[m_seeds[i]])]++] = m_seeds[i];
+    std::copy(sorted.begin(), sorted.begin() + m_seeds.size(), m_seeds.begin());
+
+    std::fill(m_head.begin(), m_head.end(), -1);
+    std::fill(m_tail.begin(), m_tail.end(), -1);
+    m_top = 0;
+}
+
+// Next unflagged pixel from the seed list or -1 when all are done.
+int unwrapContext::nextSeed()
+{
+    const char *flags = &m_flags[0];
+    int n = (int)m_seeds.size();
+    while (m_seedPos < n){
+        int k = m_seeds[m_seedPos++];
+        if (!flags[k])
+            return k;
     }
+    return -1;
+}
 
-static
-void todo_push (int ndx, double *qmap, int *todo, int *end)
+void unwrapContext::push(int ndx, const double *qmap)
 {
-    int child;
-    todo[*end] = ndx;
-    child = (*end)++;
+    if (m_mode == BUCKET_QUEUE){
+        int b = bucketOf(qmap[ndx]);
+        m_next[ndx] = -1;
+        if (m_head[b] < 0)
+            m_head[b] = ndx;
+        else
+            m_next[m_tail[b]] = ndx;
+        m_tail[b] = ndx;
+        if (b > m_top)
+            m_top = b;
+        ++m_end;
+        return;
+    }
+    int *todo = &m_todo[0];
+    todo[m_end] = ndx;
+    int child = m_end++;
     while (child > 0) {
         int parent = (child-1) / 2;
         if (qmap[todo[parent]] < qmap[todo[child]]) {
-            SWAP (todo, parent, child);
+            std::swap(todo[parent], todo[child]);
             child = parent;
         }
         else
@@ -70,19 +163,27 @@ void todo_push (int ndx, double *qmap, int *todo, int *end)
     }
 }
 
-static
-int todo_pop(double *qmap, int *todo, int *end)
+int unwrapContext::pop(const double *qmap)
 {
+    if (m_mode == BUCKET_QUEUE){
+        while (m_head[m_top] < 0)
+            --m_top;
+        int result = m_head[m_top];
+        m_head[m_top] = m_next[result];
+        --m_end;
+        return result;
+    }
+    int *todo = &m_todo[0];
     int result = todo[0], root;
-    --(*end);
-   SWAP (todo, 0, *end);
+    --m_end;
+    std::swap(todo[0], todo[m_end]);
     root = 0;
-    while (root*2+1 < *end) {
+    while (root*2+1 < m_end) {
         int child = root*2+1; // left child
-        if (child+1 < *end && qmap[todo[child]] < qmap[todo[child+1]])
+        if (child+1 < m_end && qmap[todo[child]] < qmap[todo[child+1]])
             ++child;
         if (qmap[todo[root]] < qmap[todo[child]]) {
-            SWAP (todo, root, child);
+            std::swap(todo[root], todo[child]);
             root = child;
         }
         else
@@ -96,39 +197,35 @@ int todo_pop(double *qmap, int *todo, int *end)
         unwrapped[ndx] = val;                   \
         flags[ndx] |= UNWRAPPED;                \
         path[ndx] = order++;                    \
-        todo_push (ndx, qmap, todo, &end);      \
+        push (ndx, qmap);                       \
     }
 
 // Quality-guided path following phase unwrapper.
-void qg_path_follower (int nx, int ny, double *phase, double *qmap,
-                       double *unwrapped, double *path)
+void unwrapContext::pathFollower(const double *phase, const double *qmap, double *unwrapped)
 {
-    int *todo;
-    int end;
+    int nx = m_nx;
+    int ny = m_ny;
     int order = 0;
-    int size = nx * ny;
+    char *flags = &m_flags[0];
+    double *path = &m_path[0];
 
     // Initialize the to do list.
-    todo = (int*)calloc (size, sizeof (int));
-    end = 0;
+    m_end = 0;
+    makeSeedList(qmap);
 
     // Repeat while still elements to unwrap (handles disjoint regions).
     while (1) {
 
         // Find the point of highest quality.
-        double m = -HUGE;
-        int mndx;
-        for (int k=0; k < size; ++k)
-            if (qmap[k] > m && ! flags[k])
-                m = qmap[mndx = k];
-        if (m == -HUGE) break;
+        int mndx = nextSeed();
+        if (mndx < 0) break;
 
         // Unwrap the first point.
         unwrap_and_insert (mndx, phase[mndx]);
 
         // Unwrap the rest of the points in order of quality.
-        while (end) {
-            int ndx = todo_pop (qmap, todo, &end);
+        while (m_end) {
+            int ndx = pop (qmap);
             int x = ndx%nx;
             int y = ndx/nx;
             double val = unwrapped[ndx];
@@ -146,19 +243,43 @@ void qg_path_follower (int nx, int ny, double *phase, double *qmap,
                 unwrap_and_insert (ndx+nx, val+WRAP(phase[ndx+nx]-phase[ndx]));
         }
     }
-
-
-    free (todo);
 }
 
+/* Input phase is scaled from 0 to 1 */
+void unwrapContext::unwrap(const double *phase, double *unwrapped, const char *mask)
+{
+    int size = m_nx * m_ny;
+    std::copy(mask, mask + size, m_flags.begin());
+    std::fill(m_path.begin(), m_path.end(), 0.);
+
+    // make the quality map
+    double *qmap = &m_qmap[0];
+    if (m_qualityMode == QUALITY_REFERENCE)
+        dv_quality_map(phase, 5, qmap, m_nx, m_ny);
+    else
+        dv_quality_map_integral(phase, 5, qmap, m_nx, m_ny, &m_sat);
+    for (int i = 0; i < size; ++i)
+        qmap[i] *= -1.;
+
+    pathFollower(phase, qmap, unwrapped);
+}
 
-void dv_quality_map (double *pphase,int width, double *qmap, int nx, int ny)
+void unwrapContext::unwrap(const double *phase, const double *qmap, double *unwrapped)
 {
-  double *dx;
-  double *dy;
+    int size = m_nx * m_ny;
 
-  dx = (double*)calloc (nx*ny, sizeof (double));
-  dy = (double*)calloc (nx*ny, sizeof (double));
+    // Initialize the flags array to mark the border.
+    for (int k=0; k < size; ++k)
+        m_flags[k] = phase[k] == 0.0;
+    std::fill(m_path.begin(), m_path.end(), 0.);
+
+    pathFollower(phase, qmap, unwrapped);
+}
+
+void dv_quality_map (const double *pphase,int width, double *qmap, int nx, int ny)
+{
+  std::vector<double> dx(nx*ny);
+  std::vector<double> dy(nx*ny);
 
   // Calculate the arrays of gradients.
   for (int x=0; x < nx; ++x)
@@ -178,8 +299,8 @@ void dv_quality_map (double *pphase,int width, double *qmap, int nx, int ny)
   int start = -(width/2);
   int end = start+width;
   int size = width * width;
-  double* ex = new double[size];
-  double* ey = new double[size];
+  std::vector<double> ex(size);
+  std::vector<double> ey(size);
 
   for ( int x=0; x < nx; ++x)
     for (int y=0; y < ny; ++y) {
@@ -214,22 +335,16 @@ void dv_quality_map (double *pphase,int width, double *qmap, int nx, int ny)
         qmap[ndx] = (sqrt(sx) + sqrt(sy)) / (size);
       }
     }
-
-  free (dx);
-  free (dy);
-  delete[] ex;
-  delete[] ey;
-
 }
 
 
 
-void pc_quality_map (int nx, int ny, double *phase, int width, double *qmap)
+void pc_quality_map (int nx, int ny, const double *phase, int width, double *qmap)
 {
   // Calculate the pseudo-correlation over the moving window.
   int start = -(width/2);
   int end = start+width;
-  double* ep = new double[width*width];
+  std::vector<double> ep(width*width);
 
   for (int x=0; x < nx; ++x)
     for (int y=0; y < ny; ++y) {
@@ -258,158 +373,296 @@ void pc_quality_map (int nx, int ny, double *phase, int width, double *qmap)
     }
 }
 
-
-
-
-
-
-class qual
+// Summed area tables are stored row major with a leading row and column of zeros so
+// a table for an nx by ny map is (nx+1) * (ny+1) doubles.
+static inline double boxSum(const double *sat, int w, int x0, int y0, int x1, int y1)
 {
-public:
-    int m_ndx;
-    double m_q;
-    qual(int ndx, double qual) : m_ndx(ndx), m_q(qual){};
-};
+    return sat[y1 * w + x1] - sat[y0 * w + x1] - sat[y1 * w + x0] + sat[y0 * w + x0];
+}
 
-//Function object to do a less on two points in the quality map
-class comp_qual
+// Adds each row of a set of tables into the next one.  The rows already hold their
+// own running sums so this completes the tables.  Split across columns.
+class satColumnBody : public cv::ParallelLoopBody
 {
 public:
-
-    int operator() (const qual &p1, const qual &p2)
+    double **m_tables;
+    int m_count;
+    int m_nx;
+    int m_ny;
+    satColumnBody(double **tables, int count, int nx, int ny):
+        m_tables(tables), m_count(count), m_nx(nx), m_ny(ny){}
+    void operator() (const cv::Range &range) const
     {
-    return (p1.m_q < p2.m_q);
+        int w = m_nx + 1;
+        for (int t = 0; t < m_count; ++t){
+            double *sat = m_tables[t];
+            for (int y = 2; y <= m_ny; ++y){
+                double *row = sat + y * w;
+                const double *prev = row - w;
+                for (int x = range.start; x < range.end; ++x)
+                    row[x] += prev[x];
+            }
+        }
     }
 };
 
-priority_queue<qual,vector<qual>,comp_qual> To_Do;
-/* input is normalized from 0 to 1 */
-
-#define GRAD(x) (((x) > 0.5) ? ((x)-1.0) : (((x) <= -0.5) ? ((x)+1.0) : (x)))
-
-/* Insert new pixel into the to do deque. Sorted by quality.  Best at end */
-inline void Insert_To_Do(double val, int index, double q)
+static double **satTables(std::vector<double> &work, double **tables, int count, int nx, int ny)
 {
-  unwrapped[index] = val;
-  To_Do.push(qual(index, q));
-  flags[index] =1;
-  return;
+    size_t tsize = (size_t)(nx + 1) * (ny + 1);
+    if (work.size() < tsize * count)
+        work.resize(tsize * count);
+    for (int t = 0; t < count; ++t){
+        tables[t] = &work[0] + t * tsize;
+        std::fill(tables[t], tables[t] + nx + 1, 0.);
+    }
+    return tables;
 }
 
-/* Insert the four neighboring pixels of x,y
-into the to do list.  The quality value for x,y  is val */
-void Add_Neighbors(int mid_ndx, double val)
+// Wrapped gradients used by the dv map. Zero on the last column and row.
+static inline void dvGradients(const double *p, int x, int y, int nx, int ny, double &dx, double &dy)
 {
+    dx = (x == nx - 1) ? 0.0 : WRAP(p[x + 1] - p[x]);
+    dy = (y == ny - 1) ? 0.0 : WRAP(p[x + nx] - p[x]);
+}
 
-    double  grad;
-    int x = mid_ndx % xsize;
-    int y = mid_ndx / xsize;
-
-    int ndx = mid_ndx -1;
-
-    // left neighbor
-    if ((x-1)>= 0 && !(flags[ndx]))
+// Per row count and sums of the valid gradients.  Used to center the gradients so the
+// tables stay small and the variance does not lose precision on large maps.
+class dvMeanBody : public cv::ParallelLoopBody
+{
+public:
+    const double *m_phase;
+    double *m_rowSums;
+    int m_nx;
+    int m_ny;
+    dvMeanBody(const double *phase, double *rowSums, int nx, int ny):
+        m_phase(phase), m_rowSums(rowSums), m_nx(nx), m_ny(ny){}
+    void operator() (const cv::Range &range) const
     {
-        grad = GRAD(phase[ndx]- phase[mid_ndx]);  // left - middle
-        Insert_To_Do( val + grad, ndx, -fabs(grad));
+        for (int y = range.start; y < range.end; ++y){
+            const double *p = m_phase + y * m_nx;
+            double n = 0, sx = 0, sy = 0;
+            for (int x = 0; x < m_nx; ++x){
+                double dx, dy;
+                dvGradients(p, x, y, m_nx, m_ny, dx, dy);
+                if (0.0 != dx && 0.0 != dy){
+                    n += 1.;
+                    sx += dx;
+                    sy += dy;
+                }
+            }
+            m_rowSums[3 * y] = n;
+            m_rowSums[3 * y + 1] = sx;
+            m_rowSums[3 * y + 2] = sy;
+        }
     }
+};
 
-    // right neighbor
-    ndx += 2;
-    if ((x+1) < xsize && !(flags[ndx])) {
-        grad = GRAD(phase[ndx] -phase[mid_ndx]); //right - middle
-        Insert_To_Do(val + grad, ndx, -fabs(grad));
+// Row running sums of the valid gradient count, dx, dx^2, dy and dy^2.
+class dvRowBody : public cv::ParallelLoopBody
+{
+public:
+    const double *m_phase;
+    double **m_tables;
+    int m_nx;
+    int m_ny;
+    double m_mx;
+    double m_my;
+    dvRowBody(const double *phase, double **tables, int nx, int ny, double mx, double my):
+        m_phase(phase), m_tables(tables), m_nx(nx), m_ny(ny), m_mx(mx), m_my(my){}
+    void operator() (const cv::Range &range) const
+    {
+        int nx = m_nx;
+        int w = nx + 1;
+        for (int y = range.start; y < range.end; ++y){
+            const double *p = m_phase + y * nx;
+            double *n = m_tables[0] + (y + 1) * w;
+            double *sx = m_tables[1] + (y + 1) * w;
+            double *sxx = m_tables[2] + (y + 1) * w;
+            double *sy = m_tables[3] + (y + 1) * w;
+            double *syy = m_tables[4] + (y + 1) * w;
+            n[0] = sx[0] = sxx[0] = sy[0] = syy[0] = 0.;
+            double an = 0, ax = 0, axx = 0, ay = 0, ayy = 0;
+            for (int x = 0; x < nx; ++x){
+                double dx, dy;
+                dvGradients(p, x, y, nx, m_ny, dx, dy);
+                if (0.0 != dx && 0.0 != dy){
+                    dx -= m_mx;
+                    dy -= m_my;
+                    an += 1.;
+                    ax += dx;
+                    axx += dx * dx;
+                    ay += dy;
+                    ayy += dy * dy;
+                }
+                n[x + 1] = an;
+                sx[x + 1] = ax;
+                sxx[x + 1] = axx;
+                sy[x + 1] = ay;
+                syy[x + 1] = ayy;
+            }
+        }
     }
+};
 
-    //up neighbor
-    ndx = mid_ndx - xsize;
-    if ((y-1) >= 0  && !(flags[ndx]))
+// Windows are clipped to [0, n-1) in each direction to match the reference maps.
+class dvWindowBody : public cv::ParallelLoopBody
+{
+public:
+    double **m_tables;
+    double *m_qmap;
+    int m_nx;
+    int m_ny;
+    int m_width;
+    double m_tolx;
+    double m_toly;
+    dvWindowBody(double **tables, double *qmap, int nx, int ny, int width):
+        m_tables(tables), m_qmap(qmap), m_nx(nx), m_ny(ny), m_width(width)
     {
-        grad = GRAD(phase[ndx] -phase[mid_ndx]);  //up - middle
-        Insert_To_Do( val + grad, ndx, -fabs(grad));
+        size_t last = (size_t)(nx + 1) * (ny + 1) - 1;
+        m_tolx = 64. * DBL_EPSILON * tables[2][last];
+        m_toly = 64. * DBL_EPSILON * tables[4][last];
     }
+    void operator() (const cv::Range &range) const
+    {
+        int w = m_nx + 1;
+        int start = -(m_width/2);
+        int end = start + m_width;
+        double size = m_width * m_width;
+        for (int y = range.start; y < range.end; ++y){
+            int y0 = max(y + start, 0);
+            int y1 = min(y + end, m_ny - 1);
+            double *q = m_qmap + y * m_nx;
+            for (int x = 0; x < m_nx; ++x){
+                int x0 = max(x + start, 0);
+                int x1 = min(x + end, m_nx - 1);
+                double n = (x1 > x0 && y1 > y0) ? boxSum(m_tables[0], w, x0, y0, x1, y1) : 0.;
+                if (n < 1.){
+                    q[x] = 0;
+                    continue;
+                }
+                double mx = boxSum(m_tables[1], w, x0, y0, x1, y1);
+                double my = boxSum(m_tables[3], w, x0, y0, x1, y1);
+                double vx = boxSum(m_tables[2], w, x0, y0, x1, y1) - mx * mx / n;
+                double vy = boxSum(m_tables[4], w, x0, y0, x1, y1) - my * my / n;
+                // anything below the rounding noise of the tables is a zero variance
+                if (vx < m_tolx) vx = 0.;
+                if (vy < m_toly) vy = 0.;
+                q[x] = (sqrt(vx) + sqrt(vy)) / size;
+            }
+        }
+    }
+};
 
-    // down neighbor
-    ndx= (mid_ndx + xsize);
-    if ((y+1) < ysize && !(flags[ndx])) {
-        grad = GRAD(phase[ndx] - phase[mid_ndx]); // down - middle
-        Insert_To_Do(val + grad, ndx, -fabs(grad));
+void dv_quality_map_integral (const double *pphase, int width, double *qmap, int nx, int ny,
+                              std::vector<double> *work)
+{
+    std::vector<double> rowSums(3 * ny);
+    cv::parallel_for_(cv::Range(0, ny), dvMeanBody(pphase, &rowSums[0], nx, ny));
+    double n = 0, mx = 0, my = 0;
+    for (int y = 0; y < ny; ++y){
+        n += rowSums[3 * y];
+        mx += rowSums[3 * y + 1];
+        my += rowSums[3 * y + 2];
     }
+    if (n > 0){
+        mx /= n;
+        my /= n;
+    }
+
+    std::vector<double> local;
+    double *tables[5];
+    satTables(work ? *work : local, tables, 5, nx, ny);
+    cv::parallel_for_(cv::Range(0, ny), dvRowBody(pphase, tables, nx, ny, mx, my));
+    cv::parallel_for_(cv::Range(0, nx + 1), satColumnBody(tables, 5, nx, ny));
+    cv::parallel_for_(cv::Range(0, ny), dvWindowBody(tables, qmap, nx, ny, width));
 }
 
-/* quality guided path following for phase unwrapping */
-void QGPathFollower()
+// Row running sums of the non zero count, sin and cos of the phase.
+class pcRowBody : public cv::ParallelLoopBody
 {
-    int size = xsize * ysize;
-
-    for (int cur = 0; cur < size; ++cur)
+public:
+    const double *m_phase;
+    double **m_tables;
+    int m_nx;
+    pcRowBody(const double *phase, double **tables, int nx):
+        m_phase(phase), m_tables(tables), m_nx(nx){}
+    void operator() (const cv::Range &range) const
     {
-        if (!(flags[cur]))
-        {
-            double value = unwrapped[cur] = phase[cur];
-
-            // set unwrapped flag
-            flags[cur] =1;
-
-            Add_Neighbors( cur, value);
-
-            while (!To_Do.empty())
-            {
-                int ndx = To_Do.top().m_ndx;
-                To_Do.pop();
-
-                value = unwrapped[ndx];
-
-                Add_Neighbors( ndx, value);
-
-            }  //while
+        int nx = m_nx;
+        int w = nx + 1;
+        for (int y = range.start; y < range.end; ++y){
+            const double *p = m_phase + y * nx;
+            double *n = m_tables[0] + (y + 1) * w;
+            double *sp = m_tables[1] + (y + 1) * w;
+            double *cp = m_tables[2] + (y + 1) * w;
+            n[0] = sp[0] = cp[0] = 0.;
+            double an = 0, as = 0, ac = 0;
+            for (int x = 0; x < nx; ++x){
+                if (0.0 != p[x]){
+                    an += 1.;
+                    as += sin(p[x]);
+                    ac += cos(p[x]);
+                }
+                n[x + 1] = an;
+                sp[x + 1] = as;
+                cp[x + 1] = ac;
+            }
         }
+    }
+};
 
+class pcWindowBody : public cv::ParallelLoopBody
+{
+public:
+    double **m_tables;
+    double *m_qmap;
+    int m_nx;
+    int m_ny;
+    int m_width;
+    pcWindowBody(double **tables, double *qmap, int nx, int ny, int width):
+        m_tables(tables), m_qmap(qmap), m_nx(nx), m_ny(ny), m_width(width){}
+    void operator() (const cv::Range &range) const
+    {
+        int w = m_nx + 1;
+        int start = -(m_width/2);
+        int end = start + m_width;
+        double size = m_width * m_width;
+        for (int y = range.start; y < range.end; ++y){
+            int y0 = max(y + start, 0);
+            int y1 = min(y + end, m_ny - 1);
+            double *q = m_qmap + y * m_nx;
+            for (int x = 0; x < m_nx; ++x){
+                int x0 = max(x + start, 0);
+                int x1 = min(x + end, m_nx - 1);
+                double n = (x1 > x0 && y1 > y0) ? boxSum(m_tables[0], w, x0, y0, x1, y1) : 0.;
+                if (n < 1.){
+                    q[x] = 0;
+                    continue;
+                }
+                double sp = boxSum(m_tables[1], w, x0, y0, x1, y1);
+                double cp = boxSum(m_tables[2], w, x0, y0, x1, y1);
+                q[x] = 1 - sqrt(sp*sp + cp*cp) / size;
+            }
+        }
     }
+};
 
+void pc_quality_map_integral (int nx, int ny, const double *phase, int width, double *qmap,
+                              std::vector<double> *work)
+{
+    std::vector<double> local;
+    double *tables[3];
+    satTables(work ? *work : local, tables, 3, nx, ny);
+    cv::parallel_for_(cv::Range(0, ny), pcRowBody(phase, tables, nx));
+    cv::parallel_for_(cv::Range(0, nx + 1), satColumnBody(tables, 3, nx, ny));
+    cv::parallel_for_(cv::Range(0, ny), pcWindowBody(tables, qmap, nx, ny, width));
 }
-void qg_path_follower (cv::Mat phase, double *qmap,
-                       double *unwrapped, double *path);
-
-void dv_quality_map (double *phase, int width, double *qmap, int nx, int ny);
-double* g_qqmap = NULL;
-double* path = NULL;
-
 
 /* main entrypoint for unwrapping. Input phase is scaled from 0 to 1 */
 void unwrap(double * pphase, double *punwrapped, char* bflags, int nx, int ny)
 {
-
-    xsize = nx;
-    ysize = ny;
-    unwrapped = punwrapped;
-    phase = pphase;
-
-  int size = xsize * ysize;
-  flags = bflags;
-
-
-
-  /* initialize unwrapped array */
-
-   double* qmap;
-  // make the quality map
-   if (g_qqmap)
-    delete[] g_qqmap;
-
-  g_qqmap = qmap = new double[nx * ny];
-  memset(qmap,0, sizeof(double)*size);
-
-  path = new double[nx * ny];
-  memset(path,0,sizeof(double)*size);
-
-  dv_quality_map(pphase, 5, qmap, nx, ny);
-  for (int i = 0; i < size; ++i)
-      qmap[i] *= -1.;
-
-
-  qg_path_follower(nx,ny,pphase, qmap, unwrapped, path);
-
+    unwrapContext ctx(nx, ny);
+    ctx.unwrap(pphase, punwrapped, bflags);
 }
 
 void vortex_rho_theta(int width, int height, double* rho, double* theta)
@@ -19,11 +19,99 @@
 #define PUNWRAP_H
 #include "opencv/cv.h"
 #include "opencv/highgui.h"
-void unwrap(double *pphase, double *unwrapped, char *mask, int nx, int ny);
-
+#include <vector>
 
 #define BORDER      0x1
 #define UNWRAPPED   0x2
 
 #define AVOID (BORDER | UNWRAPPED)
+
+// Quality guided path following phase unwrapper.
+// All working storage (quality map, flags, path order and the to do heap) is owned
+// by the object so any number of unwrappers may run at the same time on different
+// threads.  Buffers are kept between calls so reusing one object for maps of the
+// same size does no allocation.
+//
+// Two orderings of the to do list are available.  EXACT_HEAP pops pixels in strict
+// quality order using a binary heap and is the default.  BUCKET_QUEUE quantizes the
+// quality into a fixed number of buckets and pops first in first out within a bucket
+// which makes the whole unwrap O(N).  Pixels of nearly equal quality can then be
+// unwrapped in a different order so its results are not identical to the heap's.  Both modes find the seed of
+// each disjoint region from a seed list sorted once per unwrap instead of rescanning
+// the whole map.
+//
+// The dv quality map is normally built from summed area tables (QUALITY_INTEGRAL).
+// QUALITY_REFERENCE uses the original windowed dv_quality_map.
+class unwrapContext
+{
+public:
+    enum queueMode { EXACT_HEAP, BUCKET_QUEUE };
+    enum qualityMode { QUALITY_INTEGRAL, QUALITY_REFERENCE };
+
+    unwrapContext(int nx = 0, int ny = 0, queueMode mode = EXACT_HEAP);
+    void resize(int nx, int ny);
+    void setQueueMode(queueMode mode, int buckets = 4096);
+    queueMode mode() const { return m_mode; }
+    void setQualityMode(qualityMode mode) { m_qualityMode = mode; }
+    qualityMode quality() const { return m_qualityMode; }
+
+    // Input phase is scaled from 0 to 1.  mask is non zero outside of the mirror.
+    // Uses a dv quality map of the phase to guide the unwrap.
+    void unwrap(const double *phase, double *unwrapped, const char *mask);
+
+    // Unwrap using a caller supplied quality map. Pixels with zero phase are skipped.
+    void unwrap(const double *phase, const double *qmap, double *unwrapped);
+
+    const double *qualityMap() const { return &m_qmap[0]; }
+    const double *path() const { return &m_path[0]; }
+    int width() const { return m_nx; }
+    int height() const { return m_ny; }
+
+private:
+    int m_nx;
+    int m_ny;
+    std::vector<double> m_qmap;
+    std::vector<double> m_path;
+    std::vector<char> m_flags;
+    std::vector<int> m_todo;
+    int m_end;
+
+    queueMode m_mode;
+    int m_nbuckets;
+    std::vector<int> m_head;    // first pixel in each bucket, -1 if empty
+    std::vector<int> m_tail;    // last pixel in each bucket
+    std::vector<int> m_next;    // next pixel in the same bucket
+    int m_top;                  // highest bucket that may be non empty
+    double m_qmin;
+    double m_qscale;
+    std::vector<int> m_seeds;   // candidate seeds, best quality first
+    int m_seedPos;
+    qualityMode m_qualityMode;
+    std::vector<double> m_sat;  // summed area table workspace
+
+    void pathFollower(const double *phase, const double *qmap, double *unwrapped);
+    void makeSeedList(const double *qmap);
+    int nextSeed();
+    inline int bucketOf(double q) const {
+        int b = (int)((q - m_qmin) * m_qscale);
+        return (b < 0) ? 0 : ((b >= m_nbuckets) ? m_nbuckets - 1 : b);
+    }
+    void push(int ndx, const double *qmap);
+    int pop(const double *qmap);
+};
+
+// Reference quality maps.  Cost is O(N * width^2).
+void dv_quality_map (const double *pphase,int width, double *qmap, int nx, int ny);
+void pc_quality_map (int nx, int ny, const double *phase, int width, double *qmap);
+
+// The same maps computed from summed area tables of the phase derivatives (dv) or of
+// the sin and cos of the phase (pc).  Cost per pixel does not depend on width and
+// rows are processed in parallel.  work is optional storage reused between calls.
+void dv_quality_map_integral (const double *pphase, int width, double *qmap, int nx, int ny,
+                              std::vector<double> *work = 0);
+void pc_quality_map_integral (int nx, int ny, const double *phase, int width, double *qmap,
+                              std::vector<double> *work = 0);
+
+// Convenience wrapper that unwraps using a temporary context.
+void unwrap(double *pphase, double *unwrapped, char *mask, int nx, int ny);
 #endif
@@ -0,0 +1,152 @@
+/******************************************************************************
+**
+**  Copyright 2016 Dale Eason
+**  This file is part of DFTFringe
+**  is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation version 3 of the License
+
+** DFTFringe is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with DFTFringe.  If not, see <http://www.gnu.org/licenses/>.
+
+****************************************************************************/
+#include "referencepsf.h"
+#include "simulationsview.h"
+#include <QByteArray>
+#include <QHash>
+#include <cmath>
+#include <vector>
+
+double apertureFill(const cv::Mat &mask){
+    cv::Mat cols;
+    cv::reduce(mask != 0, cols, 0, CV_REDUCE_MAX);
+    int first = -1, last = -1;
+    for (int x = 0; x < cols.cols; ++x){
+        if (cols.at<uchar>(0, x)){
+            if (first < 0)
+                first = x;
+            last = x;
+        }
+    }
+    if (first < 0)
+        return 1.;
+    return (double)(last - first + 1) / mask.cols;
+}
+
+// The aperture is resized to pupilSize/pad samples across the mask width, so it spans
+// fill * pupilSize/pad samples and one psf pixel is lambda/(pad D) * fill radians.
+psfStats computePsfStats(const cv::Mat &psf, double pad, double fill, double lambda,
+                         double diameter){
+    psfStats st;
+    int c = psf.cols/2;
+    int maxr = c;
+    std::vector<double> ring(maxr + 1, 0.);
+    double total = 0.;
+    for (int y = 0; y < psf.rows; ++y){
+        const double *p = psf.ptr<double>(y);
+        for (int x = 0; x < psf.cols; ++x){
+            double e = p[x] * p[x];
+            total += e;
+            int r = (int)sqrt((double)((x - c) * (x - c) + (y - c) * (y - c)));
+            if (r <= maxr)
+                ring[r] += e;
+        }
+    }
+    if (total <= 0.)
+        return st;
+    double center = psf.at<double>(c, c);
+    st.peak = center * center / total;
+
+    double arcsec = 206265. * lambda * 1.e-6 / (pad * diameter) * fill;
+    double sum = 0.;
+    for (int r = 0; r <= maxr; ++r){
+        double next = sum + ring[r];
+        if (st.ee50 == 0. && next >= .5 * total)
+            st.ee50 = (r + (.5 * total - sum) / ring[r]) * arcsec;
+        if (next >= .8 * total){
+            st.ee80 = (r + (.8 * total - sum) / ring[r]) * arcsec;
+            break;
+        }
+        sum = next;
+    }
+    return st;
+}
+
+referencePsf::referencePsf(const cv::Mat &mask, int pupilSize, double pad, double obstruction,
+                           double lambda, double diameter):
+    pupilSize(pupilSize), pad(pad), maskRows(mask.rows), maskCols(mask.cols),
+    maskHash(hashMask(mask)), obstruction(obstruction), lambda(lambda), diameter(diameter)
+{
+    cv::Mat perfect = cv::Mat::zeros(mask.size(), CV_64F);
+    psf = SimulationsView::starTest(perfect, mask, pupilSize, pad);
+    // mtfCurve squares a column in place
+    mtf = SimulationsView::mtfCurve(psf.clone());
+    stats = computePsfStats(psf, pad, apertureFill(mask), lambda, diameter);
+    area = cv::countNonZero(mask);
+}
+
+size_t referencePsf::bytes() const
+{
+    return psf.total() * psf.elemSize() + mtf.size() * sizeof(QPointF);
+}
+
+bool referencePsf::matches(const cv::Mat &mask, uint hash, int size, double p, double obs,
+                           double l, double d) const
+{
+    return mask.rows == maskRows && mask.cols == maskCols && hash == maskHash &&
+            size == pupilSize && p == pad && obs == obstruction && l == lambda &&
+            d == diameter;
+}
+
+uint referencePsf::hashMask(const cv::Mat &mask)
+{
+    cv::Mat m = mask.isContinuous() ? mask : mask.clone();
+    return qHash(QByteArray::fromRawData((const char *)m.data, (int)(m.total() * m.elemSize())));
+}
+
+referencePsfCache *referencePsfCache::m_instance = 0;
+referencePsfCache *referencePsfCache::get_Instance(){
+    if (m_instance == 0){
+        m_instance = new referencePsfCache;
+    }
+    return m_instance;
+}
+
+referencePsfCache::referencePsfCache():
+    m_maxEntries(8), m_hits(0), m_misses(0)
+{
+}
+
+// Made while holding the lock like zernikeBasisCache, so the psf and mtf jobs of a
+// star test that both miss make the entry once.
+referencePsfPtr referencePsfCache::get(const cv::Mat &mask, int pupilSize, double pad,
+                                       double obstruction, double lambda, double diameter)
+{
+    uint hash = referencePsf::hashMask(mask);
+    QMutexLocker lock(&m_lock);
+    for (int i = 0; i < m_entries.size(); ++i){
+        if (m_entries[i]->matches(mask, hash, pupilSize, pad, obstruction, lambda, diameter)){
+            ++m_hits;
+            if (i > 0)
+                m_entries.move(i, 0);
+            return m_entries[0];
+        }
+    }
+    ++m_misses;
+    referencePsfPtr ref(new referencePsf(mask, pupilSize, pad, obstruction, lambda, diameter));
+    m_entries.prepend(ref);
+    while (m_entries.size() > m_maxEntries)
+        m_entries.removeLast();
+    return ref;
+}
+
+void referencePsfCache::clear()
+{
+    QMutexLocker lock(&m_lock);
+    m_entries.clear();
+}
@@ -0,0 +1,95 @@
+/******************************************************************************
+**
+**  Copyright 2016 Dale Eason
+**  This file is part of DFTFringe
+**  is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation version 3 of the License
+
+** DFTFringe is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with DFTFringe.  If not, see <http://www.gnu.org/licenses/>.
+
+****************************************************************************/
+#ifndef REFERENCEPSF_H
+#define REFERENCEPSF_H
+#include <QMutex>
+#include <QSharedPointer>
+#include <QList>
+#include <QPolygonF>
+#include "opencv/cv.h"
+
+// Strehl and encircled energy of a psf made by SimulationsView::starTest.
+struct psfStats
+{
+    psfStats() : peak(0.), ee50(0.), ee80(0.) {}
+    double peak;        // center intensity over total energy
+    double ee50;        // radius holding half the energy, arc seconds
+    double ee80;
+};
+
+// Fraction of the mask width the aperture spans.
+double apertureFill(const cv::Mat &mask);
+
+// Stats of a starTest psf made with pad from an aperture spanning fill of the mask
+// width.  lambda in nm and diameter in mm give the arc seconds of one psf pixel.
+psfStats computePsfStats(const cv::Mat &psf, double pad, double fill, double lambda,
+                         double diameter);
+
+// Psf and mtf of a perfect mirror with the given aperture.  They depend only on the
+// aperture mask, the fft size and padding, so they are shared by every wavefront of
+// the same mirror.
+class referencePsf
+{
+public:
+    int pupilSize;
+    double pad;
+    int maskRows;
+    int maskCols;
+    uint maskHash;
+    double obstruction;
+    double lambda;
+    double diameter;
+
+    cv::Mat psf;        // magnitude, as starTest returns it
+    QPolygonF mtf;
+    psfStats stats;
+    int area;           // aperture pixels, to compare with an obstructed mirror
+
+    referencePsf(const cv::Mat &mask, int pupilSize, double pad, double obstruction,
+                 double lambda, double diameter);
+    size_t bytes() const;
+    bool matches(const cv::Mat &mask, uint hash, int pupilSize, double pad,
+                 double obstruction, double lambda, double diameter) const;
+    static uint hashMask(const cv::Mat &mask);
+};
+typedef QSharedPointer<const referencePsf> referencePsfPtr;
+
+// Process wide cache of referencePsf keyed on the aperture and the simulation
+// settings.  The least recently used are dropped beyond a fixed count.  Safe to use
+// from several threads, a second thread asking for an entry being made waits for it.
+// get_Instance() is not, the first call must be made before any worker uses it.
+class referencePsfCache
+{
+public:
+    static referencePsfCache *get_Instance();
+    referencePsfPtr get(const cv::Mat &mask, int pupilSize, double pad, double obstruction,
+                        double lambda, double diameter);
+    int hits() const { return m_hits; }
+    int misses() const { return m_misses; }
+    void clear();
+private:
+    referencePsfCache();
+    static referencePsfCache *m_instance;
+    QMutex m_lock;
+    QList<referencePsfPtr> m_entries;     // most recently used first
+    int m_maxEntries;
+    int m_hits;
+    int m_misses;
+};
+
+#endif // REFERENCEPSF_H
@@ -17,12 +17,15 @@
 ****************************************************************************/
 #include "rotationdlg.h"
 #include "ui_rotationdlg.h"
+#include <QSettings>
 
 RotationDlg::RotationDlg( QList<int> list, QWidget *parent) :
     QDialog(parent),
     ui(new Ui::RotationDlg), list(list)
 {
     ui->setupUi(this);
+    QSettings set;
+    ui->modeCB->setCurrentIndex(set.value("rotationMode", ROTATE_RESAMPLE).toInt());
 }
 
 RotationDlg::~RotationDlg()
@@ -33,5 +36,7 @@ RotationDlg::~RotationDlg()
 void RotationDlg::on_buttonBox_accepted()
 {
     int sign = (ui->CCWCB->isChecked()) ?  -1:1;
-    emit rotateTheseSig(sign * ui->angleSB->value(), list);
+    QSettings set;
+    set.setValue("rotationMode", ui->modeCB->currentIndex());
+    emit rotateTheseSig(sign * ui->angleSB->value(), list, ui->modeCB->currentIndex());
 }
@@ -20,6 +20,10 @@
 
 #include <QDialog>
 
+// How the wavefronts are turned.  The zernike modes turn the fitted terms and make
+// the surface from them, which needs no resample or refit.
+enum rotationMode { ROTATE_RESAMPLE, ROTATE_ZERNIKES, ROTATE_ZERNIKES_RESIDUAL };
+
 namespace Ui {
 class RotationDlg;
 }
@@ -33,7 +37,7 @@ public:
     ~RotationDlg();
 signals:
 
-    void rotateTheseSig(double, QList<int>);
+    void rotateTheseSig(double, QList<int>, int);
 private slots:
     void on_buttonBox_accepted();
 
@@ -66,6 +66,12 @@ bool Settings2::showDFT(){
 bool Settings2::showMask(){
     return m_debug->showMask();
 }
+bool Settings2::fastUnwrap(){
+    return m_debug->fastUnwrap();
+}
+bool Settings2::referenceQualityMap(){
+    return m_debug->referenceQualityMap();
+}
 
 int Settings2::dftSize(){
     return m_dft->DFTSize();
@@ -44,6 +44,8 @@ public:
     static bool showDFT();
     static int dftSize();
     static bool showMask();
+    static bool fastUnwrap();
+    static bool referenceQualityMap();
     static bool shouldHflipIgram();
 signals:
     void igramOutlineParmsChanged(int,int,QColor,QColor);
@@ -25,6 +25,8 @@ settingsDebug::settingsDebug(QWidget *parent) :
     ui->setupUi(this);
     QSettings set;
     ui->checkBox->setChecked(set.value("DebugShowMask",false).toBool());
+    ui->fastUnwrapCB->setChecked(set.value("DebugFastUnwrap",false).toBool());
+    ui->referenceQualityCB->setChecked(set.value("DebugReferenceQualityMap",false).toBool());
 }
 
 settingsDebug::~settingsDebug()
@@ -40,3 +42,23 @@ void settingsDebug::on_checkBox_clicked(bool arg)
     QSettings set;
     set.setValue("DebugShowMask",arg );
 }
+
+bool settingsDebug::fastUnwrap(){
+    return ui->fastUnwrapCB->isChecked();
+}
+
+void settingsDebug::on_fastUnwrapCB_clicked(bool arg)
+{
+    QSettings set;
+    set.setValue("DebugFastUnwrap",arg );
+}
+
+bool settingsDebug::referenceQualityMap(){
+    return ui->referenceQualityCB->isChecked();
+}
+
+void settingsDebug::on_referenceQualityCB_clicked(bool arg)
+{
+    QSettings set;
+    set.setValue("DebugReferenceQualityMap",arg );
+}
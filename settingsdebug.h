@@ -32,9 +32,15 @@ public:
     explicit settingsDebug(QWidget *parent = 0);
     ~settingsDebug();
     bool showMask();
+    bool fastUnwrap();
+    bool referenceQualityMap();
 private slots:
     void on_checkBox_clicked(bool checked);
 
+    void on_fastUnwrapCB_clicked(bool checked);
+
+    void on_referenceQualityCB_clicked(bool checked);
+
 private:
     Ui::settingsDebug *ui;
 };
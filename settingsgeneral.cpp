@@ -1,11 +1,15 @@
 #include "settingsgeneral.h"
 #include "ui_settingsgeneral.h"
+#include <QSettings>
 
 settingsGeneral::settingsGeneral(QWidget *parent) :
     QDialog(parent),
     ui(new Ui::settingsGeneral)
 {
     ui->setupUi(this);
+    QSettings set;
+    ui->surfaceWorkersSb->setValue(set.value("surfaceWorkers", 0).toInt());
+    ui->wavefrontMemorySb->setValue(set.value("wavefrontMemoryMB", 0).toInt());
 }
 
 settingsGeneral::~settingsGeneral()
@@ -15,3 +19,25 @@ settingsGeneral::~settingsGeneral()
 bool settingsGeneral::useRMS(){
     return ui->rmsRb->isChecked();
 }
+
+// 0 means one worker per processor core.
+int settingsGeneral::surfaceWorkers(){
+    return ui->surfaceWorkersSb->value();
+}
+
+void settingsGeneral::on_surfaceWorkersSb_valueChanged(int arg)
+{
+    QSettings set;
+    set.setValue("surfaceWorkers", arg);
+}
+
+// 0 means no limit.
+int settingsGeneral::wavefrontMemoryMB(){
+    return ui->wavefrontMemorySb->value();
+}
+
+void settingsGeneral::on_wavefrontMemorySb_valueChanged(int arg)
+{
+    QSettings set;
+    set.setValue("wavefrontMemoryMB", arg);
+}
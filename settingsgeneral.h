@@ -15,6 +15,11 @@ public:
     explicit settingsGeneral(QWidget *parent = 0);
     ~settingsGeneral();
     bool useRMS();
+    int surfaceWorkers();
+    int wavefrontMemoryMB();
+private slots:
+    void on_surfaceWorkersSb_valueChanged(int arg);
+    void on_wavefrontMemorySb_valueChanged(int arg);
 
 private:
     Ui::settingsGeneral *ui;
@@ -30,6 +30,13 @@
 #include "mirrordlg.h"
 #include <qwt_scale_draw.h>
 #include <QSettings>
+#include <QRunnable>
+#include <QScrollArea>
+#include <QVBoxLayout>
+#include <QPushButton>
+#include <QFileDialog>
+#include <QFileInfo>
+#include "referencepsf.h"
 double M2PI = M_PI * 2.;
 SimulationsView *SimulationsView::m_Instance = 0;
 class arcSecScaleDraw: public QwtScaleDraw
@@ -51,9 +58,15 @@ public:
 };
 SimulationsView::SimulationsView(QWidget *parent) :
     QWidget(parent),
-     needs_drawing(false),ui(new Ui::SimulationsView),m_wf(0)
+     needs_drawing(false),ui(new Ui::SimulationsView),m_wf(0),
+     m_generation(0), m_pending(0), m_focusImages(0), m_aliased(false),
+     m_seriesWindow(0), m_seriesLabel(0)
 {
     ui->setupUi(this);
+    m_pool = new QThreadPool(this);
+    qRegisterMetaType<starTestResult>("starTestResult");
+    // made here on the GUI thread, the star test jobs all ask for it at once
+    referencePsfCache::get_Instance();
     ui->MTF->setAxisTitle( QwtPlot::yLeft, "Percent Contrast" );
     ui->MTF->setAxisTitle(QwtPlot::xBottom,"Resolution arcseconds");
 
@@ -73,15 +86,22 @@ SimulationsView::SimulationsView(QWidget *parent) :
     ui->MTF->setAxisScaleDraw(ui->MTF->xBottom, new arcSecScaleDraw(mirrorDlg::get_Instance()->diameter));
 
     ui->MakePB->setEnabled(false);
+    ui->seriesPB->setEnabled(false);
     QSettings set;
     ui->FFTSizeSB->blockSignals(true);
     ui->FFTSizeSB->setValue(set.value("FFTSize", 1000).toInt());
     ui->FFTSizeSB->blockSignals(false);
+    ui->singlePrecisionCb->blockSignals(true);
+    ui->singlePrecisionCb->setChecked(set.value("starTestSinglePrecision", false).toBool());
+    ui->singlePrecisionCb->blockSignals(false);
     connect(&m_guiTimer, SIGNAL(timeout()), this, SLOT(on_MakePB_clicked()));
 }
 
 SimulationsView::~SimulationsView()
 {
+    if (m_request)
+        m_request->cancelled.store(1);
+    m_pool->waitForDone();
     delete ui;
 }
 
@@ -94,6 +114,7 @@ void SimulationsView::setSurface(wavefront *wf){
     }
 
     ui->MakePB->setEnabled((wf != 0));
+    ui->seriesPB->setEnabled((wf != 0));
     needs_drawing = true;
 
     if (!isHidden())
@@ -111,25 +132,24 @@ SimulationsView *SimulationsView::getInstance(QWidget *parent){
 
 
 cv::Mat SimulationsView::nulledSurface(double defocus){
-    cv::Mat out;
+    QSettings settings;
+    bool GB_enabled = settings.value("GBlur", true).toBool();
+    int gbValue = settings.value("GBValue", 21).toInt();
+    return nulledSurface(*(m_Instance->m_wf), zernEnables, defocus, GB_enabled, gbValue);
+}
 
+// defocus is in mm on input
+cv::Mat SimulationsView::nulledSurface(wavefront &wf, const std::vector<bool> &enables,
+                                       double defocus, bool blur, int blurSize){
     mirrorDlg *md = mirrorDlg::get_Instance();
-
-
-    // defocus is in mm on input
-
-    std::vector<double> newZerns = m_Instance->m_wf->InputZerns;
+    std::vector<double> newZerns = wf.InputZerns;
     zernikeProcess &zp = *zernikeProcess::get_Instance();
 
     newZerns[3] -= defocus;
 
-    // if use wavefront then apply defocus to wavefront.
-    QSettings settings;
-    bool GB_enabled = settings.value("GBlur", true).toBool();
-    double gbValue = settings.value("GBValue", 21).toInt();
-    cv::Mat nulled_surface = zp.null_unwrapped( *(m_Instance->m_wf), newZerns, zernEnables);
-    if (GB_enabled){
-        cv::GaussianBlur( nulled_surface, nulled_surface , cv::Size( gbValue, gbValue ),0,0);
+    cv::Mat nulled_surface = zp.null_unwrapped(wf, newZerns, enables);
+    if (blur){
+        cv::GaussianBlur( nulled_surface, nulled_surface , cv::Size( blurSize, blurSize ),0,0);
     }
     nulled_surface  *= M2PI * md->lambda/550.;
     return nulled_surface;
@@ -137,48 +157,116 @@ cv::Mat SimulationsView::nulledSurface(double defocus){
 
 // create star test using pupil_size which is usually smaller than the wavefront being sampled.
 cv::Mat SimulationsView::computeStarTest(cv::Mat surface, int pupil_size, double pad , bool returnComplex){
-    alias = false;
-    cv::Mat out;
-
-    int nx = surface.size().width;//pupil_size;
-    int ny = surface.size().height;
+    return starTest(surface, m_wf->workMask, pupil_size, pad, returnComplex, &alias);
+}
 
-    cv::Mat tmp[] = {cv::Mat::zeros(Size(nx,ny),CV_64F)
-                    ,cv::Mat::zeros(Size(nx,ny),CV_64F)};
+// on * cos and on * sin of a row of angles.  The float row uses the vectorized
+// sin and cos of cv::polarToCart, the double row keeps the accuracy of the library.
+static inline void pupilSinCos(const cv::Mat_<float> &on, const cv::Mat_<float> &angle,
+                               cv::Mat_<float> &c, cv::Mat_<float> &s)
+{
+    cv::polarToCart(on, angle, c, s);
+}
 
-    for (int y = 0; y < ny; ++y){
-        for (int x = 0; x < nx; ++x){
-            tmp[1].at<double>(y,x) =  cos(surface.at<double>(y,x));
-            tmp[0].at<double>(y,x) = -sin(surface.at<double>(y,x));
+static inline void pupilSinCos(const cv::Mat_<double> &on, const cv::Mat_<double> &angle,
+                               cv::Mat_<double> &c, cv::Mat_<double> &s)
+{
+    const double *m = on[0];
+    const double *a = angle[0];
+    double *pc = c[0];
+    double *ps = s[0];
+    for (int x = 0; x < angle.cols; ++x){
+        pc[x] = m[x] * cos(a[x]);
+        ps[x] = m[x] * sin(a[x]);
+    }
+}
 
+// Masked pupil of one block of rows.  The real part is -sin and the imaginary part cos
+// of the surface phase, 0 outside the mask.  A row is done in whole passes with no
+// branch per pixel, the mask as 0 or 1 is the magnitude so the outside comes out 0.
+template <typename T>
+class pupilBody : public cv::ParallelLoopBody
+{
+public:
+    const cv::Mat &m_surface;
+    const cv::Mat &m_mask;
+    cv::Mat &m_pupil;
+    pupilBody(const cv::Mat &surface, const cv::Mat &mask, cv::Mat &pupil):
+        m_surface(surface), m_mask(mask), m_pupil(pupil){}
+    void operator() (const cv::Range &range) const
+    {
+        int nx = m_surface.cols;
+        cv::Mat_<T> on(1, nx), angle(1, nx), c(1, nx), s(1, nx);
+        for (int y = range.start; y < range.end; ++y){
+            const uchar *m = m_mask.ptr<uchar>(y);
+            T *o = on[0];
+            for (int x = 0; x < nx; ++x)
+                o[x] = (T)(m[x] != 0);
+            m_surface.row(y).convertTo(angle, angle.type());
+            pupilSinCos(on, angle, c, s);
+            const T *pc = c[0];
+            const T *ps = s[0];
+            T *p = m_pupil.ptr<T>(y);
+            for (int x = 0; x < nx; ++x){
+                p[2 * x] = -ps[x];
+                p[2 * x + 1] = pc[x];
+            }
         }
     }
+};
 
-    // apply the mask
-    cv::Mat tmp2;
-    tmp[0].copyTo(tmp2, m_wf->workMask);
-    tmp[0] = tmp2.clone();
-    tmp[1].copyTo(tmp2, m_wf->workMask);
-    tmp[1] = tmp2.clone();
-    //pupil_size += 1;
-    // now reduce the wavefront with pad to fit into the fft size;
-    // new padSize is fft_size/pad;
+// A psf that spills past the fft window folds back in from the edges, which shows
+// as much energy near the edge of the middle row as near its center.
+static bool psfAliased(const cv::Mat &psf){
+    double edge_avg = 0.;
+    double center_avg = 0.;
+    int half = psf.rows /2;
+    int last = psf.rows * .3;
 
-    int padSize = pupil_size/pad;
+    for (int i = 0; i < last; ++i)
+    {
+        edge_avg += psf.at<double>(half,i);
+        center_avg += psf.at<double>(half, i+half);
 
-    cv::resize(tmp[0],tmp[0],cv::Size(padSize,padSize),cv::INTER_AREA);
-    cv::resize(tmp[1],tmp[1],cv::Size(padSize,padSize),cv::INTER_AREA);
+    }
+    return center_avg/edge_avg < 2;
+}
 
-    cv::Mat in[] = {cv::Mat::zeros(Size(pupil_size,pupil_size),CV_64F)
-                    ,cv::Mat::zeros(Size(pupil_size,pupil_size),CV_64F)};
+// Tint an aliased star test image red.
+static void markAliased(cv::Mat &t){
+    cv::Mat chans[3];
+    split(t,chans);
+    chans[1] *= 0;
+    chans[2] *= 0;
+    merge(chans,3,t);
+}
 
-    tmp[0].copyTo(in[0](cv::Rect(0,0,tmp[0].cols,tmp[0].cols)));
-    tmp[1].copyTo(in[1](cv::Rect(0,0,tmp[0].cols,tmp[0].cols)));
-    //showData("xxxxff", in[0].clone());
-    cv::Mat complexIn;
+cv::Mat SimulationsView::starTest(const cv::Mat &surface, const cv::Mat &mask, int pupil_size,
+                                  double pad, bool returnComplex, bool *aliased,
+                                  bool singlePrecision){
+    if (aliased)
+        *aliased = false;
+    cv::Mat out;
+
+    int type = singlePrecision ? CV_32FC2 : CV_64FC2;
+    cv::Mat pupil(surface.size(), type);
+    if (singlePrecision)
+        cv::parallel_for_(cv::Range(0, surface.rows), pupilBody<float>(surface, mask, pupil));
+    else
+        cv::parallel_for_(cv::Range(0, surface.rows), pupilBody<double>(surface, mask, pupil));
+
+    // now reduce the wavefront with pad to fit into the fft size;
+    // new padSize is fft_size/pad;
+    // The resize goes straight into the corner of the fft buffer.  It has always been
+    // bilinear, INTER_AREA was passed where fx goes.
+    int padSize = pupil_size/pad;
+    cv::Mat complexIn = cv::Mat::zeros(pupil_size, pupil_size, type);
+    cv::Mat corner = complexIn(cv::Rect(0, 0, padSize, padSize));
+    cv::resize(pupil, corner, corner.size(), 0, 0, cv::INTER_LINEAR);
 
-    cv::merge(in,2,complexIn);
     dft(complexIn,out);
+    if (singlePrecision)
+        out.convertTo(out, CV_64F);
     shiftDFT(out);
     Mat planes[2];
     split(out, planes);
@@ -186,24 +274,9 @@ cv::Mat SimulationsView::computeStarTest(cv::Mat surface, int pupil_size, double
 
 
     // check for aliasing
-    // compute edge
-    double edge_avg = 0.;
-    double center_avg = 0.;
-    int half = pupil_size /2;
-    int last = pupil_size * .3;
-
-    for (int i = 0; i < last; ++i)
-    {
-        edge_avg += planes[0].at<double>(half,i);
-        center_avg += planes[0].at<double>(half, i+half);
-
-    }
-
-    double ddd = center_avg/edge_avg;
-
-    if (ddd < 2)
+    if (aliased && psfAliased(planes[0]))
     {
-        alias = true;
+        *aliased = true;
 /*
         AfxMessageBox(L"Warning, computed PSF was too large for the selected size of the simulation.\n"
                         L"Select larger simulation size from the Configuration Menu\n"
@@ -255,6 +328,95 @@ cv::Mat fitStarTest(cv::Mat img, int size, double gamma){
     cv::resize(t,t,cv::Size(size,size),0,0,cv::INTER_AREA);
     return t;
 }
+
+// Frames of a through focus series.  Each turns the resized pupil by its own defocus
+// phase, which is all that changes between frames, then runs its own fft.
+template <typename T>
+class focusSeriesBody : public cv::ParallelLoopBody
+{
+public:
+    const cv::Mat &m_pupil;
+    const cv::Mat &m_phase;
+    const std::vector<double> &m_defocus;
+    int m_pupilSize;
+    double m_gamma;
+    int m_frameSize;
+    std::vector<cv::Mat> &m_frames;
+    std::vector<uchar> &m_aliased;
+    QAtomicInt *m_cancelled;
+    focusSeriesBody(const cv::Mat &pupil, const cv::Mat &phase, const std::vector<double> &defocus,
+                    int pupilSize, double gamma, int frameSize, std::vector<cv::Mat> &frames,
+                    std::vector<uchar> &aliased, QAtomicInt *cancelled):
+        m_pupil(pupil), m_phase(phase), m_defocus(defocus), m_pupilSize(pupilSize),
+        m_gamma(gamma), m_frameSize(frameSize), m_frames(frames), m_aliased(aliased),
+        m_cancelled(cancelled){}
+    void operator() (const cv::Range &range) const
+    {
+        for (int f = range.start; f < range.end; ++f){
+            if (m_cancelled && m_cancelled->load())
+                return;
+            double k = m_defocus[f];
+            cv::Mat complexIn = cv::Mat::zeros(m_pupilSize, m_pupilSize, m_pupil.type());
+            for (int y = 0; y < m_pupil.rows; ++y){
+                const T *p = m_pupil.ptr<T>(y);
+                const double *u = m_phase.ptr<double>(y);
+                T *o = complexIn.ptr<T>(y);
+                for (int x = 0; x < m_pupil.cols; ++x){
+                    if (p[2 * x] == 0 && p[2 * x + 1] == 0)
+                        continue;
+                    double c = cos(k * u[x]);
+                    double s = sin(k * u[x]);
+                    o[2 * x] = (T)(p[2 * x] * c - p[2 * x + 1] * s);
+                    o[2 * x + 1] = (T)(p[2 * x] * s + p[2 * x + 1] * c);
+                }
+            }
+            cv::Mat out;
+            dft(complexIn, out);
+            if (out.depth() != CV_64F)
+                out.convertTo(out, CV_64F);
+            shiftDFT(out);
+            Mat planes[2];
+            split(out, planes);
+            magnitude(planes[0], planes[1], planes[0]);
+            m_aliased[f] = psfAliased(planes[0]);
+            m_frames[f] = fitStarTest(planes[0], m_frameSize, m_gamma);
+        }
+    }
+};
+
+std::vector<cv::Mat> SimulationsView::focusSeries(const cv::Mat &surface, const cv::Mat &defocusPhase,
+                                                  const cv::Mat &mask, const std::vector<double> &defocus,
+                                                  int pupil_size, double pad, double gamma,
+                                                  int frameSize, bool singlePrecision,
+                                                  std::vector<bool> *aliased,
+                                                  QAtomicInt *cancelled){
+    int type = singlePrecision ? CV_32FC2 : CV_64FC2;
+    cv::Mat pupil(surface.size(), type);
+    if (singlePrecision)
+        cv::parallel_for_(cv::Range(0, surface.rows), pupilBody<float>(surface, mask, pupil));
+    else
+        cv::parallel_for_(cv::Range(0, surface.rows), pupilBody<double>(surface, mask, pupil));
+
+    // the defocus phase is smooth so turning the resized pupil by the resized phase is
+    // as good as resizing each defocused pupil
+    int padSize = pupil_size/pad;
+    cv::Mat small, phase;
+    cv::resize(pupil, small, cv::Size(padSize, padSize), 0, 0, cv::INTER_LINEAR);
+    cv::resize(defocusPhase, phase, cv::Size(padSize, padSize), 0, 0, cv::INTER_LINEAR);
+
+    std::vector<cv::Mat> frames(defocus.size());
+    std::vector<uchar> flags(defocus.size(), 0);
+    cv::Range all(0, (int)defocus.size());
+    if (singlePrecision)
+        cv::parallel_for_(all, focusSeriesBody<float>(small, phase, defocus, pupil_size, gamma,
+                                                       frameSize, frames, flags, cancelled));
+    else
+        cv::parallel_for_(all, focusSeriesBody<double>(small, phase, defocus, pupil_size, gamma,
+                                                        frameSize, frames, flags, cancelled));
+    if (aliased)
+        aliased->assign(flags.begin(), flags.end());
+    return frames;
+}
 void etoxplusy(cv::Mat data)
 {
     for (int i = 0; i < data.rows; ++i)
@@ -270,7 +432,7 @@ void etoxplusy(cv::Mat data)
         }
     }
 }
-void SimulationsView::mtf(cv::Mat star, QString txt, QColor color){
+QPolygonF SimulationsView::mtfCurve(cv::Mat star){
     cv::Mat middle = star.col(star.cols/2);
     pow(middle,2,middle);
     cv::Mat planes[] = {Mat_<double>(middle),
@@ -286,19 +448,147 @@ void SimulationsView::mtf(cv::Mat star, QString txt, QColor color){
 
     cv::normalize(mtfMag,mtfMag, 0,100,cv::NORM_MINMAX);
     int nx = (mtfMag.rows)/2;
-    QwtPlotCurve *curve1 = new QwtPlotCurve(txt);
-    curve1->setPen(QPen(color));
     QPolygonF points1;
-
-
     for (int x = 0; x < nx; ++x){
 
         points1 << QPointF((double)(x)/nx, mtfMag.at<double>(x,0));
     }
-    curve1->setSamples(points1);
+    return points1;
+}
+
+void SimulationsView::mtf(const QPolygonF &points, QString txt, QColor color){
+    QwtPlotCurve *curve1 = new QwtPlotCurve(txt);
+    curve1->setPen(QPen(color));
+    curve1->setSamples(points);
     curve1->attach(ui->MTF);
 }
 
+// Makes one image of a star test run on the view's pool.  The images do not depend on
+// each other so they all run at once and each is handed to the view when done.
+class starTestJob : public QRunnable
+{
+public:
+    starTestJob(SimulationsView *view, starTestRequestPtr req, int kind) :
+        m_view(view), m_req(req), m_kind(kind) { setAutoDelete(true); }
+    void run();
+private:
+    SimulationsView *m_view;
+    starTestRequestPtr m_req;
+    int m_kind;
+};
+
+void starTestJob::run(){
+    starTestRequest &req = *m_req;
+    if (req.cancelled.load())
+        return;
+    starTestResult r;
+    r.generation = req.generation;
+    r.kind = m_kind;
+    const cv::Mat &mask = req.wf.workMask;
+    referencePsfCache &refs = *referencePsfCache::get_Instance();
+
+    switch (m_kind){
+    case SimulationsView::INSIDE:
+    case SimulationsView::OUTSIDE: {
+        bool inside = m_kind == SimulationsView::INSIDE;
+        cv::Mat surface = SimulationsView::nulledSurface(req.wf, req.enables,
+                                    inside ? -req.defocus : req.defocus, req.blur, req.blurSize);
+        if (req.cancelled.load())
+            return;
+        cv::Mat star = SimulationsView::starTest(surface, mask, req.fftSize, req.magnify,
+                                                 false, &r.aliased, req.singlePrecision);
+        if (req.cancelled.load())
+            return;
+        cv::Mat t = fitStarTest(star, 500, req.gamma);
+        QString label = inside ? QString().sprintf("-%5.1lfmm inside", 2 * req.defocus) :
+                                 QString().sprintf("%5.1lfmm outside", 2 * req.defocus);
+        cv::putText(t, label.toStdString(), cv::Point(50,30), 1, 1, cv::Scalar(255, 255,255));
+        if (r.aliased)
+            markAliased(t);
+        r.image = t;
+        break;
+    }
+    case SimulationsView::FOCUSED: {
+        cv::Mat focused = SimulationsView::starTest(req.wf.workData, mask, 600, 40, false, 0,
+                                                      req.singlePrecision);
+        if (req.cancelled.load())
+            return;
+        cv::Mat t = fitStarTest(focused, 200, req.gamma/2);
+        cv::putText(t, "Focused", cv::Point(20,20), 1, 1, cv::Scalar(255, 255,255));
+        r.image = t;
+        break;
+    }
+    case SimulationsView::PSF:
+    case SimulationsView::MTF: {
+        cv::Mat surface = SimulationsView::nulledSurface(req.wf, req.enables, 0., req.blur,
+                                                         req.blurSize);
+        if (req.cancelled.load())
+            return;
+        if (m_kind == SimulationsView::MTF){
+            r.mtf = SimulationsView::mtfCurve(SimulationsView::starTest(surface, mask, 512, 2,
+                                                        false, 0, req.singlePrecision));
+            break;
+        }
+        r.image = SimulationsView::starTest(surface, mask, 600, 20, false, 0,
+                                            req.singlePrecision);
+        // Strehl against the perfect mirror, scaled by the aperture areas since the
+        // reference has no obstruction
+        referencePsfPtr ref = refs.get(req.noObstruction, 600, 20, req.obstruction, req.lambda,
+                                       req.diameter);
+        psfStats st = computePsfStats(r.image, 20, apertureFill(mask), req.lambda, req.diameter);
+        int area = cv::countNonZero(mask);
+        double strehl = (ref->stats.peak > 0. && area > 0) ?
+                    st.peak / ref->stats.peak * ref->area / area : 0.;
+        r.label = QString().sprintf("Actual Strehl %5.3lf EE80 %4.2lf\"", strehl, st.ee80);
+        break;
+    }
+    case SimulationsView::PERFECT_PSF: {
+        referencePsfPtr ref = refs.get(req.noObstruction, 600, 20, req.obstruction, req.lambda,
+                                       req.diameter);
+        r.image = ref->psf;
+        r.label = QString().sprintf("Perfect EE80 %4.2lf\"", ref->stats.ee80);
+        break;
+    }
+    case SimulationsView::PERFECT_MTF:
+        r.mtf = refs.get(req.noObstruction, 512, 2, req.obstruction, req.lambda,
+                         req.diameter)->mtf;
+        break;
+    case SimulationsView::FOCUS_SERIES: {
+        // nulledSurface is linear in the defocus so one extra surface gives the phase
+        // of each frame, blur and null settings included
+        cv::Mat surface = SimulationsView::nulledSurface(req.wf, req.enables, 0., req.blur,
+                                                         req.blurSize);
+        cv::Mat phase = SimulationsView::nulledSurface(req.wf, req.enables, 1., req.blur,
+                                                       req.blurSize) - surface;
+        int n = req.seriesFrames;
+        std::vector<double> defocus(n);
+        for (int i = 0; i < n; ++i)
+            defocus[i] = (n > 1) ? req.defocus * (2. * i/(n - 1) - 1.) : req.defocus;
+        std::vector<bool> aliased;
+        r.frames = SimulationsView::focusSeries(surface, phase, mask, defocus, req.fftSize,
+                                                req.magnify, req.gamma, 250,
+                                                req.singlePrecision, &aliased, &req.cancelled);
+        if (req.cancelled.load())
+            return;
+        for (int i = 0; i < n; ++i){
+            cv::Mat &t = r.frames[i];
+            QString label = QString().sprintf("%5.1lfmm", 2 * defocus[i]);
+            cv::putText(t, label.toStdString(), cv::Point(20,20), 1, 1, cv::Scalar(255, 255,255));
+            if (aliased[i]){
+                markAliased(t);
+                r.aliased = true;
+            }
+        }
+        cv::hconcat(r.frames, r.image);
+        break;
+    }
+    }
+    if (req.cancelled.load())
+        return;
+    QMetaObject::invokeMethod(m_view, "starTestDone", Qt::QueuedConnection,
+                              Q_ARG(starTestResult, r));
+}
+
 void SimulationsView::on_MakePB_clicked()
 {
     m_guiTimer.stop();
@@ -309,67 +599,41 @@ void SimulationsView::on_MakePB_clicked()
         QMessageBox::warning(0,"warning","Star test simulation is not suppported for flat surfaces");
         return;
     }
-    bool wasAliased = false;
-
-    QApplication::setOverrideCursor(Qt::WaitCursor);
     needs_drawing = false;
-    double defocus = ui->defocusSB->value()/2;
-    double gamma = ui->gammaSB->value();
-
-    //inside focus star test
-    cv::Mat inside = computeStarTest(nulledSurface(-defocus), ui->FFTSizeSB->value(), ui->centerMagnifySB->value());
-    cv::Mat t = fitStarTest(inside,500,gamma);
-    cv::putText(t,QString().sprintf("-%5.1lfmm inside",2 * defocus).toStdString(),cv::Point(50,30),1,1,cv::Scalar(255, 255,255));
-    wasAliased |= alias;
-    if (alias)
-    {
-        cv::Mat chans[3];
-        split(t,chans);
-        chans[1] *= 0;
-        chans[2] *= 0;
-        merge(chans,3,t);
-
-    }
-    QImage indisplay((uchar*)t.data, t.cols, t.rows, t.step, QImage::Format_RGB888);
-    ui->inside->setPixmap(QPixmap::fromImage(indisplay));
-
-    // outside focus star test
-    cv::Mat outside = computeStarTest(nulledSurface(defocus),ui->FFTSizeSB->value(),ui->centerMagnifySB->value());
-    t = fitStarTest(outside,500,gamma);
-    cv::putText(t,QString().sprintf("%5.1lfmm outside",2 * defocus).toStdString(),cv::Point(50,30),1,1,cv::Scalar(255, 255,255));
-    wasAliased |= alias;
-    if (alias)
-    {
-        cv::Mat chans[3];
-        split(t,chans);
-        chans[2] *= 0;
-        chans[1] *= 0;
-        merge(chans,3,t);
-    }
-    QImage outdisplay((uchar*)t.data, t.cols, t.rows, t.step, QImage::Format_RGB888);
-    ui->outside->setPixmap(QPixmap::fromImage(outdisplay));
-    if (wasAliased){
-        QMessageBox::warning(NULL, tr("Warning"),
-                "Computed star test (in red) was too large for the selected size of the simulation.\n"
-                                       "Select larger FFT Size or smaller Magnification\n"
-                                       "and try again.\n\n"
-                                       "Sometime this message is caused by the errors on the surface and so the simulatin may still be usable.\n"
-                                       "The error usually shows up as a series of light and dark horizontal bands or dots.");
-    }
 
-    cv::Mat focused = computeStarTest(m_wf->workData, 600,  40);
-    t = fitStarTest(focused, 200,gamma/2);
-    cv::putText(t,QString().sprintf("Focused").toStdString(),cv::Point(20,20),1,1,cv::Scalar(255, 255,255));
-    QImage focusDisplay ((uchar*)t.data, t.cols, t.rows, t.step, QImage::Format_RGB888);
-        ui->Focused->setPixmap(QPixmap::fromImage(focusDisplay));
+    starTestRequestPtr req = makeRequest();
 
-    // make psf plot
     ui->psfView->clear();
-    cv::Mat psf = computeStarTest(nulledSurface(0), 600, 20);
-    ui->psfView->setData(psf, "Actual", QPen(Qt::red));
-    cv::Mat savedMask = m_wf->workMask.clone();
+    ui->MTF->detachItems( QwtPlotItem::Rtti_PlotCurve);
+    m_pending = STAR_TEST_IMAGES;
+    m_focusImages = 0;
+    m_aliased = false;
+    setCursor(Qt::BusyCursor);
+    for (int kind = 0; kind < STAR_TEST_IMAGES; ++kind)
+        m_pool->start(new starTestJob(this, req, kind));
+}
+
+// Request for a new run from the current settings.  A newer run replaces the one in
+// flight, its images are no longer wanted.
+starTestRequestPtr SimulationsView::makeRequest(){
+    if (m_request)
+        m_request->cancelled.store(1);
+
+    starTestRequestPtr req(new starTestRequest);
+    req->generation = ++m_generation;
+    req->cancelled.store(0);
+    req->wf = *m_wf;
+    req->enables = zernEnables;
+    req->defocus = ui->defocusSB->value()/2;
+    req->gamma = ui->gammaSB->value();
+    req->magnify = ui->centerMagnifySB->value();
+    req->fftSize = ui->FFTSizeSB->value();
+    QSettings settings;
+    req->blur = settings.value("GBlur", true).toBool();
+    req->blurSize = settings.value("GBValue", 21).toInt();
+    req->singlePrecision = settings.value("starTestSinglePrecision", false).toBool();
+
     // add central obstruction
-    cv::Mat mask = m_wf->workMask.clone();
     cv::Mat noObstruction = m_wf->workMask.clone();
     mirrorDlg *md = mirrorDlg::get_Instance();
     double r = md->obs * (2. * m_wf->m_outside.m_radius)/md->diameter;
@@ -377,26 +641,126 @@ void SimulationsView::on_MakePB_clicked()
 
         circle(noObstruction,Point(noObstruction.cols/2,noObstruction.cols/2),r, Scalar(255),-1);
     }
+    req->noObstruction = noObstruction;
+    req->obstruction = md->obs;
+    req->lambda = md->lambda;
+    req->diameter = md->diameter;
+    req->seriesFrames = 0;
+    m_request = req;
+    return req;
+}
 
-    cv::Mat p = m_wf->workData.clone() * 0.;
-    m_wf->workMask = noObstruction;
-    cv::Mat perfectPSF = computeStarTest(p, 600, 20);
-    ui->psfView->setData(perfectPSF, "Perfect", QPen(Qt::black));
+// Through focus series from the defocus setting inside to the same distance outside.
+void SimulationsView::on_seriesPB_clicked()
+{
+    m_guiTimer.stop();
 
-    //make mtf plot
-    ui->MTF->detachItems( QwtPlotItem::Rtti_PlotCurve);
-    m_wf->workMask = mask;
-    focused = computeStarTest(nulledSurface(0), 512, 2);
-    m_wf->workMask = noObstruction;
-    perfectPSF = computeStarTest(p, 512,2);
-    m_wf->workMask = mask.clone();
-    mtf(focused, "actual", Qt::red);
-    mtf(perfectPSF, "Perfect", Qt::black);
-
-    ui->MTF->replot();
-    ui->MTF->show();
-    QApplication::restoreOverrideCursor();
+    if (m_wf == 0)
+        return;
+    if (mirrorDlg::get_Instance()->isEllipse()){
+        QMessageBox::warning(0,"warning","Star test simulation is not suppported for flat surfaces");
+        return;
+    }
+    starTestRequestPtr req = makeRequest();
+    req->seriesFrames = ui->seriesFramesSB->value();
+    m_pending = 1;
+    setCursor(Qt::BusyCursor);
+    m_pool->start(new starTestJob(this, req, FOCUS_SERIES));
+}
 
+void SimulationsView::saveFocusSeries(){
+    if (m_series.empty())
+        return;
+    QString fName = QFileDialog::getSaveFileName(0, tr("Save focus series"),
+                                     mirrorDlg::getProjectPath() + "/focusSeries.png",
+                                     tr("Image (*.png)"));
+    if (fName.isEmpty())
+        return;
+    // the strip under the chosen name and each frame numbered beside it
+    QFileInfo info(fName);
+    QString base = info.absolutePath() + "/" + info.completeBaseName();
+    cv::Mat strip;
+    cv::hconcat(m_series, strip);
+    QImage((uchar*)strip.data, strip.cols, strip.rows, strip.step,
+           QImage::Format_RGB888).save(base + ".png");
+    for (size_t i = 0; i < m_series.size(); ++i){
+        cv::Mat &t = m_series[i];
+        QImage((uchar*)t.data, t.cols, t.rows, t.step, QImage::Format_RGB888)
+                .save(QString("%1_%2.png").arg(base).arg(i + 1, 2, 10, QChar('0')));
+    }
+}
+
+void SimulationsView::starTestDone(starTestResult r){
+    if (r.generation != m_generation)
+        return;
+    if (--m_pending == 0)
+        unsetCursor();
+
+    cv::Mat &t = r.image;
+    switch (r.kind){
+    case INSIDE:
+    case OUTSIDE: {
+        QImage display((uchar*)t.data, t.cols, t.rows, t.step, QImage::Format_RGB888);
+        if (r.kind == INSIDE)
+            ui->inside->setPixmap(QPixmap::fromImage(display));
+        else
+            ui->outside->setPixmap(QPixmap::fromImage(display));
+        m_aliased |= r.aliased;
+        if (++m_focusImages == 2 && m_aliased){
+            QMessageBox::warning(NULL, tr("Warning"),
+                    "Computed star test (in red) was too large for the selected size of the simulation.\n"
+                                           "Select larger FFT Size or smaller Magnification\n"
+                                           "and try again.\n\n"
+                                           "Sometime this message is caused by the errors on the surface and so the simulatin may still be usable.\n"
+                                           "The error usually shows up as a series of light and dark horizontal bands or dots.");
+        }
+        break;
+    }
+    case FOCUSED: {
+        QImage focusDisplay ((uchar*)t.data, t.cols, t.rows, t.step, QImage::Format_RGB888);
+        ui->Focused->setPixmap(QPixmap::fromImage(focusDisplay));
+        break;
+    }
+    case PSF:
+        ui->psfView->setData(t, r.label, QPen(Qt::red));
+        break;
+    case PERFECT_PSF:
+        ui->psfView->setData(t, r.label, QPen(Qt::black));
+        break;
+    case MTF:
+    case PERFECT_MTF:
+        if (r.kind == MTF)
+            mtf(r.mtf, "actual", Qt::red);
+        else
+            mtf(r.mtf, "Perfect", Qt::black);
+        ui->MTF->replot();
+        ui->MTF->show();
+        break;
+    case FOCUS_SERIES: {
+        m_series = r.frames;
+        if (m_seriesWindow == 0){
+            m_seriesWindow = new QWidget(this, Qt::Window);
+            QVBoxLayout *layout = new QVBoxLayout(m_seriesWindow);
+            QScrollArea *scroll = new QScrollArea;
+            m_seriesLabel = new QLabel;
+            scroll->setWidget(m_seriesLabel);
+            layout->addWidget(scroll);
+            QPushButton *save = new QPushButton(tr("Save..."));
+            connect(save, SIGNAL(clicked()), this, SLOT(saveFocusSeries()));
+            layout->addWidget(save);
+            m_seriesWindow->resize(1000, 330);
+        }
+        QImage strip((uchar*)t.data, t.cols, t.rows, t.step, QImage::Format_RGB888);
+        m_seriesLabel->setPixmap(QPixmap::fromImage(strip));
+        m_seriesLabel->adjustSize();
+        m_seriesWindow->setWindowTitle(r.aliased ?
+                    tr("Through focus series (red frames are too large for the FFT size)") :
+                    tr("Through focus series"));
+        m_seriesWindow->show();
+        m_seriesWindow->raise();
+        break;
+    }
+    }
 }
 
 void SimulationsView::on_defocusSB_valueChanged(double){
@@ -422,4 +786,11 @@ void SimulationsView::on_FFTSizeSB_valueChanged(int val)
     m_guiTimer.start(500);
 }
 
+void SimulationsView::on_singlePrecisionCb_clicked(bool checked)
+{
+    QSettings set;
+    set.setValue("starTestSinglePrecision", checked);
+    m_guiTimer.start(500);
+}
+
 
@@ -22,10 +22,53 @@
 #include "wavefront.h"
 #include <opencv/cv.h>
 #include <QTimer>
+#include <QThreadPool>
+#include <QSharedPointer>
+#include <QAtomicInt>
+#include <QPolygonF>
+#include <QMetaType>
+#include <QLabel>
 namespace Ui {
 class SimulationsView;
 }
 
+// Inputs of one star test run.  Made on the GUI thread so the workers never read the
+// view, the settings or a wavefront the surface workers may replace.
+struct starTestRequest
+{
+    int generation;
+    QAtomicInt cancelled;           // set when a newer run replaces this one
+    wavefront wf;
+    std::vector<bool> enables;
+    cv::Mat noObstruction;          // workMask without the central obstruction
+    double defocus;                 // mm each side of focus
+    double gamma;
+    double magnify;
+    int fftSize;
+    bool blur;
+    int blurSize;
+    bool singlePrecision;           // "starTestSinglePrecision" setting
+    double obstruction;             // mirror settings the reference psf is kept for
+    double lambda;
+    double diameter;
+    int seriesFrames;               // through focus frames, 0 for the usual images
+};
+typedef QSharedPointer<starTestRequest> starTestRequestPtr;
+
+// One finished image of a run.
+struct starTestResult
+{
+    starTestResult() : generation(-1), kind(0), aliased(false) {}
+    int generation;
+    int kind;                       // SimulationsView::starTestImage
+    cv::Mat image;                  // RGB star test or psf magnitude
+    QPolygonF mtf;
+    QString label;                  // psf legend with its Strehl and encircled energy
+    bool aliased;
+    std::vector<cv::Mat> frames;    // RGB through focus series, inside to outside
+};
+Q_DECLARE_METATYPE(starTestResult)
+
 class SimulationsView : public QWidget
 {
     Q_OBJECT
@@ -33,9 +76,29 @@ class SimulationsView : public QWidget
 public:
     explicit SimulationsView(QWidget *parent = 0);
     ~SimulationsView();
+    enum starTestImage { INSIDE, OUTSIDE, FOCUSED, PSF, PERFECT_PSF, MTF, PERFECT_MTF,
+                         STAR_TEST_IMAGES, FOCUS_SERIES = STAR_TEST_IMAGES };
     static SimulationsView *getInstance(QWidget *parent);
     void setSurface(wavefront *wf);
     cv::Mat  computeStarTest(cv::Mat surface, int pupil_size, double pad, bool returnComplex = false);
+    // Same as computeStarTest and nulledSurface without the view, safe on any thread.
+    // singlePrecision builds the pupil and runs the fft in float, the result is double.
+    static cv::Mat starTest(const cv::Mat &surface, const cv::Mat &mask, int pupil_size,
+                            double pad, bool returnComplex = false, bool *aliased = 0,
+                            bool singlePrecision = false);
+    static cv::Mat nulledSurface(wavefront &wf, const std::vector<bool> &enables,
+                                 double defocus, bool blur, int blurSize);
+    static QPolygonF mtfCurve(cv::Mat star);
+    // Star test at each defocus from one pupil.  surface is the nulled phase at focus
+    // and defocusPhase the phase added by one unit of defocus, both as nulledSurface
+    // makes them.  The pupil is built and resized once, each frame only turns it by
+    // its defocus phase before its fft, and the frames run in parallel.
+    static std::vector<cv::Mat> focusSeries(const cv::Mat &surface, const cv::Mat &defocusPhase,
+                                            const cv::Mat &mask, const std::vector<double> &defocus,
+                                            int pupil_size, double pad, double gamma,
+                                            int frameSize, bool singlePrecision,
+                                            std::vector<bool> *aliased = 0,
+                                            QAtomicInt *cancelled = 0);
     void computeMPF();
     void compute();
     bool needs_drawing;
@@ -44,10 +107,15 @@ private:
     bool alias;
     QTimer m_guiTimer;
 
-    void mtf(cv::Mat star, QString txt, QColor color);
+    void mtf(const QPolygonF &points, QString txt, QColor color);
+    starTestRequestPtr makeRequest();
 public slots:
         void on_MakePB_clicked();
 private slots:
+    void starTestDone(starTestResult r);
+    void saveFocusSeries();
+
+    void on_seriesPB_clicked();
 
     void on_defocusSB_valueChanged(double);
 
@@ -57,12 +125,23 @@ private slots:
 
     void on_FFTSizeSB_valueChanged(int val);
 
+    void on_singlePrecisionCb_clicked(bool checked);
+
 
 private:
     Ui::SimulationsView *ui;
     static SimulationsView* m_Instance;
     bool m_Computed;
     wavefront *m_wf;
+    QThreadPool *m_pool;
+    starTestRequestPtr m_request;   // the run being shown
+    int m_generation;
+    int m_pending;                  // images of the run not delivered yet
+    int m_focusImages;              // inside and outside images delivered
+    bool m_aliased;
+    std::vector<cv::Mat> m_series;  // last through focus series
+    QWidget *m_seriesWindow;
+    QLabel *m_seriesLabel;
 };
 // class to save value on construction and then restore old value on destruction
 template<class T> class save_restore
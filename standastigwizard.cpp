@@ -284,7 +284,7 @@ void define_input::browse(){
 
     QStringList fileNames = QFileDialog::getOpenFileNames(this,
                         tr("Select average ffile"), basePath->text(),
-                        tr("wft (*.wft)"));
+                        tr("wavefront (*.wft *.wfb)"));
     if (fileNames.isEmpty())
         return;
     foreach (QString fileName, fileNames){
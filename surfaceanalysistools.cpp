@@ -74,6 +74,20 @@ void surfaceAnalysisTools::addWaveFront(const QString &name){
 
 }
 
+// Add several wavefronts with one update of the list.
+void surfaceAnalysisTools::addWaveFronts(const QStringList &names){
+    QStringList shortNames;
+    foreach (QString name, names){
+        QStringList list = name.split('/');
+        QString shorter = name;
+        if (list.size() > 1)
+            shorter = list[list.size()-2] + "/" + list[list.size()-1];
+        shortNames << shorter;
+    }
+    ui->wavefrontList->addItems(shortNames);
+    lastCurrentItem = ui->wavefrontList->count()-1;
+}
+
 void surfaceAnalysisTools::removeWaveFront(const QString &){
 
 }
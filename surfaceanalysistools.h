@@ -38,6 +38,7 @@ public:
     ~surfaceAnalysisTools();
     static surfaceAnalysisTools *get_Instance(QWidget *parent = 0);
     void addWaveFront(const QString &name);
+    void addWaveFronts(const QStringList &names);
     void removeWaveFront(const QString &);
     QLabel* m_edgeMaskLabel;
     QLabel* m_centerMaskLabel;
@@ -42,10 +42,15 @@
 #include <vector>
 #include "zernikeprocess.h"
 #include <QTimer>
+#include <QThread>
 #include <qprinter.h>
 #include "rotationdlg.h"
 #include <qwt_scale_draw.h>
 #include "zernikes.h"
+#include "zernikebasis.h"
+#include "wavefrontfile.h"
+#include "wavefrontstore.h"
+#include "wavefrontaccumulator.h"
 #include <qwt_abstract_scale.h>
 #include <qwt_plot_histogram.h>
 #include "savewavedlg.h"
@@ -60,8 +65,6 @@
 #include <QSplitter>
 #include "settingsgeneral.h"
 #include "foucaultview.h"
-QMutex mutex;
-int inprocess = 0;
 
 void expandBorder(wavefront *wf){
 
@@ -90,6 +93,13 @@ void expandBorder(wavefront *wf){
     }
 }
 
+// Negate the data of wf into a new raster.  A queued surface job may still be reading
+// the old one.
+static void invertData(wavefront *wf){
+    cv::Mat_<double> inverted = wf->data * -1.;
+    wf->data = inverted;
+}
+
 class wftNameScaleDraw: public QwtScaleDraw
 {
 public:
@@ -176,11 +186,12 @@ public:
     }
 };
 // --- CONSTRUCTOR ---
-surfaceGenerator::surfaceGenerator(SurfaceManager *sm) :
+surfaceGenerator::surfaceGenerator(SurfaceManager *sm, int wavefrontNdx, int seq) :
     m_sm(sm),
-    m_zg(0)
+    m_ndx(wavefrontNdx),
+    m_seq(seq)
 {
-
+    setAutoDelete(true);
 }
 
 // --- DECONSTRUCTOR ---
@@ -188,107 +199,267 @@ surfaceGenerator::~surfaceGenerator() {
     // free resources
 }
 
-// --- PROCESS ---
-// Start processing data.
-void surfaceGenerator::process(int wavefrontNdx, SurfaceManager *sm) {
-    // allocate resources using new here
-    m_sm = sm;
-    mutex.lock();
-    ++inprocess;
-    mutex.unlock();
-    wavefront *wf = m_sm->m_wavefronts[wavefrontNdx];
+// --- RUN ---
+// Start processing data.  Runs on a pool thread.
+void surfaceGenerator::run() {
+    surfaceWork work = m_sm->startJob(m_ndx);
+    wavefront *wf = &work.wf;
 
+    if ((work.refit || work.renull) && work.ellipse){
+        wf->nulledData = wf->data.clone();
+        if (work.blur){
 
+                //expandBorder(wf);
+                cv::GaussianBlur( wf->nulledData.clone(), wf->workData, cv::Size( work.blurSize, work.blurSize ),0,0);
+        }
+        else {
+            wf->workData = wf->data.clone();
+        }
+        wf->InputZerns = std::vector<double>(Z_TERMS, 0);
+        wf->nullCoefs.clear();
+    }
+    else {
+        zernikeProcess &zp = *zernikeProcess::get_Instance();
+        if (work.refit){
+            //compute zernike values
+            zp.unwrap_to_zernikes(*wf);
 
-    if (wf->dirtyZerns){
-        if (mirrorDlg::get_Instance()->isEllipse()){
-            wf->nulledData = wf->data.clone();
-            if (m_sm->m_GB_enabled){
-
-                    //expandBorder(wf);
-                    cv::GaussianBlur( wf->nulledData.clone(), wf->workData, cv::Size( m_sm->m_gbValue, m_sm->m_gbValue ),0,0);
-            }
-            else {
-                wf->workData = wf->data.clone();
-            }
-            wf->InputZerns = std::vector<double>(Z_TERMS, 0);
-            wf->dirtyZerns = false;
-            emit finished( wavefrontNdx);
+            // null out desired terms.
+            wf->nulledData = zp.null_unwrapped(*wf, wf->InputZerns, work.enables,0,Z_TERMS   );
+            wf->nullCoefs = zp.nullCoefficients(*wf, wf->InputZerns, work.enables);
+        }
+        else if (work.renull){
+            // only the nulls changed, the fit is still good
+            zp.renull(*wf, work.enables);
+        }
+        wf->workData = wf->nulledData.clone();
+        if (work.blur){
+            // the border is filled in place, nulledData may still be the one on display
+            if (!work.refit)
+                wf->nulledData = wf->nulledData.clone();
+            expandBorder(wf);
+            cv::GaussianBlur( wf->nulledData.clone(), wf->workData, cv::Size( work.blurSize, work.blurSize ),0,0);
 
-            return;
         }
+    }
 
-        //compute zernike values
-        zernikeProcess &zp = *zernikeProcess::get_Instance();
+    m_sm->jobResult(m_seq, work);
+    QMetaObject::invokeMethod(m_sm, "surfaceJobDone", Qt::QueuedConnection,
+                              Q_ARG(int, m_seq), Q_ARG(int, m_ndx));
+}
 
-        zp.unwrap_to_zernikes(*wf);
+// Queue a surface computation for a wavefront.  A wavefront that is already waiting
+// for a worker is not queued again but its job gets the latest snapshot, and one that
+// is being computed is queued again when its current job finishes.  Returns true when
+// this call will produce a new surfaceGenFinished for the wavefront.
+bool SurfaceManager::generateSurface(int ndx){
+    wavefront *wf = m_wavefronts[ndx];
+    makeResident(wf);
+    QMutexLocker lock(&m_jobLock);
+    if (m_running.contains(ndx)){
+        if (m_rerun.contains(ndx))
+            return false;
+        m_rerun.insert(ndx);
+        return true;
+    }
+
+    // the pending work is taken from the wavefront now, the job never reads it
+    surfaceWork &work = m_work[ndx];
+    work.wf = *wf;
+    work.refit = work.refit || wf->dirtyZerns;
+    work.renull = work.renull || wf->dirtyNull;
+    wf->dirtyZerns = false;
+    wf->dirtyNull = false;
+    work.enables = zernEnables;
+    work.ellipse = mirrorDlg::get_Instance()->isEllipse();
+    work.blur = m_GB_enabled;
+    work.blurSize = m_gbValue;
+    if (m_queued.contains(ndx))
+        return false;
+
+    QSettings set;
+    int workers = set.value("surfaceWorkers", 0).toInt();
+    if (workers <= 0)
+        workers = QThread::idealThreadCount();
+    if (workers != m_generatorPool->maxThreadCount())
+        m_generatorPool->setMaxThreadCount(workers);
+
+    m_queued.insert(ndx);
+    m_generatorPool->start(new surfaceGenerator(this, ndx, m_jobSeq++));
+    return true;
+}
+
+// called by the worker when it picks up a job.  Returns what the job computes from.
+surfaceWork SurfaceManager::startJob(int ndx){
+    QMutexLocker lock(&m_jobLock);
+    m_queued.remove(ndx);
+    m_running.insert(ndx);
+    return m_work.take(ndx);
+}
 
-        ((MainWindow*)m_sm->parent())-> zernTablemodel->setValues(wf->InputZerns);
+// called by the worker with what it computed.
+void SurfaceManager::jobResult(int seq, const surfaceWork &work){
+    QMutexLocker lock(&m_jobLock);
+    m_results.insert(seq, work);
+}
 
-        // null out desired terms.
-        wf->nulledData = zp.null_unwrapped(*wf, wf->InputZerns, zernEnables,0,Z_TERMS   );
-        wf->dirtyZerns = false;
+// True while wavefront ndx has a job queued, running or waiting to be delivered.  Its
+// zernikes and surfaces are not up to date until then.
+bool SurfaceManager::isBusy(int ndx){
+    QMutexLocker lock(&m_jobLock);
+    return m_queued.contains(ndx) || m_running.contains(ndx) ||
+            m_doneJobs.values().contains(ndx);
+}
 
+// Jobs finish in any order on the pool.  Hand them to surfaceGenFinished in the order
+// they were queued.  A job whose wavefront changed while it ran is superseded by a new
+// job and is not reported.
+void SurfaceManager::surfaceJobDone(int seq, int ndx){
+    bool superseded = false;
+    surfaceWork result;
+    {
+        QMutexLocker lock(&m_jobLock);
+        m_running.remove(ndx);
+        result = m_results.take(seq);
+        if (m_rerun.contains(ndx)){
+            m_rerun.remove(ndx);
+            m_wavefronts[ndx]->wasSmoothed = false;
+            superseded = true;
+        }
+        m_doneJobs.insert(seq, superseded ? -1 : ndx);
+    }
+    // a superseded result goes in too, the job that reruns it starts from there
+    wavefront *wf = m_wavefronts[ndx];
+    wf->nulledData = result.wf.nulledData;
+    wf->workData = result.wf.workData;
+    wf->InputZerns = result.wf.InputZerns;
+    wf->nullCoefs = result.wf.nullCoefs;
+    if (superseded)
+        generateSurface(ndx);
+
+    while (m_doneJobs.contains(m_nextDelivery)){
+        int done;
+        {
+            QMutexLocker lock(&m_jobLock);
+            done = m_doneJobs.take(m_nextDelivery++);
+        }
+        if (done >= 0)
+            surfaceGenFinished(done);
     }
-    wf->workData = wf->nulledData.clone();
-    if (m_sm->m_GB_enabled){
+}
 
-            expandBorder(wf);
-            cv::GaussianBlur( wf->nulledData.clone(), wf->workData, cv::Size( m_sm->m_gbValue, m_sm->m_gbValue ),0,0);
+// True while a surface job is queued, running or waiting to be delivered.  Jobs hold
+// their wavefront and its index so wavefronts must not be deleted or replaced then.
+bool SurfaceManager::isGenerating(){
+    QMutexLocker lock(&m_jobLock);
+    return m_nextDelivery < m_jobSeq;
+}
 
-    }
+// The Demo wavefront is replaced by the first one the user makes.  While a job may
+// still use it the new wavefront is added after it instead.
+bool SurfaceManager::replaceDemo(){
+    return m_currentNdx == 0 && m_wavefronts.size() > 0 && m_wavefronts[0]->name == "Demo" &&
+            !isGenerating();
+}
 
-    QMutexLocker lock(&mutex);
+surfaceOperation::surfaceOperation(QObject *parent) :
+    QObject(parent), m_next(0), m_finished(false), m_autoDelete(true)
+{
+}
 
-    emit finished( wavefrontNdx);
+void surfaceOperation::finish(){
+    if (m_finished)
+        return;
+    m_finished = true;
+    emit finished(this);
+    if (m_autoDelete)
+        deleteLater();
 }
+
+// Operations finish from the event loop at the earliest so the caller can always
+// connect before finished is emitted.
+void surfaceOperation::then(QObject *receiver, const char *slot){
+    m_autoDelete = false;
+    connect(this, SIGNAL(finished(surfaceOperation*)), receiver, slot, Qt::QueuedConnection);
+}
+
+// Operations may be started from the loader thread but are always finished on the
+// thread of the manager.
+surfaceOperation *SurfaceManager::newOperation(){
+    surfaceOperation *op = new surfaceOperation();
+    if (QThread::currentThread() != thread())
+        op->moveToThread(thread());
+    return op;
+}
+
+// Compute the surface of wavefront ndx as part of op.  When every surface op waits on
+// is done the slot next is called with op, or op finishes when next is 0.
+void SurfaceManager::waitFor(surfaceOperation *op, int ndx, const char *next){
+    {
+        QMutexLocker lock(&m_opLock);
+        op->m_waiting.insert(ndx);
+        op->m_next = next;
+        if (!op->m_results.contains(ndx))
+            op->m_results.append(ndx);
+        m_waiters.insert(ndx, op);
+    }
+    generateSurface(ndx);
+}
+
+// For operations that end without computing anything.  The caller still gets the
+// handle before finished is emitted.
+void SurfaceManager::finishLater(surfaceOperation *op){
+    QMetaObject::invokeMethod(op, "finish", Qt::QueuedConnection);
+}
+
+// Ask a yes or no question.  From the loader thread the GUI thread shows the box
+// while this thread waits for the answer.
+int SurfaceManager::askUser(const QString &message){
+    if (QThread::currentThread() == thread())
+        return QMessageBox(QMessageBox::Information, message, "",
+                           QMessageBox::Yes | QMessageBox::No).exec();
+    sync.lock();
+    emit showMessage(message);
+    pauseCond.wait(&sync);
+    sync.unlock();
+    return messageResult;
+}
+
 cv::Mat SurfaceManager::computeWaveFrontFromZernikes(int wx, int wy, std::vector<double> &zerns, QVector<int> zernsToUse){
     double rad = getCurrent()->m_outside.m_radius;
     double xcen = (wx-1)/2, ycen = (wy-1)/2;
 
     cv::Mat result = cv::Mat::zeros(wy,wx, CV_64F);
 
-    double rho;
-
     std::vector<bool> &en = zernEnables;
     mirrorDlg *md = mirrorDlg::get_Instance();
-    zernikePolar &zpolar = *zernikePolar::get_Instance();
-    for (int i = 0; i <  wx; ++i)
-    {
-        double x1 = (double)(i - (xcen)) / rad;
-        for (int j = 0; j < wy; ++j)
-        {
-            double y1 = (double)(j - (ycen )) /rad;
-            rho = sqrt(x1 * x1 + y1 * y1);
+    std::vector<double> coef(Z_TERMS, 0.);
+    for (int ii = 0; ii < zernsToUse.size(); ++ii) {
+        int z = zernsToUse[ii];
 
-            if (rho <= 1.)
-            {
-                double S1 = 0;
-                double theta = atan2(y1,x1);
-                zpolar.init(rho,theta);
-                for (int ii = 0; ii < zernsToUse.size(); ++ii) {
-                    int z = zernsToUse[ii];
-
-                    if ( z == 3 && m_surfaceTools->m_useDefocus){
-                        S1 -= m_surfaceTools->m_defocus * zpolar.zernike(z,rho,theta);
-                    }
-                    else {
-                        if (en[z]){
-                            if (z == 8 && md->doNull)
-                                S1 +=    md->z8 * zpolar.zernike(z,rho, theta);
-
-                            S1 += zerns[z] * zpolar.zernike(z,rho, theta);
-                        }
-                    }
-                }
-                result.at<double>(j,i) = S1;
-            }
-            else
-            {
-                result.at<double>(j,i) = 0 ;
+        if ( z == 3 && m_surfaceTools->m_useDefocus){
+            coef[z] -= m_surfaceTools->m_defocus;
+        }
+        else {
+            if (en[z]){
+                if (z == 8 && md->doNull)
+                    coef[z] +=    md->z8;
+
+                coef[z] += zerns[z];
             }
         }
     }
+
+    zernikeBasisPtr basis = zernikeBasisCache::get_Instance()->get(wx, wy, xcen, ycen, rad);
+    std::vector<double> t(basis->terms);
+    for (int k = 0; k < basis->count(); ++k)
+    {
+        basis->at(k, &t[0]);
+        double S1 = 0;
+        for (int z = 0; z < Z_TERMS; ++z)
+            S1 += coef[z] * t[z];
+        ((double *)result.data)[basis->pixels[k]] = S1;
+    }
     //cv::imshow("zernbased", result);
     //cv::waitKey(1);
     return result;
@@ -309,15 +480,19 @@ SurfaceManager::SurfaceManager(QObject *parent, surfaceAnalysisTools *tools,
     m_surfaceTools(tools),m_profilePlot(profilePlot), m_contourPlot(contourPlot),
     m_oglPlot(glPlot), m_metrics(mets),
     m_gbValue(21),m_GB_enabled(false),m_currentNdx(-1),insideOffset(0),
-    outsideOffset(0),m_askAboutReverse(true), workToDo(0), m_wftStats(0)
+    outsideOffset(0),m_askAboutReverse(true), m_jobSeq(0), m_nextDelivery(0),
+    workToDo(0), m_wftStats(0), m_standRun(0)
 {
     m_simView = SimulationsView::getInstance(0);
     pd = new QProgressDialog();
     connect (this,SIGNAL(progress(int)), pd, SLOT(setValue(int)));
-    m_generatorThread = new QThread;
-    surfaceGenerator *sg = new surfaceGenerator(this);
-    connect(sg,SIGNAL(showMessage(QString)), parent, SLOT(showMessage(QString)));
-    sg->moveToThread(m_generatorThread);
+    m_generatorPool = new QThreadPool(this);
+    m_store = new wavefrontStore;
+    qRegisterMetaType<QList<wavefront *> >("QList<wavefront*>");
+    qRegisterMetaType<surfaceOperation *>("surfaceOperation*");
+    // make the singletons used by the workers on this thread
+    zernikeProcess::get_Instance();
+    zernikeBasisCache::get_Instance();
     m_profilePlot->setWavefronts(&m_wavefronts);
     // create a timer for surface change update to all non current wave fronts
     m_waveFrontTimer = new QTimer(this);
@@ -325,10 +500,6 @@ SurfaceManager::SurfaceManager(QObject *parent, surfaceAnalysisTools *tools,
     // setup signal and slot
     connect(m_waveFrontTimer, SIGNAL(timeout()),this, SLOT(backGroundUpdate()));
     connect(m_toolsEnableTimer, SIGNAL(timeout()), this, SLOT(enableTools()));
-    connect(m_generatorThread, SIGNAL(finished()), m_generatorThread, SLOT(deleteLater()));
-    connect(this, SIGNAL(generateSurfacefromWavefront(int, SurfaceManager *)), sg, SLOT(process(int, SurfaceManager *)));
-    connect(sg, SIGNAL(finished(int)), this, SLOT(surfaceGenFinished(int)));
-    m_generatorThread->start();
 
     connect(m_surfaceTools, SIGNAL(waveFrontClicked(int)), this, SLOT(waveFrontClickedSlot(int)));
     connect(m_surfaceTools, SIGNAL(wavefrontDClicked(const QString &)), this, SLOT(wavefrontDClicked(const QString &)));
@@ -356,11 +527,15 @@ SurfaceManager::SurfaceManager(QObject *parent, surfaceAnalysisTools *tools,
 
 }
 
-SurfaceManager::~SurfaceManager(){}
+SurfaceManager::~SurfaceManager(){
+    m_generatorPool->waitForDone();
+    delete m_store;
+}
 
 
 
 void SurfaceManager::makeMask(int waveNdx){
+    makeResident(m_wavefronts[waveNdx]);
     int width = m_wavefronts[waveNdx]->data.cols;
     int height = m_wavefronts[waveNdx]->data.rows;
     double xm,ym;
@@ -424,6 +599,7 @@ void SurfaceManager::wftNameChanged(int ndx, QString name){
 }
 
 void SurfaceManager::sendSurface(wavefront* wf){
+    makeResident(wf);
     emit currentNdxChanged(m_currentNdx);
     computeMetrics(wf);
 
@@ -437,6 +613,71 @@ void SurfaceManager::sendSurface(wavefront* wf){
     QFileInfo fileInfo(fn.fileName());
     QString filename(fileInfo.fileName());
     ((MainWindow*)(parent()))->setWindowTitle(filename);
+    trimMemory();
+}
+
+// Put back whatever the memory budget took from wf.  Spilled data is read from the
+// cache and dropped nulled and smoothed rasters are made again the way the surface
+// generator makes them.  Returns false if the cached data could not be read.
+bool SurfaceManager::makeResident(wavefront *wf){
+    bool ok;
+    if (m_store->load(wf, &ok)){
+        bool ellipse = mirrorDlg::get_Instance()->isEllipse();
+        zernikeProcess &zp = *zernikeProcess::get_Instance();
+        // nullCoefs must say what nulledData holds or renull adds the change again
+        if (ellipse){
+            wf->nulledData = wf->data.clone();
+            wf->nullCoefs.clear();
+        }
+        else {
+            wf->nulledData = zp.null_unwrapped(*wf, wf->InputZerns, zernEnables, 0, Z_TERMS);
+            wf->nullCoefs = zp.nullCoefficients(*wf, wf->InputZerns, zernEnables);
+        }
+        wf->workData = wf->nulledData.clone();
+        if (m_GB_enabled){
+            if (!ellipse)
+                expandBorder(wf);
+            cv::GaussianBlur( wf->nulledData.clone(), wf->workData, cv::Size( m_gbValue, m_gbValue ),0,0);
+        }
+    }
+    if (!ok)
+        emit showMessage(QString("Could not read the cached data of %1").arg(wf->name));
+    return ok;
+}
+
+wavefront *SurfaceManager::resident(int ndx){
+    makeResident(m_wavefronts[ndx]);
+    return m_wavefronts[ndx];
+}
+
+// Hold the wavefronts to the "wavefrontMemoryMB" setting, 0 is no limit.  The current
+// wavefront and the ones being computed, waiting for delivery or waited on are not
+// touched.
+void SurfaceManager::trimMemory(){
+    QSettings set;
+    m_store->setBudget(set.value("wavefrontMemoryMB", 0).toLongLong() * 1024 * 1024);
+    QSet<wavefront *> pinned;
+    if (m_currentNdx >= 0 && m_currentNdx < m_wavefronts.size())
+        pinned << m_wavefronts[m_currentNdx];
+    QList<int> busy;
+    {
+        QMutexLocker lock(&m_jobLock);
+        busy << m_queued.toList() << m_running.toList() << m_doneJobs.values();
+    }
+    {
+        QMutexLocker lock(&m_opLock);
+        busy << m_waiters.uniqueKeys();
+    }
+    foreach (int ndx, busy){
+        if (ndx >= 0 && ndx < m_wavefronts.size())
+            pinned << m_wavefronts[ndx];
+    }
+    if (m_store->trim(m_wavefronts, pinned))
+        emit showMessage(m_store->report());
+}
+
+QString SurfaceManager::memoryReport(){
+    return m_store->report();
 }
 void SurfaceManager::ObstructionChanged(){
     if (m_wavefronts.size() > 0)
@@ -451,7 +692,7 @@ void SurfaceManager::centerMaskValue(int val){
     wavefront *wf = m_wavefronts[m_currentNdx];
     wf->dirtyZerns = true;
     wf->wasSmoothed = false;
-    //emit generateSurfacefromWavefront(m_currentNdx, this);
+    //generateSurface(m_currentNdx);
     m_waveFrontTimer->start(500);
 
 }
@@ -464,7 +705,7 @@ void SurfaceManager::outsideMaskValue(int val){
     wavefront *wf = m_wavefronts[m_currentNdx];
     wf->dirtyZerns = true;
     wf->wasSmoothed = false;
-    //emit generateSurfacefromWavefront(m_currentNdx, this);
+    //generateSurface(m_currentNdx);
     m_waveFrontTimer->start(500);
 
 }
@@ -476,7 +717,8 @@ void SurfaceManager::useDemoWaveFront(){
     double rho;
     mirrorDlg *md = mirrorDlg::get_Instance();
     cv::Mat result = cv::Mat::zeros(wx,wx, CV_64F);
-    zernikePolar &zpolar = *zernikePolar::get_Instance();
+    zernikeEvaluator zern(10);
+    double z[10];
     for (int i = 0; i <  wx; ++i)
     {
         double x1 = (double)(i - (xcen)) / rad;
@@ -484,12 +726,11 @@ void SurfaceManager::useDemoWaveFront(){
         {
             double y1 = (double)(j - (ycen )) /rad;
             rho = sqrt(x1 * x1 + y1 * y1);
-            double theta = atan2(y1,x1);
-            zpolar.init(rho,theta);
 
             if (rho <= 1.)
             {
-                double S1 = md->z8 * -.9 * zpolar.zernike(8,rho,theta) + .02* zpolar.zernike(9, rho,theta);
+                zern.evaluate(x1, y1, z);
+                double S1 = md->z8 * -.9 * z[8] + .02* z[9];
 
                 result.at<double>(j,i) = S1;
             }
@@ -511,14 +752,16 @@ void SurfaceManager::useDemoWaveFront(){
 
 void SurfaceManager::waveFrontClickedSlot(int ndx)
 {
-    if (inprocess != 0)
+    if (isGenerating())
         return;
     m_currentNdx = ndx;
     sendSurface(m_wavefronts[ndx]);
 }
 void SurfaceManager::deleteWaveFronts(QList<int> list){
-    if (inprocess != 0)
+    if (isGenerating()){
+        QMessageBox::information(0, "Delete", "Wait until the surfaces being computed are done before deleting wavefronts.");
         return;
+    }
     QApplication::setOverrideCursor(Qt::WaitCursor);
     foreach(int ndx, list ){
         m_currentNdx = ndx;
@@ -542,7 +785,7 @@ void SurfaceManager::wavefrontDClicked(const QString & name){
 
 void SurfaceManager::surfaceSmoothGBValue(int value){
 
-    if (inprocess != 0)
+    if (isGenerating())
         return;
 
     if (value %2 == 0) ++value;  // make sure blur radius is always odd;
@@ -559,12 +802,12 @@ void SurfaceManager::surfaceSmoothGBValue(int value){
     if (m_wavefronts.size() == 0)
         return;
     m_wavefronts[m_currentNdx]->GBSmoothingValue = 0;
-    //emit generateSurfacefromWavefront(m_currentNdx, this);
+    //generateSurface(m_currentNdx);
 
     m_waveFrontTimer->start(1000);
 }
 void SurfaceManager::surfaceSmoothGBEnabled(bool b){
-    if (inprocess != 0)
+    if (isGenerating())
         return;
     m_GB_enabled = b;
 
@@ -580,11 +823,12 @@ void SurfaceManager::surfaceSmoothGBEnabled(bool b){
     m_surfaceTools->setBlurText(QString().sprintf("%6.2lf mm",m_gbValue* mmPerPixel));
     if (m_wavefronts.size() == 0)
         return;
-    //emit generateSurfacefromWavefront(m_currentNdx, this);
+    //generateSurface(m_currentNdx);
     m_waveFrontTimer->start(500);
 }
 
 void SurfaceManager::computeMetrics(wavefront *wf){
+    makeResident(wf);
     mirrorDlg *md = mirrorDlg::get_Instance();
     cv::Scalar mean,std;
     cv::meanStdDev(wf->workData,mean,std,wf->workMask);
@@ -622,46 +866,23 @@ void SurfaceManager::computeZerns()
     m_waveFrontTimer->start(500);
 }
 
+// .wfb files are written in binary, anything else as text.
 void SurfaceManager::writeWavefront(QString fname, wavefront *wf, bool saveNulled){
-    std::ofstream file((fname.toStdString().c_str()));
-
-    if (!file.is_open()) {
+    makeResident(wf);
+    mirrorDlg &md = *mirrorDlg::get_Instance();
+    double verticalAxis = md.isEllipse() ? md.m_verticalAxis : 0.;
+    bool ok;
+    if (QFileInfo(fname).suffix() == "wfb"){
+        QSettings settings;
+        ok = writeWavefrontBinary(fname, *wf, saveNulled, verticalAxis,
+                                  settings.value("wfbFloat32", false).toBool());
+    }
+    else
+        ok = writeWavefrontFile(fname, *wf, saveNulled, verticalAxis);
+    if (!ok) {
         QMessageBox::warning(0, tr("Write wave front"),
                              tr("Cannot write file %1: ")
                              .arg(fname));
-        return;
-    }
-    file << wf->data.cols << std::endl << wf->data.rows << std::endl;
-    for (int row = wf->data.rows - 1; row >=0; --row){
-        for (int col = 0; col < wf->data.cols ; ++col){
-            if (saveNulled)
-                file << wf->workData(row,col) << std::endl;
-            else {
-                file << wf->data(row,col) << std::endl;
-
-            }
-        }
-    }
-
-    file << "outside ellipse " <<
-                   wf->m_outside.m_center.x()
-         << " " << wf->m_outside.m_center.y()
-         << " " << wf->m_outside.m_radius
-         << " "  << wf->m_outside.m_radius << std:: endl;
-
-    if (wf->m_inside.m_radius > 0){
-        file << "obstruction ellipse " << wf->m_inside.m_center.x()
-         << " " << wf->m_inside.m_center.y()
-         << " " << wf->m_inside.m_radius
-         << " " << wf->m_inside.m_radius << std:: endl;
-    }
-
-    file << "DIAM " << wf->diameter << std::endl;
-    file << "ROC " << wf->roc << std::endl;
-    file << "Lambda " << wf->lambda << std::endl;
-    mirrorDlg &md = *mirrorDlg::get_Instance();
-    if (md.isEllipse()){
-        file << "ellipse_vertical_axis " << md.m_verticalAxis;
     }
 }
 
@@ -674,12 +895,20 @@ void SurfaceManager::SaveWavefronts(bool saveNulled){
         QString fileName = m_wavefronts[m_currentNdx]->name;
         QFileInfo fileinfo(fileName);
         QString file = fileinfo.baseName();
+        QString wftFilter = tr("wft (*.wft)");
+        QString wfbFilter = tr("binary wavefront (*.wfb)");
+        QString wfb32Filter = tr("binary wavefront float32 (*.wfb)");
+        QString filter = settings.value("wavefrontSaveFilter", wftFilter).toString();
         fileName = QFileDialog::getSaveFileName(0,
              tr("Write wave font file"), lastPath + "/" + file,
-             tr("wft (*.wft)"));
+             wftFilter + ";;" + wfbFilter + ";;" + wfb32Filter, &filter);
         if (fileName.isEmpty())
             return;
-        if (QFileInfo(fileName).suffix().isEmpty()) { fileName.append(".wft"); }
+        bool binary = (filter != wftFilter);
+        settings.setValue("wavefrontSaveFilter", filter);
+        settings.setValue("wavefrontSaveSuffix", binary ? "wfb" : "wft");
+        settings.setValue("wfbFloat32", filter == wfb32Filter);
+        if (QFileInfo(fileName).suffix().isEmpty()) { fileName.append(binary ? ".wfb" : ".wft"); }
         QString lastDir = QFileInfo(fileName).absoluteDir().path();
         settings.setValue("lastPath", lastDir);
         writeWavefront(fileName, m_wavefronts[m_currentNdx], saveNulled);
@@ -713,7 +942,9 @@ void SurfaceManager::SaveWavefronts(bool saveNulled){
             QStringList fnparts = fname.split("/");
             if (fnparts.size() > 1)
                 fname = fnparts[fnparts.size()-1];
-            if (QFileInfo(fname).suffix().isEmpty()) { fname.append(".wft");}
+            if (QFileInfo(fname).suffix().isEmpty()) {
+                fname.append("." + settings.value("wavefrontSaveSuffix", "wft").toString());
+            }
             QString fullPath = dir + QDir::separator() + fname;
             QFileInfo info;
             // check if file exists and if yes: Is it really a file and no directory?
@@ -732,11 +963,11 @@ void SurfaceManager::SaveWavefronts(bool saveNulled){
     }
     QApplication::restoreOverrideCursor();
 }
-void SurfaceManager::createSurfaceFromPhaseMap(cv::Mat phase, CircleOutline outside, CircleOutline center, QString name){
+surfaceOperation *SurfaceManager::createSurfaceFromPhaseMap(cv::Mat phase, CircleOutline outside, CircleOutline center, QString name){
 
     wavefront *wf;
 
-    if (m_wavefronts.size() >0 && (m_currentNdx == 0 &&  m_wavefronts[0]->name == "Demo")){
+    if (replaceDemo()){
         wf = m_wavefronts[0];
         emit nameChanged(wf->name, name);
         wf->name = name;
@@ -762,10 +993,16 @@ void SurfaceManager::createSurfaceFromPhaseMap(cv::Mat phase, CircleOutline outs
     wf->wasSmoothed = false;
     m_currentNdx = m_wavefronts.size()-1;
     makeMask(m_currentNdx);
-    m_surface_finished = false;
-    emit generateSurfacefromWavefront(m_currentNdx, this);
-    while (!m_surface_finished) {qApp->processEvents();}
-    // check for swapped conic value
+    surfaceOperation *op = newOperation();
+    waitFor(op, m_currentNdx, "checkPhaseMapSign");
+    return op;
+}
+
+// check for swapped conic value
+void SurfaceManager::checkPhaseMapSign(surfaceOperation *op){
+    int ndx = op->wavefront();
+    wavefront *wf = m_wavefronts[ndx];
+    mirrorDlg *md = mirrorDlg::get_Instance();
     if (md->cc * wf->InputZerns[8] < 0.){
         bool reverse = false;
         if (m_askAboutReverse){
@@ -782,30 +1019,157 @@ void SurfaceManager::createSurfaceFromPhaseMap(cv::Mat phase, CircleOutline outs
             reverse = true;
         }
         if (reverse){
-            wf->data *= -1;
+            invertData(wf);
             wf->dirtyZerns = true;
             wf->wasSmoothed = false;
-            m_surface_finished = false;
-            emit generateSurfacefromWavefront(m_currentNdx, this);
-            while (!m_surface_finished) {qApp->processEvents();}
+            waitFor(op, ndx, "phaseMapDone");
+            return;
         }
     }
-    m_surfaceTools->select(m_currentNdx);
+    phaseMapDone(op);
+}
+
+void SurfaceManager::phaseMapDone(surfaceOperation *op){
+    m_surfaceTools->select(op->wavefront());
     emit showTab(2);
+    emit surfaceCreated(op->wavefront());
+    op->finish();
+}
+
+// Read a .wft or .wfb file into wf.  Values the file does not have come from the
+// mirror configuration.  Only touches wf so several files can be read at once.
+bool SurfaceManager::readWavefront(const QString &fileName, wavefront *wf, double *verticalAxis){
+    mirrorDlg *md = mirrorDlg::get_Instance();
+    wf->name = fileName;
+    wf->roc = md->roc;
+    wf->lambda = md->lambda;
+    wf->diameter = md->diameter;
+    if (isBinaryWavefrontFile(fileName))
+        return readWavefrontBinary(fileName, *wf, verticalAxis);
+    return readWavefrontFile(fileName, *wf, verticalAxis);
+}
 
+// Most common value of a histogram of values.
+static double mostCommon(const QMap<double, int> &counts){
+    double best = 0.;
+    int n = 0;
+    for (QMap<double, int>::const_iterator it = counts.begin(); it != counts.end(); ++it){
+        if (it.value() > n){
+            n = it.value();
+            best = it.key();
+        }
+    }
+    return best;
 }
 
-bool SurfaceManager::loadWavefront(const QString &fileName){
+// Ask once about every wavelength, diameter and roc of wfs that does not match the
+// configuration.  Yes sets the configuration to the most common file value, No makes
+// the files use the configuration.  Returns true when the files were changed.
+bool SurfaceManager::matchMirrorConfig(QList<wavefront *> wfs){
+    mirrorDlg *md = mirrorDlg::get_Instance();
+    QMap<double, int> lambdas, diameters, rocs;
+    foreach (wavefront *wf, wfs){
+        if (wf->lambda != md->lambda)
+            ++lambdas[wf->lambda];
+        if (roundl(wf->diameter * 10) != roundl(md->diameter * 10))
+            ++diameters[wf->diameter];
+        if (roundl(wf->roc * 10.) != roundl(md->roc * 10.))
+            ++rocs[wf->roc];
+    }
+    if (!lambdas.isEmpty() || !diameters.isEmpty() || !rocs.isEmpty()){
+        QString message("Some of the wavefronts do not match the config values.\n");
+        if (!lambdas.isEmpty())
+            message += QString().sprintf("Interferogram wavelength %6.3lf (config %6.3lf)\n",
+                                         mostCommon(lambdas), md->lambda);
+        if (!diameters.isEmpty())
+            message += QString().sprintf("Mirror diameter %6.3lf (config %6.3lf)\n",
+                                         mostCommon(diameters), md->diameter);
+        if (!rocs.isEmpty())
+            message += QString().sprintf("Mirror roc %6.3lf (config %6.3lf)\n",
+                                         mostCommon(rocs), md->roc);
+        message += "Do you want to make the config match?";
+        if (askUser(message) == QMessageBox::Yes){
+            if (!lambdas.isEmpty())
+                md->newLambda(QString::number(mostCommon(lambdas)));
+            if (!diameters.isEmpty())
+                emit diameterChanged(mostCommon(diameters));
+            if (!rocs.isEmpty())
+                emit rocChanged(mostCommon(rocs));
+        }
+        else {
+            foreach (wavefront *wf, wfs){
+                wf->lambda = md->lambda;
+                wf->diameter = md->diameter;
+                wf->roc = md->roc;
+            }
+            return true;
+        }
+    }
+    return false;
+}
+
+// Add wavefronts read by the loader and compute all their surfaces at once.  Every
+// wavelength, diameter and roc that does not match the configuration is asked
+// about in one question.  The wavefront list is updated once.
+surfaceOperation *SurfaceManager::addWavefronts(QList<wavefront *> wfs, double verticalAxis,
+                                                QStringList unreadable){
+    surfaceOperation *op = newOperation();
+    if (!unreadable.isEmpty())
+        QMessageBox::warning(NULL, tr("Read Wavefront File"),
+                             tr("Can not read:\n") + unreadable.join("\n"));
+    if (wfs.isEmpty()){
+        finishLater(op);
+        return op;
+    }
     emit enableControls(false);
-    bool mirrorParamsChanged = false;
-    std::ifstream file(fileName.toStdString().c_str());
-    if (!file) {
+    mirrorDlg *md = mirrorDlg::get_Instance();
+    if (verticalAxis != 0.){
+        md->m_outlineShape = ELLIPSE;
+        md->m_verticalAxis = verticalAxis;
+    }
+
+    matchMirrorConfig(wfs);
+
+    QStringList names;
+    int first = m_wavefronts.size();
+    foreach (wavefront *wf, wfs){
+        if (md->isEllipse()){
+            wf->m_outside = CircleOutline(wf->m_outside.m_center, wf->m_outside.m_center.x() -2);
+        }
+        wf->dirtyZerns = true;
+        wf->wasSmoothed = false;
+        if (m_wavefronts.size() == 1 && replaceDemo()){
+            emit nameChanged(m_wavefronts[0]->name, wf->name);
+            m_store->remove(m_wavefronts[0]);
+            delete m_wavefronts[0];
+            m_wavefronts[0] = wf;
+            first = 0;
+            continue;
+        }
+        m_wavefronts << wf;
+        names << wf->name;
+    }
+    m_surfaceTools->addWaveFronts(names);
+    m_currentNdx = m_wavefronts.size()-1;
+    for (int ndx = first; ndx < m_wavefronts.size(); ++ndx){
+        makeMask(ndx);
+        waitFor(op, ndx, "selectResult");
+    }
+    return op;
+}
+
+// Read a wavefront file and start computing its surface.  Can be called from the
+// loader thread.  mirrorParamsChanged is set when the file did not match the mirror
+// configuration and the user kept the configuration.
+surfaceOperation *SurfaceManager::loadWavefront(const QString &fileName, bool *mirrorParamsChanged){
+    emit enableControls(false);
+    if (!QFileInfo(fileName).isReadable()) {
         QString b = "Can not read file " + fileName + " " +strerror(errno);
         QMessageBox::warning(NULL, tr("Read Wavefront File"),b);
     }
     wavefront *wf;
 
-    if (m_currentNdx == 0 &&  m_wavefronts[0]->name == "Demo"){
+    if (replaceDemo()){
         wf = m_wavefronts[0];
         emit nameChanged(wf->name, fileName);
         wf->name = fileName;
@@ -820,155 +1184,42 @@ bool SurfaceManager::loadWavefront(const QString &fileName){
         m_surfaceTools->addWaveFront(wf->name);
         m_currentNdx = m_wavefronts.size()-1;
     }
-    double width;
-    double height;
-    file >> width;
-    file >> height;
-
-    cv::Mat data(height,width, CV_64F,0.);
-
-    for( size_t y = 0; y < height; y++ ) {
-        for( size_t x = 0; x < width; x++ ) {
-            file >> data.at<double>(height - y-1,x);
-        }
-    }
-
-    string line;
-    QString l;
     mirrorDlg *md = mirrorDlg::get_Instance();
-
-    double xm = width/2.,ym = (height)/2.,
-            radm = min(xm,ym)-2 ,
-            roc = md->roc,
-            lambda = md->lambda,
-            diam = md->diameter;
-    double xo = width/2., yo = height/2., rado = 0;
-
-    string dummy;
-    while (getline(file, line)) {
-        l = QString::fromStdString(line);
-        std::istringstream iss(line);
-        if (l.startsWith("outside")) {
-            QStringList sl = l.split(" ");
-            xm = sl[2].toDouble();
-            radm = sl[4].toDouble();
-            ym = sl[3].toDouble();
-            continue;
-        }
-        if (l.startsWith("DIAM")){
-            iss >> dummy >> diam;
-            continue;
-        }
-        if (l.startsWith("ROC")){
-            iss >> dummy >> roc;
-            continue;
-        }
-        if (l.startsWith("Lambda")){
-            iss >> dummy >> lambda;
-            continue;
-        }
-        if (l.startsWith("obstruction")){
-            qDebug() << line.c_str();
-            iss >> dummy >> dummy >> xo >> yo >> rado;
-            continue;
-        }
-        if (l.startsWith("ellipse_vertical_axis")){
-            md->m_outlineShape = ELLIPSE;
-            iss >> dummy >> md->m_verticalAxis;
-        }
-    }
-
-    wf->m_outside = CircleOutline(QPointF(xm,height - ym), radm);
-    if (rado == 0){
-        xo = xm;
-        yo = ym;
+    double verticalAxis = 0.;
+    readWavefront(fileName, wf, &verticalAxis);
+    if (verticalAxis != 0.){
+        md->m_outlineShape = ELLIPSE;
+        md->m_verticalAxis = verticalAxis;
     }
     if (md->isEllipse()){
-        wf->m_outside = CircleOutline(QPointF(xm,height - ym), xm -2);
-    }
-    wf->m_inside = CircleOutline(QPoint(xo,yo), rado);
-
-    wf->diameter = diam;
-
-    if (lambda != md->lambda){
-        QString message("The interferogram wavelength (");
-        message += QString().sprintf("%6.3lf", lambda) +
-                ") Of the wavefront does not match the config value of " + QString().sprintf("%6.3lf\n",md->lambda) +
-                "Do you want to make the config match?";
-
-        sync.lock();
-        emit showMessage(message);
-        pauseCond.wait(&sync);
-        sync.unlock();
-        if (messageResult == QMessageBox::Yes){
-            md->newLambda(QString::number(lambda));
-        }
-        else {
-            lambda = md->diameter;
-            mirrorParamsChanged = true;
-        }
-    }
-
-    if (roundl(diam * 10) != roundl(md->diameter* 10))
-    {
-        QString message("The mirror diameter (");
-        message += QString().sprintf("%6.3lf",diam) +
-                ") Of the wavefront does not match the config value of " + QString().sprintf("%6.3lf\n",md->diameter) +
-                "Do you want to make the config match?";
-
-        sync.lock();
-        emit showMessage(message);
-        pauseCond.wait(&sync);
-        sync.unlock();
-        if (messageResult == QMessageBox::Yes){
-            emit diameterChanged(diam);
-        }
-        else {
-            diam = md->diameter;
-            mirrorParamsChanged = true;
-        }
-
-    }
-
-    if (roundl(roc * 10.) != roundl(md->roc * 10.))
-    {
-        QString message("The mirror roc (");
-        message += QString().sprintf("%6.3lf",roc) +
-                ") Of the wavefront does not match the config value of " + QString().sprintf("%6.3lf\n",md->roc) +
-                "Do you want to make the config match?";
-        //qDebug() << message;
-        sync.lock();
-
-        emit showMessage(message);
-        pauseCond.wait(&sync);
-        sync.unlock();
-        if (messageResult == QMessageBox::Yes){
-            emit rocChanged(roc);
-            mirrorParamsChanged = true;
-        }
-        else {
-            roc = md->roc;
-
-        }
+        wf->m_outside = CircleOutline(wf->m_outside.m_center, wf->m_outside.m_center.x() -2);
     }
-
-    wf->data= data;
-    wf->roc = roc;
-    wf->lambda = lambda;
+    bool paramsChanged = matchMirrorConfig(QList<wavefront *>() << wf);
     wf->wasSmoothed = false;
 
     makeMask(m_currentNdx);
-    m_surface_finished = false;
-    emit generateSurfacefromWavefront(m_currentNdx, this);
-    while (!m_surface_finished){qApp->processEvents();}
-    m_surfaceTools->select(m_currentNdx);
-    return mirrorParamsChanged;
+    if (mirrorParamsChanged)
+        *mirrorParamsChanged = paramsChanged;
+    surfaceOperation *op = newOperation();
+    waitFor(op, m_currentNdx, "selectResult");
+    return op;
+}
+
+void SurfaceManager::selectResult(surfaceOperation *op){
+    m_surfaceTools->select(op->wavefront());
+    op->finish();
 }
 void SurfaceManager::deleteCurrent(){
     if (m_wavefronts.size() == 0)
         return;
+    // surface jobs hold wavefronts and their index until they are delivered
+    if (isGenerating()){
+        QMessageBox::information(0, "Delete", "Wait until the surfaces being computed are done before deleting wavefronts.");
+        return;
+    }
     if (m_wavefronts.length()) {
         emit deleteWavefront(m_currentNdx);
+        m_store->remove(m_wavefronts[m_currentNdx]);
         delete m_wavefronts[m_currentNdx];
         m_wavefronts.removeAt(m_currentNdx);
 
@@ -988,7 +1239,7 @@ void SurfaceManager::deleteCurrent(){
 void SurfaceManager::processSmoothing(){
     if (m_wavefronts.size() == 0)
         return;
-    wavefront *wf = m_wavefronts[m_currentNdx];
+    wavefront *wf = resident(m_currentNdx);
     if (m_GB_enabled){
         if (wf->wasSmoothed != m_GB_enabled || wf->GBSmoothingValue != m_gbValue) {
 
@@ -1052,7 +1303,7 @@ void SurfaceManager::saveAllWaveFrontStats(){
 void SurfaceManager::enableTools(){
 
     m_toolsEnableTimer->stop();
-    if (inprocess == 0){
+    if (!isGenerating()){
         m_surfaceTools->setEnabled(true);
 
     }
@@ -1065,19 +1316,38 @@ void SurfaceManager::surfaceGenFinished(int ndx) {
 
     if (workToDo > 0)
         emit progress(++workProgress);
-    mutex.lock();
-    --inprocess;
-
-    mutex.unlock();
-    if (inprocess == 0)
+    if (!isGenerating())
         sendSurface(m_wavefronts[m_currentNdx]);
     else
         computeMetrics(m_wavefronts[ndx]);
 
-    m_surface_finished = true;
     if (workProgress == workToDo)
         workToDo = 0;
 
+    QList<surfaceOperation *> waiting;
+    {
+        QMutexLocker lock(&m_opLock);
+        waiting = m_waiters.values(ndx);
+        m_waiters.remove(ndx);
+    }
+    foreach (surfaceOperation *op, waiting){
+        op->m_waiting.remove(ndx);
+        if (!op->m_waiting.isEmpty())
+            continue;
+        if (op->m_next)
+            QMetaObject::invokeMethod(this, op->m_next, Qt::DirectConnection,
+                                      Q_ARG(surfaceOperation *, op));
+        else
+            op->finish();
+    }
+
+}
+
+// Refit the selected wavefronts whether or not anything changed.
+void SurfaceManager::refitSelected(){
+    foreach (int i, m_surfaceTools->SelectedWaveFronts())
+        m_wavefronts[i]->dirtyZerns = true;
+    backGroundUpdate();
 }
 
 // Update all surfaces since some control has changed.  Skip current surface it has already been done
@@ -1088,26 +1358,30 @@ void SurfaceManager::backGroundUpdate(){
 
     m_surfaceTools->setEnabled(false);
     QList<int> doThese =  m_surfaceTools->SelectedWaveFronts();
-    workToDo = doThese.size();
-    pd->setLabelText("Updating Selected Surfaces");
-    pd->setRange(0,doThese.size());
+    workToDo = 0;
     foreach (int i, doThese){
-        m_wavefronts[i]->dirtyZerns = true;
+        // wavefronts whose data or outline changed were marked dirtyZerns already.
+        // For the rest only the nulls or the smoothing changed.
+        m_wavefronts[i]->dirtyNull = true;
         m_wavefronts[i]->wasSmoothed = false;
-        emit generateSurfacefromWavefront(i, this);
+        if (generateSurface(i))
+            ++workToDo;
     }
+    pd->setLabelText("Updating Selected Surfaces");
+    pd->setRange(0,workToDo);
 }
 
 
-void SurfaceManager::average(QList<int> list){
+surfaceOperation *SurfaceManager::average(QList<int> list){
     QList<wavefront *> wflist;
     for (int i = 0; i < list.size(); ++i){
         wflist.append(m_wavefronts[list[i]]);
     }
-    average(wflist);
+    return average(wflist);
 }
 #include "ccswappeddlg.h"
-void SurfaceManager::average(QList<wavefront *> wfList){
+surfaceOperation *SurfaceManager::average(QList<wavefront *> wfList){
+    surfaceOperation *op = newOperation();
 
     // check that all the cc have the same sign
     bool sign = wfList[0]->InputZerns[8] < 0;
@@ -1127,16 +1401,17 @@ void SurfaceManager::average(QList<wavefront *> wfList){
                 if ((wf->InputZerns[8] < 0 && dlg.getSelection() == NEGATIVE) ||
                     (wf->InputZerns[8] > 0 && dlg.getSelection() == POSITIVE))
                 {
-                    wf->data *= -1;
+                    makeResident(wf);
+                    invertData(wf);
                     wf->dirtyZerns = true;
                     wf->wasSmoothed = false;
-                    m_surface_finished = false;
                     needsUpdate = true;
                 }
             }
         }
         else {
-            return;
+            finishLater(op);
+            return op;
         }
     }
     // normalize the size to the most common size
@@ -1144,7 +1419,7 @@ void SurfaceManager::average(QList<wavefront *> wfList){
     QHash<QString,int> sizes;
     for (int i = 0; i < wfList.size(); ++i){
         QString size;
-        size.sprintf("%d %d",wfList[i]->workData.rows, wfList[i]->workData.cols);
+        size.sprintf("%d %d",wfList[i]->workMask.rows, wfList[i]->workMask.cols);
         if (*sizes.find(size))
         {
             ++sizes[size];
@@ -1166,20 +1441,19 @@ void SurfaceManager::average(QList<wavefront *> wfList){
     QTextStream s(&maxkey);
 
     s >> rrows >> rcols;
-    cv::Mat mask = m_wavefronts[0]->workMask.clone();
+    cv::Mat mask = wfList[0]->workMask.clone();
     cv::resize(mask,mask,Size(rcols,rrows));
-    cv::Mat sum = cv::Mat::ones(rrows,rcols, m_wavefronts[m_currentNdx]->workData.type());
+    // one wavefront at a time so the memory budget can spill the ones already counted
+    wavefrontAccumulator acc(rrows, rcols);
     for (int j = 0; j < wfList.size(); ++j){
-        cv::Mat resized = wfList[j]->data.clone();
-        if (wfList[j]->data.rows != rrows || wfList[j]->data.cols != rcols){
-            cv::resize(wfList[j]->data, resized, Size(rcols, rrows));
-        }
-        sum += resized;
+        makeResident(wfList[j]);
+        acc.add(wfList[j]->data, wfList[j]->workMask);
+        trimMemory();
     }
-    sum = sum/wfList.size();
+    makeResident(wfList[0]);
     wavefront *wf = new wavefront();
     *wf = *wfList[0];
-    wf->data = sum;
+    wf->data = acc.mean();
     wf->mask = mask;
     wf->workMask = mask.clone();
     m_wavefronts << wf;
@@ -1188,20 +1462,25 @@ void SurfaceManager::average(QList<wavefront *> wfList){
     wf->dirtyZerns = true;
     m_surfaceTools->addWaveFront(wf->name);
     m_currentNdx = m_wavefronts.size()-1;
-    m_surface_finished = false;
-    emit generateSurfacefromWavefront(m_currentNdx, this);
-    while (!m_surface_finished) {qApp->processEvents();}
+    waitFor(op, m_currentNdx);
     if (needsUpdate)
         m_waveFrontTimer->start(1000);
+    return op;
 }
 
-void SurfaceManager::rotateThese(double angle, QList<int> list){
+// Every rotated wavefront is computed at the same time.  The operation finishes when
+// they are all done.  In the zernike modes a fitted wavefront keeps its turned terms
+// and only has its nulls and smoothing made again.  Wavefronts that are not fitted
+// yet, and elliptical mirrors which are not fitted at all, are resampled.
+surfaceOperation *SurfaceManager::rotateThese(double angle, QList<int> list, int mode){
+    surfaceOperation *op = newOperation();
     workToDo = list.size();
     workProgress = 0;
     pd->setLabelText("Rotating Wavefronts");
     pd->setRange(0, list.size());
     for (int i = 0; i < list.size(); ++i) {
-        wavefront *oldWf = m_wavefronts[list[i]];
+        wavefront *oldWf = resident(list[i]);
+        resident(list[0]);
         QString newName;
         QStringList l = oldWf->name.split('.');
         newName.sprintf("%s_%s%05.1lf",l[0].toStdString().c_str(), (angle >= 0) ? "CW":"CCW", fabs(angle) );
@@ -1210,14 +1489,23 @@ void SurfaceManager::rotateThese(double angle, QList<int> list){
         *wf = *m_wavefronts[list[0]];
         //emit nameChanged(wf->name, newName);
         wf->name = newName;
-        cv::Mat tmp = oldWf->data.clone();
-        wf->data = tmp;
+        bool zernikes = mode != ROTATE_RESAMPLE && !mirrorDlg::get_Instance()->isEllipse() &&
+                !oldWf->dirtyZerns && !isBusy(list[i]) && (int)oldWf->InputZerns.size() == Z_TERMS;
+        if (zernikes){
+            wf->data = zernikeProcess::get_Instance()->rotateFitted(*oldWf, angle,
+                                                    mode == ROTATE_ZERNIKES_RESIDUAL, wf->InputZerns);
+        }
+        else {
+            cv::Mat tmp = oldWf->data.clone();
+            cv::Point2f ptCp(tmp.cols*0.5, tmp.rows*0.5);
+            cv::Mat M = cv::getRotationMatrix2D(ptCp, angle, 1.0);
+            cv::Mat rotated;
+            cv::warpAffine(tmp, rotated, M, tmp.size(), cv::INTER_CUBIC);
+            wf->data = rotated;
+        }
         m_wavefronts << wf;
         m_surfaceTools->addWaveFront(wf->name);
         m_currentNdx = m_wavefronts.size()-1;
-        cv::Point2f ptCp(tmp.cols*0.5, tmp.rows*0.5);
-        cv::Mat M = cv::getRotationMatrix2D(ptCp, angle, 1.0);
-        cv::warpAffine(tmp, wf->data , M, tmp.size(), cv::INTER_CUBIC);
         wf->m_inside = oldWf->m_inside;
         wf->m_outside = oldWf->m_outside;
         double rad = -angle * M_PI/180.;
@@ -1233,15 +1521,19 @@ void SurfaceManager::rotateThese(double angle, QList<int> list){
         makeMask(m_currentNdx);
         wf->workMask = wf->mask.clone();
 
-        wf->dirtyZerns = true;
+        wf->dirtyZerns = !zernikes;
+        wf->dirtyNull = zernikes;
+        wf->nullCoefs.clear();
         wf->wasSmoothed = false;
-        m_surface_finished = false;
-        emit generateSurfacefromWavefront(m_currentNdx,this);
-        while (!m_surface_finished) {qApp->processEvents();}
-
+        waitFor(op, m_currentNdx);
     }
+    if (list.isEmpty())
+        finishLater(op);
+    return op;
 }
-void SurfaceManager::subtract(wavefront *wf1, wavefront *wf2, bool use_null){
+surfaceOperation *SurfaceManager::subtract(wavefront *wf1, wavefront *wf2, bool use_null){
+    makeResident(wf1);
+    makeResident(wf2);
 
     int size1 = wf1->data.rows * wf1->data.cols;
     int size2 = wf2->data.rows * wf2->data.cols;
@@ -1265,13 +1557,12 @@ void SurfaceManager::subtract(wavefront *wf1, wavefront *wf2, bool use_null){
     resultwf->dirtyZerns = true;
     resultwf->wasSmoothed = false;
 
-    m_surface_finished = false;
     if (!use_null){
         resultwf->useSANull = false;
     }
-    emit generateSurfacefromWavefront(m_currentNdx,this);
-    while (!m_surface_finished){qApp->processEvents();}
-
+    surfaceOperation *op = newOperation();
+    waitFor(op, m_currentNdx);
+    return op;
 }
 
 void SurfaceManager::subtractWavefronts(){
@@ -1294,7 +1585,7 @@ void SurfaceManager::subtractWavefronts(){
 
 void SurfaceManager::transfrom(QList<int> list){
     RotationDlg dlg(list);
-    connect(&dlg, SIGNAL(rotateTheseSig(double, QList<int>)), this, SLOT(rotateThese( double, QList<int>)));
+    connect(&dlg, SIGNAL(rotateTheseSig(double, QList<int>, int)), this, SLOT(rotateThese( double, QList<int>, int)));
     dlg.exec();
 
 }
@@ -1304,7 +1595,7 @@ void SurfaceManager::invert(QList<int> list){
     pd->setLabelText("Inverting Wavefronts");
     pd->setRange(0, list.size());
     for (int i = 0; i < list.size(); ++i) {
-        m_wavefronts[list[i]]->data *= -1;
+        invertData(resident(list[i]));
         m_wavefronts[list[i]]->dirtyZerns = true;
         m_wavefronts[list[i]]->wasSmoothed = false;
     }
@@ -1314,7 +1605,7 @@ void SurfaceManager::invert(QList<int> list){
 #include "wftexaminer.h"
 wftExaminer *wex;
 void SurfaceManager::inspectWavefront(){
-    wex = new wftExaminer(m_wavefronts[m_currentNdx]);
+    wex = new wftExaminer(resident(m_currentNdx));
     wex->show();
 }
 
@@ -1323,7 +1614,9 @@ void SurfaceManager::inspectWavefront(){
 
 
 
-textres SurfaceManager::Phase2(QList<rotationDef *> list, QList<int> inputs, int avgNdx ){
+// standNdxs are the inputs with the rotated average removed, what is left is what
+// the stand did at each rotation.
+textres SurfaceManager::Phase2(QList<rotationDef *> list, QList<int> inputs, QList<int> standNdxs){
     QTextEdit *editor = new QTextEdit;
 
     QTextDocument *doc = editor->document();
@@ -1351,24 +1644,15 @@ textres SurfaceManager::Phase2(QList<rotationDef *> list, QList<int> inputs, int
     QVector<double> astigMag;
     editor->resize(printer.pageRect().size());
     doc->setPageSize(printer.pageRect().size());
-    cv::Mat standavg = cv::Mat::zeros(m_wavefronts[inputs[0]]->workData.size(), CV_64F);
-    cv::Mat standavgZernMat = cv::Mat::zeros(m_wavefronts[inputs[0]]->workData.size(), CV_64F);
+    cv::Mat standavg = cv::Mat::zeros(resident(inputs[0])->workData.size(), CV_64F);
+    cv::Mat standavgZernMat = cv::Mat::zeros(standavg.size(), CV_64F);
     for (int i = 0; i < list.size(); ++i){
-
-        // rotate the average to match the input
-        QList<int> toRotate;
-        toRotate.append(avgNdx);
-        int ndx = m_wavefronts.size(); // index of result of rotation
-        m_surface_finished = false;
-        rotateThese(-list[i]->angle,toRotate);
-        while(!m_surface_finished){qApp->processEvents();}
-        m_surface_finished = false;
-        subtract(m_wavefronts[inputs[i]], m_wavefronts[ndx],false);
-        ++ndx;      // now ndx point to the stand only wavefront
-        while(!m_surface_finished){qApp->processEvents();}
-        cv::Mat resized = m_wavefronts[ndx]->workData.clone();
-        if (standavg.cols != m_wavefronts[ndx]->workData.cols || standavg.rows != m_wavefronts[ndx]->workData.rows){
-            cv::resize(m_wavefronts[ndx]->workData, resized, Size(standavg.cols, standavg.rows));
+        int ndx = standNdxs[i];      // the stand only wavefront
+        // the memory budget may have released its rasters since it was made
+        wavefront *standWf = resident(ndx);
+        cv::Mat resized = standWf->workData.clone();
+        if (standavg.cols != standWf->workData.cols || standavg.rows != standWf->workData.rows){
+            cv::resize(standWf->workData, resized, Size(standavg.cols, standavg.rows));
         }
         standavg += resized;
         //create contour of astig
@@ -1382,7 +1666,7 @@ textres SurfaceManager::Phase2(QList<rotationDef *> list, QList<int> inputs, int
         for (int ii = 9; ii < Z_TERMS; ++ii)
             zernsToUse << ii;
 
-        cv::Mat m = computeWaveFrontFromZernikes(m_wavefronts[inputs[0]]->data.cols,m_wavefronts[inputs[0]]->data.rows,
+        cv::Mat m = computeWaveFrontFromZernikes(resident(inputs[0])->data.cols,m_wavefronts[inputs[0]]->data.rows,
                 m_wavefronts[ndx]->InputZerns, zernsToUse );
         standavgZernMat += m;
         standwfs << m;
@@ -1476,7 +1760,7 @@ textres SurfaceManager::Phase2(QList<rotationDef *> list, QList<int> inputs, int
         // make contour plots of astig zernike terms of stand
         ContourPlot *cp = new ContourPlot();
         cp->m_zRangeMode = "Min/Max";
-        wavefront * wf = new wavefront(*m_wavefronts[inputs[i]]);
+        wavefront * wf = new wavefront(*resident(inputs[i]));
 
 
         wf->data = wf->workData = standwfs[i];
@@ -1511,7 +1795,7 @@ textres SurfaceManager::Phase2(QList<rotationDef *> list, QList<int> inputs, int
 
     imagesHtml.append("</table>");
     //display average of all stand zernwavefronts
-    wavefront * wf2 = new wavefront(*m_wavefronts[inputs[0]]);
+    wavefront * wf2 = new wavefront(*resident(inputs[0]));
     wf2->data = wf2->workData = standavgZernMat ;
     cv::resize(m_wavefronts[inputs[0]]->mask,wf2->mask, cv::Size(wf2->data.cols, wf2->data.rows));
     wf2->workMask = wf2->mask;
@@ -1667,7 +1951,51 @@ textres SurfaceManager::Phase2(QList<rotationDef *> list, QList<int> inputs, int
     return results;
 }
 
+// What computeStandAstig carries from one operation to the next.  Each step starts
+// operations and returns, the next step runs when they have finished.
+struct standAstigRun
+{
+    define_input *wizPage;
+    QList<rotationDef *> list;
+    int next;                   // the input being loaded and counter rotated
+    int startingNdx;            // wavefronts after this one are work wavefronts
+    ContourPlot *plot;
+    QTextEdit *editor;
+    QString html;
+    QList<QString> doc1Res;
+    QList<int> inputs;
+    QList<int> rotated;
+    int avgNdx;
+    QTextEdit *page2;
+    QList<QString> doc2Res;
+    QList<int> standNdxs;       // each input less the average rotated to match it
+    int pending;                // rotations and subtractions not finished yet
+};
+
+static const int standContourWidth = 2 * 340/3;
+static const int standContourHeight = 2 * 360/3;
+
+static void setupStandPrinter(QPrinter &printer){
+    printer.setColorMode( QPrinter::Color );
+    printer.setFullPage( true );
+    printer.setOutputFileName( "stand.pdf" );
+    printer.setOutputFormat( QPrinter::PdfFormat );
+    printer.setResolution(85);
+    printer.setPaperSize(QPrinter::A4);
+}
+
+static void setupStandRenderer(QwtPlotRenderer &renderer){
+    renderer.setDiscardFlag( QwtPlotRenderer::DiscardBackground );
+    renderer.setDiscardFlag( QwtPlotRenderer::DiscardCanvasBackground );
+    renderer.setDiscardFlag( QwtPlotRenderer::DiscardCanvasFrame );
+    renderer.setDiscardFlag(QwtPlotRenderer::DiscardLegend);
+}
+
+// Load each input, counter rotate it and average the counter rotated ones.  Then
+// subtract the average, rotated back, from each input and report what is left.
 void SurfaceManager::computeStandAstig(define_input *wizPage, QList<rotationDef *> list){
+    if (m_standRun)
+        return;
     QApplication::setOverrideCursor(Qt::WaitCursor);
     // check for pairs
     QVector<rotationDef*> lookat = list.toVector();
@@ -1697,155 +2025,182 @@ void SurfaceManager::computeStandAstig(define_input *wizPage, QList<rotationDef
         }
     }
     QPrinter printer(QPrinter::HighResolution);
-    printer.setColorMode( QPrinter::Color );
-    printer.setFullPage( true );
-    printer.setOutputFileName( "stand.pdf" );
-    printer.setOutputFormat( QPrinter::PdfFormat );
-    printer.setResolution(85);
-    printer.setPaperSize(QPrinter::A4);
-
-
-    QTextEdit *editor = new QTextEdit;
-    editor->resize(printer.pageRect().size());
-    const int contourWidth = 2 * 340/3;
-    const int contourHeight = 2 * 360/3;
-    QImage contour = QImage(contourWidth ,contourHeight, QImage::Format_ARGB32 );
-
-
-    QwtPlotRenderer renderer;
-    renderer.setDiscardFlag( QwtPlotRenderer::DiscardBackground );
-    renderer.setDiscardFlag( QwtPlotRenderer::DiscardCanvasBackground );
-    renderer.setDiscardFlag( QwtPlotRenderer::DiscardCanvasFrame );
-    renderer.setDiscardFlag(QwtPlotRenderer::DiscardLegend);
-    ContourPlot *plot =new ContourPlot(0,0,true);//m_contourPlot;
-    plot->m_minimal = true;
-    QList<int> unrotatedNdxs;
-    QList<int> rotatedNdxs;
-
-
-    QString html = ("<html><head/><body><h1><center>Test Stand Astig Removal</center></h1>"
+    setupStandPrinter(printer);
+
+    standAstigRun *run = m_standRun = new standAstigRun;
+    run->wizPage = wizPage;
+    run->list = list;
+    run->next = 0;
+    run->startingNdx = m_wavefronts.size() -1;
+    run->avgNdx = -1;
+    run->page2 = 0;
+    run->pending = 0;
+    run->plot = new ContourPlot(0,0,true);//m_contourPlot;
+    run->plot->m_minimal = true;
+    run->editor = new QTextEdit;
+    run->editor->resize(printer.pageRect().size());
+
+    run->html = ("<html><head/><body><h1><center>Test Stand Astig Removal</center></h1>"
                     "<h2><center>" + AstigReportTitle);
-           html.append("    <font color='grey'>" + QDate::currentDate().toString() +
+           run->html.append("    <font color='grey'>" + QDate::currentDate().toString() +
                        " " +QTime::currentTime().toString()+"</font></center><h2>");
-           html.append("<h3>Step 1. Counter rotate input files results:</h3>"
+           run->html.append("<h3>Step 1. Counter rotate input files results:</h3>"
                        "Check that all the counter rotated images appear to be oriented the same way."
                        "If the stand astig is equal to or larger than the mirror astig they may not appear to be oriented the same way."
                        "But continue anyway and look for other features on the surface that rotated if possible."
             "<table border='1'style='ds margin-top:0px; margin-bottom:0px; margin-left:0px; margin-right:0px;'"
             " 'width='100%' cellspacing='2' cellpadding='0'>");
-    html.append("<tr><td><p align='center'><b>Unrotated inputs</b></p></td>");
-    html.append("<td><p align='center'><b> Counter Rotated </b></p></td></tr>");
-
-
-    QTextDocument *doc = editor->document();
-    QList<QString> doc1Res;
-    doc->setPageSize(printer.pageRect().size()); // This is necessary if you want to hide the page number
-    QList<int> rotated;
-    QList<int> inputs;
-    editor->append("<tr>");
-    int startingNdx = m_wavefronts.size() -1;
+    run->html.append("<tr><td><p align='center'><b>Unrotated inputs</b></p></td>");
+    run->html.append("<td><p align='center'><b> Counter Rotated </b></p></td></tr>");
 
-    for (int i = 0; i < list.size(); ++i){
-        contour.fill( QColor( Qt::white ).rgb() );
-        QPainter painter( &contour );
-        int ndx = m_wavefronts.size();
-        inputs.append(ndx);
-        // get input file
-
-        m_surface_finished = false;
-        QStringList loadList;
-        loadList << list[i]->fname;
-        emit load(loadList, this);
-        while (!m_surface_finished){qApp->processEvents();} // wait for wavefront to be computed
-
-        wavefront * wf = m_wavefronts[m_currentNdx];
-        unrotatedNdxs.append(m_currentNdx);
-        plot->setSurface(wf);
-        plot->replot();
-        renderer.render( plot, &painter, QRect(0,0,contourWidth,contourHeight) );
-
-        QString imageName = QString().sprintf("mydata://%s.png",list[i]->fname.toStdString().c_str());
-        QString angle = QString().sprintf("%6.2lf Deg",list[i]->angle);
-        doc->addResource(QTextDocument::ImageResource,  QUrl(imageName), QVariant(contour));
-        doc1Res.append(imageName);
-        html.append("<tr><td><p align='center'> <img src='" +imageName + "' /><br><b>" + angle + "</b></p></td>");
-
-
-        // counter rotate it
-        wizPage->runpb->setText(QString("Counter Rotating " + list[i]->fname));
-        QList<int> l;
-        l.append(ndx);
-        ndx = m_wavefronts.size();
-
-        m_surface_finished = false;
-        rotateThese(list[i]->angle,l);
-        rotated.append(ndx);
-        wf = m_wavefronts[ndx];
-        while (!m_surface_finished){qApp->processEvents();}
-        plot->setSurface(wf);
-        plot->replot();
 
-        contour.fill( QColor( Qt::white ).rgb() );
-        renderer.render( plot, &painter, QRect(0,0,contourWidth,contourHeight) );
-        angle = QString().sprintf("%6.2lf Deg",list[i]->angle);
-        imageName = QString().sprintf("mydata://CR%s%s.png",list[i]->fname.toStdString().c_str(),angle.toStdString().c_str());
+    run->editor->document()->setPageSize(printer.pageRect().size()); // This is necessary if you want to hide the page number
+    run->editor->append("<tr>");
+    standAstigNextInput();
+}
 
+// Render wf into the report document under imageName.
+static void addStandContour(QTextDocument *doc, ContourPlot *plot, wavefront *wf,
+                            const QString &imageName){
+    QImage contour(standContourWidth, standContourHeight, QImage::Format_ARGB32);
+    contour.fill( QColor( Qt::white ).rgb() );
+    QPainter painter( &contour );
+    QwtPlotRenderer renderer;
+    setupStandRenderer(renderer);
+    plot->setSurface(wf);
+    plot->replot();
+    renderer.render( plot, &painter, QRect(0,0,standContourWidth,standContourHeight) );
+    doc->addResource(QTextDocument::ImageResource,  QUrl(imageName), QVariant(contour));
+}
 
-        doc->addResource(QTextDocument::ImageResource,  QUrl(imageName), QVariant(contour));
-        doc1Res.append(imageName);
-        html.append("<td><p align='center'> <img src='" +imageName + "' /><br><b>Counter " + angle + "</b></p></td>");
-        html.append("</tr>");
+// Load the next input or, when all are counter rotated, average them.
+void SurfaceManager::standAstigNextInput(){
+    standAstigRun *run = m_standRun;
+    if (run->next < run->list.size()){
+        loadWavefront(run->list[run->next]->fname)->then(this, SLOT(standInputLoaded(surfaceOperation*)));
+        return;
     }
-    html.append("</table></body></html>");
-
-    editor->setHtml(html);
-    editor->setDocument(doc);
-
-    //editor->show();
+    run->html.append("</table></body></html>");
+    run->editor->setHtml(run->html);
 
     // Now average all the rotated ones.
     QList<wavefront *> wlist;
-    for (int i = 0; i < rotated.size(); ++i){
-        wlist << m_wavefronts[rotated[i]];
+    for (int i = 0; i < run->rotated.size(); ++i){
+        wlist << m_wavefronts[run->rotated[i]];
     }
+    average(wlist)->then(this, SLOT(standAverageDone(surfaceOperation*)));
+}
 
-    int avgNdx = m_wavefronts.size();  // the index of the average
+void SurfaceManager::standInputLoaded(surfaceOperation *op){
+    standAstigRun *run = m_standRun;
+    rotationDef *input = run->list[run->next];
+    int ndx = op->wavefront();
+    op->deleteLater();
+    run->inputs.append(ndx);
+
+    QString imageName = QString().sprintf("mydata://%s.png",input->fname.toStdString().c_str());
+    QString angle = QString().sprintf("%6.2lf Deg",input->angle);
+    addStandContour(run->editor->document(), run->plot, resident(ndx), imageName);
+    run->doc1Res.append(imageName);
+    run->html.append("<tr><td><p align='center'> <img src='" +imageName + "' /><br><b>" + angle + "</b></p></td>");
+
+    // counter rotate it
+    run->wizPage->runpb->setText(QString("Counter Rotating " + input->fname));
+    QList<int> l;
+    l.append(ndx);
+    rotateThese(input->angle,l)->then(this, SLOT(standInputRotated(surfaceOperation*)));
+}
 
-    m_surface_finished = false;
+void SurfaceManager::standInputRotated(surfaceOperation *op){
+    standAstigRun *run = m_standRun;
+    rotationDef *input = run->list[run->next];
+    int ndx = op->wavefront();
+    op->deleteLater();
+    run->rotated.append(ndx);
+
+    QString angle = QString().sprintf("%6.2lf Deg",input->angle);
+    QString imageName = QString().sprintf("mydata://CR%s%s.png",input->fname.toStdString().c_str(),angle.toStdString().c_str());
+    addStandContour(run->editor->document(), run->plot, resident(ndx), imageName);
+    run->doc1Res.append(imageName);
+    run->html.append("<td><p align='center'> <img src='" +imageName + "' /><br><b>Counter " + angle + "</b></p></td>");
+    run->html.append("</tr>");
+
+    ++run->next;
+    standAstigNextInput();
+}
 
-    average(wlist);
-    while (!m_surface_finished){qApp->processEvents();}
+void SurfaceManager::standAverageDone(surfaceOperation *op){
+    standAstigRun *run = m_standRun;
+    run->avgNdx = op->wavefront();  // the index of the average
+    op->deleteLater();
+    if (run->avgNdx < 0){
+        // the user cancelled the average
+        run->wizPage->runpb->setText("Compute");
+        run->wizPage->runpb->setEnabled(true);
+        delete run->plot;
+        delete run->editor;
+        delete run;
+        m_standRun = 0;
+        QApplication::restoreOverrideCursor();
+        return;
+    }
     emit(nameChanged(m_wavefronts[m_currentNdx]->name, QString("AverageStandRemoved")));
-    QTextEdit *page2 = new QTextEdit;
-    page2->resize(600,800);
-    QTextDocument *doc2 = page2->document();
-    QList<QString> doc2Res;
-    html = ("<html><head/><body><h1>Test Stand Astig Removal</h1>"
+    run->page2 = new QTextEdit;
+    run->page2->resize(600,800);
+    QTextDocument *doc2 = run->page2->document();
+    QString html = ("<html><head/><body><h1>Test Stand Astig Removal</h1>"
             "<h3>Step 2. Averaged surface with stand induced terms removed:</h3>");
 
 
-    plot->setSurface(m_wavefronts[m_currentNdx]);
-    contour = QImage(450,450, QImage::Format_ARGB32 );
+    run->plot->setSurface(resident(run->avgNdx));
+    QImage contour = QImage(450,450, QImage::Format_ARGB32 );
     contour.fill( QColor( Qt::white ).rgb() );
     QPainter painter( &contour );
-
-    renderer.render( plot, &painter, QRect(0,0,450,450) );
+    QwtPlotRenderer renderer;
+    setupStandRenderer(renderer);
+    renderer.render( run->plot, &painter, QRect(0,0,450,450) );
 
     QString imageName = "mydata://AvgAstigremoved.png";
     doc2->addResource(QTextDocument::ImageResource,  QUrl(imageName), QVariant(contour));
-    doc2Res.append(imageName);
+    run->doc2Res.append(imageName);
     html.append("<p> <img src='" +imageName + "' /></p>");
     html.append("</body></html>");
-    page2->setDocument(doc2);
-    page2->setHtml(html);
-    //page2->show();
+    run->page2->setHtml(html);
 
-    // calculate stand astig for each input
-    // for each input rotate the average by the input angle and subtract it from the input
-    // plot the astig of each of the inputs which will be the stand only astig.
+    standAstigRemoveStand();
+}
+
+// calculate stand astig for each input
+// for each input rotate the average by the input angle and subtract it from the input
+// plot the astig of each of the inputs which will be the stand only astig.
+// The subtraction only needs the rotated data so all of them are started at once.
+void SurfaceManager::standAstigRemoveStand(){
+    standAstigRun *run = m_standRun;
+    run->wizPage->runpb->setText("computing averages");
+    for (int i = 0; i < run->list.size(); ++i){
+        QList<int> toRotate;
+        toRotate.append(run->avgNdx);
+        surfaceOperation *rotOp = rotateThese(-run->list[i]->angle,toRotate);
+        int ndx = rotOp->wavefront();   // the rotated average
+        rotOp->then(this, SLOT(standRemoved(surfaceOperation*)));
+        surfaceOperation *op = subtract(m_wavefronts[run->inputs[i]], m_wavefronts[ndx],false);
+        run->standNdxs << op->wavefront();
+        op->then(this, SLOT(standRemoved(surfaceOperation*)));
+        run->pending += 2;
+    }
+}
+
+void SurfaceManager::standRemoved(surfaceOperation *op){
+    op->deleteLater();
+    if (--m_standRun->pending == 0)
+        standAstigReport();
+}
 
-    wizPage->runpb->setText("computing averages");
-    textres page3res = Phase2(list, inputs, avgNdx);
+void SurfaceManager::standAstigReport(){
+    standAstigRun *run = m_standRun;
+    QTextEdit *editor = run->editor;
+    QTextEdit *page2 = run->page2;
+    textres page3res = Phase2(run->list, run->inputs, run->standNdxs);
     QTabWidget *tabw = new QTabWidget();
     tabw->setTabShape(QTabWidget::Triangular);
     tabw->addTab(editor, "Page 1 input analysis");
@@ -1863,13 +2218,15 @@ void SurfaceManager::computeStandAstig(define_input *wizPage, QList<rotationDef
                        page3res.Edit->document()->resource(QTextDocument::ImageResource,QString("mydata://StandCotourZerns.png") ));
     pdfDoc.addResource(QTextDocument::ImageResource, QString("mydata://StandCotourMat.png"),
                        page3res.Edit->document()->resource(QTextDocument::ImageResource,QString("mydata://StandCotourMat.png") ));
-    foreach(QString res, doc1Res){
+    foreach(QString res, run->doc1Res){
         pdfDoc.addResource(QTextDocument::ImageResource, res, editor->document()->resource(QTextDocument::ImageResource,res));
     }
-    foreach(QString res, doc2Res){
+    foreach(QString res, run->doc2Res){
         pdfDoc.addResource(QTextDocument::ImageResource, res, page2->document()->resource(QTextDocument::ImageResource,res));
     }
 
+     QPrinter printer(QPrinter::HighResolution);
+     setupStandPrinter(printer);
      printer.setOutputFileName(AstigReportPdfName);
      QTextCursor cursor(&pdfDoc);
      cursor.insertHtml(editor->toHtml());
@@ -1883,15 +2240,18 @@ void SurfaceManager::computeStandAstig(define_input *wizPage, QList<rotationDef
 
      //Delete all work wavefronts except the overall average with stand removed.
      QList<int> deleteThese;
-     for (int i = m_wavefronts.size() -1; i > startingNdx; --i){
-         if (i != avgNdx)
+     for (int i = m_wavefronts.size() -1; i > run->startingNdx; --i){
+         if (i != run->avgNdx)
             deleteThese.append(i);
      }
 
      deleteWaveFronts(deleteThese);
 
-    wizPage->runpb->setText("Compute");
-    wizPage->runpb->setEnabled(true);
+    run->wizPage->runpb->setText("Compute");
+    run->wizPage->runpb->setEnabled(true);
+    delete run->plot;
+    delete run;
+    m_standRun = 0;
     QApplication::restoreOverrideCursor();
 }
 
@@ -1940,7 +2300,7 @@ void SurfaceManager::showAll3D(GLWidget *gl)
     QFont serifFont("Times", 18, QFont::Bold);
     for (int i = 0; i < m_wavefronts.size(); ++i)
     {
-        wavefront * wf = m_wavefronts[i];
+        wavefront * wf = resident(i);
         gl->setSurface(wf);
         QImage glImage = gl->grabFrameBuffer();
         QPainter p2(&glImage);
@@ -2006,7 +2366,7 @@ void SurfaceManager::showAllContours(){
     renderer.setLayoutFlag( QwtPlotRenderer::FrameWithScales,false );
     for (int i = 0; i < m_wavefronts.size(); ++i)
     {
-        wavefront * wf = m_wavefronts[i];
+        wavefront * wf = resident(i);
         plot->setSurface(wf);
         plot->replot();
         int y_offset =  height * (i/columns) + 10;
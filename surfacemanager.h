@@ -36,16 +36,78 @@
 #include "metricsdisplay.h"
 #include <QTimer>
 #include <QProgressDialog>
+#include <QThreadPool>
+#include <QRunnable>
+#include <QSet>
+#include <QMap>
+#include <QMultiHash>
 #include "wftstats.h"
 #include "circleoutline.h"
 #include "simulationsview.h"
 #include "standastigwizard.h"
+#include "rotationdlg.h"
 
 
+// What a surface job computes from, taken when the job is queued so the worker never
+// reads a wavefront or setting the GUI thread may change meanwhile.  wf shares the
+// rasters of the wavefront, the GUI thread replaces them rather than writing into
+// them.  The job leaves its results in wf.
+struct surfaceWork
+{
+    surfaceWork() : refit(false), renull(false), ellipse(false), blur(false), blurSize(0) {}
+    wavefront wf;
+    bool refit;
+    bool renull;
+    std::vector<bool> enables;
+    bool ellipse;
+    bool blur;
+    int blurSize;
+};
+
+// Handle to an asynchronous SurfaceManager operation such as loading a wavefront,
+// averaging or rotating.  The call that starts the operation returns the handle at
+// once and finished is emitted on the GUI thread when every surface it makes has
+// been computed.  Connect to finished to chain the next operation.  The handle
+// deletes itself after finished unless autoDelete is turned off.
+class surfaceOperation : public QObject
+{
+    Q_OBJECT
+public:
+    explicit surfaceOperation(QObject *parent = 0);
+    bool isFinished() const { return m_finished; }
+    // the wavefronts the operation made, the main result last.  -1 if there is none.
+    QList<int> wavefronts() const { return m_results; }
+    int wavefront() const { return m_results.isEmpty() ? -1 : m_results.last(); }
+    void setAutoDelete(bool autoDelete) { m_autoDelete = autoDelete; }
+    bool autoDelete() const { return m_autoDelete; }
+    // Call slot of receiver with the handle once the operation has finished.  The
+    // call is queued so it runs after the surface delivery that finished it.  The
+    // slot owns the handle then and deletes it.
+    void then(QObject *receiver, const char *slot);
+
+signals:
+    void finished(surfaceOperation *op);
+
+private slots:
+    void finish();
+
+private:
+    friend class SurfaceManager;
+    QSet<int> m_waiting;        // wavefronts whose surfaces are still being computed
+    QList<int> m_results;
+    const char *m_next;         // SurfaceManager slot to run when m_waiting empties
+    bool m_finished;
+    bool m_autoDelete;
+};
+
+Q_DECLARE_METATYPE(QList<wavefront *>)
+
 struct textres {
     QTextEdit *Edit;
     QList<QString> res;
 };
+class wavefrontStore;
+struct standAstigRun;
 class SurfaceManager : public QObject
 {
     Q_OBJECT
@@ -58,7 +120,8 @@ public:
                                         ProfilePlot *profilePlot = 0, ContourPlot *contourPlot = 0,
                                         GLWidget *glPlot = 0, metricsDisplay *mets = 0);
     static SurfaceManager *m_instance;
-    bool loadWavefront(const QString &fileName);
+    surfaceOperation *loadWavefront(const QString &fileName, bool *mirrorParamsChanged = 0);
+    static bool readWavefront(const QString &fileName, wavefront *wf, double *verticalAxis);
     void sendSurface(wavefront* wf);
     void computeMetrics(wavefront *wf);
     void makeMask(int waveNdx);
@@ -100,25 +163,54 @@ public:
 
     cv::Mat_<double> subtractPlane(cv::Mat_<double> phase, cv::Mat_<bool> mask);
 
-    void average(QList<wavefront *> wfList);
+    surfaceOperation *average(QList<wavefront *> wfList);
     void subtractWavefronts();
     bool m_askAboutReverse;
-    bool m_surface_finished;
+    bool generateSurface(int ndx);
+    bool isGenerating();
+    bool makeResident(wavefront *wf);
+    wavefront *resident(int ndx);
+    void trimMemory();
+    QString memoryReport();
 private:
+    wavefrontStore *m_store;    // keeps m_wavefronts within the memory budget
     QProgressDialog *pd;
-    QThread *m_generatorThread;
+    QThreadPool *m_generatorPool;
+    QMutex m_jobLock;           // guards the job lists, m_jobSeq and m_nextDelivery
+    QSet<int> m_queued;         // wavefronts with a job waiting for a worker
+    QHash<int, surfaceWork> m_work;     // input of the queued jobs by wavefront
+    QHash<int, surfaceWork> m_results;  // output of finished jobs by sequence
+    QSet<int> m_running;        // wavefronts being computed
+    QSet<int> m_rerun;          // wavefronts changed while being computed
+    QMap<int, int> m_doneJobs;  // finished jobs waiting for earlier ones, sequence -> index
+    int m_jobSeq;
+    int m_nextDelivery;
+    surfaceWork startJob(int ndx);
+    void jobResult(int seq, const surfaceWork &work);
+    bool isBusy(int ndx);
     QTimer *m_waveFrontTimer;
     QTimer *m_toolsEnableTimer;
     int workToDo;
     int workProgress;
-    void subtract(wavefront *wf1, wavefront *wf2, bool use_null = true);
+    surfaceOperation *subtract(wavefront *wf1, wavefront *wf2, bool use_null = true);
+    QMutex m_opLock;                            // guards m_waiters
+    QMultiHash<int, surfaceOperation *> m_waiters;  // wavefront -> operations waiting on it
+    surfaceOperation *newOperation();
+    bool replaceDemo();
+    void waitFor(surfaceOperation *op, int ndx, const char *next = 0);
+    void finishLater(surfaceOperation *op);
+    int askUser(const QString &message);
+    bool matchMirrorConfig(QList<wavefront *> wfs);
     wftStats *m_wftStats;
-    textres Phase2(QList<rotationDef *> list, QList<int> inputs, int avgNdx);
+    textres Phase2(QList<rotationDef *> list, QList<int> inputs, QList<int> standNdxs);
+    standAstigRun *m_standRun;  // computeStandAstig between its operations
+    void standAstigNextInput();
+    void standAstigRemoveStand();
+    void standAstigReport();
 
 signals:
     void currentNdxChanged(int);
     void waveFrontClicked(int);
-    void generateSurfacefromWavefront(int ndx, SurfaceManager * sm);
     void deleteWavefront(int);
     void rotateTheseSig(int, QList<int>);
     void progress(int);
@@ -129,6 +221,7 @@ signals:
     void showTab(int);
     void load(QStringList, SurfaceManager *);
     void enableControls(bool);
+    void surfaceCreated(int ndx);   // createSurfaceFromPhaseMap is done
 private slots:
     void waveFrontClickedSlot(int ndx);
     void wavefrontDClicked(const QString & name);
@@ -138,16 +231,27 @@ private slots:
     void surfaceSmoothGBValue(int value);
     void computeZerns();
     void surfaceGenFinished(int ndx);
+    void surfaceJobDone(int seq, int ndx);
     void backGroundUpdate();
+    void refitSelected();
     void deleteWaveFronts(QList<int> list);
-    void average(QList<int> list);
+    surfaceOperation *average(QList<int> list);
     void transfrom(QList<int> list);
     void saveAllContours();
     void enableTools();
+    void checkPhaseMapSign(surfaceOperation *op);
+    void phaseMapDone(surfaceOperation *op);
+    void selectResult(surfaceOperation *op);
+    void standInputLoaded(surfaceOperation *op);
+    void standInputRotated(surfaceOperation *op);
+    void standAverageDone(surfaceOperation *op);
+    void standRemoved(surfaceOperation *op);
 public slots:
-    void rotateThese(double angle, QList<int> list);
-    void createSurfaceFromPhaseMap(cv::Mat phase, CircleOutline outside,
-                                   CircleOutline center, QString name);
+    surfaceOperation *addWavefronts(QList<wavefront *> wfs, double verticalAxis,
+                                   QStringList unreadable);
+    surfaceOperation *rotateThese(double angle, QList<int> list, int mode = ROTATE_RESAMPLE);
+    surfaceOperation *createSurfaceFromPhaseMap(cv::Mat phase, CircleOutline outside,
+                                                CircleOutline center, QString name);
     void invert(QList<int> list);
     void wftNameChanged(int, QString);
     void showAllContours();
@@ -157,26 +261,20 @@ public slots:
 };
 
 
-class surfaceGenerator : public QObject {
-    Q_OBJECT
+// Computes the zernikes, nulled and smoothed surface of one wavefront on a
+// SurfaceManager pool thread.  It works on the surfaceWork the manager made for it and
+// hands the results back, the manager puts them in the wavefront on its own thread.
+class surfaceGenerator : public QRunnable {
 
 public:
-    surfaceGenerator(SurfaceManager *sm);
+    surfaceGenerator(SurfaceManager *sm, int wavefront_index, int seq);
     ~surfaceGenerator();
-
-public slots:
-    void process(int wavefront_index, SurfaceManager *sm);
-
-signals:
-    void finished(int wavefront_index);
-    void error(QString err);
-    void showMessage(QString);
+    void run();
 
 private:
-    // add your variables here
     SurfaceManager* m_sm;
-    QMutex sync;
-    zern_generator * m_zg;
+    int m_ndx;
+    int m_seq;
 };
 
 #endif // SURFACEMANAGER_H
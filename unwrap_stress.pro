@@ -0,0 +1,21 @@
+#-------------------------------------------------
+#
+# unwrap_stress: checks that phase unwrapping on many threads at once gives the
+# same results, bit for bit, as unwrapping one map at a time.
+# See unwrapstress.cpp for the command line.
+#
+#-------------------------------------------------
+
+TEMPLATE = app
+TARGET = unwrap_stress
+CONFIG += console
+CONFIG -= qt app_bundle
+
+SOURCES += unwrapstress.cpp \
+    punwrap.cpp
+
+HEADERS += punwrap.h
+
+# same OpenCV as DFTFringe.pro
+INCLUDEPATH += c:\opencv\build\include
+LIBS += C:/opencv/build-mingw/bin/*.dll
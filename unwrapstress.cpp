@@ -0,0 +1,186 @@
+/******************************************************************************
+**
+**  Copyright 2016 Dale Eason
+**  This file is part of DFTFringe
+**  is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation version 3 of the License
+
+** DFTFringe is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with DFTFringe.  If not, see <http://www.gnu.org/licenses/>.
+
+****************************************************************************/
+
+// unwrap_stress: checks that unwrapContext gives the same answer on any thread.
+//
+// A set of synthetic wrapped phase maps is unwrapped one at a time on one thread to
+// get the reference results.  The same maps are then unwrapped with many contexts
+// running at once, some of them reused from map to map, and every result must match
+// its reference bit for bit.  Both queue modes are checked, and the reference is
+// checked to have really been unwrapped.
+//
+//  unwrap_stress [--maps 32] [--size 384] [--rounds 3]
+//
+// Exits with 0 when every parallel result matches and 1 otherwise.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <vector>
+#include <algorithm>
+#include "opencv/cv.h"
+#include "punwrap.h"
+
+// One synthetic mirror.  The surface is a few low order terms with a different mix
+// for every map plus a little noise, wrapped to 0..1 like the vortex phase is.
+struct stressMap
+{
+    int size;
+    std::vector<double> phase;
+    std::vector<char> mask;     // non zero outside the mirror
+};
+
+// small deterministic generator so every run makes the same maps
+static unsigned int nextRandom(unsigned int &state){
+    state = state * 1103515245u + 12345u;
+    return (state >> 8) & 0xffffff;
+}
+
+static stressMap makeMap(int size, int seed){
+    stressMap m;
+    m.size = size;
+    m.phase.assign(size * size, 0.);
+    m.mask.assign(size * size, 1);
+    unsigned int state = 7919u * (seed + 1);
+    double tiltX = (nextRandom(state) / 16777216. - .5) * 20.;
+    double tiltY = (nextRandom(state) / 16777216. - .5) * 20.;
+    double power = 2. + nextRandom(state) / 16777216. * 10.;
+    double astig = (nextRandom(state) / 16777216. - .5) * 6.;
+    double sphere = (nextRandom(state) / 16777216. - .5) * 4.;
+    // a central obstruction on every other map gives more than one region to seed
+    double obstruction = (seed % 2) ? .2 : 0.;
+    double c = (size - 1)/2.;
+    double r = c - 2;
+    for (int y = 0; y < size; ++y){
+        for (int x = 0; x < size; ++x){
+            double ux = (x - c)/r;
+            double uy = (y - c)/r;
+            double rho2 = ux * ux + uy * uy;
+            if (rho2 > 1. || rho2 < obstruction * obstruction)
+                continue;
+            double v = tiltX * ux + tiltY * uy + power * rho2 + astig * (ux * ux - uy * uy) +
+                    sphere * rho2 * rho2 + (nextRandom(state) / 16777216. - .5) * .05;
+            m.phase[y * size + x] = v - floor(v);
+            m.mask[y * size + x] = 0;
+        }
+    }
+    return m;
+}
+
+// Unwraps a range of maps.  Every range has its own context which is reused for each
+// map of the range, so buffer reuse is checked as well as concurrency.
+class stressBody : public cv::ParallelLoopBody
+{
+public:
+    const std::vector<stressMap> &m_maps;
+    std::vector<std::vector<double> > &m_results;
+    unwrapContext::queueMode m_mode;
+    stressBody(const std::vector<stressMap> &maps, std::vector<std::vector<double> > &results,
+               unwrapContext::queueMode mode):
+        m_maps(maps), m_results(results), m_mode(mode){}
+    void operator() (const cv::Range &range) const
+    {
+        unwrapContext context;
+        context.setQueueMode(m_mode);
+        for (int i = range.start; i < range.end; ++i){
+            const stressMap &m = m_maps[i];
+            m_results[i].assign(m.size * m.size, 0.);
+            context.resize(m.size, m.size);
+            context.unwrap(&m.phase[0], &m_results[i][0], &m.mask[0]);
+        }
+    }
+};
+
+static const char *modeName(unwrapContext::queueMode mode){
+    return (mode == unwrapContext::EXACT_HEAP) ? "exact heap" : "bucket queue";
+}
+
+int main(int argc, char *argv[])
+{
+    int maps = 32;
+    int size = 384;
+    int rounds = 3;
+    for (int i = 1; i < argc; ++i){
+        if (i + 1 < argc && !strcmp(argv[i], "--maps"))
+            maps = atoi(argv[++i]);
+        else if (i + 1 < argc && !strcmp(argv[i], "--size"))
+            size = atoi(argv[++i]);
+        else if (i + 1 < argc && !strcmp(argv[i], "--rounds"))
+            rounds = atoi(argv[++i]);
+        else {
+            fprintf(stderr, "usage: unwrap_stress [--maps 32] [--size 384] [--rounds 3]\n");
+            return 1;
+        }
+    }
+    if (maps < 1 || size < 16 || rounds < 1){
+        fprintf(stderr, "maps, size and rounds must be positive, size at least 16\n");
+        return 1;
+    }
+
+    std::vector<stressMap> data;
+    for (int i = 0; i < maps; ++i)
+        data.push_back(makeMap(size, i));
+    size_t bytes = (size_t)size * size * sizeof(double);
+
+    unwrapContext::queueMode modes[] = {unwrapContext::EXACT_HEAP, unwrapContext::BUCKET_QUEUE};
+    int failures = 0;
+    for (int mi = 0; mi < 2; ++mi){
+        unwrapContext::queueMode mode = modes[mi];
+
+        // reference results, one map at a time on this thread
+        std::vector<std::vector<double> > serial(maps);
+        for (int i = 0; i < maps; ++i)
+            stressBody(data, serial, mode)(cv::Range(i, i + 1));
+        // the maps have several waves of power so an unwrapped one spans more than 1
+        for (int i = 0; i < maps; ++i){
+            double low = 0., high = 0.;
+            for (size_t k = 0; k < serial[i].size(); ++k){
+                if (data[i].mask[k])
+                    continue;
+                low = std::min(low, serial[i][k]);
+                high = std::max(high, serial[i][k]);
+            }
+            if (high - low <= 1.){
+                fprintf(stderr, "%s: map %d was not unwrapped\n", modeName(mode), i);
+                ++failures;
+            }
+        }
+
+        for (int round = 0; round < rounds; ++round){
+            // one map per stripe on the first round, then fewer stripes than maps so
+            // contexts are reused
+            int stripes = (round == 0) ? maps : std::max(1, maps/(round + 1));
+            std::vector<std::vector<double> > parallel(maps);
+            cv::parallel_for_(cv::Range(0, maps), stressBody(data, parallel, mode), stripes);
+            int bad = 0;
+            for (int i = 0; i < maps; ++i){
+                if (memcmp(&serial[i][0], &parallel[i][0], bytes) != 0){
+                    fprintf(stderr, "%s round %d: map %d differs from the serial result\n",
+                            modeName(mode), round, i);
+                    ++bad;
+                }
+            }
+            printf("%s round %d: %d maps of %dx%d in %d stripes, %d mismatches\n",
+                   modeName(mode), round, maps, size, size, stripes, bad);
+            failures += bad;
+        }
+    }
+    printf("%s\n", failures ? "FAILED" : "passed");
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,217 @@
+/******************************************************************************
+**
+**  Copyright 2016 Dale Eason
+**  This file is part of DFTFringe
+**  is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation version 3 of the License
+
+** DFTFringe is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with DFTFringe.  If not, see <http://www.gnu.org/licenses/>.
+
+****************************************************************************/
+#include "vortex.h"
+#include "vortexdebug.h"
+#include "graphicsutilities.h"
+#include <math.h>
+
+#define WRAPPI(x) (((x) > M_PI) ? ((x)-2*M_PI) : (((x) <= -M_PI) ? ((x)+2*M_PI) : (x)))
+
+vortexEngine::vortexEngine():
+    m_low(-1.), m_smooth(-1.)
+{
+}
+
+// Rebuild only the cached grids and filters whose key changed.
+void vortexEngine::prepare(cv::Size size, double low, double smooth)
+{
+    int xsize = size.width;
+    int ysize = size.height;
+    if (size != m_size){
+        m_size = size;
+        m_low = m_smooth = -1.;
+        std::vector<int> ix(xsize);
+        std::vector<int> iy(ysize);
+        for (int i=0; i<=xsize/2 && i < xsize; ++i) ix[i] = -i;
+        for (int i=1; i<=xsize/2; ++i) ix[xsize-i] = i;
+        for (int i=0; i<=ysize/2 && i < ysize; ++i) iy[i] = -i;
+        for (int i=1; i<=ysize/2; ++i) iy[ysize-i] = i;
+
+        m_rho2.create(size, CV_64F);
+        m_spiral.create(size, CV_64FC2);
+        for (int j=0; j<ysize; ++j) {
+            double *r = m_rho2.ptr<double>(j);
+            double *s = m_spiral.ptr<double>(j);
+            for (int i=0; i<xsize; ++i) {
+                r[i] = ix[i]*ix[i] + iy[j]*iy[j];
+                double theta = atan2 ((double)iy[j], (double)ix[i]);
+                s[2*i] = cos(theta);
+                s[2*i+1] = sin(theta);
+            }
+        }
+    }
+    if (low > 0 && low != m_low){
+        m_low = low;
+        m_highPass.create(size, CV_64F);
+        const double *r = m_rho2.ptr<double>(0);
+        double *f = m_highPass.ptr<double>(0);
+        for (int i = 0; i < xsize * ysize; ++i)
+            f[i] = 1.0 - exp (-r[i]/(low*low));
+    }
+    if (smooth > 0 && smooth != m_smooth){
+        m_smooth = smooth;
+        m_lowPass.create(size, CV_64F);
+        const double *r = m_rho2.ptr<double>(0);
+        double *f = m_lowPass.ptr<double>(0);
+        for (int i = 0; i < xsize * ysize; ++i)
+            f[i] = exp (-r[i]/(smooth * smooth));
+    }
+}
+
+// Multiply an interleaved complex array in place by a real filter.
+static void applyFilter(cv::Mat &spec, const cv::Mat &filter)
+{
+    double *s = spec.ptr<double>(0);
+    const double *f = filter.ptr<double>(0);
+    int size = (int)filter.total();
+    for (int i = 0; i < size; ++i){
+        s[2*i] *= f[i];
+        s[2*i+1] *= f[i];
+    }
+}
+
+// Multiply an interleaved complex array in place by a complex kernel.
+static void applyKernel(cv::Mat &spec, const cv::Mat &kernel)
+{
+    double *s = spec.ptr<double>(0);
+    const double *k = kernel.ptr<double>(0);
+    int size = (int)kernel.total();
+    for (int i = 0; i < size; ++i){
+        double re = s[2*i]*k[2*i] - s[2*i+1]*k[2*i+1];
+        double im = s[2*i]*k[2*i+1] + s[2*i+1]*k[2*i];
+        s[2*i] = re;
+        s[2*i+1] = im;
+    }
+}
+
+cv::Mat vortexEngine::compute(const cv::Mat &input, const cv::Mat &mask, double low, double smooth,
+                              vortexDebug *debug)
+{
+    int xsize = input.cols;
+    int ysize = input.rows;
+    int size = xsize * ysize;
+    prepare(input.size(), low, smooth);
+
+    // Take the Fourier transform.
+    cv::dft(input, m_fdom, cv::DFT_COMPLEX_OUTPUT);
+
+    // High-pass filter the Fourier domain to remove the background.
+    if (low > 0)
+        applyFilter(m_fdom, m_highPass);
+    if (debug && debug->m_showFdom){
+        showMag(m_fdom.clone(),true,"fdom");
+    }
+
+    // Take the inverse Fourier transform to get the cleaned igram.
+    cv::dft(m_fdom, m_im, cv::DFT_INVERSE | cv::DFT_REAL_OUTPUT | cv::DFT_SCALE);
+
+    // Normalize the image by removing the exterior and centering values.
+    double *imRe = m_im.ptr<double>(0);
+    const uchar *bp = mask.ptr<uchar>(0);
+    double sum = 0;
+    int count = 0;
+    for (int i = 0; i < size; ++i){
+        if (!bp[i])
+            imRe[i] = 0.;
+        else if (imRe[i] != 0.0){
+            sum += imRe[i];
+            ++count;
+        }
+    }
+    cv::dft(m_im, m_fdom, cv::DFT_COMPLEX_OUTPUT);
+    if (count > 0)
+        m_im -= sum/count;
+
+    // Calculate the intermediate values d1 and d2.
+    applyKernel(m_fdom, m_spiral);
+    cv::dft(m_fdom, m_d1, cv::DFT_INVERSE | cv::DFT_SCALE);
+    applyKernel(m_fdom, m_spiral);
+    cv::dft(m_fdom, m_d2, cv::DFT_INVERSE | cv::DFT_SCALE);
+
+    // Calculate the orientation and the quality map for unwrapping.
+    m_r.create(input.size(), CV_64FC2);
+    const double *d1 = m_d1.ptr<double>(0);
+    const double *d2 = m_d2.ptr<double>(0);
+    double *r = m_r.ptr<double>(0);
+    for (int i=0; i<size; ++i) {
+        r[2*i] = d1[2*i]*d1[2*i] - d1[2*i+1]*d1[2*i+1] - imRe[i]*d2[2*i];
+        r[2*i+1] = d1[2*i]*d1[2*i+1] + d1[2*i+1]*d1[2*i] - imRe[i]*d2[2*i+1];
+    }
+    if (smooth > 0) {
+        // Low-pass filter r to smooth it.
+        cv::dft(m_r, m_r);
+        applyFilter(m_r, m_lowPass);
+        cv::dft(m_r, m_r, cv::DFT_INVERSE | cv::DFT_SCALE);
+    }
+
+    m_orient.create(input.size(), CV_64F);
+    m_qmap.create(input.size(), CV_64F);
+    m_dir.create(input.size(), CV_64F);
+    double *orient = m_orient.ptr<double>(0);
+    double *qmap = m_qmap.ptr<double>(0);
+    double *dir = m_dir.ptr<double>(0);
+    for (int i=0; i<size; ++i)
+        orient[i] = atan2 (r[2*i+1], r[2*i]);
+
+    if (debug && debug->m_showOrientation){
+        showData("orient", m_orient.clone());
+    }
+
+    for (int i=0; i<size; ++i) {
+        qmap[i] = sqrt (r[2*i]*r[2*i] + r[2*i+1]*r[2*i+1]);
+        orient[i] /= (2.*M_PI);  // put in range -.5..5 for unwrap
+    }
+
+    // Unwrap the orientation to get the direction.
+    m_unwrapper.resize(xsize, ysize);
+    m_unwrapper.unwrap(orient, qmap, dir);
+
+    // Calculate the quadrature and from it the wrapped phase.
+    cv::Mat phase = cv::Mat::zeros(input.size(), CV_64F);
+    double *p = phase.ptr<double>(0);
+    for (int i=0; i<size; ++i) {
+        if (!bp[i])
+            continue;
+        double d = WRAPPI(dir[i]*M_PI);
+        double imIm = d1[2*i]*cos(-d) - d1[2*i+1]*sin(-d);
+        p[i] = atan2 (imIm, imRe[i]);
+    }
+
+    if (debug && debug->m_showFdom3){
+        // Display the isolated side lobe.
+        cv::Mat planes[2] = {m_im.clone(), cv::Mat::zeros(input.size(), CV_64F)};
+        double *q = planes[1].ptr<double>(0);
+        for (int i=0; i<size; ++i){
+            double d = WRAPPI(dir[i]*M_PI);
+            q[i] = d1[2*i]*cos(-d) - d1[2*i+1]*sin(-d);
+        }
+        cv::Mat sideLobe;
+        cv::merge(planes,2,sideLobe);
+        shiftDFT(sideLobe);
+        cv::dft(sideLobe,sideLobe);
+        shiftDFT(sideLobe);
+        showMag(sideLobe, true, "fdom3");
+    }
+    if (debug && debug->m_showWrapped){
+        cv::Mat tt = phase.clone();
+        cv::normalize(tt,tt,0.f,1.f,CV_MINMAX);
+        cv::imshow(" wrapped ", tt);
+        cv::waitKey(1);
+    }
+    return phase;
+}
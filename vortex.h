@@ -18,8 +18,48 @@
 #ifndef VORTEX_H
 #define VORTEX_H
 #include <opencv/cv.h>
+#include "punwrap.h"
+
+class vortexDebug;
+
+// Vortex (spiral phase) transform of an interferogram into a wrapped phase map.
+// The radial grid, the spiral phase kernel and the high and low pass filters are
+// cached for the current size and filter widths and all intermediate complex arrays
+// are kept between calls.  Repeated use on images of the same size with the same
+// filters does no allocation apart from the returned phase.
+// An engine is not shared between threads, use one per thread.
+class vortexEngine
+{
+public:
+    vortexEngine();
+
+    // input is the real CV_64F image, mask is CV_8U non zero on the mirror.
+    // low is the high pass filter radius, smooth the orientation low pass radius.
+    // Returns the wrapped phase in radians, zero outside of the mask.
+    cv::Mat compute(const cv::Mat &input, const cv::Mat &mask, double low, double smooth,
+                    vortexDebug *debug = 0);
+    unwrapContext &unwrapper() { return m_unwrapper; }
+
+private:
+    cv::Size m_size;
+    cv::Mat m_rho2;         // squared distance from DC in DFT order
+    cv::Mat m_spiral;       // exp(i * theta), CV_64FC2
+    cv::Mat m_highPass;
+    double m_low;
+    cv::Mat m_lowPass;
+    double m_smooth;
+
+    cv::Mat m_im;           // real image
+    cv::Mat m_fdom;         // spectrum, CV_64FC2
+    cv::Mat m_d1;
+    cv::Mat m_d2;
+    cv::Mat m_r;
+    cv::Mat m_orient;
+    cv::Mat m_qmap;
+    cv::Mat m_dir;
+    unwrapContext m_unwrapper;
+
+    void prepare(cv::Size size, double low, double smooth);
+};
 
-void vortex(cv::Mat &dft, const char *ext,
-           double low, double smooth,
-           double *phase, const char *what);
 #endif // VORTEX_H
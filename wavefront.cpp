@@ -18,7 +18,7 @@
 #include "wavefront.h"
 
 wavefront::wavefront():
-    gaussian_diameter(0.),dirtyZerns(true),useSANull(true)
+    gaussian_diameter(0.),dirtyZerns(true),dirtyNull(false),useSANull(true)
 {
 }
 
@@ -45,6 +45,8 @@ wavefront::wavefront(const wavefront &wf): data(wf.data.clone()),
     max(wf.max),
     std(wf.std),
     mean(wf.mean),
-    dirtyZerns(wf.dirtyZerns)
+    dirtyZerns(wf.dirtyZerns),
+    dirtyNull(wf.dirtyNull),
+    nullCoefs(wf.nullCoefs)
 {}
 
@@ -48,6 +48,8 @@ public:
     double std;
     double mean;
     bool dirtyZerns;
+    bool dirtyNull;                 // nulls changed, nulledData needs redoing but not the fit
+    std::vector<double> nullCoefs;  // amount of each term added to data to make nulledData
 
 
 };
@@ -0,0 +1,65 @@
+/******************************************************************************
+**
+**  Copyright 2016 Dale Eason
+**  This file is part of DFTFringe
+**  is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation version 3 of the License
+
+** DFTFringe is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with DFTFringe.  If not, see <http://www.gnu.org/licenses/>.
+
+****************************************************************************/
+#include "wavefrontaccumulator.h"
+
+// Move the mean of each counted pixel of a block of rows toward the new value.
+class meanBody : public cv::ParallelLoopBody
+{
+public:
+    const cv::Mat &m_data;
+    const cv::Mat &m_mask;
+    cv::Mat &m_mean;
+    cv::Mat &m_count;
+    meanBody(const cv::Mat &data, const cv::Mat &mask, cv::Mat &mean, cv::Mat &count):
+        m_data(data), m_mask(mask), m_mean(mean), m_count(count){}
+    void operator() (const cv::Range &range) const
+    {
+        for (int y = range.start; y < range.end; ++y){
+            const double *x = m_data.ptr<double>(y);
+            const uchar *m = m_mask.empty() ? 0 : m_mask.ptr<uchar>(y);
+            double *mean = m_mean.ptr<double>(y);
+            int *n = m_count.ptr<int>(y);
+            for (int i = 0; i < m_data.cols; ++i){
+                if (m && !m[i])
+                    continue;
+                mean[i] += (x[i] - mean[i]) / ++n[i];
+            }
+        }
+    }
+};
+
+wavefrontAccumulator::wavefrontAccumulator(int rows, int cols) :
+    m_mean(cv::Mat::zeros(rows, cols, CV_64F)),
+    m_count(cv::Mat::zeros(rows, cols, CV_32S)),
+    m_samples(0)
+{
+}
+
+void wavefrontAccumulator::add(const cv::Mat &data, const cv::Mat &mask){
+    cv::Mat x = data;
+    if (x.rows != m_mean.rows || x.cols != m_mean.cols)
+        cv::resize(data, x, m_mean.size());
+    cv::Mat m;
+    if (!mask.empty()){
+        m = mask;
+        if (m.rows != m_mean.rows || m.cols != m_mean.cols)
+            cv::resize(mask, m, m_mean.size(), 0, 0, cv::INTER_NEAREST);
+    }
+    cv::parallel_for_(cv::Range(0, m_mean.rows), meanBody(x, m, m_mean, m_count));
+    ++m_samples;
+}
@@ -0,0 +1,50 @@
+/******************************************************************************
+**
+**  Copyright 2016 Dale Eason
+**  This file is part of DFTFringe
+**  is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation version 3 of the License
+
+** DFTFringe is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with DFTFringe.  If not, see <http://www.gnu.org/licenses/>.
+
+****************************************************************************/
+#ifndef WAVEFRONTACCUMULATOR_H
+#define WAVEFRONTACCUMULATOR_H
+
+#include "opencv/cv.h"
+
+// Per pixel running mean of a series of rasters.
+//
+// Each add() updates the mean and the sample count of every pixel it counts.  It
+// costs one pass over the pixels of the new raster and the earlier ones are not
+// needed again, so a series can be averaged one wavefront at a time and the mean
+// read after every step.
+class wavefrontAccumulator
+{
+public:
+    // rows and cols are the size every raster is resized to.
+    wavefrontAccumulator(int rows, int cols);
+
+    // Add a CV_64F raster.  Only pixels where mask is not 0 are counted, an empty
+    // mask counts them all.
+    void add(const cv::Mat &data, const cv::Mat &mask = cv::Mat());
+
+    int samples() const { return m_samples; }
+    cv::Mat mean() const { return m_mean; }    // CV_64F, 0 where nothing was counted.
+                                                // Shared with the accumulator, clone it
+                                                // to keep it past the next add().
+
+private:
+    cv::Mat m_mean;
+    cv::Mat m_count;
+    int m_samples;
+};
+
+#endif // WAVEFRONTACCUMULATOR_H
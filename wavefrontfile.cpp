@@ -0,0 +1,622 @@
+/******************************************************************************
+**
+**  Copyright 2016 Dale Eason
+**  This file is part of DFTFringe
+**  is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation version 3 of the License
+
+** DFTFringe is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with DFTFringe.  If not, see <http://www.gnu.org/licenses/>.
+
+****************************************************************************/
+#include "wavefrontfile.h"
+#include <QFileInfo>
+#include <QStringList>
+#include <QtEndian>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <cstring>
+#include <clocale>
+#include <cstdio>
+#include <algorithm>
+#include <locale>
+
+static const char wfbMagic[8] = {'D','F','T','W','F','B','1','\0'};
+
+// little endian field access for the .wfb header
+static void putU32(uchar *p, quint32 v){
+    qToLittleEndian<quint32>(v, p);
+}
+static quint32 getU32(const uchar *p){
+    return qFromLittleEndian<quint32>(p);
+}
+static void putF64(uchar *p, double v){
+    quint64 u;
+    memcpy(&u, &v, 8);
+    qToLittleEndian<quint64>(u, p);
+}
+static double getF64(const uchar *p){
+    quint64 u = qFromLittleEndian<quint64>(p);
+    double v;
+    memcpy(&v, &u, 8);
+    return v;
+}
+
+bool isBinaryWavefrontFile(const QString &fileName){
+    QFile file(fileName);
+    if (!file.open(QIODevice::ReadOnly))
+        return false;
+    char buf[8];
+    return file.read(buf, 8) == 8 && memcmp(buf, wfbMagic, 8) == 0;
+}
+
+// Text .wft values are written one per line with the %g conversion an ostream uses
+// by default, 6 significant digits.  Large maps are formatted and parsed in chunks
+// on all cores.  The files stay byte for byte what the stream writer made.
+
+#define WFT_CHUNK_BYTES 65536
+
+static const double exactPowers[23] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+static inline bool isSpace(char c){
+    return c == ' ' || c == '\n' || c == '\r' || c == '\t' || c == '\v' || c == '\f';
+}
+
+// Convert the token [p, end) to a double.  A number with no more than 19 digits and
+// a power of ten up to 22 is converted with one exact multiply or divide, which is
+// correctly rounded.  Anything else, including nan and inf, goes through a C locale
+// stream.  Returns false when the whole token is not a number.
+static bool parseDouble(const char *p, const char *end, double &v){
+    const char *start = p;
+    bool neg = false;
+    if (p < end && (*p == '-' || *p == '+')){
+        neg = (*p == '-');
+        ++p;
+    }
+    quint64 mantissa = 0;
+    int digits = 0;
+    int exp10 = 0;
+    bool exact = true;
+    bool any = false;
+    for (; p < end && *p >= '0' && *p <= '9'; ++p){
+        any = true;
+        if (digits < 19){
+            mantissa = mantissa * 10 + (*p - '0');
+            if (mantissa)
+                ++digits;
+        }
+        else {
+            ++exp10;
+            exact = false;
+        }
+    }
+    if (p < end && *p == '.'){
+        for (++p; p < end && *p >= '0' && *p <= '9'; ++p){
+            any = true;
+            if (digits < 19){
+                mantissa = mantissa * 10 + (*p - '0');
+                if (mantissa)
+                    ++digits;
+                --exp10;
+            }
+            else
+                exact = false;
+        }
+    }
+    if (any && p < end && (*p == 'e' || *p == 'E')){
+        ++p;
+        bool eneg = false;
+        if (p < end && (*p == '-' || *p == '+')){
+            eneg = (*p == '-');
+            ++p;
+        }
+        if (p == end || *p < '0' || *p > '9')
+            any = false;
+        int e = 0;
+        for (; p < end && *p >= '0' && *p <= '9'; ++p)
+            if (e < 10000)
+                e = e * 10 + (*p - '0');
+        exp10 += eneg ? -e : e;
+    }
+    if (any && p == end && exact && mantissa <= ((quint64)1 << 53) &&
+            exp10 >= -22 && exp10 <= 22){
+        double d = (double)mantissa;
+        d = (exp10 < 0) ? d / exactPowers[-exp10] : d * exactPowers[exp10];
+        v = neg ? -d : d;
+        return true;
+    }
+
+    std::istringstream iss(std::string(start, end));
+    iss.imbue(std::locale::classic());
+    iss >> v;
+    return !iss.fail() && iss.peek() == EOF;
+}
+
+// Count the whitespace separated tokens of each chunk of the text.
+class wftCountBody : public cv::ParallelLoopBody
+{
+public:
+    const char *m_text;
+    const std::vector<qint64> &m_bounds;
+    std::vector<qint64> &m_counts;
+    wftCountBody(const char *text, const std::vector<qint64> &bounds, std::vector<qint64> &counts):
+        m_text(text), m_bounds(bounds), m_counts(counts){}
+    void operator() (const cv::Range &range) const
+    {
+        for (int c = range.start; c < range.end; ++c){
+            const char *p = m_text + m_bounds[c];
+            const char *end = m_text + m_bounds[c + 1];
+            qint64 n = 0;
+            while (p < end){
+                while (p < end && isSpace(*p))
+                    ++p;
+                if (p == end)
+                    break;
+                ++n;
+                while (p < end && !isSpace(*p))
+                    ++p;
+            }
+            m_counts[c] = n;
+        }
+    }
+};
+
+// Parse the raster values of each chunk.  Values are in file order, bottom row first.
+class wftParseBody : public cv::ParallelLoopBody
+{
+public:
+    const char *m_text;
+    const std::vector<qint64> &m_bounds;
+    const std::vector<qint64> &m_first;
+    qint64 m_count;
+    cv::Mat &m_data;
+    std::vector<char> &m_failed;
+    wftParseBody(const char *text, const std::vector<qint64> &bounds,
+                 const std::vector<qint64> &first, qint64 count, cv::Mat &data,
+                 std::vector<char> &failed):
+        m_text(text), m_bounds(bounds), m_first(first), m_count(count), m_data(data),
+        m_failed(failed){}
+    void operator() (const cv::Range &range) const
+    {
+        int width = m_data.cols;
+        int height = m_data.rows;
+        for (int c = range.start; c < range.end; ++c){
+            const char *p = m_text + m_bounds[c];
+            const char *end = m_text + m_bounds[c + 1];
+            qint64 i = m_first[c];
+            while (p < end && i < m_count){
+                while (p < end && isSpace(*p))
+                    ++p;
+                if (p == end)
+                    break;
+                const char *token = p;
+                while (p < end && !isSpace(*p))
+                    ++p;
+                double v;
+                if (!parseDouble(token, p, v)){
+                    m_failed[c] = 1;
+                    break;
+                }
+                int y = (int)(i / width);
+                int x = (int)(i % width);
+                m_data.at<double>(height - y - 1, x) = v;
+                ++i;
+            }
+        }
+    }
+};
+
+// Format the values of a range of output rows, top of the file first, into one
+// string per row.
+class wftFormatBody : public cv::ParallelLoopBody
+{
+public:
+    const cv::Mat_<double> &m_src;
+    std::vector<std::string> &m_rows;
+    char m_point;
+    wftFormatBody(const cv::Mat_<double> &src, std::vector<std::string> &rows, char point):
+        m_src(src), m_rows(rows), m_point(point){}
+    void operator() (const cv::Range &range) const
+    {
+        char buf[64];
+        for (int r = range.start; r < range.end; ++r){
+            const double *s = m_src[m_src.rows - 1 - r];
+            std::string &out = m_rows[r];
+            out.clear();
+            out.reserve(m_src.cols * 10);
+            for (int x = 0; x < m_src.cols; ++x){
+                int n = snprintf(buf, sizeof(buf), "%g", s[x]);
+                if (m_point != '.'){
+                    for (int k = 0; k < n; ++k)
+                        if (buf[k] == m_point)
+                            buf[k] = '.';
+                }
+                buf[n++] = '\n';
+                out.append(buf, n);
+            }
+        }
+    }
+};
+
+bool writeWavefrontFile(const QString &fname, const wavefront &wf, bool saveNulled,
+                        double verticalAxis){
+    std::ofstream file((fname.toStdString().c_str()));
+
+    if (!file.is_open())
+        return false;
+
+    file << wf.data.cols << std::endl << wf.data.rows << std::endl;
+
+    // The stream formats in the classic locale.  snprintf uses the C locale, which
+    // Qt may have set to one with a comma.
+    char point = '.';
+    const char *dp = localeconv()->decimal_point;
+    if (dp && *dp)
+        point = *dp;
+    const cv::Mat_<double> &src = saveNulled ? wf.workData : wf.data;
+    int block = std::max(64, cv::getNumThreads() * 16);
+    std::vector<std::string> rows(std::min(block, src.rows));
+    for (int first = 0; first < src.rows; first += block){
+        int n = std::min(block, src.rows - first);
+        cv::Mat_<double> part = src.rowRange(src.rows - first - n, src.rows - first);
+        cv::parallel_for_(cv::Range(0, n), wftFormatBody(part, rows, point));
+        for (int r = 0; r < n; ++r)
+            file.write(rows[r].data(), rows[r].size());
+    }
+
+    file << "outside ellipse " <<
+                   wf.m_outside.m_center.x()
+         << " " << wf.m_outside.m_center.y()
+         << " " << wf.m_outside.m_radius
+         << " "  << wf.m_outside.m_radius << std:: endl;
+
+    if (wf.m_inside.m_radius > 0){
+        file << "obstruction ellipse " << wf.m_inside.m_center.x()
+         << " " << wf.m_inside.m_center.y()
+         << " " << wf.m_inside.m_radius
+         << " " << wf.m_inside.m_radius << std:: endl;
+    }
+
+    file << "DIAM " << wf.diameter << std::endl;
+    file << "ROC " << wf.roc << std::endl;
+    file << "Lambda " << wf.lambda << std::endl;
+    if (verticalAxis != 0.){
+        file << "ellipse_vertical_axis " << verticalAxis;
+    }
+    return file.good();
+}
+
+bool writeWavefrontBinary(const QString &fname, const wavefront &wf, bool saveNulled,
+                          double verticalAxis, bool float32){
+    QFile file(fname);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate))
+        return false;
+
+    const cv::Mat_<double> &src = saveNulled ? wf.workData : wf.data;
+    int sample = float32 ? 4 : 8;
+
+    uchar h[WFB_HEADER_SIZE];
+    memset(h, 0, sizeof(h));
+    memcpy(h, wfbMagic, 8);
+    putU32(h + 8, 1);
+    putU32(h + 12, WFB_HEADER_SIZE);
+    putU32(h + 16, src.cols);
+    putU32(h + 20, src.rows);
+    putU32(h + 24, sample);
+    putU32(h + 28, (verticalAxis != 0.) ? 1 : 0);
+    putF64(h + 32, wf.m_outside.m_center.x());
+    putF64(h + 40, wf.m_outside.m_center.y());
+    putF64(h + 48, wf.m_outside.m_radius);
+    putF64(h + 56, wf.m_inside.m_center.x());
+    putF64(h + 64, wf.m_inside.m_center.y());
+    putF64(h + 72, wf.m_inside.m_radius);
+    putF64(h + 80, wf.diameter);
+    putF64(h + 88, wf.roc);
+    putF64(h + 96, wf.lambda);
+    putF64(h + 104, verticalAxis);
+    int nz = wf.InputZerns.size();
+    putU32(h + 112, nz);
+    for (int i = 0; i < qMin(nz, WFB_HEADER_ZERNS); ++i)
+        putF64(h + 120 + 8 * i, wf.InputZerns[i]);
+    if (file.write((const char *)h, WFB_HEADER_SIZE) != WFB_HEADER_SIZE)
+        return false;
+
+    std::vector<uchar> row(src.cols * sample);
+    for (int y = 0; y < src.rows; ++y){
+        const double *s = src[y];
+        if (!float32 && Q_BYTE_ORDER == Q_LITTLE_ENDIAN){
+            memcpy(&row[0], s, row.size());
+        }
+        else if (!float32){
+            for (int x = 0; x < src.cols; ++x)
+                putF64(&row[8 * x], s[x]);
+        }
+        else {
+            for (int x = 0; x < src.cols; ++x){
+                float f = (float)s[x];
+                quint32 u;
+                memcpy(&u, &f, 4);
+                putU32(&row[4 * x], u);
+            }
+        }
+        if (file.write((const char *)&row[0], row.size()) != (qint64)row.size())
+            return false;
+    }
+    for (int i = WFB_HEADER_ZERNS; i < nz; ++i){
+        uchar z[8];
+        putF64(z, wf.InputZerns[i]);
+        if (file.write((const char *)z, 8) != 8)
+            return false;
+    }
+    return true;
+}
+
+// The outline and mirror lines after the raster.
+static void readWavefrontTail(std::istream &file, double width, double height,
+                              wavefront &wf, double *verticalAxis){
+    std::string line;
+    QString l;
+
+    double xm = width/2.,ym = (height)/2.,
+            radm = std::min(xm,ym)-2 ,
+            roc = wf.roc,
+            lambda = wf.lambda,
+            diam = wf.diameter;
+    double xo = width/2., yo = height/2., rado = 0;
+    if (verticalAxis)
+        *verticalAxis = 0.;
+
+    std::string dummy;
+    while (getline(file, line)) {
+        l = QString::fromStdString(line);
+        std::istringstream iss(line);
+        if (l.startsWith("outside")) {
+            QStringList sl = l.split(" ");
+            xm = sl[2].toDouble();
+            radm = sl[4].toDouble();
+            ym = sl[3].toDouble();
+            continue;
+        }
+        if (l.startsWith("DIAM")){
+            iss >> dummy >> diam;
+            continue;
+        }
+        if (l.startsWith("ROC")){
+            iss >> dummy >> roc;
+            continue;
+        }
+        if (l.startsWith("Lambda")){
+            iss >> dummy >> lambda;
+            continue;
+        }
+        if (l.startsWith("obstruction")){
+            iss >> dummy >> dummy >> xo >> yo >> rado;
+            continue;
+        }
+        if (l.startsWith("ellipse_vertical_axis")){
+            double v = 0;
+            iss >> dummy >> v;
+            if (verticalAxis)
+                *verticalAxis = v;
+        }
+    }
+
+    wf.m_outside = CircleOutline(QPointF(xm,height - ym), radm);
+    if (rado == 0){
+        xo = xm;
+        yo = ym;
+    }
+    wf.m_inside = CircleOutline(QPoint(xo,yo), rado);
+    wf.diameter = diam;
+    wf.roc = roc;
+    wf.lambda = lambda;
+}
+
+// Memory map the file and parse the raster in parallel.  Returns false, having
+// changed nothing, for anything unusual such as a short raster or a value that is
+// not a number.  The stream reader then handles it as it always has.
+static bool readWavefrontFileMapped(const QString &fname, wavefront &wf, double *verticalAxis){
+    QFile qfile(fname);
+    if (!qfile.open(QIODevice::ReadOnly) || qfile.size() == 0)
+        return false;
+    qint64 size = qfile.size();
+    uchar *map = qfile.map(0, size);
+    if (!map)
+        return false;
+    const char *text = (const char *)map;
+
+    // width and height
+    double dims[2];
+    qint64 pos = 0;
+    for (int i = 0; i < 2; ++i){
+        while (pos < size && isSpace(text[pos]))
+            ++pos;
+        qint64 start = pos;
+        while (pos < size && !isSpace(text[pos]))
+            ++pos;
+        if (start == pos || !parseDouble(text + start, text + pos, dims[i])){
+            qfile.unmap(map);
+            return false;
+        }
+    }
+    double width = dims[0];
+    double height = dims[1];
+    if (width <= 0 || height <= 0 || width * height > 2.e9){
+        qfile.unmap(map);
+        return false;
+    }
+    cv::Mat data(height,width, CV_64F,0.);
+    qint64 count = (qint64)data.rows * data.cols;
+
+    // line aligned chunks
+    std::vector<qint64> bounds;
+    bounds.push_back(pos);
+    while (bounds.back() < size){
+        qint64 b = std::min(size, bounds.back() + WFT_CHUNK_BYTES);
+        while (b < size && text[b - 1] != '\n')
+            ++b;
+        bounds.push_back(b);
+    }
+    int chunks = (int)bounds.size() - 1;
+    std::vector<qint64> counts(chunks, 0);
+    cv::parallel_for_(cv::Range(0, chunks), wftCountBody(text, bounds, counts));
+
+    // index of the first value of each chunk and the chunk holding the last one
+    std::vector<qint64> first(chunks + 1, 0);
+    for (int c = 0; c < chunks; ++c)
+        first[c + 1] = first[c] + counts[c];
+    if (first[chunks] < count){
+        qfile.unmap(map);
+        return false;
+    }
+    int last = 0;
+    while (first[last + 1] < count)
+        ++last;
+    // the text after the raster starts right after value count - 1
+    qint64 tail = bounds[last];
+    qint64 need = count - first[last];
+    while (need > 0){
+        while (isSpace(text[tail]))
+            ++tail;
+        while (tail < size && !isSpace(text[tail]))
+            ++tail;
+        --need;
+    }
+
+    std::vector<char> failed(chunks, 0);
+    cv::parallel_for_(cv::Range(0, last + 1),
+                      wftParseBody(text, bounds, first, count, data, failed));
+    bool ok = std::find(failed.begin(), failed.end(), 1) == failed.end();
+    std::string rest;
+    if (ok)
+        rest.assign(text + tail, size - tail);
+    qfile.unmap(map);
+    if (!ok)
+        return false;
+
+    std::istringstream file(rest);
+    wf.data = data;
+    readWavefrontTail(file, width, height, wf, verticalAxis);
+    return true;
+}
+
+bool readWavefrontFile(const QString &fname, wavefront &wf, double *verticalAxis){
+    if (readWavefrontFileMapped(fname, wf, verticalAxis))
+        return true;
+
+    std::ifstream file(fname.toStdString().c_str());
+    if (!file)
+        return false;
+
+    double width;
+    double height;
+    file >> width;
+    file >> height;
+    if (!file || width <= 0 || height <= 0)
+        return false;
+
+    cv::Mat data(height,width, CV_64F,0.);
+
+    for( size_t y = 0; y < height; y++ ) {
+        for( size_t x = 0; x < width; x++ ) {
+            file >> data.at<double>(height - y-1,x);
+        }
+    }
+
+    wf.data = data;
+    readWavefrontTail(file, width, height, wf, verticalAxis);
+    return true;
+}
+
+bool readWavefrontBinary(const QString &fname, wavefront &wf, double *verticalAxis){
+    QFile file(fname);
+    if (!file.open(QIODevice::ReadOnly))
+        return false;
+    uchar h[WFB_HEADER_SIZE];
+    if (file.read((char *)h, WFB_HEADER_SIZE) != WFB_HEADER_SIZE ||
+            memcmp(h, wfbMagic, 8) != 0 || getU32(h + 8) != 1 || getU32(h + 12) != WFB_HEADER_SIZE)
+        return false;
+    int width = getU32(h + 16);
+    int height = getU32(h + 20);
+    int sample = getU32(h + 24);
+    quint32 flags = getU32(h + 28);
+    if (width <= 0 || height <= 0 || (sample != 8 && sample != 4))
+        return false;
+    qint64 n = (qint64)width * height;
+    if (file.size() < WFB_HEADER_SIZE + n * sample)
+        return false;
+
+    // A float64 raster goes straight into the new matrix.  Anything else is read into
+    // the same memory and widened in place from the end backward.
+    cv::Mat_<double> data(height, width);
+    uchar *raster = data.data;
+    if (file.read((char *)raster, n * sample) != n * sample)
+        return false;
+    if (sample == 8 && Q_BYTE_ORDER != Q_LITTLE_ENDIAN){
+        double *d = (double *)raster;
+        for (qint64 i = 0; i < n; ++i)
+            d[i] = getF64(raster + 8 * i);
+    }
+    else if (sample == 4){
+        double *d = (double *)raster;
+        for (qint64 i = n - 1; i >= 0; --i){
+            quint32 u = getU32(raster + 4 * i);
+            float f;
+            memcpy(&f, &u, 4);
+            d[i] = f;
+        }
+    }
+
+    int nz = getU32(h + 112);
+    std::vector<double> zerns;
+    for (int i = 0; i < qMin(nz, WFB_HEADER_ZERNS); ++i)
+        zerns.push_back(getF64(h + 120 + 8 * i));
+    if (nz > WFB_HEADER_ZERNS){
+        QByteArray extra = file.read(8 * (nz - WFB_HEADER_ZERNS));
+        for (int i = 0; i + 8 <= extra.size(); i += 8)
+            zerns.push_back(getF64((const uchar *)extra.constData() + i));
+    }
+
+    wf.data = data;
+    wf.m_outside = CircleOutline(QPointF(getF64(h + 32), getF64(h + 40)), getF64(h + 48));
+    wf.m_inside = CircleOutline(QPointF(getF64(h + 56), getF64(h + 64)), getF64(h + 72));
+    wf.diameter = getF64(h + 80);
+    wf.roc = getF64(h + 88);
+    wf.lambda = getF64(h + 96);
+    if (zerns.size() > 0){
+        if (zerns.size() < WFB_HEADER_ZERNS)
+            zerns.resize(WFB_HEADER_ZERNS, 0.);
+        wf.InputZerns = zerns;
+    }
+    if (verticalAxis)
+        *verticalAxis = (flags & 1) ? getF64(h + 104) : 0.;
+    return true;
+}
+
+QString convertWavefrontFile(const QString &fname, bool float32){
+    wavefront wf;
+    wf.diameter = wf.roc = wf.lambda = 0.;
+    double verticalAxis = 0.;
+    QFileInfo info(fname);
+    QString base = info.absolutePath() + "/" + info.completeBaseName();
+    if (isBinaryWavefrontFile(fname)){
+        if (!readWavefrontBinary(fname, wf, &verticalAxis))
+            return QString();
+        QString out = base + ".wft";
+        return writeWavefrontFile(out, wf, false, verticalAxis) ? out : QString();
+    }
+    if (!readWavefrontFile(fname, wf, &verticalAxis))
+        return QString();
+    QString out = base + ".wfb";
+    return writeWavefrontBinary(out, wf, false, verticalAxis, float32) ? out : QString();
+}
@@ -0,0 +1,79 @@
+/******************************************************************************
+**
+**  Copyright 2016 Dale Eason
+**  This file is part of DFTFringe
+**  is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation version 3 of the License
+
+** DFTFringe is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with DFTFringe.  If not, see <http://www.gnu.org/licenses/>.
+
+****************************************************************************/
+#ifndef WAVEFRONTFILE_H
+#define WAVEFRONTFILE_H
+
+#include <QString>
+#include <QFile>
+#include "wavefront.h"
+
+// Reading and writing wavefront files.
+//
+// .wft is the original text format: width, height, one value per line starting at
+// the bottom row, then outline, DIAM, ROC and Lambda lines.
+//
+// .wfb is a binary format.  A 512 byte little endian header is followed by the raster
+// in wavefront::data order (top row first), either float64 or float32.  A float64
+// raster is read straight into the wavefront without parsing or conversion.
+//
+//  offset  size
+//       0     8  magic "DFTWFB1" and a 0
+//       8     4  version (1)
+//      12     4  header size (512)
+//      16     4  width
+//      20     4  height
+//      24     4  bytes per sample (8 or 4)
+//      28     4  flags, 1 = elliptical mirror
+//      32    80  f64 outside x, y, radius, inside x, y, radius, diameter, roc,
+//                lambda, ellipse vertical axis
+//     112     4  number of zernikes
+//     116     4  unused
+//     120   384  f64 zernikes, the first 48
+//     504     8  unused
+//     512        raster
+//                f64 zernikes after the first 48
+
+#define WFB_HEADER_SIZE 512
+#define WFB_HEADER_ZERNS 48
+
+bool isBinaryWavefrontFile(const QString &fileName);
+
+// Write wf as a text .wft file.  verticalAxis is written for elliptical mirrors and
+// is 0 for round ones.  Returns false if the file could not be created.
+bool writeWavefrontFile(const QString &fname, const wavefront &wf, bool saveNulled,
+                        double verticalAxis = 0.);
+
+// Write wf as a .wfb file.  float32 halves the size.
+bool writeWavefrontBinary(const QString &fname, const wavefront &wf, bool saveNulled,
+                          double verticalAxis = 0., bool float32 = false);
+
+// Read a .wft file into wf.data, m_outside, m_inside, diameter, roc and lambda.
+// Values missing from the file are left as they were in wf.  verticalAxis is set
+// when the file is for an elliptical mirror.
+bool readWavefrontFile(const QString &fname, wavefront &wf, double *verticalAxis);
+
+// Same for a .wfb file.  Also sets InputZerns when the file has them.  The raster is
+// read into a new wf.data in one pass.
+bool readWavefrontBinary(const QString &fname, wavefront &wf, double *verticalAxis);
+
+// Read either format by looking at the file contents and write the other.  The new
+// file is next to the old one with the other suffix.  Returns the new name or an
+// empty string.
+QString convertWavefrontFile(const QString &fname, bool float32 = false);
+
+#endif // WAVEFRONTFILE_H
@@ -16,6 +16,7 @@
 
 ****************************************************************************/
 #include "wavefrontloader.h"
+#include <qtconcurrentmap.h>
 
 waveFrontLoader::waveFrontLoader(QObject *parent) :
     QObject(parent), shouldCancel(false)
@@ -32,20 +33,69 @@ void waveFrontLoader::cancel(){
     qDebug() << "trying to cancel";
 }
 
+struct loadedWavefront
+{
+    loadedWavefront() : wf(0), verticalAxis(0.) {}
+    wavefront *wf;          // 0 when the file could not be read
+    double verticalAxis;    // not 0 for an elliptical mirror
+};
+
+// Read one file for loadx on a pool thread.
+static loadedWavefront readOne(const QString &fileName){
+    loadedWavefront result;
+    wavefront *wf = new wavefront();
+    if (!QFileInfo(fileName).isReadable() ||
+            !SurfaceManager::readWavefront(fileName, wf, &result.verticalAxis)){
+        delete wf;
+        return result;
+    }
+    result.wf = wf;
+    return result;
+}
+
+// Read every file on the global pool, then hand them all to the surface manager in
+// one call.  It asks once about any that do not match the mirror configuration and
+// computes all the surfaces at the same time.
 void waveFrontLoader::loadx(QStringList list, SurfaceManager *sm){
     shouldCancel = false;
     emit progressRange(0,list.size()+1);
     emit status(0);
-    bool mirrorConfigChanged = false;
+    emit currentWavefront(QString("Reading %1 wavefronts").arg(list.size()));
+
+    QFutureWatcher<loadedWavefront> watcher;
+    QEventLoop loop;
+    connect(&watcher, SIGNAL(progressValueChanged(int)), this, SIGNAL(status(int)));
+    connect(&watcher, SIGNAL(finished()), &loop, SLOT(quit()));
+    connect(pd, SIGNAL(canceled()), &watcher, SLOT(cancel()));
+    watcher.setFuture(QtConcurrent::mapped(list, readOne));
+    loop.exec();
+
+    QFuture<loadedWavefront> results = watcher.future();
+    QList<wavefront *> wfs;
+    QStringList unreadable;
+    double verticalAxis = 0.;
     for (int i = 0; i < list.size(); ++i){
-        if (pd->wasCanceled())
-                break;
-        emit currentWavefront(list[i]);
-        emit status(i+1);
-        qDebug() << " loading " << i;
-        mirrorConfigChanged |= sm->loadWavefront(list[i]);
+        if (!results.isResultReadyAt(i))
+            continue;
+        loadedWavefront loaded = results.resultAt(i);
+        wavefront *wf = loaded.wf;
+        if (shouldCancel || results.isCanceled()){
+            delete wf;
+            continue;
+        }
+        if (wf == 0){
+            unreadable << list[i];
+            continue;
+        }
+        if (loaded.verticalAxis != 0.)
+            verticalAxis = loaded.verticalAxis;
+        wfs << wf;
     }
     emit status(list.size()+1);
+    if (shouldCancel || results.isCanceled())
+        return;
 
+    QMetaObject::invokeMethod(sm, "addWavefronts", Qt::QueuedConnection,
+                              Q_ARG(QList<wavefront*>, wfs), Q_ARG(double, verticalAxis),
+                              Q_ARG(QStringList, unreadable));
 }
-
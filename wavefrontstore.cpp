@@ -0,0 +1,206 @@
+/******************************************************************************
+**
+**  Copyright 2016 Dale Eason
+**  This file is part of DFTFringe
+**  is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation version 3 of the License
+
+** DFTFringe is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with DFTFringe.  If not, see <http://www.gnu.org/licenses/>.
+
+****************************************************************************/
+#include "wavefrontstore.h"
+#include "wavefrontfile.h"
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QPair>
+#include <algorithm>
+
+wavefrontStore::wavefrontStore() :
+    m_tick(0), m_budget(0), m_serial(0),
+    m_dir(QDir::tempPath() + "/DFTFringe-XXXXXX")
+{
+}
+
+void wavefrontStore::setBudget(qint64 bytes){
+    QMutexLocker lock(&m_lock);
+    m_budget = bytes;
+}
+
+static qint64 matBytes(const cv::Mat &m){
+    return (qint64)m.total() * m.elemSize();
+}
+
+qint64 wavefrontStore::rasterBytes(const wavefront *wf){
+    return matBytes(wf->data) + matBytes(wf->nulledData) + matBytes(wf->workData) +
+            matBytes(wf->mask) + matBytes(wf->workMask);
+}
+
+// The entry for wf, made if it is new.  A wavefront can be deleted and another made
+// at the same address before the next trim so an entry that does not match what is
+// in memory is started over.
+wavefrontStore::entry &wavefrontStore::entryFor(wavefront *wf){
+    QHash<wavefront *, entry>::iterator it = m_entries.find(wf);
+    if (it == m_entries.end()){
+        entry e;
+        e.used = ++m_tick;
+        return m_entries.insert(wf, e).value();
+    }
+    entry &e = it.value();
+    if (!e.spillFile.isEmpty() && !wf->data.empty()){
+        QFile::remove(e.spillFile);
+        e.spillFile.clear();
+        e.spillBytes = 0;
+    }
+    if (e.derivedDropped && !wf->nulledData.empty())
+        e.derivedDropped = false;
+    return e;
+}
+
+bool wavefrontStore::load(wavefront *wf, bool *ok){
+    QMutexLocker lock(&m_lock);
+    if (ok)
+        *ok = true;
+    entry &e = entryFor(wf);
+    e.used = ++m_tick;
+    if (!e.spillFile.isEmpty()){
+        wavefront spilled;
+        if (!readWavefrontBinary(e.spillFile, spilled, 0)){
+            if (ok)
+                *ok = false;
+            return false;
+        }
+        wf->data = spilled.data;
+        QFile::remove(e.spillFile);
+        e.spillFile.clear();
+        e.spillBytes = 0;
+    }
+    bool rebuild = e.derivedDropped;
+    e.derivedDropped = false;
+    return rebuild;
+}
+
+void wavefrontStore::remove(wavefront *wf){
+    QMutexLocker lock(&m_lock);
+    QHash<wavefront *, entry>::iterator it = m_entries.find(wf);
+    if (it == m_entries.end())
+        return;
+    if (!it.value().spillFile.isEmpty())
+        QFile::remove(it.value().spillFile);
+    m_entries.erase(it);
+}
+
+bool wavefrontStore::spill(wavefront *wf, entry &e){
+    if (!m_dir.isValid())
+        return false;
+    QString name = QString("%1/%2.wfb").arg(m_dir.path()).arg(m_serial++);
+    if (!writeWavefrontBinary(name, *wf, false)){
+        QFile::remove(name);
+        return false;
+    }
+    e.spillFile = name;
+    e.spillBytes = QFileInfo(name).size();
+    wf->data = cv::Mat_<double>();
+    return true;
+}
+
+bool wavefrontStore::trim(const QVector<wavefront *> &all, const QSet<wavefront *> &pinned){
+    QMutexLocker lock(&m_lock);
+
+    // forget wavefronts that are gone
+    QSet<wavefront *> live;
+    for (int i = 0; i < all.size(); ++i)
+        live.insert(all[i]);
+    QHash<wavefront *, entry>::iterator it = m_entries.begin();
+    while (it != m_entries.end()){
+        if (live.contains(it.key())){
+            ++it;
+            continue;
+        }
+        if (!it.value().spillFile.isEmpty())
+            QFile::remove(it.value().spillFile);
+        it = m_entries.erase(it);
+    }
+
+    if (m_budget <= 0)
+        return false;
+    qint64 total = 0;
+    for (int i = 0; i < all.size(); ++i)
+        total += rasterBytes(all[i]);
+    if (total <= m_budget)
+        return false;
+
+    // least recently used first
+    QVector<QPair<qint64, wavefront *> > order;
+    for (int i = 0; i < all.size(); ++i){
+        if (!pinned.contains(all[i]))
+            order << qMakePair(entryFor(all[i]).used, all[i]);
+    }
+    std::sort(order.begin(), order.end());
+
+    bool released = false;
+    for (int i = 0; i < order.size() && total > m_budget; ++i){
+        wavefront *wf = order[i].second;
+        // an unfitted wavefront has nothing to rebuild its nulls from
+        if (wf->dirtyZerns || (wf->nulledData.empty() && wf->workData.empty()))
+            continue;
+        qint64 before = rasterBytes(wf);
+        wf->nulledData = cv::Mat_<double>();
+        wf->workData = cv::Mat_<double>();
+        m_entries[wf].derivedDropped = true;
+        total -= before - rasterBytes(wf);
+        released = true;
+    }
+    for (int i = 0; i < order.size() && total > m_budget; ++i){
+        wavefront *wf = order[i].second;
+        entry &e = m_entries[wf];
+        if (!e.spillFile.isEmpty() || wf->data.empty())
+            continue;
+        qint64 before = rasterBytes(wf);
+        if (!spill(wf, e))
+            break;      // disk full or no cache directory, keep the rest in memory
+        total -= before - rasterBytes(wf);
+        released = true;
+    }
+    return released;
+}
+
+bool wavefrontStore::isSpilled(wavefront *wf){
+    QMutexLocker lock(&m_lock);
+    QHash<wavefront *, entry>::const_iterator it = m_entries.constFind(wf);
+    return it != m_entries.constEnd() && !it.value().spillFile.isEmpty();
+}
+
+qint64 wavefrontStore::residentBytes(){
+    QMutexLocker lock(&m_lock);
+    qint64 total = 0;
+    QHash<wavefront *, entry>::const_iterator it;
+    for (it = m_entries.constBegin(); it != m_entries.constEnd(); ++it)
+        total += rasterBytes(it.key());
+    return total;
+}
+
+qint64 wavefrontStore::spilledBytes(){
+    QMutexLocker lock(&m_lock);
+    qint64 total = 0;
+    QHash<wavefront *, entry>::const_iterator it;
+    for (it = m_entries.constBegin(); it != m_entries.constEnd(); ++it)
+        total += it.value().spillBytes;
+    return total;
+}
+
+QString wavefrontStore::report(){
+    const double MB = 1024. * 1024.;
+    QString s = QString("Wavefronts: %1 MB in memory, %2 MB in the disk cache")
+            .arg(residentBytes()/MB, 0, 'f', 1).arg(spilledBytes()/MB, 0, 'f', 1);
+    if (m_budget > 0)
+        s += QString(", budget %1 MB").arg(m_budget/MB, 0, 'f', 0);
+    return s;
+}
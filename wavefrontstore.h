@@ -0,0 +1,89 @@
+/******************************************************************************
+**
+**  Copyright 2016 Dale Eason
+**  This file is part of DFTFringe
+**  is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation version 3 of the License
+
+** DFTFringe is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with DFTFringe.  If not, see <http://www.gnu.org/licenses/>.
+
+****************************************************************************/
+#ifndef WAVEFRONTSTORE_H
+#define WAVEFRONTSTORE_H
+
+#include <QHash>
+#include <QMutex>
+#include <QSet>
+#include <QString>
+#include <QTemporaryDir>
+#include <QVector>
+#include "wavefront.h"
+
+// Keeps the rasters of the loaded wavefronts within a memory budget.
+//
+// When the wavefronts use more than the budget the least recently used ones give
+// up memory in two steps.  First nulledData and workData are dropped since they can
+// be made again from data.  If that is not enough data itself is written to a .wfb
+// file in a temporary cache directory and released.  The masks and zernikes are
+// always kept.
+//
+// load() puts back what was taken.  It reads a spilled raster and says whether the
+// derived rasters have to be rebuilt, which is left to the caller since it knows the
+// current null and smoothing settings.  The cache directory is removed with the
+// store.
+class wavefrontStore
+{
+public:
+    wavefrontStore();
+
+    // 0 is no limit.
+    void setBudget(qint64 bytes);
+    qint64 budget() const { return m_budget; }
+
+    // Make wf usable and mark it as the most recently used.  Returns true when
+    // nulledData and workData were dropped and must be rebuilt.  *ok is false if a
+    // spilled raster could not be read back.
+    bool load(wavefront *wf, bool *ok = 0);
+
+    // Forget wf before it is deleted.
+    void remove(wavefront *wf);
+
+    // Release memory from the least recently used of all until they fit in the
+    // budget.  pinned ones are in use and are left alone.  Returns true if anything
+    // was released.
+    bool trim(const QVector<wavefront *> &all, const QSet<wavefront *> &pinned);
+
+    bool isSpilled(wavefront *wf);
+    qint64 residentBytes();
+    qint64 spilledBytes();
+    QString report();       // one line for the status bar
+
+    static qint64 rasterBytes(const wavefront *wf);
+
+private:
+    struct entry {
+        entry() : used(0), spillBytes(0), derivedDropped(false) {}
+        qint64 used;
+        QString spillFile;  // empty when data is in memory
+        qint64 spillBytes;
+        bool derivedDropped;
+    };
+    QMutex m_lock;          // guards m_entries and m_tick
+    QHash<wavefront *, entry> m_entries;
+    qint64 m_tick;
+    qint64 m_budget;
+    int m_serial;
+    QTemporaryDir m_dir;
+
+    entry &entryFor(wavefront *wf);
+    bool spill(wavefront *wf, entry &e);
+};
+
+#endif // WAVEFRONTSTORE_H
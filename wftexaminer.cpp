@@ -28,8 +28,10 @@
 #include <qwt_plot_intervalcurve.h>
 #include <qwt_scale_engine.h>
 #include "opencv/cv.h"
+// The examiner keeps its own copy of wf.  It shares the rasters so the memory budget
+// can not take them away while the examiner is open.
 wftExaminer::wftExaminer( wavefront *wf,QWidget *parent) :
-    QDialog(parent),m_wf(wf),
+    QDialog(parent),m_wf(new wavefront(*wf)),
     curve(0),maskCurve(0),ui(new Ui::wftExaminer)
 {
     ui->setupUi(this);
@@ -48,6 +50,7 @@ wftExaminer::wftExaminer( wavefront *wf,QWidget *parent) :
 
 wftExaminer::~wftExaminer()
 {
+    delete m_wf;
     delete ui;
 }
 
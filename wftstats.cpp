@@ -19,8 +19,10 @@
 #include <qwt_scale_draw.h>
 #include "wavefront.h"
 #include "zernikedlg.h"
+#include "wavefrontaccumulator.h"
 #include <qwt_plot_histogram.h>
 #include <QTextStream>
+#include "surfacemanager.h"
 class wftNameScaleDraw: public QwtScaleDraw
 {
 public:
@@ -254,7 +256,8 @@ void wftStats::computeWftRunningAvg( QVector<wavefront*> wavefronts, int ndx){
     QHash<QString,int> sizes;
     for (int i = 0; i < last; ++i){
         QString size;
-        size.sprintf("%d %d",wavefronts[i]->workData.rows, wavefronts[i]->workData.cols);
+        // the masks stay in memory when the memory budget releases workData
+        size.sprintf("%d %d",wavefronts[i]->workMask.rows, wavefronts[i]->workMask.cols);
         if (*sizes.find(size))
         {
             ++sizes[size];
@@ -279,25 +282,28 @@ void wftStats::computeWftRunningAvg( QVector<wavefront*> wavefronts, int ndx){
     cv::Mat mask = wavefronts[0]->workMask.clone();
     cv::resize(mask,mask,cv::Size(rcols,rrows));
     QVector<wavefront*> twaves = wavefronts;
-    cv::Mat sum = cv::Mat::zeros(rrows,rcols, wavefronts[ndx]->workData.type());
+    wavefrontAccumulator acc(rrows, rcols);
 
     avgPoints.clear();
     wftPoints.clear();
     trueNdx.clear();
     inrange.clear();
+    SurfaceManager *sm = SurfaceManager::get_instance();
     for (int j = 0; j < last; ++j){
         int i = (ndx + j) % wavefronts.size();
         //i = samndx[j];
+        // one wavefront at a time is brought back and released again
+        sm->makeResident(twaves[i]);
         cv::Mat resized = twaves[i]->workData.clone();
         if (twaves[i]->workData.rows != rrows || twaves[i]->workData.cols != rcols){
             cv::resize(twaves[i]->workData,resized, cv::Size(rcols, rrows));
         }
-        sum += resized;
-        cv::Mat avg = sum/(j+1);
+        sm->trimMemory();
+        acc.add(resized);
         cv::Scalar mean,std;
         cv::meanStdDev(resized,mean,std,mask);
         double stdi = std.val[0]* md->lambda/550.;
-        cv::meanStdDev(avg,mean,std,mask);
+        cv::meanStdDev(acc.mean(),mean,std,mask);
         avgPoints << QPointF(j,std.val[0] * md->lambda/550.);
         wftPoints << QPointF(j,stdi);
         trueNdx << i;
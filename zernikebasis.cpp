@@ -0,0 +1,171 @@
+/******************************************************************************
+**
+**  Copyright 2016 Dale Eason
+**  This file is part of DFTFringe
+**  is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation version 3 of the License
+
+** DFTFringe is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with DFTFringe.  If not, see <http://www.gnu.org/licenses/>.
+
+****************************************************************************/
+#include "zernikebasis.h"
+#include "zernikeprocess.h"
+#include "zernikes.h"
+#include <QSettings>
+#include <cmath>
+
+zernikeBasis::zernikeBasis(int width, int height, double cx, double cy, double radius,
+                           double obstruction, int terms, bool tabulate):
+    width(width), height(height), cx(cx), cy(cy), radius(radius),
+    obstruction(obstruction), terms(terms), m_zern(terms)
+{
+    pixels.reserve((size_t)(M_PI * radius * radius) + width);
+    for (int y = 0; y < height; ++y){
+        double uy = (double)(y - cy)/radius;
+        for (int x = 0; x < width; ++x){
+            double ux = (double)(x - cx)/radius;
+            double rho = sqrt(ux * ux + uy * uy);
+            if (rho > 1. || rho < obstruction)
+                continue;
+            pixels.push_back(y * width + x);
+        }
+    }
+    if (!tabulate)
+        return;
+    table.resize(pixels.size() * terms);
+    std::vector<double> v(terms);
+    for (size_t k = 0; k < pixels.size(); ++k){
+        int x = pixels[k] % width;
+        int y = pixels[k] / width;
+        m_zern.evaluate((x - cx)/radius, (y - cy)/radius, &v[0]);
+        for (int i = 0; i < terms; ++i)
+            table[k * terms + i] = (float)v[i];
+    }
+}
+
+size_t zernikeBasis::bytes() const
+{
+    return pixels.size() * sizeof(int) + table.size() * sizeof(float);
+}
+
+// about what the table of a full circle of radius pixels takes
+qint64 zernikeBasis::tableBytes(double radius, int terms)
+{
+    return (qint64)(M_PI * radius * radius) * terms * (qint64)sizeof(float);
+}
+
+bool zernikeBasis::matches(int w, int h, double x, double y, double r,
+                           double obs, int t) const
+{
+    return w == width && h == height && x == cx && y == cy && r == radius &&
+            obs == obstruction && t == terms;
+}
+
+QBasicAtomicPointer<zernikeBasisCache> zernikeBasisCache::m_instance = Q_BASIC_ATOMIC_INITIALIZER(0);
+zernikeBasisCache *zernikeBasisCache::get_Instance(){
+    zernikeBasisCache *cache = m_instance.loadAcquire();
+    if (cache == 0){
+        // two threads may both make one, only the first to be stored is used
+        cache = new zernikeBasisCache;
+        if (!m_instance.testAndSetOrdered(0, cache)){
+            delete cache;
+            cache = m_instance.loadAcquire();
+        }
+    }
+    return cache;
+}
+
+zernikeBasisCache::zernikeBasisCache():
+    m_hits(0), m_misses(0)
+{
+    QSettings set;
+    m_limit = (qint64)set.value("zernikeBasisCacheMB", 512).toInt() * 1024 * 1024;
+}
+
+zernikeBasisPtr zernikeBasisCache::get(int width, int height, double cx, double cy,
+                                       double radius, double obstruction, int terms)
+{
+    key k = {width, height, cx, cy, radius, obstruction, terms};
+    QMutexLocker lock(&m_lock);
+    for (;;){
+        for (int i = 0; i < m_entries.size(); ++i){
+            if (m_entries[i]->matches(width, height, cx, cy, radius, obstruction, terms)){
+                m_hits.ref();
+                if (i > 0)
+                    m_entries.move(i, 0);
+                return m_entries[0];
+            }
+        }
+        if (!m_making.contains(k))
+            break;
+        // another thread is making it
+        m_made.wait(&m_lock);
+    }
+    m_misses.ref();
+    m_making.append(k);
+    bool tabulate = zernikeBasis::tableBytes(radius, terms) <= m_limit;
+    lock.unlock();
+
+    zernikeBasisPtr basis;
+    try {
+        basis = zernikeBasisPtr(new zernikeBasis(width, height, cx, cy, radius, obstruction,
+                                                 terms, tabulate));
+    }
+    catch (...){
+        lock.relock();
+        m_making.removeOne(k);
+        m_made.wakeAll();
+        throw;
+    }
+
+    lock.relock();
+    m_making.removeOne(k);
+    m_entries.prepend(basis);
+    trim();
+    m_made.wakeAll();
+    return basis;
+}
+
+void zernikeBasisCache::trim()
+{
+    qint64 total = 0;
+    for (int i = 0; i < m_entries.size(); ++i){
+        total += m_entries[i]->bytes();
+        if (i > 0 && total > m_limit){
+            while (m_entries.size() > i)
+                m_entries.removeLast();
+            break;
+        }
+    }
+}
+
+void zernikeBasisCache::setMemoryLimit(qint64 bytes)
+{
+    QMutexLocker lock(&m_lock);
+    m_limit = bytes;
+    trim();
+}
+
+qint64 zernikeBasisCache::bytes()
+{
+    QMutexLocker lock(&m_lock);
+    qint64 total = 0;
+    for (int i = 0; i < m_entries.size(); ++i)
+        total += m_entries[i]->bytes();
+    return total;
+}
+
+void zernikeBasisCache::clear()
+{
+    QMutexLocker lock(&m_lock);
+    m_entries.clear();
+    m_hits.store(0);
+    m_misses.store(0);
+}
@@ -0,0 +1,109 @@
+/******************************************************************************
+**
+**  Copyright 2016 Dale Eason
+**  This file is part of DFTFringe
+**  is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation version 3 of the License
+
+** DFTFringe is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with DFTFringe.  If not, see <http://www.gnu.org/licenses/>.
+
+****************************************************************************/
+#ifndef ZERNIKEBASIS_H
+#define ZERNIKEBASIS_H
+#include <QMutex>
+#include <QWaitCondition>
+#include <QSharedPointer>
+#include <QAtomicInt>
+#include <QAtomicPointer>
+#include <QList>
+#include <vector>
+#include "zernikes.h"
+
+// Zernike values tabulated for every pixel inside the unit circle of one outline.
+// Pixels are listed in row major order and the values of all terms of one pixel are
+// adjacent so a surface is a dot product per pixel.  The table is kept in float, half
+// the memory of double and well within the accuracy of a measured surface.  A basis
+// made without a table evaluates the terms of a pixel when they are asked for.
+class zernikeBasis
+{
+public:
+    int width;
+    int height;
+    double cx;
+    double cy;
+    double radius;
+    double obstruction;     // pixels with rho < obstruction are left out
+    int terms;
+    std::vector<int> pixels;        // y * width + x
+    std::vector<float> table;       // pixels.size() * terms, empty when not tabulated
+
+    zernikeBasis(int width, int height, double cx, double cy, double radius,
+                 double obstruction, int terms, bool tabulate = true);
+    inline int count() const { return (int)pixels.size(); }
+    inline bool tabulated() const { return !table.empty(); }
+    // Values of all terms at pixel k.  out has terms entries.
+    inline void at(int k, double *out) const {
+        if (table.empty()){
+            m_zern.evaluate((pixels[k] % width - cx)/radius, (pixels[k] / width - cy)/radius, out);
+            return;
+        }
+        const float *t = &table[(size_t)k * terms];
+        for (int i = 0; i < terms; ++i)
+            out[i] = t[i];
+    }
+    size_t bytes() const;
+    static qint64 tableBytes(double radius, int terms);
+    bool matches(int width, int height, double cx, double cy, double radius,
+                 double obstruction, int terms) const;
+private:
+    zernikeEvaluator m_zern;
+};
+typedef QSharedPointer<const zernikeBasis> zernikeBasisPtr;
+
+// Process wide cache of zernikeBasis tables keyed on the outline geometry and term
+// count.  Least recently used tables are dropped when the memory limit is exceeded.
+// An outline whose table alone would exceed the limit gets a basis without a table.
+// Safe to use from several threads.  A table is made outside the lock so other
+// outlines are served meanwhile, a second thread asking for the same one waits for it.
+class zernikeBasisCache
+{
+public:
+    static zernikeBasisCache *get_Instance();
+    zernikeBasisPtr get(int width, int height, double cx, double cy, double radius,
+                        double obstruction = 0., int terms = 48);
+    void setMemoryLimit(qint64 bytes);
+    qint64 memoryLimit() const { return m_limit; }
+    qint64 bytes();
+    int hits() const { return m_hits.load(); }
+    int misses() const { return m_misses.load(); }
+    void clear();
+private:
+    zernikeBasisCache();
+    static QBasicAtomicPointer<zernikeBasisCache> m_instance;
+    void trim();
+    struct key {
+        int width, height;
+        double cx, cy, radius, obstruction;
+        int terms;
+        bool operator==(const key &o) const {
+            return width == o.width && height == o.height && cx == o.cx && cy == o.cy &&
+                    radius == o.radius && obstruction == o.obstruction && terms == o.terms;
+        }
+    };
+    QMutex m_lock;
+    QWaitCondition m_made;              // a table being made is done
+    QList<zernikeBasisPtr> m_entries;   // most recently used first
+    QList<key> m_making;                // tables being made outside the lock
+    qint64 m_limit;
+    QAtomicInt m_hits;
+    QAtomicInt m_misses;
+};
+
+#endif // ZERNIKEBASIS_H
@@ -4,6 +4,7 @@
 #include <fstream>
 #include "zernikeprocess.h"
 #include "mirrordlg.h"
+#include "zernikebasis.h"
 zernikeEditDlg::zernikeEditDlg(SurfaceManager *sfm, QWidget *parent) :
     QDialog(parent),
     ui(new Ui::zernikeEditDlg), m_sm(sfm), shouldEnableAll(false)
@@ -41,40 +42,25 @@ void zernikeEditDlg::on_createSurface_clicked()
     int size = ui->sizeSb->value();
     cv::Mat result = cv::Mat::zeros(size,size, CV_64F);
 
-    double rho;
     double xcen = (size -1)/2.;
     double ycen = xcen;
     double rad = xcen - 1;
-    zernikePolar &zpolar = *zernikePolar::get_Instance();
-    for (int y = 0; y <  size; ++y)
+    int terms = std::min(tableModel->rowCount(), Z_TERMS);
+    std::vector<double> coef(Z_TERMS, 0.);
+    for (int z = 0; z < terms; ++z){
+        if (m_zernEnables[z])
+            coef[z] = tableModel->values[z];
+    }
+    zernikeBasisPtr basis = zernikeBasisCache::get_Instance()->get(size, size, xcen, ycen, rad);
+    std::vector<double> t(basis->terms);
+    for (int k = 0; k < basis->count(); ++k)
     {
-        double uy = (double)(y - (ycen)) / rad;
-        for (int x = 0; x < size; ++x)
-        {
-            double ux = (double)(x - (xcen )) /rad;
-            rho = sqrt(ux * ux + uy * uy);
-
-            if (rho <= 1.)
-            {
-                double theta = atan2(uy,ux);
-                zpolar.init(rho,theta);
-                double s1 = 0;
-                for (int z = 0; z < tableModel->rowCount(); ++z){
-                    double v = tableModel->values[z];
-                    if (m_zernEnables[z]){
-                        s1 += v * zpolar.zernike(z, rho, theta);
-                    }
-                }
-                result.at<double>(y,x) = s1;
-
-            }
-            else    // outside mirror outline
-            {
-
-                    result.at<double>(y,x) = 0 ;
-                }
-            }
-        }
+        basis->at(k, &t[0]);
+        double s1 = 0;
+        for (int z = 0; z < terms; ++z)
+            s1 += coef[z] * t[z];
+        ((double *)result.data)[basis->pixels[k]] = s1;
+    }
 
     m_sm->createSurfaceFromPhaseMap(result, CircleOutline(QPointF(xcen,ycen),rad),
                                                 CircleOutline(QPointF(0,0),0),
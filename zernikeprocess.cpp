@@ -22,6 +22,9 @@
 #include <QDebug>
 #include "surfaceanalysistools.h"
 #include "simigramdlg.h"
+#include "zernikebasis.h"
+#include "zernikes.h"
+#include <QMutex>
 std::vector<bool> zernEnables;
 std::vector<double> zNulls;
 double BestSC = -1.;
@@ -165,340 +168,6 @@ Dim big As Double, dum As Double, pivinv As Double, temp As Double
     delete[] indxr;
     delete[] indxc;
 }
-/*
-Public Function Zernike(n As Integer, X As Double, Y As Double) As Double
-' N is Zernike number as given by James Wyant
-*/
-zernikePolar *zernikePolar::m_instance = 0;
-zernikePolar *zernikePolar::get_Instance(){
-    if (m_instance == 0){
-        m_instance = new zernikePolar;
-    }
-    return m_instance;
-}
-
-void zernikePolar::init(double rho, double theta){
-        rho2 = rho * rho;
-        rho3 = pow(rho,3.);
-        rho4 = pow(rho,4.);
-        rho5 = pow(rho,5.);
-        rho6 = pow(rho,6.);
-        rho8 = pow(rho,8.);
-        rho10 = pow(rho,10.);
-        costheta = cos(theta);
-        sintheta = sin(theta);
-        cos2theta = cos(2. * theta);
-        sin2theta = sin(2. * theta);
-        cos3theta = cos(3. * theta);
-        sin3theta = sin(3. * theta);
-        cos4theta = cos(4. * theta);
-        sin4theta = sin(4. * theta);
-        cos5theta = cos(5. * theta);
-        sin5theta = sin(5. * theta);
-    }
-
-double zernikePolar::zernike(int n, double rho, double theta){
-
-    switch(n){
-    case 0: return 1.;
-        break;
-    case 1: return rho * costheta;
-        break;
-    case 2: return rho * sintheta;
-        break;
-    case 3: return -1. + 2. * rho * rho;
-        break;
-    case 4: return rho2 * cos2theta;
-        break;
-    case 5: return rho2 * sin2theta;
-        break;
-    case 6: return rho * (-2. + 3. * rho2) * costheta;
-        break;
-    case 7: return rho * (-2. + 3. * rho2) * sintheta;
-        break;
-    case 8:
-    {
-        return 1. + rho2 * (-6 + 6. * rho2);
-        break;
-    }
-    case 9: return rho * rho * rho * cos3theta;
-        break;
-    case 10: return rho * rho * rho * sin3theta;
-        break;
-
-    case 11:
-
-        return rho2 * (-3 + 4 * rho2) * cos2theta;
-
-        break;
-    case 12:
-
-        return rho2 * (-3 + 4 * rho2) * sin2theta ;
-
-        break;
-
-    case 13:
-        return rho * (3. - 12. * rho2 + 10. * rho4) * costheta;
-        break;
-    case 14:
-        return rho * (3. - 12. * rho2 + 10. * rho4) * sintheta;
-        break;
-    case 15:
-        return -1 + 12 * rho2 - 30. * rho4 + 20. * rho6;
-        break;
-    case 16: return rho4 * cos4theta;
-        break;
-    case 17: return rho4 * sin4theta;
-        break;
-    case 18: return rho3 *( -4. + 5. * rho2) * cos3theta;
-        break;
-    case 19: return rho3 *( -4. + 5. * rho2) * sin3theta;
-        break;
-    case 20: return rho2 * (6. - 20. * rho2 + 15 * rho4)* cos2theta;
-        break;
-    case 21: return rho2 * (6. - 20. * rho2 + 15 * rho4)* sin2theta;
-        break;
-    case 22: return rho * (-4. + 30. * rho2 - 60. * rho4 + 35 * rho6)* costheta;
-        break;
-    case 23: return rho * (-4. + 30. * rho2 - 60. * rho4 + 35 * rho6)* sintheta;
-        break;
-    case 24: return 1. - 20. * rho2 + 90. *  rho4 - 140. * rho6 + 70. * rho8;
-        break;
-    case 25: return rho5 * cos5theta;
-        break;
-    case 26: return rho5 * sin5theta;
-        break;
-    case 27: return rho4 * (-5. + 6. * rho2) * cos4theta;
-        break;
-    case 28: return rho4 * (-5. + 6. * rho2) * sin4theta;
-        break;
-    case 29: return rho3 * (10. - 30. * rho2 + 21. * rho4) * cos3theta;
-        break;
-    case 30: return rho3 * (10. - 30. * rho2 + 21. * rho4) * sin3theta;
-        break;
-    case 31: return rho2 *(-10. + 60. * rho2 - 105. * rho4 + 56. * rho6) * cos2theta;
-        break;
-    case 32: return rho2 *(-10. + 60. * rho2 - 105. * rho4 + 56. * rho6) * sin2theta;
-        break;
-    case 33: return rho * (5. - 60. * rho2 + 210 * rho4 -280. * rho6 + 126. * rho8) * costheta;
-        break;
-    case 34: return rho * (5. - 60. * rho2 + 210 * rho4 -280. * rho6 + 126. * rho8) * sintheta;
-        break;
-    case 35: return -1 + 30. * rho2 -210 * rho4 + 560. * rho6 - 630 * rho8 + 252. * rho10;
-        break;
-    case 36: return rho6 * cos(6. * theta);
-        break;
-    case 37: return rho6 * sin(6. * theta);
-        break;
-    case 38: return rho5 * (-6. + 7 * rho2) * cos5theta;
-        break;
-    case 39: return rho5 * (-6. + 7 * rho2) * sin5theta;
-        break;
-    case 40: return rho4 * (15. -42. * rho2 + 28. * rho4) * cos4theta;
-        break;
-    case 41: return rho4 * (15. -42. * rho2 + 28. * rho4) * sin4theta;
-        break;
-    case 42: return rho3 * (-20 + 105. * rho2 - 168. * rho4 + 84 * rho6) * cos3theta;
-        break;
-    case 43: return rho3 * (-20. + 105. * rho2 - 168. * rho4 + 84. * rho6) * sin3theta;
-        break;
-    case 44: return rho2 * (15. - 140. * rho2 + 420. * rho4 - 504. * rho6 +  210. * rho8) * cos2theta;
-        break;
-    case 45: return rho2 * (15. - 140. * rho2 + 420. * rho4 - 504. * rho6 +  210. * rho8) * sin2theta;
-        break;
-    case 46: return rho *(-6. + 105 * rho2 - 560. * rho4 + 1260. * rho6 -1260. * rho8 +462. * rho10) * costheta;
-        break;
-    case 47: return rho *(-6. + 105 * rho2 - 560. * rho4 + 1260. * rho6 -1260. * rho8 +462. * rho10) * sintheta;
-        break;
-    case 48: return 1. - 42. * rho2 + 420. * rho4 - 1680. * rho6 + 3150. * rho8 -2772. * rho10 + 924. * pow(rho,12.);
-        break;
-
-    }
-    return 0.;
-
-
-}
-
-
-double Zernike(int n, double X, double Y)
-{
-
-
-    static double X2 = 0., X3 = 0., X4 = 0.;
-    static double Y2 = 0., Y3 = 0., Y4 = 0.;
-    static double R2 = 0.;
-    static double last_x = 0.;
-    static double last_y = 0.;
-
-    if (last_x != X || last_y != Y)
-    {
-        X2 = X * X;
-        X3 = X2 * X;
-        X4 = X2 * X2;
-        last_x = X;
-        Y2 = Y * Y;
-        Y3 = Y2 * Y;
-        Y4 = Y2 * Y2;
-        R2 = X2 +Y2;
-
-
-        last_y =Y;
-    }
-
-    double d;
-    switch(n)
-    {
-    case 0:
-        //	return(.01 * sin(3 * M2PI * sqrt(R2)));
-        return(1.);
-        break;
-    case 1:
-        return(X);
-        break;
-    case 2:
-        return(Y);
-        break;
-    case 3:
-        return(-1. + 2. * R2);
-        break;
-    case 4:
-        return(X2 - Y2);
-        break;
-    case 5:
-        return(2. * X * Y);
-        break;
-    case 6:
-        return(-2. * X + 3. * X * R2);
-        break;
-    case 7:
-        return(-2. * Y + 3. * Y * R2);
-        break;
-    case 8:
-        return(1.+ R2 * (-6. + 6. * R2));
-        break;
-    case 9:
-        return(X3 - 3. * X * Y2);
-        break;
-    case 10:
-        return(3. * X2 * Y - Y3);
-        break;
-    case 11:
-        return(-3. * X2 + 4.* X4 + 3. * Y2- 4. * Y4);
-        break;
-    case 12:
-        return 2. * X * Y*(-3. + 4. * R2);
-        break;
-    case 13:
-        return X * (3. + R2 * (-12. + 10. * R2));
-        break;
-    case 14:
-        return Y * (3. + R2 * (-12. + 10. * R2));
-        break;
-    case 15:		//2nd spherical
-        return(-1. + R2 * (12. + R2* (-30. + 20. * R2)));
-        break;
-    case 16:
-        return(X4 - 6. * X2 * Y2 + Y4);
-        break;
-    case 17:
-        return 4. * X * Y * (X2- Y2);
-        break;
-    case 18:
-        return X * (5. * X4 + 3. * Y2 *(4.-5.* Y2) - 2 * X2 * ( 2. + 5. * Y2));
-        break;
-    case 19:
-        return Y * (15. * X4 + 4. * Y2  - 5. * Y4 + 2. * X2 * (-6. + 5. * Y2 ));
-        break;
-    case 20:
-        return (X2 - Y2)*(6. + R2 * (-20. + 15.* R2));
-        break;
-    case 21:
-        return       2. * X*Y*(6. + R2 * (-20.  + 15. * R2));
-        break;
-    case 22:
-        return X * (-4. + R2 * (30. + R2 * (-60. + 35. * R2)));
-        break;
-    case 23:
-        return Y * (-4. + R2 * (30. + R2 * (-60. + 35. * R2)));
-        break;
-    case 24:  //3Rd spherical
-        return(1. + R2 * (-20. + R2 * (90. + R2 * (-140. + 70. * R2))));
-        break;
-    case 25:
-        return X *( X4 - 10. * X2 * Y2 + 5. * Y4);
-        break;
-    case 26:
-        d = Y*(5. * X4 - 10. * X2* Y2 + Y4);
-        break;
-    case 27:
-        d = 6.* X4 * X2 - (30. * X2 * Y2) * (-1. + Y2) + Y4 * (-5. + 6. * Y2) - 5* X4 *(1.+6. * Y2);
-        break;
-    case 28:
-        d = X*(-20. *  X2 * Y + 20. * Y3 + 24. * X2 * Y * R2 -	24 * Y3 * R2);
-        break;
-    case 29:
-        d = X*( 10. * X2 - 30. * Y2 + R2 *(-30. * X2 + 90.* Y2 + R2 * (21.*X2 - 63.* Y2)));
-        break;
-    case 30:
-        d = Y*(-10. * Y2 + 30. * X2 + R2 * (30. * Y2   - 90.* X2 + R2 * (-21.* Y2 + 63.* X2)));
-        break;
-    case 31:
-        d = (-10. + R2 * (60. + R2* (-105. + 56. * R2)))* (X2 - Y2);
-        break;
-    case 32:
-        d =  X*Y*(-20. + R2 * (120. + R2* (- 210. + 112.* R2)));
-        break;
-    case 33:
-        d = X*(5. + R2 * (-60. + R2*(210. + R2 *(-280. + R2 * 126))));
-        break;
-    case 34:
-        d = Y*(5. +R2 * (-60. + R2 * (210. +R2 * (-280. + 126.* R2))));
-        break;
-    case 35: //4 spherical
-        d = -1. + R2 * (30. + R2 * (-210.  + R2 * (560. +R2 * (-630. + 252.* R2))));
-        break;
-    case 36:
-        d = X4 * X2 - 15. * X4 * Y2 + 15. * X2 * Y4 - Y4*Y2;
-        break;
-    case 37:
-        d = 6. * X4 * X * Y - 20. * X3 * Y3 + 6. * X * Y4*Y;
-        break;
-    case 38:
-        d = -6. * X4 * X + 60. * X3 * Y2 - 30. * X * Y4 + 7. * X4 * X * R2 - 70. * X3 * Y2 * R2 +
-            35. * X * Y4 * R2;
-        break;
-    case 39: // Spherical 5
-        d = 1. + R2* (-42. + R2 * (420. + R2 *(-1680. + R2 * (3150.+ R2 * (-2772. + 924. * R2)))));
-        break;
-    case 40:	// spherical 6
-        {
-
-        d = -1. + R2 * (56. +R2 * (-756. + R2 * (4200. + R2 * ( -11550.  + R2 * (16632. +R2 * (-12012.  +3432.* R2))))));
-        }
-        break;
-
-    case 41:	// spherical 7
-
-        d = 1. + R2 * (-72. + R2 * (1260. +R2*(-9240. + R2 * (34650. +R2 * (-72072. + R2 * (84084.
-            +R2 * (-51480. + 12870. * R2)))))));
-        //d = zpr(8,0,R);
-        break;
-
-    default:
-        return(0.);
-    }
-    return d;
-
-
-}
-
-
-/*
-Public Function Wavefront(x1 As Double, y1 As Double, Order As Integer)
-'computes the wavefront deviation from all selected Zernikes
-*/
-
-
 zernikeProcess *zernikeProcess::m_Instance = NULL;
 zernikeProcess *zernikeProcess::get_Instance(){
     if (m_Instance == NULL){
@@ -513,208 +182,406 @@ zernikeProcess::zernikeProcess(QObject *parent) :
     md = mirrorDlg::get_Instance();;
 }
 
-//void zernikeProcess::unwrap_to_zernikes(zern_generator *zg, cv::Mat wf, cv::Mat mask){
-//    // given a wavefront generate arbitrary number of zernikes from it.  Then create wavefront from the zernikies.
-//    double *m = (double *)(wf.data);
-
-//    int size = wf.cols;
-
-//    //'calculate LSF matrix elements
-//    int terms = zg->get_terms_cnt();
-//    int am_size = terms* terms;
-//    double* Am = new double[am_size];
-//    double* Bm = new double[terms];
-//    for (int  i = 0; i < am_size; ++i)
-//    {
-//        Am[i] = 0.;
-//    }
-//    for (int i = 0; i < terms; ++i)
-//        Bm[i] = 0;
-
-//    //calculate LSF right hand side
-//    for(int y = 0; y < size; ++y) //for each point on the surface
-//    {
-//        for(int x = 0; x < size; ++x)
-//        {
-//             if (mask.at<bool>(x,y))
-//            {
-//                int sndx = x + y* size;
-
-//                for (int  i = 0; i < terms; ++i)
-//                {
-//                    double ipoly = zg->get_zpoly(i,x,y);
-//                    int dy = i * terms;
-//                    for (int j = 0; j < terms; ++j)
-//                    {
-//                        int ndx = j + dy;
-//                        Am[ndx] = Am[ndx] +
-//                                ipoly * zg->get_zpoly(j, x, y);
-//                    }
-//                    Bm[i] = Bm[i] + m[sndx] * ipoly;
-
-//                }
-
-//            }
-//        }
-
-//    }
-//    // compute coefficients
-//    gauss_jordan (terms, Am, Bm);
-//    for (int i = 0; i < terms; ++i){
-//        qDebug() << i << " " << Bm[i];
-//    }
-//    zg->set_zcoefs(Bm);
-//    delete[] Am;
-//}
 // compute zernikes from unwrapped surface
 #define SAMPLE_WIDTH 1
-double zernikeProcess::unwrap_to_zernikes(wavefront &wf)
-{
-    int nx = wf.data.cols;
-    int ny = wf.data.rows;
+#define FIT_TILE 64     // samples per design matrix tile, 64 * 48 terms fits in L1
 
-    cv::Mat surface = wf.data;
+static inline double tileDot(const double *a, const double *b, int n)
+{
+    double s0 = 0., s1 = 0., s2 = 0., s3 = 0.;
+    int i = 0;
+    for (; i + 4 <= n; i += 4){
+        s0 += a[i] * b[i];
+        s1 += a[i + 1] * b[i + 1];
+        s2 += a[i + 2] * b[i + 2];
+        s3 += a[i + 3] * b[i + 3];
+    }
+    for (; i < n; ++i)
+        s0 += a[i] * b[i];
+    return (s0 + s1) + (s2 + s3);
+}
 
-    static double RMS = 0.;
-    if (!m_dirty_zerns)
-        return RMS;
+// Add the upper triangle of AtA and Atb of one term major design block of rows
+// samples.  Every entry is a dot product of two contiguous columns that stay in cache.
+static void accumulateTile(int n, const double *a, const double *f, int rows,
+                           double *AtA, double *Atb)
+{
+    for (int i = 0; i < n; ++i){
+        const double *ai = a + i * FIT_TILE;
+        double *row = AtA + i * n;
+        for (int j = i; j < n; ++j)
+            row[j] += tileDot(ai, a + j * FIT_TILE, rows);
+        Atb[i] += tileDot(ai, f, rows);
+    }
+}
 
-    Z = cv::Mat(Z_TERMS,1,CV_64F, 0.);
+#define FIT_CHUNKS 64   // pieces the samples are split into, summed in this order
 
-/*
-'calculate LSF matrix elements
-*/
-    int am_size = Z_TERMS * Z_TERMS;
-    double* Am = new double[am_size];
-    double* Bm = new double[Z_TERMS];
-    for (int i = 0; i < am_size; ++i)
+// Sums of the least squares fit over some samples, n * n + n doubles.  normalSums
+// keeps the upper triangle of AtA followed by Atb.  givensSums keeps the triangular R
+// and Qtb of a QR factorization of the design matrix, made one sample at a time by
+// Givens rotations so the matrix itself is never stored.  add takes a term major
+// design block of rows samples, merge adds the sums of other samples.
+struct normalSums
+{
+    static void add(int n, const double *a, const double *f, int rows, double *s)
     {
-        Am[i] = 0.;
+        accumulateTile(n, a, f, rows, s, s + n * n);
     }
-    for (int i = 0; i < Z_TERMS; ++i)
-        Bm[i] = 0;
+    static void merge(int n, double *s, const double *from)
+    {
+        for (int i = 0; i < n * n + n; ++i)
+            s[i] += from[i];
+    }
+};
 
-    //calculate LSF right hand side
-    int step = SAMPLE_WIDTH;
+// Rotate the sample v with value f into R and Qtb.  v is overwritten.
+static void givensRow(int n, double *v, double f, double *R, double *Qtb)
+{
+    for (int i = 0; i < n; ++i){
+        if (v[i] == 0.)
+            continue;
+        double *r = R + i * n;
+        double h = sqrt(r[i] * r[i] + v[i] * v[i]);
+        double c = r[i]/h;
+        double s = v[i]/h;
+        r[i] = h;
+        for (int j = i + 1; j < n; ++j){
+            double t = r[j];
+            r[j] = c * t + s * v[j];
+            v[j] = c * v[j] - s * t;
+        }
+        double t = Qtb[i];
+        Qtb[i] = c * t + s * f;
+        f = c * f - s * t;
+    }
+}
 
-    while ((nx/step) > 100)
+struct givensSums
+{
+    static void add(int n, const double *a, const double *f, int rows, double *s)
     {
-        ++step;
+        std::vector<double> v(n);
+        for (int k = 0; k < rows; ++k){
+            for (int i = 0; i < n; ++i)
+                v[i] = a[i * FIT_TILE + k];
+            givensRow(n, &v[0], f[k], s, s + n * n);
+        }
     }
-
-    double delta = 1./(wf.m_outside.m_radius);
-    zernikePolar &zpolar = *zernikePolar::get_Instance();
-    for(int y = 0; y < ny; y += step) //for each point on the surface
+    // the rows of the other R are samples with the same least squares solution
+    static void merge(int n, double *s, const double *from)
     {
-        //((MainWindow*)parent())->progBar->setValue(100 * y/ny);
-        for(int x = 0; x < nx; x += step)
-        {
-            double ux = (x -wf.m_outside.m_center.x()) * delta;
-            double uy = (y -wf.m_outside.m_center.y()) * delta;
-            double rho = sqrt(ux * ux + uy * uy);
-            double theta = atan2(uy,ux);
-            zpolar.init(rho, theta);
-            if (wf.workMask.at<bool>(y,x) and rho <= 1.)           {
-
-                for ( int i = 0; i < Z_TERMS; ++i)
-                {
+        std::vector<double> v(n);
+        for (int i = 0; i < n; ++i){
+            std::copy(from + i * n, from + (i + 1) * n, v.begin());
+            givensRow(n, &v[0], from[n * n + i], s, s + n * n);
+        }
+    }
+};
 
-                    int dy = i * Z_TERMS;
-                    double t = zpolar.zernike(i, rho, theta);
-                    for (int j = 0; j < Z_TERMS; ++j)
-                    {
-                        int ndx = j + dy;
-                        Am[ndx] = Am[ndx] + t * zpolar.zernike(j, rho, theta);
+// Fit sums over chunks of tiles of basis pixels.  The masked samples of a tile are
+// copied into a small term major design block.  Each chunk has its own sums.
+template <class Sums>
+class normalEquationBody : public cv::ParallelLoopBody
+{
+public:
+    const zernikeBasis *m_basis;
+    const cv::Mat_<double> &m_surface;
+    const cv::Mat_<bool> &m_mask;
+    int m_chunks;
+    double *m_sums;
+    int *m_samples;
+    normalEquationBody(const zernikeBasis *basis, const cv::Mat_<double> &surface,
+                       const cv::Mat_<bool> &mask, int chunks, double *sums, int *samples):
+        m_basis(basis), m_surface(surface), m_mask(mask), m_chunks(chunks), m_sums(sums),
+        m_samples(samples){}
+    void operator() (const cv::Range &range) const
+    {
+        int n = m_basis->terms;
+        int nx = m_basis->width;
+        int tiles = (m_basis->count() + FIT_TILE - 1)/FIT_TILE;
+        std::vector<double> a(n * FIT_TILE);
+        std::vector<double> f(FIT_TILE);
+        std::vector<double> t(n);
+        for (int c = range.start; c < range.end; ++c){
+            double *sums = m_sums + (size_t)c * (n * n + n);
+            int samples = 0;
+            for (int tile = c * tiles/m_chunks; tile < (c + 1) * tiles/m_chunks; ++tile){
+                int first = tile * FIT_TILE;
+                int last = std::min(first + FIT_TILE, m_basis->count());
+                int rows = 0;
+                for (int k = first; k < last; ++k){
+                    int x = m_basis->pixels[k] % nx;
+                    int y = m_basis->pixels[k] / nx;
+                    if (!m_mask(y,x))
+                        continue;
+                    m_basis->at(k, &t[0]);
+                    for (int i = 0; i < n; ++i)
+                        a[i * FIT_TILE + rows] = t[i];
+                    f[rows++] = m_surface(y,x);
+                }
+                if (rows == 0)
+                    continue;
+                samples += rows;
+                Sums::add(n, &a[0], &f[0], rows, sums);
+            }
+            m_samples[c] = samples;
+        }
+    }
+};
 
+// Same sums over chunks of image rows with the zernike values made as they are
+// needed instead of read from a basis table.  Used for term counts that are not
+// cached so a high order fit needs no table of pixels * terms.
+template <class Sums>
+class streamedNormalEquationBody : public cv::ParallelLoopBody
+{
+public:
+    const zernikeEvaluator &m_zern;
+    const cv::Mat_<double> &m_surface;
+    const cv::Mat_<bool> &m_mask;
+    double m_cx;
+    double m_cy;
+    double m_radius;
+    int m_chunks;
+    double *m_sums;
+    int *m_samples;
+    streamedNormalEquationBody(const zernikeEvaluator &zern, const cv::Mat_<double> &surface,
+                               const cv::Mat_<bool> &mask, double cx, double cy, double radius,
+                               int chunks, double *sums, int *samples):
+        m_zern(zern), m_surface(surface), m_mask(mask), m_cx(cx), m_cy(cy), m_radius(radius),
+        m_chunks(chunks), m_sums(sums), m_samples(samples){}
+    void operator() (const cv::Range &range) const
+    {
+        int n = m_zern.terms();
+        std::vector<double> a(n * FIT_TILE);
+        std::vector<double> f(FIT_TILE);
+        std::vector<double> t(n);
+        for (int c = range.start; c < range.end; ++c){
+            double *sums = m_sums + (size_t)c * (n * n + n);
+            int samples = 0;
+            int rows = 0;
+            for (int y = c * m_surface.rows/m_chunks; y < (c + 1) * m_surface.rows/m_chunks; ++y){
+                double uy = (y - m_cy)/m_radius;
+                for (int x = 0; x < m_surface.cols; ++x){
+                    double ux = (x - m_cx)/m_radius;
+                    if (ux * ux + uy * uy > 1. || !m_mask(y,x))
+                        continue;
+                    m_zern.evaluate(ux, uy, &t[0]);
+                    for (int i = 0; i < n; ++i)
+                        a[i * FIT_TILE + rows] = t[i];
+                    f[rows++] = m_surface(y,x);
+                    if (rows == FIT_TILE){
+                        Sums::add(n, &a[0], &f[0], rows, sums);
+                        samples += rows;
+                        rows = 0;
                     }
-
-                    // FN is the OPD at (Xn,Yn)
-                    Bm[i] = Bm[i] + surface.at<double>(y,x) * t;
-
                 }
-
             }
+            if (rows > 0){
+                Sums::add(n, &a[0], &f[0], rows, sums);
+                samples += rows;
+            }
+            m_samples[c] = samples;
         }
     }
+};
 
-    // compute coefficients
-    gauss_jordan (Z_TERMS, Am, Bm);
-
-
-    wf.InputZerns.assign(Bm, Bm+Z_TERMS);
-
+// Sums of the fit of wf.data inside wf.workMask, from the basis table when there is
+// one.  The samples are split into a fixed number of chunks that depends only on the
+// outline and the chunk sums are added in chunk order, so the result is the same
+// whatever the number of threads or the order the chunks finish in.
+// Returns the number of samples.
+template <class Sums>
+static int fitSums(const wavefront &wf, const zernikeBasis *basis, const zernikeEvaluator &zern,
+                   std::vector<double> &sums)
+{
+    int n = zern.terms();
+    int size = n * n + n;
+    int chunks = basis ? (basis->count() + FIT_TILE - 1)/FIT_TILE : wf.data.rows;
+    // keep the chunk sums of a high order fit under about 16MB
+    chunks = std::min(chunks, std::min(FIT_CHUNKS, (int)((16 << 20)/(size * sizeof(double)))));
+    chunks = std::max(chunks, 1);
+    std::vector<double> partial((size_t)chunks * size, 0.);
+    std::vector<int> samples(chunks, 0);
+    if (basis)
+        cv::parallel_for_(cv::Range(0, chunks),
+                          normalEquationBody<Sums>(basis, wf.data, wf.workMask, chunks,
+                                                   &partial[0], &samples[0]));
+    else
+        cv::parallel_for_(cv::Range(0, chunks),
+                          streamedNormalEquationBody<Sums>(zern, wf.data, wf.workMask,
+                                                           wf.m_outside.m_center.x(),
+                                                           wf.m_outside.m_center.y(),
+                                                           wf.m_outside.m_radius, chunks,
+                                                           &partial[0], &samples[0]));
+    sums.assign(partial.begin(), partial.begin() + size);
+    int total = samples[0];
+    for (int c = 1; c < chunks; ++c){
+        Sums::merge(n, &sums[0], &partial[(size_t)c * size]);
+        total += samples[c];
+    }
+    return total;
+}
 
-    //m_fringe_rms = RMS;
-    delete[] Am;
-    delete[] Bm;
+// Solve A x = b for symmetric positive definite A by Cholesky decomposition.  Only the
+// upper triangle of A is read and A is overwritten.  b is replaced by x.  Returns
+// false if A is not positive definite enough to give a trustworthy answer.
+static bool choleskySolve(int n, double *A, double *b)
+{
+    double maxDiag = 0.;
+    for (int i = 0; i < n; ++i)
+        maxDiag = std::max(maxDiag, A[i * n + i]);
+    if (maxDiag <= 0.)
+        return false;
+    // upper triangle becomes R with A = Rt R
+    for (int i = 0; i < n; ++i){
+        double d = A[i * n + i];
+        for (int k = 0; k < i; ++k)
+            d -= A[k * n + i] * A[k * n + i];
+        if (d <= 1.e-12 * maxDiag)
+            return false;
+        d = sqrt(d);
+        A[i * n + i] = d;
+        for (int j = i + 1; j < n; ++j){
+            double s = A[i * n + j];
+            for (int k = 0; k < i; ++k)
+                s -= A[k * n + i] * A[k * n + j];
+            A[i * n + j] = s/d;
+        }
+    }
+    // Rt y = b then R x = y
+    for (int i = 0; i < n; ++i){
+        double s = b[i];
+        for (int k = 0; k < i; ++k)
+            s -= A[k * n + i] * b[k];
+        b[i] = s/A[i * n + i];
+    }
+    for (int i = n - 1; i >= 0; --i){
+        double s = b[i];
+        for (int k = i + 1; k < n; ++k)
+            s -= A[i * n + k] * b[k];
+        b[i] = s/A[i * n + i];
+    }
+    return true;
+}
 
-    return RMS;
+// Solve R x = b for the upper triangular R of a QR factorization.  b is replaced by x.
+// A term the samples do not determine, with a negligible diagonal, is set to zero.
+static void triangularSolve(int n, const double *R, double *b)
+{
+    double maxDiag = 0.;
+    for (int i = 0; i < n; ++i)
+        maxDiag = std::max(maxDiag, fabs(R[i * n + i]));
+    for (int i = n - 1; i >= 0; --i){
+        double d = R[i * n + i];
+        if (fabs(d) <= 1.e-12 * maxDiag){
+            b[i] = 0.;
+            continue;
+        }
+        double s = b[i];
+        for (int k = i + 1; k < n; ++k)
+            s -= R[i * n + k] * b[k];
+        b[i] = s/d;
+    }
 }
 
-cv::Mat zernikeProcess::null_unwrapped(wavefront&wf, std::vector<double> zerns, std::vector<bool> enables,
-                                       int start_term, int last_term)
+// Least squares fit of terms zernikes to wf.data inside wf.workMask.  The result
+// goes to wf.InputZerns.  Only touches wf and locals so surface workers and the batch
+// engine can fit several wavefronts at once.
+// Every pixel is used.  The normal equations are summed in parallel and solved by
+// Cholesky.  If they are too badly conditioned for that, as happens with few samples
+// or a large obstruction, every sample is folded into a QR factorization instead.
+// Z_TERMS fits use the cached basis shared with nulling, other term counts make the
+// zernike values as they go.
+void fitZernikes(wavefront &wf, int terms)
 {
+    int n = terms;
+    zernikeEvaluator zern(n);
+    zernikeBasisPtr basis;
+    if (n == Z_TERMS)
+        basis = zernikeBasisCache::get_Instance()->get(wf.data.cols, wf.data.rows,
+                    wf.m_outside.m_center.x(), wf.m_outside.m_center.y(), wf.m_outside.m_radius);
+
+    std::vector<double> sums;
+    if (fitSums<normalSums>(wf, basis.data(), zern, sums) < n){
+        wf.InputZerns.assign(n, 0.);
+        return;
+    }
+    if (!choleskySolve(n, &sums[0], &sums[n * n])){
+        fitSums<givensSums>(wf, basis.data(), zern, sums);
+        triangularSolve(n, &sums[0], &sums[n * n]);
+    }
+    wf.InputZerns.assign(sums.begin() + n * n, sums.end());
+}
 
-    int nx = wf.data.cols;
-    int ny = wf.data.rows;
+double zernikeProcess::unwrap_to_zernikes(wavefront &wf)
+{
+    static double RMS = 0.;
+    if (!m_dirty_zerns)
+        return RMS;
 
-    cv::Mat unwrapped = wf.data.clone();
+    fitZernikes(wf);
 
+    //m_fringe_rms = RMS;
+    return RMS;
+}
 
+std::vector<double> zernikeProcess::nullCoefficients(const wavefront &wf,
+                                                     const std::vector<double> &zerns,
+                                                     const std::vector<bool> &enables,
+                                                     int start_term, int last_term)
+{
     double scz8 = md->z8 * md->cc;
     if (!md->doNull || !wf.useSANull){
         scz8 = 0.;
     }
-    double midx = wf.m_outside.m_center.rx();
-    double midy = wf.m_outside.m_center.ry();
-    double rad = wf.m_outside.m_radius;
-
-    cv::Mat nulled = cv::Mat::zeros(ny,nx,CV_64F);
 
     bool doDefocus = surfaceAnalysisTools::get_Instance()->m_useDefocus;
     double defocus = 0;
     if (doDefocus)
         defocus = surfaceAnalysisTools::get_Instance()->m_defocus;
-    double ux,uy,sz,nz;
-    double rho,theta;
-    zernikePolar &zpolar = *zernikePolar::get_Instance();
-    for(int  y = 0; y < ny; ++y)
-    {
-        for(int x = 0; x < nx; ++x)
-        {
-            if(wf.mask.at<bool>(y,x))
-            {
-                ux = (double)(x - midx)/rad;
-                uy = (double)(y - midy)/rad;
-                rho = sqrt(ux * ux + uy * uy);
-                theta = atan2(uy,ux);
-                zpolar.init(rho,theta);
 
-                if (rho > 1.){
-                    continue;
-                }
+    // the amount of each term to remove
+    std::vector<double> coef(Z_TERMS, 0.);
+    if (last_term > 7 && md->doNull && enables[8])
+        coef[8] -= scz8;
+    for (int z = start_term; z < Z_TERMS; ++z)
+    {
+        if ((z == 3) & doDefocus)
+            coef[z] -= defocus;
+        if (!enables[z])
+            coef[z] -= zerns[z];
+    }
+    return coef;
+}
 
-                sz = unwrapped.at<double>(y,x);
-                nz = 0;
+cv::Mat zernikeProcess::null_unwrapped(wavefront&wf, std::vector<double> zerns, std::vector<bool> enables,
+                                       int start_term, int last_term)
+{
 
-                if (last_term > 7)
-                {
-                    if (md->doNull && enables[8])
-                        nz -= scz8 * zpolar.zernike(8,rho, theta);
-                }
+    int nx = wf.data.cols;
+    int ny = wf.data.rows;
 
-                for (int z = start_term; z < Z_TERMS; ++z)
-                {
-                    if ((z == 3) & doDefocus)
-                        nz -= defocus * zpolar.zernike(z,rho, theta);
+    cv::Mat nulled = cv::Mat::zeros(ny,nx,CV_64F);
 
-                    if (!enables[z])
-                        nz -= zerns[z] * zpolar.zernike(z,rho, theta);
+    std::vector<double> coef = nullCoefficients(wf, zerns, enables, start_term, last_term);
 
-                }
-                nulled.at<double>(y,x) = sz +nz;
-            }
-        }
+    zernikeBasisPtr basis = zernikeBasisCache::get_Instance()->get(nx, ny,
+                wf.m_outside.m_center.x(), wf.m_outside.m_center.y(), wf.m_outside.m_radius);
+    const double *c = &coef[0];
+    std::vector<double> t(basis->terms);
+    for (int k = 0; k < basis->count(); ++k)
+    {
+        int x = basis->pixels[k] % nx;
+        int y = basis->pixels[k] / nx;
+        if (!wf.mask.at<bool>(y,x))
+            continue;
+        basis->at(k, &t[0]);
+        double nz = 0;
+        for (int z = 0; z < Z_TERMS; ++z)
+            nz += c[z] * t[z];
+        nulled.at<double>(y,x) = wf.data.at<double>(y,x) + nz;
     }
 
     //generate_image_from_doubles(nulled_image, nx,ny, CString(L"Nulled"),true);
@@ -722,47 +589,128 @@ cv::Mat zernikeProcess::null_unwrapped(wavefront&wf, std::vector<double> zerns,
     return nulled;
 }
 
-/*
-Public Function Wavefront(x1 As Double, y1 As Double, Order As Integer)
-'computes the wavefront deviation from all selected Zernikes
-*/
-/*
-double zernikeProcess::Wavefront(double x1, double y1, int Order)
+// Add the change in the amount of some terms to a nulled surface over a range of
+// basis pixels.  Only the changed terms are summed.
+class renullBody : public cv::ParallelLoopBody
 {
-    double S1;
-
-
-    S1 = 0;
-
-    for(int  j = 0; j < Order; ++j)
+public:
+    const zernikeBasis *m_basis;
+    const cv::Mat_<bool> &m_mask;
+    cv::Mat_<double> &m_nulled;
+    const std::vector<int> &m_terms;
+    const std::vector<double> &m_delta;
+    renullBody(const zernikeBasis *basis, const cv::Mat_<bool> &mask, cv::Mat_<double> &nulled,
+               const std::vector<int> &terms, const std::vector<double> &delta):
+        m_basis(basis), m_mask(mask), m_nulled(nulled), m_terms(terms), m_delta(delta){}
+    void operator() (const cv::Range &range) const
     {
-        if (zernEnables[j])
-        {
-            double W = Zernike(j,x1,y1);
-            double z = zNulls[j];
-
-//            if (j ==4 && m_remove_bath_astig)
-//            {
-//                z = z - m_bath_astig;
-//            }
-
-            S1 = S1 + z * W;
-
-            if (j == 8 && md->doNull)
-            {
-                S1 = S1 - md->z8 * md->cc * W;
-            }
+        int nx = m_basis->width;
+        int n = (int)m_terms.size();
+        const int *terms = &m_terms[0];
+        const double *delta = &m_delta[0];
+        std::vector<double> t(m_basis->terms);
+        for (int k = range.start; k < range.end; ++k){
+            int x = m_basis->pixels[k] % nx;
+            int y = m_basis->pixels[k] / nx;
+            if (!m_mask(y,x))
+                continue;
+            m_basis->at(k, &t[0]);
+            double d = 0.;
+            for (int i = 0; i < n; ++i)
+                d += delta[i] * t[terms[i]];
+            m_nulled(y,x) += d;
+        }
+    }
+};
 
+// wf.nullCoefs are the amounts null_unwrapped used for wf.nulledData.  When the nulls
+// change only the difference is added, which for a term toggle or the defocus dial
+// is one basis column instead of all of them and no refit.  Falls back to a full
+// null when nulledData was not made by null_unwrapped from the same data.
+void zernikeProcess::renull(wavefront &wf, const std::vector<bool> &enables)
+{
+    std::vector<double> coef = nullCoefficients(wf, wf.InputZerns, enables);
+    if (wf.nullCoefs.size() != coef.size() || wf.nulledData.size() != wf.data.size()){
+        wf.nulledData = null_unwrapped(wf, wf.InputZerns, enables, 0, Z_TERMS);
+        wf.nullCoefs = coef;
+        return;
+    }
 
+    std::vector<int> terms;
+    std::vector<double> delta;
+    for (int z = 0; z < Z_TERMS; ++z){
+        double d = coef[z] - wf.nullCoefs[z];
+        if (d != 0.){
+            terms.push_back(z);
+            delta.push_back(d);
+        }
+    }
+    wf.nullCoefs = coef;
+    if (terms.empty())
+        return;
+
+    zernikeBasisPtr basis = zernikeBasisCache::get_Instance()->get(wf.data.cols, wf.data.rows,
+                wf.m_outside.m_center.x(), wf.m_outside.m_center.y(), wf.m_outside.m_radius);
+    // nulledData may be shared with a surface on display so change a copy
+    cv::Mat_<double> nulled = wf.nulledData.clone();
+    cv::parallel_for_(cv::Range(0, basis->count()),
+                      renullBody(basis.data(), wf.mask, nulled, terms, delta),
+                      cv::getNumThreads() * 4);
+    wf.nulledData = nulled;
+}
 
+// Add the surface of zerns to out at every basis pixel.
+class zernikeSumBody : public cv::ParallelLoopBody
+{
+public:
+    const zernikeBasis *m_basis;
+    const std::vector<double> &m_zerns;
+    cv::Mat_<double> &m_out;
+    zernikeSumBody(const zernikeBasis *basis, const std::vector<double> &zerns, cv::Mat_<double> &out):
+        m_basis(basis), m_zerns(zerns), m_out(out){}
+    void operator() (const cv::Range &range) const
+    {
+        int nx = m_basis->width;
+        int n = std::min((int)m_zerns.size(), m_basis->terms);
+        const double *z = &m_zerns[0];
+        std::vector<double> t(m_basis->terms);
+        for (int k = range.start; k < range.end; ++k){
+            m_basis->at(k, &t[0]);
+            double v = 0.;
+            for (int i = 0; i < n; ++i)
+                v += z[i] * t[i];
+            m_out(m_basis->pixels[k] / nx, m_basis->pixels[k] % nx) += v;
         }
     }
-    return(S1);
+};
 
+// Turning the coefficients is exact for the fitted part of the surface, so a rotation
+// costs one pass over the basis instead of a cubic resample and a refit.  Only the
+// residual, when it is wanted, goes through warpAffine.
+cv::Mat_<double> zernikeProcess::rotateFitted(const wavefront &wf, double angle, bool residual,
+                                              std::vector<double> &zerns)
+{
+    zerns = rotateZernikes(wf.InputZerns, angle);
+    double cx = wf.m_outside.m_center.x();
+    double cy = wf.m_outside.m_center.y();
+    zernikeBasisPtr basis = zernikeBasisCache::get_Instance()->get(wf.data.cols, wf.data.rows,
+                cx, cy, wf.m_outside.m_radius);
+    int grain = cv::getNumThreads() * 4;
+    cv::Mat_<double> out = cv::Mat_<double>::zeros(wf.data.rows, wf.data.cols);
+    if (residual){
+        cv::Mat_<double> fit = cv::Mat_<double>::zeros(wf.data.rows, wf.data.cols);
+        cv::parallel_for_(cv::Range(0, basis->count()),
+                          zernikeSumBody(basis.data(), wf.InputZerns, fit), grain);
+        cv::Mat_<double> rest = cv::Mat_<double>::zeros(wf.data.rows, wf.data.cols);
+        cv::subtract(wf.data, fit, rest, wf.mask);
+        cv::Mat M = cv::getRotationMatrix2D(cv::Point2f(cx, cy), angle, 1.0);
+        cv::warpAffine(rest, out, M, rest.size(), cv::INTER_CUBIC);
+    }
+    cv::parallel_for_(cv::Range(0, basis->count()),
+                      zernikeSumBody(basis.data(), zerns, out), grain);
+    return out;
 }
 
-
-*/
 cv::Mat makeSurfaceFromZerns(int border, bool doColor){
     simIgramDlg &dlg = *simIgramDlg::get_instance();
     int wx = dlg.size;
@@ -772,57 +720,57 @@ cv::Mat makeSurfaceFromZerns(int border, bool doColor){
     rad -= border;
     cv::Mat result = cv::Mat::zeros(wx,wx, (doColor)? CV_8UC4: CV_64F);
 
-    double rho;
     double spacing = 1.;
     mirrorDlg *md = mirrorDlg::get_Instance();
-    zernikePolar &zpolar = *zernikePolar::get_Instance();
-    for (int y = 0; y <  wx; ++y)
+    int terms = dlg.zernikes.size();
+    std::vector<double> coef(terms, 0.);
+    for (int z = 0; z < terms; ++z){
+        double val = dlg.zernikes[z];
+        if (z == 8){
+           val = (dlg.doCorrection) ? md->z8 * val * .01 : val;
+        }
+        coef[z] = val;
+    }
+
+    if (doColor)
+        result.setTo(cv::Scalar(0,0,100,0));
+    zernikeBasisPtr basis = zernikeBasisCache::get_Instance()->get(wx, wx, xcen, ycen, rad);
+    // more terms than the shared basis holds are made at each pixel
+    zernikeEvaluator zern(terms);
+    std::vector<double> t(std::max(terms, basis->terms));
+    for (int k = 0; k < basis->count(); ++k)
     {
-        double uy = (double)(y - (ycen)) / rad;
-        for (int x = 0; x < wy; ++x)
-        {
+        int x = basis->pixels[k] % wx;
+        int y = basis->pixels[k] / wx;
+        if (terms <= basis->terms)
+            basis->at(k, &t[0]);
+        else
+            zern.evaluate((x - xcen)/rad, (y - ycen)/rad, &t[0]);
+        double S1 = 0;
+        if (dlg.star != 0. || dlg.ring != 0.){
             double ux = (double)(x - (xcen )) /rad;
-            rho = sqrt(ux * ux + uy * uy);
+            double uy = (double)(y - (ycen)) / rad;
+            double rho = sqrt(ux * ux + uy * uy);
+            double theta = atan2(uy,ux);
+            S1 = dlg.star * cos(10.  *  theta) +
+                 dlg.ring * cos(10 * 2. * rho);
+        }
 
-            if (rho <= 1.)
-            {
-                double theta = atan2(uy,ux);
-                zpolar.init(rho,theta);
-                double S1 =
-                        dlg.star * cos(10.  *  theta) +
-                        dlg.ring * cos(10 * 2. * rho);
-
-                for (int z = 0; z < dlg.zernikes.size(); ++z){
-                    double val = dlg.zernikes[z];
-                    if (z == 8){
-                       val = (dlg.doCorrection) ? md->z8 * val * .01 : val;
-                    }
-                    S1 += val * zpolar.zernike(z,rho,theta);
-                }
+        for (int z = 0; z < terms; ++z)
+            S1 += coef[z] * t[z];
 
-                if (doColor){
-                    int iv = cos(spacing *2 * M_PI * S1) * 100 + 120;
-                    result.at<Vec4b>(y,x)[2] = iv;
-                    result.at<Vec4b>(y,x)[3] = 255;
-                }
-                else {
-                    result.at<double>(y,x) = S1;
-                }
-            }
-            else    // outside mirror outline
-            {
-                if (doColor){
-                    result.at<Vec4b>(y,x) = Vec4f(0.,00.,100.,0);
-                }
-                else {
-                    result.at<double>(y,x) = 0 ;
-                }
-            }
+        if (doColor){
+            int iv = cos(spacing *2 * M_PI * S1) * 100 + 120;
+            result.at<Vec4b>(y,x)[2] = iv;
+            result.at<Vec4b>(y,x)[3] = 255;
+        }
+        else {
+            result.at<double>(y,x) = S1;
         }
     }
     return result;
 }
-#define TSIZE 450	// number of points in zern generator
+#define SMOOTH_ORDER 6      // highest zernike order ZernikeSmooth fits
 void ZernikeSmooth(cv::Mat wf, cv::Mat mask)
 {
     // given a wavefront generate arbitrary number of zernikes from it.  Then create wavefront from the zernikies.
@@ -830,21 +778,16 @@ void ZernikeSmooth(cv::Mat wf, cv::Mat mask)
 
 
     int size = wf.cols;
-    int step = (double)size/200.;	// 200 samples across the wavefront
-    double delta = (double)TSIZE/size;	// scale factor from wavefront to zernike generator
-
-    double* tmp = new double[TSIZE * TSIZE];
-    memset(tmp, 0,sizeof(double) * TSIZE * TSIZE);
-
-    zern_generator zg(TSIZE);
-    zg.set_spec(6);
-    zg.zpoly_list();
-
+    int step = std::max(1, (int)(size/200.));	// 200 samples across the wavefront
+    double delta = 2./(size - 1);	// wavefront pixels to the unit square
 
+    // the terms of each sample are made as it is used, there is no table of them
+    int terms = (SMOOTH_ORDER + 1) * (SMOOTH_ORDER + 1);
+    zernikeEvaluator zern(terms);
+    std::vector<double> t(terms);
 
     //'calculate LSF matrix elements
 
-    int terms = zg.get_terms_cnt();
     int am_size = terms* terms;
     double* Am = new double[am_size];
     double* Bm = new double[terms];
@@ -860,24 +803,19 @@ void ZernikeSmooth(cv::Mat wf, cv::Mat mask)
     {
         for(int x = 0; x < size; x += step)
         {
-            int xx = x* delta;
-            int yy = y * delta;
-            if (mask.at<bool>(x,y))
+            if (mask.at<uchar>(y,x))
             {
                 int sndx = x + y* size;
-
-                tmp[xx+yy * TSIZE] = m[sndx];
+                zern.evaluate(-1. + delta * x, -1. + delta * y, &t[0]);
                 for (int  i = 0; i < terms; ++i)
                 {
-                    double ipoly = zg.get_zpoly(i,xx,yy);
                     int dy = i * terms;
                     for (int j = 0; j < terms; ++j)
                     {
                         int ndx = j + dy;
-                        Am[ndx] = Am[ndx] +
-                                ipoly * zg.get_zpoly(j, xx, yy);
+                        Am[ndx] = Am[ndx] + t[i] * t[j];
                     }
-                    Bm[i] = Bm[i] + m[sndx] * ipoly;
+                    Bm[i] = Bm[i] + m[sndx] * t[i];
 
                 }
 
@@ -888,12 +826,9 @@ void ZernikeSmooth(cv::Mat wf, cv::Mat mask)
     // compute coefficients
     gauss_jordan (terms, Am, Bm);
 
-    zg.set_zcoefs(Bm);
-
     for (int i = 0; i < terms; ++i){
         qDebug() << i << " " << Bm[i];
     }
     delete[] Am;
     delete[] Bm;
-    delete[] tmp;
 }
@@ -29,6 +29,7 @@ extern int Zw[];
 extern double BestSC;
 double zernike(int n, double x, double y);
 void gauss_jordan(int n, double* Am, double* Bm);
+void fitZernikes(wavefront &wf, int terms = Z_TERMS);
 void ZernikeSmooth(Mat wf, Mat mask);
 cv::Mat makeSurfaceFromZerns(int border = 5, bool doColor = false);
 class zernikeProcess : public QObject
@@ -41,8 +42,17 @@ public:
     static zernikeProcess *get_Instance();
     double unwrap_to_zernikes(wavefront &wf);
     cv::Mat null_unwrapped(wavefront&wf,  std::vector<double> zerns, std::vector<bool> enables,int start_term =0, int last_term = Z_TERMS);
-    //double Wavefront(double x1, double y1, int Order);
-    void unwrap_to_zernikes(zern_generator *zg, cv::Mat wf, cv::Mat mask);
+    // The amount of each term null_unwrapped adds to the surface.
+    std::vector<double> nullCoefficients(const wavefront &wf, const std::vector<double> &zerns,
+                                         const std::vector<bool> &enables,
+                                         int start_term = 0, int last_term = Z_TERMS);
+    // Bring wf.nulledData up to date with the current nulls without refitting.
+    void renull(wavefront &wf, const std::vector<bool> &enables);
+    // wf.data turned by angle degrees about the outline center by turning its fitted
+    // zernikes and making the surface from them.  zerns is set to the turned terms.
+    // With residual the part of the data the fit leaves out is resampled and added.
+    cv::Mat_<double> rotateFitted(const wavefront &wf, double angle, bool residual,
+                                  std::vector<double> &zerns);
     cv::Mat Z;
     cv::Mat inputZ;
     bool m_dirty_zerns;
@@ -55,34 +65,4 @@ public slots:
 
 };
 
-class zernikePolar : public QObject
-{
-    Q_OBJECT
-public:
-    explicit zernikePolar(){};
-    static zernikePolar *get_Instance();
-    void init(double rho, double theta);
-    double zernike(int z, double rho, double theta);
-private:
-     static zernikePolar *m_instance;
-     double rho2;
-     double rho3;
-     double rho4;
-     double rho5;
-     double rho6;
-     double rho8;
-     double rho10;
-     double costheta;
-     double sintheta;
-     double cos2theta;
-     double sin2theta;
-     double cos3theta;
-     double sin3theta;
-     double cos4theta;
-     double sin4theta;
-     double cos5theta;
-     double sin5theta;
-};
-
-
 #endif // ZERNIKEPROCESS_H
@@ -17,241 +17,130 @@
 ****************************************************************************/
 
 #include <math.h>
+#include <algorithm>
 #include "zernikes.h"
 #include <QDebug>
 #include <QString>
 
 
-void dump_matrix (double *a, int nrows, int ncols, char *desc)
-{
-    int i, j;
-    qDebug() << "###############";
-    qDebug() << QString().sprintf("%s", desc);
-    qDebug() << "###############";
-    qDebug() << QString().sprintf("%d, %d\n", nrows, ncols);
-    for (i=0; i < nrows; i++)
-    {
-        for (j=0; j < ncols; j++)
-        {
-            qDebug() << QString().sprintf("%f ", a[I(i, j, ncols)]);
-        }
-    }
-}
-
 extern int Zw[];
 double computeRMS(int term,  double val){
     return val /sqrt( Zw[term]);
 }
 
-zern_spec::zern_spec(int order)
+void zernikeEvaluator::termOrder(int term, int &n, int &m, int &kind)
 {
-   /* Zernike terms ordered as in Wyant and Creath. */
-    m_nterms = (order+1)*(order+1);
-    m_n = new int[m_nterms];
-    m_m = new int[m_nterms];
-    m_s = new unsigned char[m_nterms];
-
-    int i = 0;
-    for (int n=0; n <= order; n++) {
-        for (int m=n; m > 0; m--) {
-            for (int k=1; k <= 2; k++) {
-                m_n[i] = n; m_m[i] = m; m_s[i] = k; i++;
-            }
-        }
-        m_n[i] = n; m_m[i] = 0; m_s[i] = 0; i++;
+    int k = (int)sqrt((double)term);
+    while (k * k > term)
+        --k;
+    while ((k + 1) * (k + 1) <= term)
+        ++k;
+    int r = term - k * k;
+    if (r == 2 * k){
+        m = 0;
+        kind = 0;
     }
-
-}
-
-void zern_spec::dump(void)
-{
-    int i;
-    qDebug() <<  "############";
-    qDebug() <<  "zernike spec";
-    qDebug() <<  "############";
-    qDebug() <<  "       n   m   s";
-    qDebug() <<  "      ----------";
-    for (i=0; i < m_nterms; i++) {
-        qDebug() <<  QString().sprintf("%3d: %3d %3d %3d", i, m_n[i], m_m[i], m_s[i]);
+    else {
+        m = k - r/2;
+        kind = (r % 2) ? 2 : 1;
     }
+    n = 2 * k - m;
 }
 
-inline
-int rix (int n, int m)
+zernikeEvaluator::zernikeEvaluator(int terms)
+    : m_terms(terms), m_maxm(0)
 {
-    /* Turn (n, m) into single zero-based index for radial polynomials. */
-    return ((n+1)*(n+2)/2 - m - 1);
-}
-zern_generator::zern_generator(int size)
-:m_size(size), m_rho(0), m_theta(0), m_zpoly(0), m_zcoef(0)
-{
-    fill_rho();
-    fill_theta();
-    m_spec = new zern_spec(6);
-}
-zern_generator::~zern_generator()
-{
-    if (m_zpoly)
-        delete[] m_zpoly;
-    if (m_rho)
-        delete[] m_rho;
-    if (m_theta)
-        delete[] m_theta;
-    if (m_spec)
-        delete m_spec;
-}
-void zern_generator::fill_rho ()
-{
-
-    double delta;
-    int i, j;
-    delta = 2.0 /  (m_size-1);
-    if (m_rho)
-        delete[] m_rho;
-    m_rho = new double[m_size * m_size];
-
-    for (i=0; i < m_size; i++)
-    {
-        double x = -1.0 + delta * i;
-        for (j=0; j < m_size; j++)
-        {
-            double y = -1.0 + delta * j;
-            m_rho[I(i, j, m_size)] = sqrt (pow (x, 2) + pow (y, 2));
-        }
-    }
-}
-
-void zern_generator::fill_theta ()
-{
-    double delta;
-    int i, j;
-    delta = 2.0 /  (m_size-1);
-    if (m_theta)
-        delete[] m_theta;
-
-    m_theta = new double[m_size * m_size];
-
-    for (i=0; i < m_size; i++)
-    {
-        double x = -1. + delta * i;
-        for (j=0; j < m_size; j++)
-        {
-            double y = -1. + delta * j;
-            m_theta[I(i, j, m_size)] = atan2 (x, y);
-        }
+    int maxk = 0;
+    for (int t = 0; t < terms; ++t){
+        int n, m, kind;
+        termOrder(t, n, m, kind);
+        maxk = std::max(maxk, (n + m)/2);
+        m_maxm = std::max(m_maxm, m);
     }
-}
-
-void zern_generator::set_spec(int order)
-{
-    if (m_spec)
-        delete m_spec;
-    m_spec = new zern_spec(order);
-}
-double *rpoly_list (double *rho, int npoints, int nmax)
-{
-    /* Evaluate and return a matrix of Zernike radial polynomials over the
-       specified values of rho and up to the specified maximum n value. */
-    int n, m, nterms, j, i;
-    double *r;
-    nterms = (nmax+1)*(nmax+2)/2;
-    r = new double[nterms*npoints];// (sizeof (double), nterms*npoints);
-    for (n=0; n <= nmax; n++)
-        for (m=n; m >= 0; m--) {
-            j = rix (n, m);
-            if (n == m) {
-                for (i=0; i < npoints; i++)
-                    r[I(i, j, nterms)] = pow (rho[i], m);
-            }
-            else {
-                for (i=0; i < npoints; i++)
-                    r[I(i, j, nterms)] =
-                        ((2*n-m)*rho[i]*r[I(i, j-1, nterms)]
-                         - n*r[I(i, j-n-1, nterms)]) / (n-m);
+    // every m up to the last group is walked so lower levels feed the recurrence
+    for (int m = 0; m <= m_maxm; ++m){
+        m_first.push_back(m_cosTerm.size());
+        m_levels.push_back(maxk - m);
+        for (int l = 0; l <= maxk - m; ++l){
+            int n = m + 2 * l;
+            m_cosTerm.push_back(-1);
+            m_sinTerm.push_back(-1);
+            double a = 0., b = 0., c = 0.;
+            if (l >= 2){
+                // Kintner's recurrence R(n) from R(n-2) and R(n-4), divided through by rho^m
+                double k1 = (n + m) * (n - m) * (n - 2)/2.;
+                double k2 = 2. * n * (n - 1) * (n - 2);
+                double k3 = -(double)m * m * (n - 1) - (double)n * (n - 1) * (n - 2);
+                double k4 = -n * (n + m - 2) * (n - m - 2)/2.;
+                a = k2/k1;
+                b = k3/k1;
+                c = k4/k1;
             }
+            m_a.push_back(a);
+            m_b.push_back(b);
+            m_c.push_back(c);
         }
-    return (r);
+    }
+    for (int t = 0; t < terms; ++t){
+        int n, m, kind;
+        termOrder(t, n, m, kind);
+        int ndx = m_first[m] + (n - m)/2;
+        if (kind == 2)
+            m_sinTerm[ndx] = t;
+        else
+            m_cosTerm[ndx] = t;
+    }
 }
 
-void zern_generator::zpoly_list (void)
+void zernikeEvaluator::evaluate(double x, double y, double *out) const
 {
-    int npoints = m_size * m_size;
-    /* Evaluate and return a matrix of zernike polynomials.  The columns
-       are ordered according to the specification s. */
-    double *r, *ct, *st, *p;
-    int i, j, maxn, maxm, rterms;
-
-    /* These should really look for the max values in s: */
-    maxn = maxm = m_spec->m_n[m_spec->m_nterms-1];
-
-    r = rpoly_list (m_rho, npoints, maxn);
-    rterms = (maxn+1)*(maxn+2)/2;
-
-    ct = new double[npoints*maxm];// *)calloc (sizeof (double), npoints*maxm);
-    st = new double[npoints*maxm];//(double *)calloc (sizeof (double), npoints*maxm);
-    if (m_zpoly)
-        delete[] m_zpoly;
-
-    m_zpoly = new double[npoints*m_spec->m_nterms];//(double *)calloc (sizeof (double), npoints*s->nterms);
-
-    /* Cache sin and cos of multiples of theta for efficiency. */
-    for (i=0; i < npoints; i++)
-        for (j=0; j < maxm; j++) {
-            ct[I(i, j, maxm)] = cos ((j+1) * m_theta[i]);
-            st[I(i, j, maxm)] = sin ((j+1) * m_theta[i]);
+    double r2 = x * x + y * y;
+    double cm = 1.;     // rho^m cos(m theta)
+    double sm = 0.;     // rho^m sin(m theta)
+    for (int m = 0; m <= m_maxm; ++m){
+        const int *ct = &m_cosTerm[m_first[m]];
+        const int *st = &m_sinTerm[m_first[m]];
+        const double *a = &m_a[m_first[m]];
+        const double *b = &m_b[m_first[m]];
+        const double *c = &m_c[m_first[m]];
+        double q2 = 0., q1 = 0.;
+        for (int l = 0; l <= m_levels[m]; ++l){
+            double q;
+            if (l == 0)
+                q = 1.;
+            else if (l == 1)
+                q = (m + 2) * r2 - (m + 1);
+            else
+                q = (a[l] * r2 + b[l]) * q1 + c[l] * q2;
+            q2 = q1;
+            q1 = q;
+            if (ct[l] >= 0)
+                out[ct[l]] = q * cm;
+            if (st[l] >= 0)
+                out[st[l]] = q * sm;
         }
-
-    /* Calculate the zernike polynomial matrix. */
-    for (i=0; i < npoints; i++)
-        for (j=0; j < m_spec->m_nterms; j++) {
-            p = &m_zpoly[I(i, j, m_spec->m_nterms)];
-            *p = r[I(i, rix(m_spec->m_n[j], m_spec->m_m[j]), rterms)];
-            if (m_spec->m_s[j] == 1)
-                *p *= ct[I(i, m_spec->m_m[j]-1, maxm)];
-            else if (m_spec->m_s[j] == 2)
-                *p *= st[I(i, m_spec->m_m[j]-1, maxm)];
+        double next = cm * x - sm * y;
+        sm = cm * y + sm * x;
+        cm = next;
     }
-    delete[] ct;
-    delete[] st;
-    delete[] r;
-
 }
 
-
-void zern_generator::dump_zpoly()
-{
-    dump_matrix(m_theta, m_size, m_size, "zpoly");
-
-}
-double * zern_generator::zern_eval ()
+// A raster point at theta moves to theta - angle in the basis coordinates (y is the
+// row), so the new surface at theta is the old one at theta + angle.
+std::vector<double> rotateZernikes(const std::vector<double> &zerns, double angle)
 {
-    int i, j;
-    int npoints = m_size * m_size;
-    double *wf = new double[npoints];
-
-    for (i=0; i < npoints; i++)
-    {
-        wf[i] = 0.;
-        for (j=0; j < m_spec->m_nterms; j++)
-            wf[i] += m_zcoef[j] * m_zpoly[I(i, j, m_spec->m_nterms)];
+    std::vector<double> out = zerns;
+    double a = angle * M_PI / 180.;
+    for (int t = 0; t + 1 < (int)zerns.size(); ++t){
+        int n, m, kind;
+        zernikeEvaluator::termOrder(t, n, m, kind);
+        if (kind != 1)
+            continue;
+        // the sin partner follows its cos term
+        double c = cos(m * a);
+        double s = sin(m * a);
+        out[t] = zerns[t] * c + zerns[t + 1] * s;
+        out[t + 1] = zerns[t + 1] * c - zerns[t] * s;
     }
-    return (wf);
-}
-double *rand_zern ( zern_spec *s)
-{
-    /* Return a set of random Zernike coefficients according to spec. */
-    int i;
-    double* z = new double[s->m_nterms];
-
-    for (i = 0; i < s->m_nterms; i++)
-        z[i] = sqrt (1/((double)i+1));
-    return (z);
-}
-
-void zern_generator::set_zcoefs(double *data)
-{
-    m_zcoef.assign(data,data + get_terms_cnt());		// temp.  chanage to param after debug
+    return out;
 }
-
-
-
@@ -18,7 +18,6 @@
 #ifndef ZERNIKES_H
 #define ZERNIKES_H
 #include <vector>
-#define I(row, col, rowlen) (row)*rowlen+(col)
 
 
 const char* const zernsNames[] =
@@ -73,45 +72,41 @@ const char* const zernsNames[] =
   "5th Spherical"
 };
 double computeRMS(int term, double v);
-class zern_spec
+// Zernike terms in the Wyant order used everywhere in DFTFringe (piston, x tilt,
+// y tilt, defocus, x astig ...) for any number of terms.  Group k holds the 2k + 1
+// terms with n + m = 2k, cos and sin pairs from m = k down to 1 then m = 0.
+// All terms at a point are made in one pass.  The radial part of each m comes from
+// a three term recurrence in n and rho^m cos(m theta), rho^m sin(m theta) from the
+// Chebyshev (complex power) recurrence, so there is no trig, pow or table.
+class zernikeEvaluator
 {
 public:
-    int* m_n;
-    int* m_m;
-    int m_nterms;
-    unsigned char *m_s; /* 0 = symmetric, 1=cos, 2=sin */
+    explicit zernikeEvaluator(int terms = 48);
+    int terms() const { return m_terms; }
 
+    // radial order n, angular frequency m and kind of a term, 0 = symmetric,
+    // 1 = cos, 2 = sin
+    static void termOrder(int term, int &n, int &m, int &kind);
 
-public:
-    zern_spec(int order);
-    void dump();
-    static int rix(int n, int m);
-};
+    // Values of all terms at (x, y) of the unit circle.  out has terms() entries.
+    void evaluate(double x, double y, double *out) const;
 
-class zern_generator
-{
-public:
-    int m_size;
-    double* m_rho;
-    double* m_theta;
-    double* m_zpoly;
-    zern_spec* m_spec;
-    std::vector<double> m_zcoef;
-public:
-    ~zern_generator();
-    zern_generator(int size);
-    void new_size(int size);
-    void set_spec(int order);
-    void fill_rho();
-    void fill_theta();
-    void zpoly_list ();
-    void dump_zpoly();
-    double* zern_eval();
-    void set_zcoefs(double *data);
-    inline int get_terms_cnt() {return m_spec->m_nterms;};
-    inline double get_zpoly(int term, int x, int y)
-    {
-        return m_zpoly[I(x+y*m_size,term,m_spec->m_nterms)];
-    };
+private:
+    int m_terms;
+    int m_maxm;
+    std::vector<int> m_levels;      // highest level (n - m)/2 used for each m
+    std::vector<int> m_first;       // offset of each m in the per level tables
+    std::vector<int> m_cosTerm;     // output term per (m, level), -1 if not wanted
+    std::vector<int> m_sinTerm;
+    std::vector<double> m_a;        // Q(l) = (a r^2 + b) Q(l-1) + c Q(l-2)
+    std::vector<double> m_b;
+    std::vector<double> m_c;
 };
+
+// Coefficients of the same surface turned by angle degrees about the center of the
+// unit circle, in the sense of SurfaceManager::rotateThese and cv::warpAffine on the
+// raster.  Each cos and sin pair of order m turns by m times the angle, symmetric
+// terms are unchanged.
+std::vector<double> rotateZernikes(const std::vector<double> &zerns, double angle);
+
 #endif